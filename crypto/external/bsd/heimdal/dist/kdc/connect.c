@@ -454,50 +454,66 @@ do_request(krb5_context context,
  * Handle incoming data to the UDP socket in `d'
  */
 
+/*
+ * Maximum number of datagrams read from one UDP socket per wakeup;
+ * under load this saves a trip through select/poll per request
+ * without starving the other sockets.
+ */
+#define UDP_BATCH 16
+
 static void
 handle_udp(krb5_context context,
 	   krb5_kdc_configuration *config,
 	   struct descr *d)
 {
-    unsigned char *buf;
+    static unsigned char *buf;
+    static size_t buf_size;
     ssize_t n;
-
-    buf = malloc(max_request_udp);
-    if (buf == NULL){
-	kdc_log(context, config, 0, "Failed to allocate %lu bytes",
-	        (unsigned long)max_request_udp);
-	return;
+    int batch;
+
+    if (buf_size < max_request_udp) {
+	free(buf);
+	buf_size = 0;
+	buf = malloc(max_request_udp);
+	if (buf == NULL){
+	    kdc_log(context, config, 0, "Failed to allocate %lu bytes",
+		    (unsigned long)max_request_udp);
+	    return;
+	}
+	buf_size = max_request_udp;
     }
 
-    d->sock_len = sizeof(d->__ss);
-    n = recvfrom(d->s, buf, max_request_udp, 0, d->sa, &d->sock_len);
-    if (rk_IS_SOCKET_ERROR(n)) {
-	if (rk_SOCK_ERRNO != EAGAIN && rk_SOCK_ERRNO != EINTR)
-	    krb5_warn(context, rk_SOCK_ERRNO, "recvfrom");
-    } else {
-	addr_to_string (context, d->sa, d->sock_len,
-			d->addr_string, sizeof(d->addr_string));
-	if ((size_t)n == max_request_udp) {
-	    krb5_data data;
-	    krb5_warn(context, errno,
-		      "recvfrom: truncated packet from %s, asking for TCP",
-		      d->addr_string);
-	    krb5_mk_error(context,
-			  KRB5KRB_ERR_RESPONSE_TOO_BIG,
-			  NULL,
-			  NULL,
-			  NULL,
-			  NULL,
-			  NULL,
-			  NULL,
-			  &data);
-	    send_reply(context, config, FALSE, d, &data);
-	    krb5_data_free(&data);
+    for (batch = 0; batch < UDP_BATCH; batch++) {
+	d->sock_len = sizeof(d->__ss);
+	n = recvfrom(d->s, buf, max_request_udp, 0, d->sa, &d->sock_len);
+	if (rk_IS_SOCKET_ERROR(n)) {
+	    if (rk_SOCK_ERRNO != EAGAIN && rk_SOCK_ERRNO != EINTR)
+		krb5_warn(context, rk_SOCK_ERRNO, "recvfrom");
+	    break;
 	} else {
-	    do_request(context, config, buf, n, FALSE, d);
+	    addr_to_string (context, d->sa, d->sock_len,
+			    d->addr_string, sizeof(d->addr_string));
+	    if ((size_t)n == max_request_udp) {
+		krb5_data data;
+		krb5_warn(context, errno,
+			  "recvfrom: truncated packet from %s, asking for TCP",
+			  d->addr_string);
+		krb5_mk_error(context,
+			      KRB5KRB_ERR_RESPONSE_TOO_BIG,
+			      NULL,
+			      NULL,
+			      NULL,
+			      NULL,
+			      NULL,
+			      NULL,
+			      &data);
+		send_reply(context, config, FALSE, d, &data);
+		krb5_data_free(&data);
+	    } else {
+		do_request(context, config, buf, n, FALSE, d);
+	    }
 	}
     }
-    free (buf);
 }
 
 static void
@@ -561,7 +577,7 @@ add_new_tcp (krb5_context context,
 	return;
     }
 
-#ifdef FD_SETSIZE
+#if defined(FD_SETSIZE) && !defined(HAVE_POLL)
     if (s >= FD_SETSIZE) {
 	krb5_warnx(context, "socket FD too large");
 	rk_closesocket (s);
@@ -856,19 +872,21 @@ krb5_boolean
 realloc_descrs(struct descr **d, unsigned int *ndescr)
 {
     struct descr *tmp;
-    size_t i;
+    size_t i, grow;
 
-    tmp = realloc(*d, (*ndescr + 4) * sizeof(**d));
+    /* grow geometrically, busy KDCs hold thousands of TCP clients */
+    grow = max(4, *ndescr / 2);
+    tmp = realloc(*d, (*ndescr + grow) * sizeof(**d));
     if(tmp == NULL)
         return FALSE;
 
     *d = tmp;
     reinit_descrs (*d, *ndescr);
-    memset(*d + *ndescr, 0, 4 * sizeof(**d));
-    for(i = *ndescr; i < *ndescr + 4; i++)
+    memset(*d + *ndescr, 0, grow * sizeof(**d));
+    for(i = *ndescr; i < *ndescr + grow; i++)
         init_descr (*d + i);
 
-    *ndescr += 4;
+    *ndescr += grow;
 
     return TRUE;
 }
@@ -894,6 +912,119 @@ next_min_free(krb5_context context, struct descr **d, unsigned int *ndescr)
     return min_free;
 }
 
+static void
+loop_exit(krb5_context context, krb5_kdc_configuration *config)
+{
+    _kdc_db_cache_stats(context, config);
+    _kdc_db_cache_flush(context);
+
+    switch (exit_flag) {
+    case -1:
+	kdc_log(context, config, 0,
+                "KDC worker process exiting because KDC master exited.");
+	break;
+#ifdef SIGXCPU
+    case SIGXCPU:
+	kdc_log(context, config, 0, "CPU time limit exceeded");
+	break;
+#endif
+    case SIGINT:
+    case SIGTERM:
+	kdc_log(context, config, 0, "Terminated");
+	break;
+    default:
+	kdc_log(context, config, 0, "Unexpected exit reason: %d", exit_flag);
+	break;
+    }
+}
+
+#ifdef HAVE_POLL
+static void
+loop(krb5_context context, krb5_kdc_configuration *config,
+     struct descr *d, unsigned int ndescr, int islive)
+{
+    struct pollfd *pfds = NULL;
+    unsigned int npfds = 0;
+
+    while (exit_flag == 0) {
+	unsigned int nfds = 0, npolled, n;
+	int min_free = -1;
+	time_t now = time(NULL);
+	size_t i;
+
+	if (npfds < ndescr + 1) {
+	    struct pollfd *tmp;
+
+	    tmp = realloc(pfds, (ndescr + 1) * sizeof(*pfds));
+	    if (tmp == NULL)
+		krb5_errx(context, 1, "No memory");
+	    pfds = tmp;
+	    npfds = ndescr + 1;
+	}
+
+	/*
+	 * pfds[i] describes d[i] so that ready descriptors can be mapped
+	 * back without a search; the islive pipe, if any, goes last.
+	 */
+	for (i = 0; i < ndescr; i++) {
+	    pfds[i].fd = -1;
+	    pfds[i].events = POLLIN;
+	    pfds[i].revents = 0;
+	    if (rk_IS_BAD_SOCKET(d[i].s))
+		continue;
+	    if (d[i].type == SOCK_STREAM &&
+	       d[i].timeout && d[i].timeout < now) {
+		kdc_log(context, config, 1,
+			"TCP-connection from %s expired after %lu bytes",
+			d[i].addr_string, (unsigned long)d[i].len);
+		clear_descr(&d[i]);
+		continue;
+	    }
+	    pfds[i].fd = d[i].s;
+	}
+	/* ndescr grows if accept() needs more slots; remember this pass */
+	npolled = nfds = ndescr;
+	if (islive > -1) {
+	    pfds[nfds].fd = islive;
+	    pfds[nfds].events = POLLIN;
+	    pfds[nfds].revents = 0;
+	    nfds++;
+	}
+
+	switch(poll(pfds, nfds, TCP_TIMEOUT * 1000)){
+	case 0:
+	    break;
+	case -1:
+	    if (errno != EINTR)
+		krb5_warn(context, rk_SOCK_ERRNO, "poll");
+	    break;
+	default:
+#ifdef HAVE_FORK
+	    if (islive > -1 && pfds[nfds - 1].revents != 0)
+		handle_islive(islive);
+#endif
+	    /* d may grow while accepting, only look at what was polled */
+	    for (n = 0; n < npolled; n++) {
+		if (pfds[n].fd == -1 || pfds[n].revents == 0 ||
+		    rk_IS_BAD_SOCKET(d[n].s))
+		    continue;
+
+		if (d[n].type == SOCK_DGRAM)
+		    handle_udp(context, config, &d[n]);
+		else if (d[n].type == SOCK_STREAM) {
+		    /* only listening sockets need a free slot */
+		    if (d[n].timeout == 0)
+			min_free = next_min_free(context, &d, &ndescr);
+		    handle_tcp(context, config, d, n, min_free);
+		}
+	    }
+	}
+    }
+    free(pfds);
+
+    loop_exit(context, config);
+}
+#else /* !HAVE_POLL */
 static void
 loop(krb5_context context, krb5_kdc_configuration *config,
      struct descr *d, unsigned int ndescr, int islive)
@@ -959,25 +1090,9 @@ loop(krb5_context context, krb5_kdc_configuration *config,
 	}
     }
 
-    switch (exit_flag) {
-    case -1:
-	kdc_log(context, config, 0,
-                "KDC worker process exiting because KDC master exited.");
-	break;
-#ifdef SIGXCPU
-    case SIGXCPU:
-	kdc_log(context, config, 0, "CPU time limit exceeded");
-	break;
-#endif
-    case SIGINT:
-    case SIGTERM:
-	kdc_log(context, config, 0, "Terminated");
-	break;
-    default:
-	kdc_log(context, config, 0, "Unexpected exit reason: %d", exit_flag);
-	break;
-    }
+    loop_exit(context, config);
 }
+#endif /* !HAVE_POLL */
 
 #ifdef __APPLE__
 static void
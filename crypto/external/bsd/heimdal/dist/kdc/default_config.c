@@ -213,6 +213,18 @@ krb5_kdc_get_config(krb5_context context, krb5_kdc_configuration **config)
 				      c->kdc_warn_pwexpire,
 				      "kdc", "kdc_warn_pwexpire", NULL);
 
+    c->principal_cache_ttl =
+	krb5_config_get_time_default (context, NULL,
+				      0,
+				      "kdc", "principal-cache-ttl", NULL);
+
+    c->principal_cache_size =
+	krb5_config_get_int_default(context, NULL,
+				    1024,
+				    "kdc",
+				    "principal-cache-size",
+				    NULL);
+
 
     c->enable_pkinit =
 	krb5_config_get_bool_default(context,
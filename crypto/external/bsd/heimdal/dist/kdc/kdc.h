@@ -97,6 +97,9 @@ typedef struct krb5_kdc_configuration {
     const char *kx509_template;
     const char *kx509_ca;
 
+    time_t principal_cache_ttl; /* 0 disables the hdb entry cache */
+    size_t principal_cache_size;
+
 } krb5_kdc_configuration;
 
 struct krb5_kdc_service {
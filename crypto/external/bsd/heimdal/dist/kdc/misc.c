@@ -53,6 +53,105 @@ name_type_ok(krb5_context context,
 
 struct timeval _kdc_now;
 
+/*
+ * Cache of decoded hdb entries, with their keys already decrypted, in
+ * front of the backends: the krbtgt and popular service principals are
+ * looked up on nearly every request.  The cache is direct mapped, so
+ * its size is bounded by principal-cache-size, and entries are trusted
+ * for principal-cache-ttl seconds, which bounds how long a change made
+ * with kadmin (or received through iprop) can go unnoticed.  Every KDC
+ * worker process has its own cache.
+ *
+ * Callers always get their own duplicate of a cached entry.  Entries a
+ * backend returns with private state (ctx/free_entry) cannot be
+ * duplicated and are not cached.  Keys are zeroed by hdb_free_entry()
+ * whenever an entry is evicted, expires or the process exits.
+ */
+
+struct db_cache_ent {
+    char *name;			/* unparsed principal, NULL if unused */
+    unsigned flags;
+    unsigned kvno;
+    int db;			/* index into config->db */
+    time_t expires;
+    hdb_entry_ex ent;		/* ctx and free_entry always NULL */
+};
+
+static struct db_cache_ent *db_cache;
+static size_t db_cache_size;
+static unsigned long db_cache_hits, db_cache_misses;
+
+static void
+db_cache_clear(krb5_context context, struct db_cache_ent *c)
+{
+    if (c->name == NULL)
+	return;
+    hdb_free_entry(context, &c->ent);	/* zeroes the keys */
+    free(c->name);
+    memset_s(c, sizeof(*c), 0, sizeof(*c));
+}
+
+/*
+ * Fill in the caller's entry with a duplicate of a cached one, so that
+ * freeing or modifying it leaves the cache alone.
+ */
+static krb5_error_code
+db_cache_dup(krb5_context context, struct db_cache_ent *c, hdb_entry_ex *ent)
+{
+    krb5_error_code ret;
+
+    memset(ent, 0, sizeof(*ent));
+    ret = copy_hdb_entry(&c->ent.entry, &ent->entry);
+    if (ret)
+	memset(ent, 0, sizeof(*ent));
+    return ret;
+}
+
+void
+_kdc_db_cache_flush(krb5_context context)
+{
+    size_t i;
+
+    for (i = 0; i < db_cache_size; i++)
+	db_cache_clear(context, &db_cache[i]);
+    free(db_cache);
+    db_cache = NULL;
+    db_cache_size = 0;
+}
+
+static struct db_cache_ent *
+db_cache_slot(krb5_kdc_configuration *config, const char *name,
+	      unsigned flags, unsigned kvno)
+{
+    const unsigned char *p;
+    unsigned long h = 5381;
+
+    if (db_cache == NULL) {
+	if (config->principal_cache_size == 0)
+	    return NULL;
+	db_cache = calloc(config->principal_cache_size, sizeof(*db_cache));
+	if (db_cache == NULL)
+	    return NULL;
+	db_cache_size = config->principal_cache_size;
+    }
+    for (p = (const unsigned char *)name; *p; p++)
+	h = h * 33 + *p;
+    h ^= flags * 31 + kvno;
+    return &db_cache[h % db_cache_size];
+}
+
+void
+_kdc_db_cache_stats(krb5_context context, krb5_kdc_configuration *config)
+{
+    unsigned long total = db_cache_hits + db_cache_misses;
+
+    if (total == 0)
+	return;
+    kdc_log(context, config, 0,
+	    "principal cache: %lu lookups, %lu hits (%lu%%)",
+	    total, db_cache_hits, db_cache_hits * 100 / total);
+}
+
 krb5_error_code
 _kdc_db_fetch(krb5_context context,
 	      krb5_kdc_configuration *config,
@@ -68,6 +167,8 @@ _kdc_db_fetch(krb5_context context,
     unsigned kvno = 0;
     krb5_principal enterprise_principal = NULL;
     krb5_const_principal princ;
+    struct db_cache_ent *cache = NULL;
+    char *name = NULL;
 
     *h = NULL;
 
@@ -85,6 +186,25 @@ _kdc_db_fetch(krb5_context context,
     if (ent == NULL)
         return krb5_enomem(context);
 
+    if (config->principal_cache_ttl > 0 &&
+	krb5_unparse_name(context, principal, &name) == 0 &&
+	(cache = db_cache_slot(config, name, flags, kvno)) != NULL) {
+	if (cache->name != NULL && cache->expires > kdc_time &&
+	    cache->flags == flags && cache->kvno == kvno &&
+	    cache->db < config->num_db && strcmp(cache->name, name) == 0 &&
+	    db_cache_dup(context, cache, ent) == 0) {
+	    if (++db_cache_hits % 100000 == 0)
+		_kdc_db_cache_stats(context, config);
+	    if (db)
+		*db = config->db[cache->db];
+	    *h = ent;
+	    ent = NULL;
+	    ret = 0;
+	    goto out;
+	}
+	db_cache_misses++;
+    }
+
     if (principal->name.name_type == KRB5_NT_ENTERPRISE_PRINCIPAL) {
         if (principal->name.name_string.len != 1) {
             ret = KRB5_PARSE_MALFORMED;
@@ -130,6 +250,18 @@ _kdc_db_fetch(krb5_context context,
 	     */
 	    /* fall through */
 	case 0:
+	    if (ret == 0 && cache != NULL &&
+		ent->ctx == NULL && ent->free_entry == NULL) {
+		db_cache_clear(context, cache);
+		if (copy_hdb_entry(&ent->entry, &cache->ent.entry) == 0) {
+		    cache->name = name;
+		    cache->flags = flags;
+		    cache->kvno = kvno;
+		    cache->db = i;
+		    cache->expires = kdc_time + config->principal_cache_ttl;
+		    name = NULL;
+		}
+	    }
 	    if (db)
 		*db = config->db[i];
 	    *h = ent;
@@ -158,6 +290,7 @@ out2:
     }
 out:
     krb5_free_principal(context, enterprise_principal);
+    free(name);
     free(ent);
     return ret;
 }
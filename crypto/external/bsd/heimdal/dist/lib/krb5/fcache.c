@@ -831,6 +831,112 @@ fcc_end_get (krb5_context context,
 	     krb5_ccache id,
 	     krb5_cc_cursor *cursor);
 
+/*
+ * Credential lookup without the cursor interface: the cursor reads
+ * every field of every entry with a read(2) of its own, which makes
+ * lookups in caches holding thousands of service tickets (S4U proxies)
+ * slow.  Instead take the shared lock once, map (or read) the file and
+ * parse the entries from memory.
+ */
+static krb5_error_code KRB5_CALLCONV
+fcc_retrieve(krb5_context context,
+	     krb5_ccache id,
+	     krb5_flags whichfields,
+	     const krb5_creds *mcreds,
+	     krb5_creds *creds)
+{
+    krb5_error_code ret;
+    krb5_principal principal;
+    krb5_storage *sp, *msp = NULL;
+    unsigned char *buf = NULL;
+    struct stat sb;
+    size_t size = 0;
+    off_t off;
+    int mapped = 0;
+    int fd;
+
+    ret = init_fcc(context, id, "retrieve", &sp, &fd, NULL);
+    if (ret)
+	return ret;
+    ret = krb5_ret_principal(sp, &principal);
+    if (ret) {
+	krb5_clear_error_message(context);
+	goto out;
+    }
+    krb5_free_principal(context, principal);
+
+    off = krb5_storage_seek(sp, 0, SEEK_CUR);
+    if (off < 0 || fstat(fd, &sb) < 0) {
+	ret = errno;
+	krb5_clear_error_message(context);
+	goto out;
+    }
+    if (sb.st_size <= off) {
+	ret = KRB5_CC_END;
+	goto out;
+    }
+    size = sb.st_size;
+
+#ifdef HAVE_MMAP
+    buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf != MAP_FAILED)
+	mapped = 1;
+    else
+#endif
+    {
+	ssize_t n;
+	size_t done = 0;
+
+	if ((buf = malloc(size)) == NULL) {
+	    ret = krb5_enomem(context);
+	    goto out;
+	}
+	while (done < size) {
+	    n = pread(fd, buf + done, size - done, done);
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		break;
+	    done += n;
+	}
+	size = done;
+	if (size <= (size_t)off) {
+	    ret = KRB5_CC_END;
+	    goto out;
+	}
+    }
+
+    msp = krb5_storage_from_readonly_mem(buf + off, size - off);
+    if (msp == NULL) {
+	ret = krb5_enomem(context);
+	goto out;
+    }
+    krb5_storage_set_eof_code(msp, KRB5_CC_END);
+    storage_set_flags(context, msp, FCACHE(id)->version);
+
+    while ((ret = krb5_ret_creds(msp, creds)) == 0) {
+	if (krb5_compare_creds(context, whichfields, mcreds, creds))
+	    break;
+	krb5_free_cred_contents(context, creds);
+    }
+    if (ret)
+	krb5_clear_error_message(context);
+
+  out:
+    if (msp != NULL)
+	krb5_storage_free(msp);
+#ifdef HAVE_MMAP
+    if (mapped)
+	munmap(buf, size);
+    else
+#endif
+	free(buf);
+    krb5_storage_free(sp);
+    fcc_unlock(context, fd);
+    close(fd);
+    return ret;
+}
+
 static krb5_error_code KRB5_CALLCONV
 fcc_get_first (krb5_context context,
 	       krb5_ccache id,
@@ -1312,7 +1418,7 @@ KRB5_LIB_VARIABLE const krb5_cc_ops krb5_fcc_ops = {
     fcc_destroy,
     fcc_close,
     fcc_store_cred,
-    NULL, /* fcc_retrieve */
+    fcc_retrieve,
     fcc_get_principal,
     fcc_get_first,
     fcc_get_next,
@@ -634,6 +634,101 @@ test_cc_config(krb5_context context, const char *cc_type,
 }
 
 
+/*
+ * Store `count' service tickets and look some of them up, and one that
+ * isn't there, with krb5_cc_retrieve_cred().  With -d, print how long
+ * the lookups took.
+ */
+
+static void
+test_retrieve(krb5_context context, const char *cc_type, int count)
+{
+    struct timeval tv1, tv2;
+    krb5_error_code ret;
+    krb5_creds cred, mcred, found;
+    krb5_principal p;
+    krb5_ccache id;
+    char *name;
+    int i, lookups;
+
+    ret = krb5_parse_name(context, "lha@SU.SE", &p);
+    if (ret)
+	krb5_err(context, 1, ret, "krb5_parse_name");
+
+    ret = krb5_cc_new_unique(context, cc_type, NULL, &id);
+    if (ret)
+	krb5_err(context, 1, ret, "krb5_cc_new_unique: %s", cc_type);
+
+    ret = krb5_cc_initialize(context, id, p);
+    if (ret)
+	krb5_err(context, 1, ret, "krb5_cc_initialize");
+
+    memset(&cred, 0, sizeof(cred));
+    cred.client = p;
+    cred.times.authtime = time(NULL);
+    cred.times.endtime = cred.times.authtime + 36000;
+    cred.ticket.length = 1024;
+    cred.ticket.data = ecalloc(1, cred.ticket.length);
+
+    for (i = 0; i < count; i++) {
+	if (asprintf(&name, "host/host%d.su.se@SU.SE", i) < 0 || name == NULL)
+	    krb5_errx(context, 1, "out of memory");
+	ret = krb5_parse_name(context, name, &cred.server);
+	if (ret)
+	    krb5_err(context, 1, ret, "krb5_parse_name: %s", name);
+	free(name);
+	((unsigned char *)cred.ticket.data)[0] = i & 0xff;
+	((unsigned char *)cred.ticket.data)[1] = (i >> 8) & 0xff;
+	ret = krb5_cc_store_cred(context, id, &cred);
+	if (ret)
+	    krb5_err(context, 1, ret, "krb5_cc_store_cred");
+	krb5_free_principal(context, cred.server);
+    }
+    free(cred.ticket.data);
+
+    lookups = count < 100 ? count : 100;
+
+    gettimeofday(&tv1, NULL);
+
+    for (i = 0; i <= lookups; i++) {
+	int n = (i == lookups) ? count : (i * 7919) % count;
+
+	memset(&mcred, 0, sizeof(mcred));
+	if (asprintf(&name, "host/host%d.su.se@SU.SE", n) < 0 || name == NULL)
+	    krb5_errx(context, 1, "out of memory");
+	ret = krb5_parse_name(context, name, &mcred.server);
+	if (ret)
+	    krb5_err(context, 1, ret, "krb5_parse_name: %s", name);
+	ret = krb5_cc_retrieve_cred(context, id, 0, &mcred, &found);
+	if (n == count) {
+	    if (ret == 0)
+		krb5_errx(context, 1, "%s: found %s", cc_type, name);
+	} else {
+	    if (ret)
+		krb5_err(context, 1, ret, "krb5_cc_retrieve_cred: %s", name);
+	    if (found.ticket.length != 1024 ||
+		((unsigned char *)found.ticket.data)[0] != (n & 0xff) ||
+		((unsigned char *)found.ticket.data)[1] != ((n >> 8) & 0xff))
+		krb5_errx(context, 1, "%s: wrong ticket for %s", cc_type, name);
+	    krb5_free_cred_contents(context, &found);
+	}
+	free(name);
+	krb5_free_principal(context, mcred.server);
+    }
+
+    gettimeofday(&tv2, NULL);
+
+    timevalsub(&tv2, &tv1);
+
+    if (debug_flag)
+	printf("%s: %d tickets, %d lookups: %3ld.%06ld\n", cc_type,
+	       count, lookups + 1, (long)tv2.tv_sec, (long)tv2.tv_usec);
+
+    krb5_cc_destroy(context, id);
+    krb5_free_principal(context, p);
+}
+
+
 static struct getargs args[] = {
     {"debug",	'd',	arg_flag,	&debug_flag,
      "turn on debuggin", NULL },
@@ -767,6 +862,9 @@ main(int argc, char **argv)
     test_cc_config(context, "MEMORY", "bar", 1000);  /* 1000 because fast */
     test_cc_config(context, "FILE", "/tmp/foocc", 30); /* 30 because slower */
 
+    test_retrieve(context, krb5_cc_type_memory, 1000);
+    test_retrieve(context, krb5_cc_type_file, 1000);
+
     krb5_free_context(context);
 
 #if 0
@@ -55,6 +55,14 @@ _kdc_check_anon_policy (
 	hdb_entry_ex */*client*/,
 	hdb_entry_ex */*server*/);
 
+void
+_kdc_db_cache_flush (krb5_context /*context*/);
+
+void
+_kdc_db_cache_stats (
+	krb5_context /*context*/,
+	krb5_kdc_configuration */*config*/);
+
 krb5_error_code
 _kdc_db_fetch (
 	krb5_context /*context*/,
@@ -116,6 +116,7 @@ unsigned pgp_hash_size(pgp_hash_alg_t);
 unsigned pgp_hash(uint8_t *, pgp_hash_alg_t, const void *, size_t);
 
 void pgp_hash_add_int(pgp_hash_t *, unsigned, unsigned);
+void pgp_hash_add_data(pgp_hash_t *, const uint8_t *, size_t);
 
 unsigned pgp_dsa_verify(const uint8_t *, size_t,
 			const pgp_dsa_sig_t *,
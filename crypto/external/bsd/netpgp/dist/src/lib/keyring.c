@@ -893,6 +893,127 @@ pgp_keyring_free(pgp_keyring_t *keyring)
 	(void)free(keyring->keys);
 	keyring->keys = NULL;
 	keyring->keyc = keyring->keyvsize = 0;
+	(void)free(keyring->idx);
+	keyring->idx = NULL;
+	keyring->idxc = keyring->idxkeyc = 0;
+}
+
+/*
+ * Key id index
+ *
+ * Rings with more than KEYIDX_MIN keys get a sorted array of the low
+ * 32 bits of every signing and encryption key id, so that a lookup by
+ * key id is a binary search rather than a walk over the whole ring.
+ * The index is a cache: it is built on first use, and covers all but
+ * the last key of the ring at that time, since a subkey read later
+ * may still set the last key's encid.  Keys beyond the indexed ones
+ * are searched linearly, and the index is rebuilt once more than
+ * KEYIDX_SLACK of them have accumulated.
+ */
+#define KEYIDX_MIN	16
+#define KEYIDX_SLACK	16
+
+struct pgp_keyidx_t {
+	uint32_t	id;		/* low 32 bits of the key id */
+	unsigned	key;		/* index of the key in the ring */
+	unsigned	enc;		/* id is the encryption key's id */
+};
+
+static uint32_t
+keyidx_low32(const uint8_t *id)
+{
+	return ((uint32_t)id[0] << 24) | ((uint32_t)id[1] << 16) |
+		((uint32_t)id[2] << 8) | (uint32_t)id[3];
+}
+
+static int
+keyidx_cmp(const void *a, const void *b)
+{
+	const struct pgp_keyidx_t	*ia = a;
+	const struct pgp_keyidx_t	*ib = b;
+
+	if (ia->id != ib->id) {
+		return (ia->id < ib->id) ? -1 : 1;
+	}
+	if (ia->key != ib->key) {
+		return (ia->key < ib->key) ? -1 : 1;
+	}
+	return (int)ia->enc - (int)ib->enc;
+}
+
+/* (re)build the key id index; on failure, lookups stay linear */
+static void
+keyidx_build(pgp_keyring_t *keyring)
+{
+	struct pgp_keyidx_t	*idx;
+	static const uint8_t	 nullid[PGP_KEY_ID_SIZE];
+	unsigned		 keyc;
+	unsigned		 c;
+	unsigned		 n;
+
+	free(keyring->idx);
+	keyring->idx = NULL;
+	keyring->idxc = keyring->idxkeyc = 0;
+	keyc = keyring->keyc - 1;
+	if ((idx = calloc(2 * (size_t)keyc, sizeof(*idx))) == NULL) {
+		return;
+	}
+	for (c = 0, n = 0 ; n < keyc ; n++) {
+		idx[c].id = keyidx_low32(&keyring->keys[n].sigid[PGP_KEY_ID_SIZE / 2]);
+		idx[c].key = n;
+		idx[c++].enc = 0;
+		if (memcmp(keyring->keys[n].encid, nullid, sizeof(nullid)) != 0) {
+			idx[c].id = keyidx_low32(&keyring->keys[n].encid[PGP_KEY_ID_SIZE / 2]);
+			idx[c].key = n;
+			idx[c++].enc = 1;
+		}
+	}
+	qsort(idx, c, sizeof(*idx), keyidx_cmp);
+	keyring->idx = idx;
+	keyring->idxc = c;
+	keyring->idxkeyc = keyc;
+}
+
+/* does the key id (full, or short in its first 4 bytes) match this id? */
+static int
+keyid_match(const uint8_t *id, const uint8_t *keyid)
+{
+	return memcmp(id, keyid, PGP_KEY_ID_SIZE) == 0 ||
+		memcmp(&id[PGP_KEY_ID_SIZE / 2], keyid, PGP_KEY_ID_SIZE / 2) == 0;
+}
+
+/*
+ * find the lowest indexed entry at or after key `from' with a low 32 bit
+ * key id of `id' which matches keyid, preferring a signing key id over an
+ * encryption key id of the same key; returns NULL if none
+ */
+static const struct pgp_keyidx_t *
+keyidx_find(const pgp_keyring_t *keyring, uint32_t id, const uint8_t *keyid,
+		unsigned from)
+{
+	const struct pgp_keyidx_t	*ip;
+	const pgp_key_t			*key;
+	unsigned			 lo;
+	unsigned			 hi;
+	unsigned			 mid;
+
+	/* first entry with an id of at least `id', at key `from' or later */
+	for (lo = 0, hi = keyring->idxc ; lo < hi ; ) {
+		mid = lo + (hi - lo) / 2;
+		ip = &keyring->idx[mid];
+		if (ip->id < id || (ip->id == id && ip->key < from)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (ip = &keyring->idx[lo] ; lo < keyring->idxc && ip->id == id ; lo++, ip++) {
+		key = &keyring->keys[ip->key];
+		if (keyid_match((ip->enc) ? key->encid : key->sigid, keyid)) {
+			return ip;
+		}
+	}
+	return NULL;
 }
 
 /**
@@ -913,17 +1034,44 @@ const pgp_key_t *
 pgp_getkeybyid(pgp_io_t *io, const pgp_keyring_t *keyring,
 			   const uint8_t *keyid, unsigned *from, pgp_pubkey_t **pubkey)
 {
-	uint8_t	nullid[PGP_KEY_ID_SIZE];
-
+	const struct pgp_keyidx_t	*best;
+	const struct pgp_keyidx_t	*ip;
+	pgp_keyring_t			*ring;
+	uint8_t				 nullid[PGP_KEY_ID_SIZE];
+
+	if (keyring && keyring->keyc > KEYIDX_MIN &&
+	    (keyring->idx == NULL || keyring->idxkeyc > keyring->keyc ||
+	     keyring->keyc - keyring->idxkeyc > KEYIDX_SLACK)) {
+		/* the index is a cache, not part of the keyring's contents */
+		ring = __UNCONST(keyring);
+		keyidx_build(ring);
+	}
+	if (keyring && keyring->idx != NULL && *from < keyring->idxkeyc) {
+		best = keyidx_find(keyring, keyidx_low32(keyid), keyid, *from);
+		ip = keyidx_find(keyring, keyidx_low32(&keyid[PGP_KEY_ID_SIZE / 2]),
+				keyid, *from);
+		if (ip != NULL && (best == NULL || ip->key < best->key ||
+		    (ip->key == best->key && ip->enc < best->enc))) {
+			best = ip;
+		}
+		if (best != NULL) {
+			*from = best->key;
+			if (pubkey) {
+				*pubkey = (best->enc) ?
+					&keyring->keys[*from].enckey :
+					&keyring->keys[*from].key.pubkey;
+			}
+			return &keyring->keys[*from];
+		}
+		*from = keyring->idxkeyc;
+	}
 	(void) memset(nullid, 0x0, sizeof(nullid));
 	for ( ; keyring && *from < keyring->keyc; *from += 1) {
 		if (pgp_get_debug_level(__FILE__)) {
 			hexdump(io->errs, "keyring keyid", keyring->keys[*from].sigid, PGP_KEY_ID_SIZE);
 			hexdump(io->errs, "keyid", keyid, PGP_KEY_ID_SIZE);
 		}
-		if (memcmp(keyring->keys[*from].sigid, keyid, PGP_KEY_ID_SIZE) == 0 ||
-		    memcmp(&keyring->keys[*from].sigid[PGP_KEY_ID_SIZE / 2],
-				keyid, PGP_KEY_ID_SIZE / 2) == 0) {
+		if (keyid_match(keyring->keys[*from].sigid, keyid)) {
 			if (pubkey) {
 				*pubkey = &keyring->keys[*from].key.pubkey;
 			}
@@ -932,8 +1080,7 @@ pgp_getkeybyid(pgp_io_t *io, const pgp_keyring_t *keyring,
 		if (memcmp(&keyring->keys[*from].encid, nullid, sizeof(nullid)) == 0) {
 			continue;
 		}
-		if (memcmp(&keyring->keys[*from].encid, keyid, PGP_KEY_ID_SIZE) == 0 ||
-		    memcmp(&keyring->keys[*from].encid[PGP_KEY_ID_SIZE / 2], keyid, PGP_KEY_ID_SIZE / 2) == 0) {
+		if (keyid_match(keyring->keys[*from].encid, keyid)) {
 			if (pubkey) {
 				*pubkey = &keyring->keys[*from].enckey;
 			}
@@ -71,6 +71,9 @@ typedef struct pgp_key_t	pgp_key_t;
 typedef struct pgp_keyring_t {
 	DYNARRAY(pgp_key_t,	key);
 	pgp_hash_alg_t	hashtype;
+	struct pgp_keyidx_t	*idx;	/* sorted key id index, built lazily */
+	unsigned		 idxc;	/* # of entries in idx */
+	unsigned		 idxkeyc;	/* # of keys covered by idx */
 } pgp_keyring_t;
 
 const pgp_key_t *pgp_getkeybyid(pgp_io_t *,
@@ -614,6 +614,31 @@ pgp_hash_add_int(pgp_hash_t *hash, unsigned n, unsigned length)
 	}
 }
 
+/* largest amount handed to hash->add() at a time */
+#define PGP_HASH_CHUNK	(1U << 30)
+
+/**
+\ingroup Core_Hashes
+\brief Add a buffer of any size to the hash
+\param hash Hash to add to
+\param data Data to add
+\param length Length of data in bytes
+
+The per-algorithm add functions take an unsigned length, so
+anything over 4GB has to be fed to them in pieces.
+*/
+void
+pgp_hash_add_data(pgp_hash_t *hash, const uint8_t *data, size_t length)
+{
+	unsigned	chunk;
+
+	for ( ; length > 0 ; data += chunk, length -= chunk) {
+		chunk = (length > PGP_HASH_CHUNK) ?
+			PGP_HASH_CHUNK : (unsigned)length;
+		hash->add(hash, data, chunk);
+	}
+}
+
 /**
 \ingroup Core_Hashes
 \brief Setup hash for given hash algorithm
@@ -1089,6 +1114,10 @@ pgp_mem_readfile(pgp_memory_t *mem, const char *f)
 	} else {
 		mem->length = mem->allocated;
 		mem->mmapped = 1;
+#ifdef MADV_SEQUENTIAL
+		/* files are hashed front to back: read ahead hard */
+		(void) madvise(mem->buf, mem->length, MADV_SEQUENTIAL);
+#endif
 	}
 	(void) fclose(fp);
 	return (mem->allocated == mem->length);
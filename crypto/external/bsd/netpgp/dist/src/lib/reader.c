@@ -844,12 +844,30 @@ end:
 	return ret;
 }
 
+/*
+ * value of a base64 character, or -1 if c is not one; computed with
+ * masks rather than branches or a table, as this is called for every
+ * character of armoured input
+ */
+static int
+b64value(int c)
+{
+	int	v = -1;
+
+	v += (((0x40 - c) & (c - 0x5b)) >> 8) & (c - 64);	/* A-Z */
+	v += (((0x60 - c) & (c - 0x7b)) >> 8) & (c - 70);	/* a-z */
+	v += (((0x2f - c) & (c - 0x3a)) >> 8) & (c + 5);	/* 0-9 */
+	v += (((0x2a - c) & (c - 0x2c)) >> 8) & 63;		/* + */
+	v += (((0x2e - c) & (c - 0x30)) >> 8) & 64;		/* / */
+	return v;
+}
+
 static int 
 read4(pgp_stream_t *stream, dearmour_t *dearmour, pgp_error_t **errors,
       pgp_reader_t *readinfo, pgp_cbdata_t *cbinfo,
       int *pc, unsigned *pn, uint32_t *pl)
 {
-	int             n, c;
+	int             n, c, v;
 	uint32_t   l = 0;
 
 	for (n = 0; n < 4; ++n) {
@@ -861,20 +879,10 @@ read4(pgp_stream_t *stream, dearmour_t *dearmour, pgp_error_t **errors,
 		if (c == '-' || c == '=') {
 			break;
 		}
-		l <<= 6;
-		if (c >= 'A' && c <= 'Z') {
-			l += (uint32_t)(c - 'A');
-		} else if (c >= 'a' && c <= 'z') {
-			l += (uint32_t)(c - 'a') + 26;
-		} else if (c >= '0' && c <= '9') {
-			l += (uint32_t)(c - '0') + 52;
-		} else if (c == '+') {
-			l += 62;
-		} else if (c == '/') {
-			l += 63;
-		} else {
+		if ((v = b64value(c)) < 0) {
 			--n;
-			l >>= 6;
+		} else {
+			l = (l << 6) | (uint32_t)v;
 		}
 	}
 
@@ -885,18 +893,68 @@ read4(pgp_stream_t *stream, dearmour_t *dearmour, pgp_error_t **errors,
 	return 4;
 }
 
+/*
+ * CRC24 is computed slice-by-8: crc24tab[0] holds the CRC of each byte
+ * value, crc24tab[k] that of the byte followed by k zero bytes, so that
+ * 8 bytes of input fold into the register with 8 independent look-ups.
+ * The register is kept in the top 24 bits of a 32-bit word.  The tables
+ * are filled on first use.
+ */
+static uint32_t	crc24tab[8][256];
+static int	crc24tabdone;
+
+static void
+crc24_init(void)
+{
+	uint32_t	crc;
+	unsigned	i;
+	unsigned	k;
+
+	for (i = 0; i < 256; i++) {
+		crc = (uint32_t)i << 24;
+		for (k = 0; k < 8; k++) {
+			crc = (crc << 1) ^ ((crc & 0x80000000) ? (uint32_t)(CRC24_POLY << 8) : 0);
+		}
+		crc24tab[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		for (k = 1; k < 8; k++) {
+			crc = crc24tab[k - 1][i];
+			crc24tab[k][i] = (crc << 8) ^ crc24tab[0][crc >> 24];
+		}
+	}
+	crc24tabdone = 1;
+}
+
 unsigned 
 pgp_crc24(unsigned checksum, uint8_t c)
 {
-	unsigned        i;
+	return pgp_crc24_update(checksum, &c, 1);
+}
+
+/* add len bytes of buf to the CRC24 checksum */
+unsigned
+pgp_crc24_update(unsigned checksum, const uint8_t *buf, size_t len)
+{
+	uint32_t	crc;
+	uint32_t	w;
 
-	checksum ^= c << 16;
-	for (i = 0; i < 8; i++) {
-		checksum <<= 1;
-		if (checksum & 0x1000000)
-			checksum ^= CRC24_POLY;
+	if (!crc24tabdone) {
+		crc24_init();
+	}
+	crc = (uint32_t)checksum << 8;
+	for ( ; len >= 8 ; len -= 8, buf += 8) {
+		w = crc ^ (((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+			((uint32_t)buf[2] << 8) | (uint32_t)buf[3]);
+		crc = crc24tab[7][w >> 24] ^ crc24tab[6][(w >> 16) & 0xff] ^
+			crc24tab[5][(w >> 8) & 0xff] ^ crc24tab[4][w & 0xff] ^
+			crc24tab[3][buf[4]] ^ crc24tab[2][buf[5]] ^
+			crc24tab[1][buf[6]] ^ crc24tab[0][buf[7]];
+	}
+	for ( ; len > 0 ; len--) {
+		crc = (crc << 8) ^ crc24tab[0][(crc >> 24) ^ *buf++];
 	}
-	return (unsigned)(checksum & 0xffffffL);
+	return (unsigned)(crc >> 8);
 }
 
 static int 
@@ -760,7 +760,7 @@ pgp_start_sig(pgp_create_sig_t *sig,
 void 
 pgp_sig_add_data(pgp_create_sig_t *sig, const void *buf, size_t length)
 {
-	sig->hash.add(&sig->hash, buf, (unsigned)length);
+	pgp_hash_add_data(&sig->hash, buf, length);
 }
 
 /**
@@ -1126,7 +1126,7 @@ pgp_sign_file(pgp_io_t *io,
 
 		/* hash file contents */
 		hash = pgp_sig_get_hash(sig);
-		hash->add(hash, pgp_mem_data(infile), (unsigned)pgp_mem_len(infile));
+		pgp_hash_add_data(hash, pgp_mem_data(infile), pgp_mem_len(infile));
 
 #if 1
 		/* output file contents as Literal Data packet */
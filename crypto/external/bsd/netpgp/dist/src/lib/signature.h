@@ -131,6 +131,7 @@ int pgp_sign_detached(pgp_io_t *,
 
 /* armoured stuff */
 unsigned pgp_crc24(unsigned, uint8_t);
+unsigned pgp_crc24_update(unsigned, const uint8_t *, size_t);
 
 void pgp_reader_push_dearmour(pgp_stream_t *);
 
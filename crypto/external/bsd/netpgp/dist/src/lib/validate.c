@@ -177,7 +177,7 @@ to give the final hash value that is checked against the one in the signature
 /* Does the signed hash match the given hash? */
 unsigned
 check_binary_sig(const uint8_t *data,
-		const unsigned len,
+		const size_t len,
 		const pgp_sig_t *sig,
 		const pgp_pubkey_t *signer)
 {
@@ -192,7 +192,7 @@ check_binary_sig(const uint8_t *data,
 		(void) fprintf(stderr, "check_binary_sig: bad hash init\n");
 		return 0;
 	}
-	hash.add(&hash, data, len);
+	pgp_hash_add_data(&hash, data, len);
 	switch (sig->info.version) {
 	case PGP_V3:
 		trailer[0] = sig->info.type;
@@ -521,7 +521,7 @@ validate_data_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 					sizeof(content->sig));
 			}
 			valid = check_binary_sig(pgp_mem_data(data->mem),
-					(const unsigned)pgp_mem_len(data->mem),
+					pgp_mem_len(data->mem),
 					&content->sig,
 					pgp_get_pubkey(signer));
 			break;
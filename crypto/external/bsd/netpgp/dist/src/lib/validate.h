@@ -97,7 +97,7 @@ void pgp_keydata_reader_set(pgp_stream_t *, const pgp_key_t *);
 pgp_cb_ret_t pgp_validate_key_cb(const pgp_packet_t *, pgp_cbdata_t *);
 
 unsigned check_binary_sig(const uint8_t *,
-		const unsigned,
+		const size_t,
 		const pgp_sig_t *,
 		const pgp_pubkey_t *);
 
@@ -541,6 +541,11 @@ typedef struct {
 static const char     b64map[] =
 	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+/*
+ * encode src into a local buffer, carrying a partial group over in
+ * base64->t and base64->pos, and pass the characters on in large
+ * writes rather than one at a time
+ */
 static unsigned 
 base64_writer(const uint8_t *src,
 	      unsigned len,
@@ -549,17 +554,28 @@ base64_writer(const uint8_t *src,
 {
 	base64_t	*base64;
 	unsigned         n;
+	unsigned         c;
+	char		 buf[1024];
 
 	base64 = pgp_writer_get_arg(writer);
-	for (n = 0; n < len;) {
-		base64->checksum = pgp_crc24(base64->checksum, src[n]);
-		if (base64->pos == 0) {
-			/* XXXXXX00 00000000 00000000 */
-			if (!stacked_write(writer,
-					&b64map[(unsigned)src[n] >> 2],
-					1, errors)) {
+	base64->checksum = pgp_crc24_update(base64->checksum, src, len);
+	for (n = 0, c = 0; n < len;) {
+		if (c > sizeof(buf) - 4) {
+			if (!stacked_write(writer, buf, c, errors)) {
 				return 0;
 			}
+			c = 0;
+		}
+		if (base64->pos == 0 && len - n >= 3) {
+			/* whole groups: XXXXXXxx xxxxXXXX XXxxxxxx */
+			buf[c++] = b64map[(unsigned)src[n] >> 2];
+			buf[c++] = b64map[((src[n] & 3) << 4) | ((unsigned)src[n + 1] >> 4)];
+			buf[c++] = b64map[((src[n + 1] & 0xf) << 2) | ((unsigned)src[n + 2] >> 6)];
+			buf[c++] = b64map[src[n + 2] & 0x3f];
+			n += 3;
+		} else if (base64->pos == 0) {
+			/* XXXXXX00 00000000 00000000 */
+			buf[c++] = b64map[(unsigned)src[n] >> 2];
 
 			/* 000000XX xxxx0000 00000000 */
 			base64->t = (src[n++] & 3) << 4;
@@ -567,10 +583,7 @@ base64_writer(const uint8_t *src,
 		} else if (base64->pos == 1) {
 			/* 000000xx XXXX0000 00000000 */
 			base64->t += (unsigned)src[n] >> 4;
-			if (!stacked_write(writer, &b64map[base64->t], 1,
-					errors)) {
-				return 0;
-			}
+			buf[c++] = b64map[base64->t];
 
 			/* 00000000 0000XXXX xx000000 */
 			base64->t = (src[n++] & 0xf) << 2;
@@ -578,22 +591,14 @@ base64_writer(const uint8_t *src,
 		} else if (base64->pos == 2) {
 			/* 00000000 0000xxxx XX000000 */
 			base64->t += (unsigned)src[n] >> 6;
-			if (!stacked_write(writer, &b64map[base64->t], 1,
-					errors)) {
-				return 0;
-			}
+			buf[c++] = b64map[base64->t];
 
 			/* 00000000 00000000 00XXXXXX */
-			if (!stacked_write(writer,
-					&b64map[src[n++] & 0x3f], 1, errors)) {
-				return 0;
-			}
-
+			buf[c++] = b64map[src[n++] & 0x3f];
 			base64->pos = 0;
 		}
 	}
-
-	return 1;
+	return (c == 0) ? 1 : stacked_write(writer, buf, c, errors);
 }
 
 static unsigned 
@@ -652,9 +657,10 @@ linebreak_writer(const uint8_t *src,
 {
 	linebreak_t	*linebreak;
 	unsigned         n;
+	unsigned         run;
 
 	linebreak = pgp_writer_get_arg(writer);
-	for (n = 0; n < len; ++n, ++linebreak->pos) {
+	for (n = 0; n < len; n += run) {
 		if (src[n] == '\r' || src[n] == '\n') {
 			linebreak->pos = 0;
 		}
@@ -664,9 +670,14 @@ linebreak_writer(const uint8_t *src,
 			}
 			linebreak->pos = 0;
 		}
-		if (!stacked_write(writer, &src[n], 1, errors)) {
+		/* pass on the rest of the line, up to the next break */
+		for (run = 1; n + run < len && linebreak->pos + run < BREAKPOS &&
+		     src[n + run] != '\r' && src[n + run] != '\n'; run++) {
+		}
+		if (!stacked_write(writer, &src[n], run, errors)) {
 			return 0;
 		}
+		linebreak->pos += run;
 	}
 
 	return 1;
@@ -53,6 +53,7 @@ __RCSID("$NetBSD: channels.c,v 1.38 2022/10/05 22:39:36 christos Exp $");
 #include <sys/queue.h>
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include <errno.h>
@@ -87,6 +88,7 @@ __RCSID("$NetBSD: channels.c,v 1.38 2022/10/05 22:39:36 christos Exp $");
 
 static int hpn_disabled = 0;
 static int hpn_buffer_size = 2 * 1024 * 1024;
+static u_int dynamic_window_max = 0;	/* 0: socket receive buffer */
 
 /* XXX remove once we're satisfied there's no lurking bugs */
 /* #define DEBUG_CHANNEL_POLL 1 */
@@ -411,6 +413,7 @@ channel_new(struct ssh *ssh, const char *ctype, int type, int rfd, int wfd,
 	c->local_window_max = window;
 	c->local_maxpacket = maxpack;
 	c->dynamic_window = 0;
+	c->window_adjusted = 0;
 	c->remote_id = -1;
 	c->remote_name = xstrdup(remote_name);
 	c->ctl_chan = -1;
@@ -1130,6 +1133,74 @@ channel_tcpwinsz(struct ssh *ssh)
 	return(tcpwinsz);
 }
 
+/* Smoothed round trip time of the connection in usec, 0 if unknown */
+static u_int
+channel_tcprtt(struct ssh *ssh)
+{
+#ifdef TCP_INFO
+	struct tcp_info ti;
+	socklen_t optsz = sizeof(ti);
+
+	if (!ssh_packet_connection_is_on_socket(ssh))
+		return 0;
+	memset(&ti, 0, sizeof(ti));
+	if (getsockopt(ssh_packet_get_connection_in(ssh),
+	    IPPROTO_TCP, TCP_INFO, &ti, &optsz) == -1)
+		return 0;
+	return ti.tcpi_rtt;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Work out how much to grow a dynamic window by.  The window needs to
+ * cover what the channel consumes in one round trip; we measure the
+ * consumption rate between window adjusts and take the RTT from the
+ * TCP stack, and grow towards twice that bandwidth-delay product (at
+ * most doubling per adjust) so that the sender is never stalled waiting
+ * for an adjust.  The window never grows beyond the socket receive
+ * buffer, which is what TcpRcvBuf and the kernel autotuning limits
+ * configure, nor beyond DynamicWindowMax if that is set.  Without an
+ * RTT estimate fall back to sizing by the receive buffer alone.
+ */
+static u_int
+channel_window_growth(struct ssh *ssh, Channel *c)
+{
+	u_int32_t tcpwinsz = channel_tcpwinsz(ssh);
+	u_int rtt, want, addition;
+	double now, elapsed, rate;
+
+	now = monotime_double();
+	elapsed = c->window_adjusted == 0 ? 0 : now - c->window_adjusted;
+	c->window_adjusted = now;
+
+	if (dynamic_window_max != 0 && tcpwinsz > dynamic_window_max)
+		tcpwinsz = dynamic_window_max;
+	if (tcpwinsz <= c->local_window_max)
+		return 0;
+	if ((rtt = channel_tcprtt(ssh)) == 0 || elapsed <= 0) {
+		/* grow the window somewhat aggressively to maintain 
+		 * pressure */
+		addition = 1.5*(tcpwinsz - c->local_window_max);
+		/* the 1.5 overshoots the receive buffer, not an explicit max */
+		if (dynamic_window_max != 0)
+			addition = MINIMUM(addition,
+			    tcpwinsz - c->local_window_max);
+		return addition;
+	}
+
+	rate = c->local_consumed / elapsed;
+	want = MINIMUM(2.0 * rate * rtt / 1000000.0, (double)tcpwinsz);
+	if (want <= c->local_window_max)
+		return 0;
+	addition = MINIMUM(want - c->local_window_max, c->local_window_max);
+	debug2("channel %d: rtt %u usec, %.0f bytes/s, window max %u -> %u",
+	    c->self, rtt, rate, c->local_window_max,
+	    c->local_window_max + addition);
+	return addition;
+}
+
 static void
 channel_pre_open(struct ssh *ssh, Channel *c)
 {
@@ -2171,12 +2242,9 @@ channel_check_window(struct ssh *ssh, Channel *c)
 	    c->local_window < c->local_window_max/2) &&
 	    c->local_consumed > 0) {
 		u_int addition = 0;
-		u_int32_t tcpwinsz = channel_tcpwinsz(ssh);
 		/* adjust max window size if we are in a dynamic environment */
-		if (c->dynamic_window && (tcpwinsz > c->local_window_max)) {
-			/* grow the window somewhat aggressively to maintain 
-			 * pressure */
-			addition = 1.5*(tcpwinsz - c->local_window_max);
+		if (c->dynamic_window &&
+		    (addition = channel_window_growth(ssh, c)) > 0) {
 			c->local_window_max += addition;
 			debug("Channel: Window growth to %d by %d bytes", c->local_window_max, addition);
 		}
@@ -3229,6 +3297,10 @@ channel_input_data(int type, u_int32_t seq, struct ssh *ssh)
 	if (c->datagram)
 		win_len += 4;  /* string length header */
 
+	/* Start the consumption rate clock with the first data. */
+	if (c->window_adjusted == 0)
+		c->window_adjusted = monotime_double();
+
 	/*
 	 * The sending side reduces its window as it sends data, so we
 	 * must 'fake' consumption of the data in order to ensure that window
@@ -3520,6 +3592,14 @@ channel_set_hpn(int external_hpn_disabled, int external_hpn_buffer_size)
 	debug("HPN Disabled: %d, HPN Buffer Size: %d", hpn_disabled, hpn_buffer_size);
 }
 
+/* Limit dynamic window growth to max bytes; 0 for no limit of its own */
+void
+channel_set_dynamic_window_max(u_int max)
+{
+	dynamic_window_max = max;
+	debug("Dynamic window max: %u", dynamic_window_max);
+}
+
 /*
  * Determine whether or not a port forward listens to loopback, the
  * specified address or wildcard. On the client, a specified bind
@@ -172,6 +172,7 @@ struct Channel {
 	u_int	local_consumed;
 	u_int	local_maxpacket;
 	int	dynamic_window;
+	double	window_adjusted;	/* time of the last window adjust */
 	int     extended_usage;
 	int	single_connection;
 	u_int 	tcpwinsz;	
@@ -256,6 +257,9 @@ struct Channel {
 /* Maximum channel input buffer size */
 #define CHAN_INPUT_MAX	(16*1024*1024)
 
+/* Largest DynamicWindowMax that ssh and sshd accept, in bytes */
+#define CHAN_DYNWIN_MAX	(64*1024*1024)
+
 /* Hard limit on number of channels */
 #define CHANNELS_MAX_CHANNELS	(16*1024)
 
@@ -386,5 +390,6 @@ void	 chan_obuf_empty(struct ssh *, Channel *);
 
 /* hpn handler */
 void     channel_set_hpn(int, int);
+void     channel_set_dynamic_window_max(u_int);
 
 #endif
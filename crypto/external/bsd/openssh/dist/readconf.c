@@ -19,6 +19,7 @@ __RCSID("$NetBSD: readconf.c,v 1.40 2022/10/05 22:39:36 christos Exp $");
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/queue.h>
 #include <sys/wait.h>
 #include <sys/un.h>
 
@@ -44,6 +45,7 @@ __RCSID("$NetBSD: readconf.c,v 1.40 2022/10/05 22:39:36 christos Exp $");
 #include "xmalloc.h"
 #include "ssh.h"
 #include "sshbuf.h"
+#include "channels.h"
 #include "ssherr.h"
 #include "compat.h"
 #include "cipher.h"
@@ -177,7 +179,7 @@ typedef enum {
 	oPubkeyAcceptedAlgorithms, oCASignatureAlgorithms, oProxyJump,
 	oSecurityKeyProvider, oKnownHostsCommand, oRequiredRSASize,
 	oNoneEnabled, oTcpRcvBufPoll, oTcpRcvBuf, oNoneSwitch, oHPNDisabled,
-	oHPNBufferSize,
+	oHPNBufferSize, oDynamicWindowMax,
 	oSendVersionFirst,
 	oIgnore, oIgnoredUnknownOption, oDeprecated, oUnsupported
 } OpCodes;
@@ -350,6 +352,7 @@ static struct {
 	{ "noneswitch", oNoneSwitch },
 	{ "hpndisabled", oHPNDisabled },
 	{ "hpnbuffersize", oHPNBufferSize },
+	{ "dynamicwindowmax", oDynamicWindowMax },
 	{ "sendversionfirst", oSendVersionFirst },
 	{ "ignoreunknown", oIgnoreUnknown },
 	{ "proxyjump", oProxyJump },
@@ -1211,6 +1214,23 @@ parse_time:
 		intptr = &options->hpn_buffer_size;
 		goto parse_int;
 
+	case oDynamicWindowMax:
+		arg = argv_next(&ac, &av);
+		if (arg == NULL || *arg == '\0') {
+			error("%s line %d: missing argument.",
+			    filename, linenum);
+			goto out;
+		}
+		value = (int)strtonum(arg, 0, CHAN_DYNWIN_MAX / 1024, &errstr);
+		if (errstr != NULL) {
+			error("%s line %d: DynamicWindowMax value %s.",
+			    filename, linenum, errstr);
+			goto out;
+		}
+		if (*activep && options->dynamic_window_max == -1)
+			options->dynamic_window_max = value;
+		break;
+
 	case oTcpRcvBufPoll:
 		intptr = &options->tcp_rcv_buf_poll;
 		goto parse_flag;
@@ -2534,6 +2554,7 @@ initialize_options(Options * options)
 	options->none_enabled = -1;
 	options->hpn_disabled = -1;
 	options->hpn_buffer_size = -1;
+	options->dynamic_window_max = -1;
 	options->tcp_rcv_buf_poll = -1;
 	options->tcp_rcv_buf = -1;
 	options->send_version_first = -1;
@@ -2720,6 +2741,10 @@ fill_default_options(Options * options)
 		options->tcp_rcv_buf *=1024;
 	if (options->tcp_rcv_buf_poll == -1)
 		options->tcp_rcv_buf_poll = 1;
+	/* KB, 0 leaves the socket receive buffer as the only limit */
+	if (options->dynamic_window_max == -1)
+		options->dynamic_window_max = 0;
+	options->dynamic_window_max *= 1024;
 	if (options->control_master == -1)
 		options->control_master = 0;
 	if (options->control_persist == -1) {
@@ -66,6 +66,7 @@ typedef struct {
 	int	tcp_rcv_buf_poll; /* Option to poll recv buf every window transfer */
 	int 	hpn_disabled; 	 /* Switch to disable HPN buffer management */
 	int	hpn_buffer_size; /* User definable size for HPN buffer window */
+	int	dynamic_window_max; /* Upper limit for dynamic window growth */
 
 	SyslogFacility log_facility;	/* Facility for system logging. */
 	LogLevel log_level;	/* Level for logging. */
@@ -230,6 +230,7 @@ initialize_server_options(ServerOptions *options)
 	options->tcp_rcv_buf_poll = -1;
 	options->hpn_disabled = -1;
 	options->hpn_buffer_size = -1;
+	options->dynamic_window_max = -1;
 }
 
 /* Returns 1 if a string option is unset or set to "none" or 0 otherwise. */
@@ -513,6 +514,10 @@ fill_default_server_options(ServerOptions *options)
 		} else
 			options->hpn_buffer_size = CHAN_TCP_WINDOW_DEFAULT;
 	}
+	/* KB, 0 leaves the socket receive buffer as the only limit */
+	if (options->dynamic_window_max == -1)
+		options->dynamic_window_max = 0;
+	options->dynamic_window_max *= 1024;
 
 #ifdef WITH_LDAP_PUBKEY
 	if (options->lpk.on == -1)
@@ -630,6 +635,7 @@ typedef enum {
 	sKexAlgorithms, sCASignatureAlgorithms, sIPQoS, sVersionAddendum,
 	sIgnoreRootRhosts,
 	sNoneEnabled, sTcpRcvBufPoll,sHPNDisabled, sHPNBufferSize,
+	sDynamicWindowMax,
 	sAuthorizedKeysCommand, sAuthorizedKeysCommandUser,
 	sAuthenticationMethods, sHostKeyAgent, sPermitUserRC,
 	sStreamLocalBindMask, sStreamLocalBindUnlink,
@@ -803,6 +809,7 @@ static struct {
 	{ "hpndisabled", sHPNDisabled, SSHCFG_ALL },
 	{ "hpnbuffersize", sHPNBufferSize, SSHCFG_ALL },
 	{ "tcprcvbufpoll", sTcpRcvBufPoll, SSHCFG_ALL },
+	{ "dynamicwindowmax", sDynamicWindowMax, SSHCFG_GLOBAL },
 	{ "authenticationmethods", sAuthenticationMethods, SSHCFG_ALL },
 	{ "streamlocalbindmask", sStreamLocalBindMask, SSHCFG_ALL },
 	{ "streamlocalbindunlink", sStreamLocalBindUnlink, SSHCFG_ALL },
@@ -1648,6 +1655,19 @@ process_server_config_line_depth(ServerOptions *options, char *line,
 		intptr = &options->hpn_buffer_size;
 		goto parse_int;
 
+	case sDynamicWindowMax:
+		arg = argv_next(&ac, &av);
+		if (arg == NULL || *arg == '\0')
+			fatal("%s line %d: %s missing argument.",
+			    filename, linenum, keyword);
+		value = (int)strtonum(arg, 0, CHAN_DYNWIN_MAX / 1024, &errstr);
+		if (errstr != NULL)
+			fatal("%s line %d: %s value %s.",
+			    filename, linenum, keyword, errstr);
+		if (*activep && options->dynamic_window_max == -1)
+			options->dynamic_window_max = value;
+		break;
+
 	case sIgnoreUserKnownHosts:
 		intptr = &options->ignore_user_known_hosts;
  parse_flag:
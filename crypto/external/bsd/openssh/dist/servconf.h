@@ -215,6 +215,7 @@ typedef struct {
 	int     tcp_rcv_buf_poll;       /* poll tcp rcv window in autotuning kernels*/
 	int	hpn_disabled;		/* disable hpn functionality. false by default */
 	int	hpn_buffer_size;	/* set the hpn buffer size - default 3MB */
+	int	dynamic_window_max;	/* dynamic window limit, 0 for none */
 
 	char   *adm_forced_command;
 
@@ -284,6 +284,42 @@ get_status(struct sftp_conn *conn, u_int expected_id)
 	return status;
 }
 
+/*
+ * Collect the status replies to n requests sent back to back.  The
+ * server may answer them in any order, so each reply is matched by its
+ * id: statuses[i] receives the status for ids[i].
+ */
+static void
+get_statuses(struct sftp_conn *conn, const u_int *ids, u_int *statuses,
+    u_int n)
+{
+	struct sshbuf *msg;
+	u_char type;
+	u_int i, id, got, seen = 0;
+	int r;
+
+	for (got = 0; got < n; got++) {
+		if ((msg = sshbuf_new()) == NULL)
+			fatal_f("sshbuf_new failed");
+		get_msg(conn, msg);
+		if ((r = sshbuf_get_u8(msg, &type)) != 0 ||
+		    (r = sshbuf_get_u32(msg, &id)) != 0)
+			fatal_fr(r, "parse");
+		for (i = 0; i < n && ids[i] != id; i++)
+			;
+		if (i == n || (seen & (1 << i)) != 0)
+			fatal("Unexpected reply ID %u", id);
+		seen |= 1 << i;
+		if (type != SSH2_FXP_STATUS)
+			fatal("Expected SSH2_FXP_STATUS(%u) packet, got %u",
+			    SSH2_FXP_STATUS, type);
+		if ((r = sshbuf_get_u32(msg, &statuses[i])) != 0)
+			fatal_fr(r, "parse status");
+		sshbuf_free(msg);
+		debug3("SSH2_FXP_STATUS I:%u %u", id, statuses[i]);
+	}
+}
+
 static u_char *
 get_handle(struct sftp_conn *conn, u_int expected_id, size_t *len,
     const char *errfmt, ...)
@@ -645,10 +681,11 @@ do_limits(struct sftp_conn *conn, struct sftp_limits *limits)
 	return 0;
 }
 
-int
-do_close(struct sftp_conn *conn, const u_char *handle, u_int handle_len)
+/* Send a close request without waiting for the reply; returns its id */
+static u_int
+send_close(struct sftp_conn *conn, const u_char *handle, u_int handle_len)
 {
-	u_int id, status;
+	u_int id;
 	struct sshbuf *msg;
 	int r;
 
@@ -663,12 +700,20 @@ do_close(struct sftp_conn *conn, const u_char *handle, u_int handle_len)
 	send_msg(conn, msg);
 	debug3("Sent message SSH2_FXP_CLOSE I:%u", id);
 
-	status = get_status(conn, id);
+	sshbuf_free(msg);
+
+	return id;
+}
+
+int
+do_close(struct sftp_conn *conn, const u_char *handle, u_int handle_len)
+{
+	u_int status;
+
+	status = get_status(conn, send_close(conn, handle, handle_len));
 	if (status != SSH2_FX_OK)
 		error("close remote: %s", fx2txt(status));
 
-	sshbuf_free(msg);
-
 	return status == SSH2_FX_OK ? 0 : -1;
 }
 
@@ -1309,16 +1354,14 @@ do_symlink(struct sftp_conn *conn, const char *oldpath, const char *newpath)
 	return status == SSH2_FX_OK ? 0 : -1;
 }
 
-int
-do_fsync(struct sftp_conn *conn, u_char *handle, u_int handle_len)
+/* Send an fsync request without waiting for the reply; returns its id */
+static u_int
+send_fsync(struct sftp_conn *conn, const u_char *handle, u_int handle_len)
 {
 	struct sshbuf *msg;
-	u_int status, id;
+	u_int id;
 	int r;
 
-	/* Silently return if the extension is not supported */
-	if ((conn->exts & SFTP_EXT_FSYNC) == 0)
-		return -1;
 	debug2("Sending SSH2_FXP_EXTENDED(fsync@openssh.com)");
 
 	/* Send fsync request */
@@ -1334,7 +1377,19 @@ do_fsync(struct sftp_conn *conn, u_char *handle, u_int handle_len)
 	debug3("Sent message fsync@openssh.com I:%u", id);
 	sshbuf_free(msg);
 
-	status = get_status(conn, id);
+	return id;
+}
+
+int
+do_fsync(struct sftp_conn *conn, u_char *handle, u_int handle_len)
+{
+	u_int status;
+
+	/* Silently return if the extension is not supported */
+	if ((conn->exts & SFTP_EXT_FSYNC) == 0)
+		return -1;
+
+	status = get_status(conn, send_fsync(conn, handle, handle_len));
 	if (status != SSH2_FX_OK)
 		error("remote fsync: %s", fx2txt(status));
 
@@ -1976,6 +2031,7 @@ do_upload(struct sftp_conn *conn, const char *local_path,
 {
 	int r, local_fd;
 	u_int openmode, id, status = SSH2_FX_OK, reordered = 0;
+	u_int ids[3], statuses[3], nids, setstat_i, fsync_i, close_i;
 	off_t offset, progress_counter;
 	u_char type, *handle, *data;
 	struct sshbuf *msg;
@@ -2159,15 +2215,39 @@ do_upload(struct sftp_conn *conn, const char *local_path,
 		status = SSH2_FX_FAILURE;
 	}
 
+	/*
+	 * Queue the attribute update, sync and close back to back and
+	 * only then collect the replies; for trees of small files the
+	 * per-file round trips dominate the transfer time.
+	 */
+	nids = 0;
+	setstat_i = fsync_i = 0;
 	/* Override umask and utimes if asked */
-	if (preserve_flag)
-		do_fsetstat(conn, handle, handle_len, &a);
-
-	if (fsync_flag)
-		(void)do_fsync(conn, handle, handle_len);
-
-	if (do_close(conn, handle, handle_len) != 0)
+	if (preserve_flag) {
+		debug2("Sending SSH2_FXP_FSETSTAT");
+		setstat_i = nids;
+		ids[nids++] = conn->msg_id++;
+		send_string_attrs_request(conn, ids[setstat_i],
+		    SSH2_FXP_FSETSTAT, handle, handle_len, &a);
+	}
+	if (fsync_flag && (conn->exts & SFTP_EXT_FSYNC) == 0)
+		fsync_flag = 0;
+	if (fsync_flag) {
+		fsync_i = nids;
+		ids[nids++] = send_fsync(conn, handle, handle_len);
+	}
+	close_i = nids;
+	ids[nids++] = send_close(conn, handle, handle_len);
+
+	get_statuses(conn, ids, statuses, nids);
+	if (preserve_flag && statuses[setstat_i] != SSH2_FX_OK)
+		error("remote fsetstat: %s", fx2txt(statuses[setstat_i]));
+	if (fsync_flag && statuses[fsync_i] != SSH2_FX_OK)
+		error("remote fsync: %s", fx2txt(statuses[fsync_i]));
+	if (statuses[close_i] != SSH2_FX_OK) {
+		error("close remote: %s", fx2txt(statuses[close_i]));
 		status = SSH2_FX_FAILURE;
+	}
 
 	free(handle);
 
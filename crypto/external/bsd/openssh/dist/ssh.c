@@ -2128,6 +2128,7 @@ hpn_options_init(struct ssh *ssh)
 	debug("Final hpn_buffer_size = %d", options.hpn_buffer_size);
 
 	channel_set_hpn(options.hpn_disabled, options.hpn_buffer_size);
+	channel_set_dynamic_window_max(options.dynamic_window_max);
 }
 
 /* open new channel for a session */
@@ -2136,6 +2136,7 @@ main(int ac, char **av)
 
 	/* set the HPN options for the child */
 	channel_set_hpn(options.hpn_disabled, options.hpn_buffer_size);
+	channel_set_dynamic_window_max(options.dynamic_window_max);
 
 	/*
 	 * We don't want to listen forever unless the other side
@@ -27,9 +27,16 @@
 #define ASYNC_JOB_PAUSED    2
 #define ASYNC_JOB_STOPPING  3
 
+/* Smallest fibre stack we accept, anything less will not run a handshake */
+#define ASYNC_MIN_STACK_SIZE    16384
+
 static CRYPTO_THREAD_LOCAL ctxkey;
 static CRYPTO_THREAD_LOCAL poolkey;
 
+/* Stack size for new fibres, 0 for the platform default */
+static size_t async_stack_size = 0;
+static CRYPTO_RWLOCK *async_stack_lock = NULL;
+
 static async_ctx *async_ctx_new(void)
 {
     async_ctx *nctx;
@@ -93,7 +100,7 @@ static ASYNC_JOB *async_job_new(void)
 static void async_job_free(ASYNC_JOB *job)
 {
     if (job != NULL) {
-        OPENSSL_free(job->funcargs);
+        OPENSSL_clear_free(job->argbuf, job->argbuf_size);
         async_fibre_free(&job->fibrectx);
         OPENSSL_free(job);
     }
@@ -117,8 +124,10 @@ static ASYNC_JOB *async_get_pool_job(void) {
     job = sk_ASYNC_JOB_pop(pool->jobs);
     if (job == NULL) {
         /* Pool is empty */
-        if ((pool->max_size != 0) && (pool->curr_size >= pool->max_size))
+        if ((pool->max_size != 0) && (pool->curr_size >= pool->max_size)) {
+            pool->num_no_jobs++;
             return NULL;
+        }
 
         job = async_job_new();
         if (job != NULL) {
@@ -127,17 +136,32 @@ static ASYNC_JOB *async_get_pool_job(void) {
                 return NULL;
             }
             pool->curr_size++;
+            pool->num_misses++;
         }
     }
     return job;
 }
 
+/*
+ * Return a finished job to the pool.  The pool grows on demand, and
+ * shrinks again only once the idle jobs outnumber twice those in flight
+ * (plus the pre-created ones), so that a burst leaves enough headroom
+ * behind for the next one without jobs being freed and recreated on
+ * every swing of the load.  The argument buffer stays with the job for
+ * reuse.
+ */
 static void async_release_job(ASYNC_JOB *job) {
     async_pool *pool;
+    size_t idle;
 
     pool = (async_pool *)CRYPTO_THREAD_get_local(&poolkey);
-    OPENSSL_free(job->funcargs);
-    job->funcargs = NULL;
+    idle = sk_ASYNC_JOB_num(pool->jobs);
+    if (idle > pool->init_size
+            && idle - pool->init_size > 2 * (pool->curr_size - idle - 1)) {
+        async_job_free(job);
+        pool->curr_size--;
+        return;
+    }
     sk_ASYNC_JOB_push(pool->jobs, job);
 }
 
@@ -193,6 +217,9 @@ int ASYNC_start_job(ASYNC_JOB **job, ASYNC_WAIT_CTX *wctx, int *ret,
             }
 
             if (ctx->currjob->status == ASYNC_JOB_PAUSING) {
+                async_pool *pool = CRYPTO_THREAD_get_local(&poolkey);
+
+                pool->num_pauses++;
                 *job = ctx->currjob;
                 ctx->currjob->status = ASYNC_JOB_PAUSED;
                 ctx->currjob = NULL;
@@ -224,14 +251,21 @@ int ASYNC_start_job(ASYNC_JOB **job, ASYNC_WAIT_CTX *wctx, int *ret,
             return ASYNC_NO_JOBS;
 
         if (args != NULL) {
-            ctx->currjob->funcargs = OPENSSL_malloc(size);
-            if (ctx->currjob->funcargs == NULL) {
-                ASYNCerr(ASYNC_F_ASYNC_START_JOB, ERR_R_MALLOC_FAILURE);
-                async_release_job(ctx->currjob);
-                ctx->currjob = NULL;
-                return ASYNC_ERR;
+            if (size > ctx->currjob->argbuf_size) {
+                OPENSSL_clear_free(ctx->currjob->argbuf,
+                                   ctx->currjob->argbuf_size);
+                ctx->currjob->argbuf_size = 0;
+                ctx->currjob->argbuf = OPENSSL_malloc(size);
+                if (ctx->currjob->argbuf == NULL) {
+                    ASYNCerr(ASYNC_F_ASYNC_START_JOB, ERR_R_MALLOC_FAILURE);
+                    async_release_job(ctx->currjob);
+                    ctx->currjob = NULL;
+                    return ASYNC_ERR;
+                }
+                ctx->currjob->argbuf_size = size;
             }
-            memcpy(ctx->currjob->funcargs, args, size);
+            memcpy(ctx->currjob->argbuf, args, size);
+            ctx->currjob->funcargs = ctx->currjob->argbuf;
         } else {
             ctx->currjob->funcargs = NULL;
         }
@@ -304,6 +338,12 @@ int async_init(void)
         return 0;
     }
 
+    if ((async_stack_lock = CRYPTO_THREAD_lock_new()) == NULL) {
+        CRYPTO_THREAD_cleanup_local(&ctxkey);
+        CRYPTO_THREAD_cleanup_local(&poolkey);
+        return 0;
+    }
+
     return 1;
 }
 
@@ -311,6 +351,8 @@ void async_deinit(void)
 {
     CRYPTO_THREAD_cleanup_local(&ctxkey);
     CRYPTO_THREAD_cleanup_local(&poolkey);
+    CRYPTO_THREAD_lock_free(async_stack_lock);
+    async_stack_lock = NULL;
 }
 
 int ASYNC_init_thread(size_t max_size, size_t init_size)
@@ -361,6 +403,7 @@ int ASYNC_init_thread(size_t max_size, size_t init_size)
         curr_size++;
     }
     pool->curr_size = curr_size;
+    pool->init_size = curr_size;
     if (!CRYPTO_THREAD_set_local(&poolkey, pool)) {
         ASYNCerr(ASYNC_F_ASYNC_INIT_THREAD, ASYNC_R_FAILED_TO_SET_POOL);
         goto err;
@@ -374,6 +417,74 @@ err:
     return 0;
 }
 
+/*
+ * Reports on the calling thread's job pool: the number of jobs it holds,
+ * how many of those are idle (the rest are in flight), how often a job
+ * had to be created because the pool was empty, how often a start was
+ * refused because the pool was at its maximum size, and how often jobs
+ * paused.  Any of the pointers may be NULL.  Returns 0 if the thread has
+ * no pool yet.
+ */
+int ASYNC_get_pool_stats(size_t *curr_size, size_t *idle,
+                         unsigned long *misses, unsigned long *no_jobs,
+                         unsigned long *pauses)
+{
+    async_pool *pool;
+
+    if (!OPENSSL_init_crypto(OPENSSL_INIT_ASYNC, NULL))
+        return 0;
+
+    pool = (async_pool *)CRYPTO_THREAD_get_local(&poolkey);
+    if (pool == NULL)
+        return 0;
+
+    if (curr_size != NULL)
+        *curr_size = pool->curr_size;
+    if (idle != NULL)
+        *idle = sk_ASYNC_JOB_num(pool->jobs);
+    if (misses != NULL)
+        *misses = pool->num_misses;
+    if (no_jobs != NULL)
+        *no_jobs = pool->num_no_jobs;
+    if (pauses != NULL)
+        *pauses = pool->num_pauses;
+    return 1;
+}
+
+/*
+ * Sets the stack size of the fibres created from now on, 0 restoring the
+ * platform default.  Jobs already in a pool keep their stacks, so this
+ * is best called before any thread starts jobs.
+ */
+int ASYNC_set_stack_size(size_t size)
+{
+    if (size != 0 && size < ASYNC_MIN_STACK_SIZE)
+        return 0;
+
+    if (!OPENSSL_init_crypto(OPENSSL_INIT_ASYNC, NULL))
+        return 0;
+
+    if (!CRYPTO_THREAD_write_lock(async_stack_lock))
+        return 0;
+    async_stack_size = size;
+    CRYPTO_THREAD_unlock(async_stack_lock);
+    return 1;
+}
+
+size_t ASYNC_get_stack_size(void)
+{
+    size_t size;
+
+    if (!OPENSSL_init_crypto(OPENSSL_INIT_ASYNC, NULL))
+        return 0;
+
+    if (!CRYPTO_THREAD_read_lock(async_stack_lock))
+        return 0;
+    size = async_stack_size;
+    CRYPTO_THREAD_unlock(async_stack_lock);
+    return size;
+}
+
 void async_delete_thread_state(void)
 {
     async_pool *pool = (async_pool *)CRYPTO_THREAD_get_local(&poolkey);
@@ -40,6 +40,8 @@ struct async_job_st {
     async_fibre fibrectx;
     int (*func) (void *);
     void *funcargs;
+    void *argbuf;               /* kept across jobs for funcargs */
+    size_t argbuf_size;
     int ret;
     int status;
     ASYNC_WAIT_CTX *waitctx;
@@ -67,6 +69,10 @@ struct async_pool_st {
     STACK_OF(ASYNC_JOB) *jobs;
     size_t curr_size;
     size_t max_size;
+    size_t init_size;
+    unsigned long num_misses;   /* jobs created because the pool was empty */
+    unsigned long num_no_jobs;  /* starts refused because max_size was hit */
+    unsigned long num_pauses;
 };
 
 void async_local_cleanup(void);
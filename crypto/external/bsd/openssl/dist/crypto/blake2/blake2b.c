@@ -97,8 +97,18 @@ int BLAKE2b_Init(BLAKE2B_CTX *c)
     return 1;
 }
 
+#if !defined(OPENSSL_NO_ASM) && !defined(OPENSSL_SMALL_FOOTPRINT) && \
+    (defined(__x86_64) || defined(__x86_64__)) && \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) \
+     || defined(__clang__))
+# define BLAKE2B_SSSE3
+# include <tmmintrin.h>
+
+extern unsigned int OPENSSL_ia32cap_P[];
+#endif
+
 /* Permute the state while xoring in the block of data. */
-static void blake2b_compress(BLAKE2B_CTX *S,
+static void blake2b_compress_c(BLAKE2B_CTX *S,
                             const uint8_t *blocks,
                             size_t len)
 {
@@ -201,6 +211,165 @@ static void blake2b_compress(BLAKE2B_CTX *S,
     } while (len);
 }
 
+#ifdef BLAKE2B_SSSE3
+/*
+ * SSSE3 flavour of the above.  The 4x4 state matrix is kept as four
+ * rows of two 128-bit halves, so that each half-round computes four G
+ * functions at once; the diagonal step is carried out by rotating rows
+ * 2-4 in place.  The 16- and 24-bit rotations are byte shuffles, which
+ * is what makes SSSE3 rather than plain SSE2 worthwhile.
+ */
+__attribute__((target("ssse3")))
+static void blake2b_compress_ssse3(BLAKE2B_CTX *S,
+                                   const uint8_t *blocks,
+                                   size_t len)
+{
+    const __m128i r16 = _mm_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1,
+                                      10, 11, 12, 13, 14, 15, 8, 9);
+    const __m128i r24 = _mm_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2,
+                                      11, 12, 13, 14, 15, 8, 9, 10);
+    __m128i row1l, row1h, row2l, row2h, row3l, row3h, row4l, row4h;
+    __m128i h0, h1, h2, h3, b0, b1, t0, t1;
+    uint64_t m[16];
+    size_t increment;
+    int i, r;
+
+    assert(len < BLAKE2B_BLOCKBYTES || len % BLAKE2B_BLOCKBYTES == 0);
+    increment = len < BLAKE2B_BLOCKBYTES ? len : BLAKE2B_BLOCKBYTES;
+
+    h0 = _mm_loadu_si128((const __m128i *)&S->h[0]);
+    h1 = _mm_loadu_si128((const __m128i *)&S->h[2]);
+    h2 = _mm_loadu_si128((const __m128i *)&S->h[4]);
+    h3 = _mm_loadu_si128((const __m128i *)&S->h[6]);
+
+    do {
+        for (i = 0; i < 16; ++i) {
+            m[i] = load64(blocks + i * sizeof(m[i]));
+        }
+
+        /* blake2b_increment_counter */
+        S->t[0] += increment;
+        S->t[1] += (S->t[0] < increment);
+
+        row1l = h0;
+        row1h = h1;
+        row2l = h2;
+        row2h = h3;
+        row3l = _mm_loadu_si128((const __m128i *)&blake2b_IV[0]);
+        row3h = _mm_loadu_si128((const __m128i *)&blake2b_IV[2]);
+        row4l = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blake2b_IV[4]),
+                              _mm_loadu_si128((const __m128i *)&S->t[0]));
+        row4h = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blake2b_IV[6]),
+                              _mm_loadu_si128((const __m128i *)&S->f[0]));
+#define LOAD(s,i,j) \
+        _mm_set_epi64x((long long)m[(s)[j]], (long long)m[(s)[i]])
+#define ROTR63(x) \
+        _mm_xor_si128(_mm_srli_epi64((x), 63), _mm_add_epi64((x), (x)))
+#define G1(b0,b1) \
+        do { \
+            row1l = _mm_add_epi64(_mm_add_epi64(row1l, b0), row2l); \
+            row1h = _mm_add_epi64(_mm_add_epi64(row1h, b1), row2h); \
+            row4l = _mm_xor_si128(row4l, row1l); \
+            row4h = _mm_xor_si128(row4h, row1h); \
+            row4l = _mm_shuffle_epi32(row4l, _MM_SHUFFLE(2, 3, 0, 1)); \
+            row4h = _mm_shuffle_epi32(row4h, _MM_SHUFFLE(2, 3, 0, 1)); \
+            row3l = _mm_add_epi64(row3l, row4l); \
+            row3h = _mm_add_epi64(row3h, row4h); \
+            row2l = _mm_shuffle_epi8(_mm_xor_si128(row2l, row3l), r24); \
+            row2h = _mm_shuffle_epi8(_mm_xor_si128(row2h, row3h), r24); \
+        } while (0)
+#define G2(b0,b1) \
+        do { \
+            row1l = _mm_add_epi64(_mm_add_epi64(row1l, b0), row2l); \
+            row1h = _mm_add_epi64(_mm_add_epi64(row1h, b1), row2h); \
+            row4l = _mm_shuffle_epi8(_mm_xor_si128(row4l, row1l), r16); \
+            row4h = _mm_shuffle_epi8(_mm_xor_si128(row4h, row1h), r16); \
+            row3l = _mm_add_epi64(row3l, row4l); \
+            row3h = _mm_add_epi64(row3h, row4h); \
+            row2l = ROTR63(_mm_xor_si128(row2l, row3l)); \
+            row2h = ROTR63(_mm_xor_si128(row2h, row3h)); \
+        } while (0)
+#define DIAGONALIZE() \
+        do { \
+            t0 = _mm_alignr_epi8(row2h, row2l, 8); \
+            t1 = _mm_alignr_epi8(row2l, row2h, 8); \
+            row2l = t0; \
+            row2h = t1; \
+            t0 = row3l; \
+            row3l = row3h; \
+            row3h = t0; \
+            t0 = _mm_alignr_epi8(row4h, row4l, 8); \
+            t1 = _mm_alignr_epi8(row4l, row4h, 8); \
+            row4l = t1; \
+            row4h = t0; \
+        } while (0)
+#define UNDIAGONALIZE() \
+        do { \
+            t0 = _mm_alignr_epi8(row2l, row2h, 8); \
+            t1 = _mm_alignr_epi8(row2h, row2l, 8); \
+            row2l = t0; \
+            row2h = t1; \
+            t0 = row3l; \
+            row3l = row3h; \
+            row3h = t0; \
+            t0 = _mm_alignr_epi8(row4l, row4h, 8); \
+            t1 = _mm_alignr_epi8(row4h, row4l, 8); \
+            row4l = t1; \
+            row4h = t0; \
+        } while (0)
+        for (r = 0; r < 12; r++) {
+            const uint8_t *s = blake2b_sigma[r];
+
+            b0 = LOAD(s, 0, 2);
+            b1 = LOAD(s, 4, 6);
+            G1(b0, b1);
+            b0 = LOAD(s, 1, 3);
+            b1 = LOAD(s, 5, 7);
+            G2(b0, b1);
+            DIAGONALIZE();
+            b0 = LOAD(s, 8, 10);
+            b1 = LOAD(s, 12, 14);
+            G1(b0, b1);
+            b0 = LOAD(s, 9, 11);
+            b1 = LOAD(s, 13, 15);
+            G2(b0, b1);
+            UNDIAGONALIZE();
+        }
+#undef LOAD
+#undef ROTR63
+#undef G1
+#undef G2
+#undef DIAGONALIZE
+#undef UNDIAGONALIZE
+
+        h0 = _mm_xor_si128(h0, _mm_xor_si128(row1l, row3l));
+        h1 = _mm_xor_si128(h1, _mm_xor_si128(row1h, row3h));
+        h2 = _mm_xor_si128(h2, _mm_xor_si128(row2l, row4l));
+        h3 = _mm_xor_si128(h3, _mm_xor_si128(row2h, row4h));
+        blocks += increment;
+        len -= increment;
+    } while (len);
+
+    _mm_storeu_si128((__m128i *)&S->h[0], h0);
+    _mm_storeu_si128((__m128i *)&S->h[2], h1);
+    _mm_storeu_si128((__m128i *)&S->h[4], h2);
+    _mm_storeu_si128((__m128i *)&S->h[6], h3);
+}
+#endif
+
+static void blake2b_compress(BLAKE2B_CTX *S,
+                            const uint8_t *blocks,
+                            size_t len)
+{
+#ifdef BLAKE2B_SSSE3
+    if (OPENSSL_ia32cap_P[1] & (1 << (41 - 32))) {
+        blake2b_compress_ssse3(S, blocks, len);
+        return;
+    }
+#endif
+    blake2b_compress_c(S, blocks, len);
+}
+
 /* Absorb the input data into the hash state.  Always returns 1. */
 int BLAKE2b_Update(BLAKE2B_CTX *c, const void *data, size_t datalen)
 {
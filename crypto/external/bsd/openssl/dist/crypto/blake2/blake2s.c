@@ -93,8 +93,18 @@ int BLAKE2s_Init(BLAKE2S_CTX *c)
     return 1;
 }
 
+#if !defined(OPENSSL_NO_ASM) && !defined(OPENSSL_SMALL_FOOTPRINT) && \
+    (defined(__x86_64) || defined(__x86_64__)) && \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) \
+     || defined(__clang__))
+# define BLAKE2S_SSSE3
+# include <tmmintrin.h>
+
+extern unsigned int OPENSSL_ia32cap_P[];
+#endif
+
 /* Permute the state while xoring in the block of data. */
-static void blake2s_compress(BLAKE2S_CTX *S,
+static void blake2s_compress_c(BLAKE2S_CTX *S,
                             const uint8_t *blocks,
                             size_t len)
 {
@@ -195,6 +205,113 @@ static void blake2s_compress(BLAKE2S_CTX *S,
     } while (len);
 }
 
+#ifdef BLAKE2S_SSSE3
+/*
+ * SSSE3 flavour of the above.  Each row of the 4x4 state matrix fits
+ * in one register, so a half-round is four G functions in parallel and
+ * the diagonal step is a lane rotation of rows 2-4.
+ */
+__attribute__((target("ssse3")))
+static void blake2s_compress_ssse3(BLAKE2S_CTX *S,
+                                   const uint8_t *blocks,
+                                   size_t len)
+{
+    const __m128i r8 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4,
+                                     9, 10, 11, 8, 13, 14, 15, 12);
+    const __m128i r16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5,
+                                      10, 11, 8, 9, 14, 15, 12, 13);
+    __m128i row1, row2, row3, row4, h0, h1, b;
+    uint32_t m[16];
+    size_t increment;
+    int i, r;
+
+    assert(len < BLAKE2S_BLOCKBYTES || len % BLAKE2S_BLOCKBYTES == 0);
+    increment = len < BLAKE2S_BLOCKBYTES ? len : BLAKE2S_BLOCKBYTES;
+
+    h0 = _mm_loadu_si128((const __m128i *)&S->h[0]);
+    h1 = _mm_loadu_si128((const __m128i *)&S->h[4]);
+
+    do {
+        for (i = 0; i < 16; ++i) {
+            m[i] = load32(blocks + i * sizeof(m[i]));
+        }
+
+        /* blake2s_increment_counter */
+        S->t[0] += increment;
+        S->t[1] += (S->t[0] < increment);
+
+        row1 = h0;
+        row2 = h1;
+        row3 = _mm_loadu_si128((const __m128i *)&blake2s_IV[0]);
+        row4 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blake2s_IV[4]),
+                             _mm_setr_epi32((int)S->t[0], (int)S->t[1],
+                                            (int)S->f[0], (int)S->f[1]));
+#define LOAD(s,i,j,k,l) \
+        _mm_setr_epi32((int)m[(s)[i]], (int)m[(s)[j]], \
+                       (int)m[(s)[k]], (int)m[(s)[l]])
+#define ROTR(x,n) \
+        _mm_xor_si128(_mm_srli_epi32((x), (n)), _mm_slli_epi32((x), 32 - (n)))
+#define G1(b) \
+        do { \
+            row1 = _mm_add_epi32(_mm_add_epi32(row1, b), row2); \
+            row4 = _mm_shuffle_epi8(_mm_xor_si128(row4, row1), r16); \
+            row3 = _mm_add_epi32(row3, row4); \
+            row2 = ROTR(_mm_xor_si128(row2, row3), 12); \
+        } while (0)
+#define G2(b) \
+        do { \
+            row1 = _mm_add_epi32(_mm_add_epi32(row1, b), row2); \
+            row4 = _mm_shuffle_epi8(_mm_xor_si128(row4, row1), r8); \
+            row3 = _mm_add_epi32(row3, row4); \
+            row2 = ROTR(_mm_xor_si128(row2, row3), 7); \
+        } while (0)
+        for (r = 0; r < 10; r++) {
+            const uint8_t *s = blake2s_sigma[r];
+
+            b = LOAD(s, 0, 2, 4, 6);
+            G1(b);
+            b = LOAD(s, 1, 3, 5, 7);
+            G2(b);
+            row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(0, 3, 2, 1));
+            row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(1, 0, 3, 2));
+            row4 = _mm_shuffle_epi32(row4, _MM_SHUFFLE(2, 1, 0, 3));
+            b = LOAD(s, 8, 10, 12, 14);
+            G1(b);
+            b = LOAD(s, 9, 11, 13, 15);
+            G2(b);
+            row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(2, 1, 0, 3));
+            row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(1, 0, 3, 2));
+            row4 = _mm_shuffle_epi32(row4, _MM_SHUFFLE(0, 3, 2, 1));
+        }
+#undef LOAD
+#undef ROTR
+#undef G1
+#undef G2
+
+        h0 = _mm_xor_si128(h0, _mm_xor_si128(row1, row3));
+        h1 = _mm_xor_si128(h1, _mm_xor_si128(row2, row4));
+        blocks += increment;
+        len -= increment;
+    } while (len);
+
+    _mm_storeu_si128((__m128i *)&S->h[0], h0);
+    _mm_storeu_si128((__m128i *)&S->h[4], h1);
+}
+#endif
+
+static void blake2s_compress(BLAKE2S_CTX *S,
+                            const uint8_t *blocks,
+                            size_t len)
+{
+#ifdef BLAKE2S_SSSE3
+    if (OPENSSL_ia32cap_P[1] & (1 << (41 - 32))) {
+        blake2s_compress_ssse3(S, blocks, len);
+        return;
+    }
+#endif
+    blake2s_compress_c(S, blocks, len);
+}
+
 /* Absorb the input data into the hash state.  Always returns 1. */
 int BLAKE2s_Update(BLAKE2S_CTX *c, const void *data, size_t datalen)
 {
@@ -77,41 +77,45 @@ void OPENSSL_LH_stats_bio(const OPENSSL_LHASH *lh, BIO *out)
     BIO_printf(out, "num_retrieve          = %lu\n", lh->num_retrieve);
     BIO_printf(out, "num_retrieve_miss     = %lu\n", lh->num_retrieve_miss);
     BIO_printf(out, "num_hash_comps        = %lu\n", lh->num_hash_comps);
+    BIO_printf(out, "max_probe             = %lu\n", lh->max_probe);
+    BIO_printf(out, "num_deleted           = %lu\n", lh->num_deleted);
 }
 
+/* For each occupied slot, how far its item sits from its home slot */
 void OPENSSL_LH_node_stats_bio(const OPENSSL_LHASH *lh, BIO *out)
 {
-    OPENSSL_LH_NODE *n;
-    unsigned int i, num;
+    const OPENSSL_LH_NODE *n;
+    unsigned int i;
 
     for (i = 0; i < lh->num_nodes; i++) {
-        for (n = lh->b[i], num = 0; n != NULL; n = n->next)
-            num++;
-        BIO_printf(out, "node %6u -> %3u\n", i, num);
+        n = &lh->b[i];
+        if (n->data == NULL || n->data == LH_DELETED)
+            continue;
+        BIO_printf(out, "node %6u -> %3u\n", i,
+                   (i - lh_home_slot(lh, n->hash)) & lh->mask);
     }
 }
 
 void OPENSSL_LH_node_usage_stats_bio(const OPENSSL_LHASH *lh, BIO *out)
 {
-    OPENSSL_LH_NODE *n;
-    unsigned long num;
+    const OPENSSL_LH_NODE *n;
     unsigned int i;
-    unsigned long total = 0, n_used = 0;
+    unsigned long total = 0, disp = 0;
 
     for (i = 0; i < lh->num_nodes; i++) {
-        for (n = lh->b[i], num = 0; n != NULL; n = n->next)
-            num++;
-        if (num != 0) {
-            n_used++;
-            total += num;
-        }
+        n = &lh->b[i];
+        if (n->data == NULL || n->data == LH_DELETED)
+            continue;
+        total++;
+        disp += (i - lh_home_slot(lh, n->hash)) & lh->mask;
     }
-    BIO_printf(out, "%lu nodes used out of %u\n", n_used, lh->num_nodes);
-    BIO_printf(out, "%lu items\n", total);
-    if (n_used == 0)
+    BIO_printf(out, "%lu nodes used out of %u\n", total, lh->num_nodes);
+    BIO_printf(out, "%lu deleted\n", lh->num_deleted);
+    if (total == 0)
         return;
-    BIO_printf(out, "load %d.%02d  actual load %d.%02d\n",
+    BIO_printf(out, "load %d.%02d  mean probe length %d.%02d\n",
                (int)(total / lh->num_nodes),
                (int)((total % lh->num_nodes) * 100 / lh->num_nodes),
-               (int)(total / n_used), (int)((total % n_used) * 100 / n_used));
+               (int)((total + disp) / total),
+               (int)(((total + disp) % total) * 100 / total));
 }
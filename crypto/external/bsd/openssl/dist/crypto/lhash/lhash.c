@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <openssl/crypto.h>
 #include <openssl/lhash.h>
 #include <openssl/err.h>
@@ -18,31 +19,36 @@
 #include "lhash_local.h"
 
 /*
- * A hashing implementation that appears to be based on the linear hashing
- * algorithm:
- * https://en.wikipedia.org/wiki/Linear_hashing
+ * An open addressing hash table with linear probing.
  *
- * Litwin, Witold (1980), "Linear hashing: A new tool for file and table
- * addressing", Proc. 6th Conference on Very Large Databases: 212-223
- * https://hackthology.com/pdfs/Litwin-1980-Linear_Hashing.pdf
+ * The items live directly in a power-of-two sized array of slots, each
+ * caching the full hash value next to the data pointer, so that a lookup
+ * normally touches a single cache line instead of chasing a chain of
+ * separately allocated nodes.  The home slot is taken from the top bits
+ * of a Fibonacci (multiplicative) hash, which spreads the weak low bits
+ * of OPENSSL_LH_strhash() and friends evenly over the table.
  *
- * From the Wikipedia article "Linear hashing is used in the BDB Berkeley
- * database system, which in turn is used by many software systems such as
- * OpenLDAP, using a C implementation derived from the CACM article and first
- * published on the Usenet in 1988 by Esmond Pitt."
- *
- * The CACM paper is available here:
- * https://pdfs.semanticscholar.org/ff4d/1c5deca6269cc316bfd952172284dbf610ee.pdf
+ * Deleted items leave a marker behind unless the following slot is
+ * empty, so that the slots of other items never move while a
+ * OPENSSL_LH_doall() callback is deleting things; markers are reclaimed
+ * by insert and thrown away when the table is rebuilt.  The table is
+ * rebuilt at twice the size once live items and markers exceed 3/4 of
+ * the slots, and at half the size once the load drops to the down_load
+ * threshold.  Within a doall it is never shrunk, and only grown when an
+ * insert finds it full.
  */
 
 #undef MIN_NODES
 #define MIN_NODES       16
-#define UP_LOAD         (2*LH_LOAD_MULT) /* load times 256 (default 2) */
-#define DOWN_LOAD       (LH_LOAD_MULT) /* load times 256 (default 1) */
+#define UP_LOAD         (3*LH_LOAD_MULT/4) /* load times 256 (default 3/4) */
+#define DOWN_LOAD       (LH_LOAD_MULT/8) /* load times 256 (default 1/8) */
+
+const char openssl_lh_deleted = 0;
 
 static int expand(OPENSSL_LHASH *lh);
 static void contract(OPENSSL_LHASH *lh);
-static OPENSSL_LH_NODE **getrn(OPENSSL_LHASH *lh, const void *data, unsigned long *rhash);
+static OPENSSL_LH_NODE *getrn(OPENSSL_LHASH *lh, const void *data,
+                              unsigned long *rhash, OPENSSL_LH_NODE **rfree);
 
 OPENSSL_LHASH *OPENSSL_LH_new(OPENSSL_LH_HASHFUNC h, OPENSSL_LH_COMPFUNC c)
 {
@@ -60,9 +66,10 @@ OPENSSL_LHASH *OPENSSL_LH_new(OPENSSL_LH_HASHFUNC h, OPENSSL_LH_COMPFUNC c)
         goto err;
     ret->comp = ((c == NULL) ? (OPENSSL_LH_COMPFUNC)strcmp : c);
     ret->hash = ((h == NULL) ? (OPENSSL_LH_HASHFUNC)OPENSSL_LH_strhash : h);
-    ret->num_nodes = MIN_NODES / 2;
+    ret->num_nodes = MIN_NODES;
     ret->num_alloc_nodes = MIN_NODES;
-    ret->pmax = MIN_NODES / 2;
+    ret->mask = MIN_NODES - 1;
+    ret->shift = 32 - 4;        /* log2(MIN_NODES) */
     ret->up_load = UP_LOAD;
     ret->down_load = DOWN_LOAD;
     return ret;
@@ -75,51 +82,48 @@ err:
 
 void OPENSSL_LH_free(OPENSSL_LHASH *lh)
 {
-    unsigned int i;
-    OPENSSL_LH_NODE *n, *nn;
-
     if (lh == NULL)
         return;
 
-    for (i = 0; i < lh->num_nodes; i++) {
-        n = lh->b[i];
-        while (n != NULL) {
-            nn = n->next;
-            OPENSSL_free(n);
-            n = nn;
-        }
-    }
     OPENSSL_free(lh->b);
     OPENSSL_free(lh);
 }
 
 void *OPENSSL_LH_insert(OPENSSL_LHASH *lh, void *data)
 {
-    unsigned long hash;
-    OPENSSL_LH_NODE *nn, **rn;
+    unsigned long hash, disp;
+    OPENSSL_LH_NODE *rn, *nn;
     void *ret;
 
     lh->error = 0;
-    if ((lh->up_load <= (lh->num_items * LH_LOAD_MULT / lh->num_nodes)) && !expand(lh))
+    /*
+     * Within a doall the table is only grown when it is completely full,
+     * as the old chained table could be: an insert must not fail just
+     * because a callback made it.  As before, the rest of that doall may
+     * then visit some items twice and miss others.
+     */
+    if ((lh->doall ? lh->num_items + lh->num_deleted + 1 >= lh->num_nodes
+                   : lh->up_load <= ((lh->num_items + lh->num_deleted + 1)
+                                     * LH_LOAD_MULT / lh->num_nodes))
+        && !expand(lh))
         return NULL;        /* 'lh->error++' already done in 'expand' */
 
-    rn = getrn(lh, data, &hash);
+    rn = getrn(lh, data, &hash, &nn);
 
-    if (*rn == NULL) {
-        if ((nn = OPENSSL_malloc(sizeof(*nn))) == NULL) {
-            lh->error++;
-            return NULL;
-        }
+    if (rn == NULL) {
+        if (nn->data == LH_DELETED)
+            lh->num_deleted--;
         nn->data = data;
-        nn->next = NULL;
         nn->hash = hash;
-        *rn = nn;
+        disp = ((unsigned int)(nn - lh->b) - lh_home_slot(lh, hash)) & lh->mask;
+        if (disp > lh->max_probe)
+            lh->max_probe = disp;
         ret = NULL;
         lh->num_insert++;
         lh->num_items++;
     } else {                    /* replace same key */
-        ret = (*rn)->data;
-        (*rn)->data = data;
+        ret = rn->data;
+        rn->data = data;
         lh->num_replace++;
     }
     return ret;
@@ -128,25 +132,34 @@ void *OPENSSL_LH_insert(OPENSSL_LHASH *lh, void *data)
 void *OPENSSL_LH_delete(OPENSSL_LHASH *lh, const void *data)
 {
     unsigned long hash;
-    OPENSSL_LH_NODE *nn, **rn;
+    OPENSSL_LH_NODE *rn;
+    unsigned int next;
     void *ret;
 
     lh->error = 0;
-    rn = getrn(lh, data, &hash);
+    rn = getrn(lh, data, &hash, NULL);
 
-    if (*rn == NULL) {
+    if (rn == NULL) {
         lh->num_no_delete++;
         return NULL;
     } else {
-        nn = *rn;
-        *rn = nn->next;
-        ret = nn->data;
-        OPENSSL_free(nn);
+        ret = rn->data;
+        /*
+         * If the next slot is empty no probe sequence runs through this
+         * one, so it can be emptied rather than marked.
+         */
+        next = ((unsigned int)(rn - lh->b) + 1) & lh->mask;
+        if (lh->b[next].data == NULL) {
+            rn->data = NULL;
+        } else {
+            rn->data = LH_DELETED;
+            lh->num_deleted++;
+        }
         lh->num_delete++;
     }
 
     lh->num_items--;
-    if ((lh->num_nodes > MIN_NODES) &&
+    if (!lh->doall && (lh->num_nodes > MIN_NODES) &&
         (lh->down_load >= (lh->num_items * LH_LOAD_MULT / lh->num_nodes)))
         contract(lh);
 
@@ -156,18 +169,18 @@ void *OPENSSL_LH_delete(OPENSSL_LHASH *lh, const void *data)
 void *OPENSSL_LH_retrieve(OPENSSL_LHASH *lh, const void *data)
 {
     unsigned long hash;
-    OPENSSL_LH_NODE **rn;
+    OPENSSL_LH_NODE *rn;
     void *ret;
 
     tsan_store((TSAN_QUALIFIER int *)&lh->error, 0);
 
-    rn = getrn(lh, data, &hash);
+    rn = getrn(lh, data, &hash, NULL);
 
-    if (*rn == NULL) {
+    if (rn == NULL) {
         tsan_counter(&lh->num_retrieve_miss);
         return NULL;
     } else {
-        ret = (*rn)->data;
+        ret = rn->data;
         tsan_counter(&lh->num_retrieve);
     }
 
@@ -179,26 +192,26 @@ static void doall_util_fn(OPENSSL_LHASH *lh, int use_arg,
                           OPENSSL_LH_DOALL_FUNCARG func_arg, void *arg)
 {
     int i;
-    OPENSSL_LH_NODE *a, *n;
+    void *a;
 
     if (lh == NULL)
         return;
 
     /*
-     * reverse the order so we search from 'top to bottom' We were having
-     * memory leaks otherwise
+     * The callback may delete items, including the current one; the
+     * table is not resized until we are done, so no item moves under us.
      */
+    lh->doall++;
     for (i = lh->num_nodes - 1; i >= 0; i--) {
-        a = lh->b[i];
-        while (a != NULL) {
-            n = a->next;
-            if (use_arg)
-                func_arg(a->data, arg);
-            else
-                func(a->data);
-            a = n;
-        }
+        a = lh->b[i].data;
+        if (a == NULL || a == LH_DELETED)
+            continue;
+        if (use_arg)
+            func_arg(a, arg);
+        else
+            func(a);
     }
+    lh->doall--;
 }
 
 void OPENSSL_LH_doall(OPENSSL_LHASH *lh, OPENSSL_LH_DOALL_FUNC func)
@@ -211,116 +224,119 @@ void OPENSSL_LH_doall_arg(OPENSSL_LHASH *lh, OPENSSL_LH_DOALL_FUNCARG func, void
     doall_util_fn(lh, 1, (OPENSSL_LH_DOALL_FUNC)0, func, arg);
 }
 
+/* Move every live item into a freshly allocated table of |nslots| slots. */
+static int rehash(OPENSSL_LHASH *lh, unsigned int nslots)
+{
+    OPENSSL_LH_NODE *n, *o = lh->b;
+    unsigned int i, j, onodes = lh->num_nodes, shift;
+    unsigned long disp;
+
+    if ((n = OPENSSL_zalloc(sizeof(*n) * nslots)) == NULL) {
+        lh->error++;
+        return 0;
+    }
+    for (shift = 32, j = nslots; j > 1; j >>= 1)
+        shift--;
+
+    lh->b = n;
+    lh->num_nodes = nslots;
+    lh->num_alloc_nodes = nslots;
+    lh->mask = nslots - 1;
+    lh->shift = shift;
+    lh->num_deleted = 0;
+    lh->max_probe = 0;
+
+    for (i = 0; i < onodes; i++) {
+        if (o[i].data == NULL || o[i].data == LH_DELETED)
+            continue;
+        for (j = lh_home_slot(lh, o[i].hash), disp = 0; n[j].data != NULL;
+             j = (j + 1) & lh->mask)
+            disp++;
+        n[j] = o[i];
+        if (disp > lh->max_probe)
+            lh->max_probe = disp;
+    }
+    OPENSSL_free(o);
+    return 1;
+}
+
 static int expand(OPENSSL_LHASH *lh)
 {
-    OPENSSL_LH_NODE **n, **n1, **n2, *np;
-    unsigned int p, pmax, nni, j;
-    unsigned long hash;
+    unsigned int nslots = lh->num_nodes;
 
-    nni = lh->num_alloc_nodes;
-    p = lh->p;
-    pmax = lh->pmax;
-    if (p + 1 >= pmax) {
-        j = nni * 2;
-        n = OPENSSL_realloc(lh->b, sizeof(OPENSSL_LH_NODE *) * j);
-        if (n == NULL) {
+    /*
+     * If it is mostly deletion markers that fill the table, rebuilding
+     * it at the same size is enough.
+     */
+    if ((lh->num_items + 1) * LH_LOAD_MULT / nslots >= lh->up_load / 2) {
+        if (nslots > UINT_MAX / 2) {
             lh->error++;
             return 0;
         }
-        lh->b = n;
-        memset(n + nni, 0, sizeof(*n) * (j - nni));
-        lh->pmax = nni;
-        lh->num_alloc_nodes = j;
-        lh->num_expand_reallocs++;
-        lh->p = 0;
-    } else {
-        lh->p++;
+        nslots *= 2;
     }
-
-    lh->num_nodes++;
+    if (!rehash(lh, nslots))
+        return 0;
     lh->num_expands++;
-    n1 = &(lh->b[p]);
-    n2 = &(lh->b[p + pmax]);
-    *n2 = NULL;
-
-    for (np = *n1; np != NULL;) {
-        hash = np->hash;
-        if ((hash % nni) != p) { /* move it */
-            *n1 = (*n1)->next;
-            np->next = *n2;
-            *n2 = np;
-        } else
-            n1 = &((*n1)->next);
-        np = *n1;
-    }
-
+    lh->num_expand_reallocs++;
     return 1;
 }
 
 static void contract(OPENSSL_LHASH *lh)
 {
-    OPENSSL_LH_NODE **n, *n1, *np;
-
-    np = lh->b[lh->p + lh->pmax - 1];
-    lh->b[lh->p + lh->pmax - 1] = NULL; /* 24/07-92 - eay - weird but :-( */
-    if (lh->p == 0) {
-        n = OPENSSL_realloc(lh->b,
-                            (unsigned int)(sizeof(OPENSSL_LH_NODE *) * lh->pmax));
-        if (n == NULL) {
-            /* fputs("realloc error in lhash",stderr); */
-            lh->error++;
-            return;
-        }
-        lh->num_contract_reallocs++;
-        lh->num_alloc_nodes /= 2;
-        lh->pmax /= 2;
-        lh->p = lh->pmax - 1;
-        lh->b = n;
-    } else
-        lh->p--;
-
-    lh->num_nodes--;
-    lh->num_contracts++;
+    unsigned int nslots = lh->num_nodes / 2;
 
-    n1 = lh->b[(int)lh->p];
-    if (n1 == NULL)
-        lh->b[(int)lh->p] = np;
-    else {
-        while (n1->next != NULL)
-            n1 = n1->next;
-        n1->next = np;
-    }
+    /*
+     * Whatever down_load says, the items must still fit below up_load
+     * at half the size, or the table would fill up (and probes for
+     * missing items would never end) or grow straight back.
+     */
+    if ((lh->num_items + 1) * LH_LOAD_MULT / nslots >= lh->up_load)
+        return;
+    if (!rehash(lh, nslots))
+        return;
+    lh->num_contracts++;
+    lh->num_contract_reallocs++;
 }
 
-static OPENSSL_LH_NODE **getrn(OPENSSL_LHASH *lh,
-                               const void *data, unsigned long *rhash)
+/*
+ * Look |data| up and return its slot, or NULL if it is not there.  In
+ * the latter case |*rfree|, if given, is set to the slot an insert of
+ * |data| should use: the first deletion marker on the probe sequence,
+ * or else the empty slot that ended it.
+ */
+static OPENSSL_LH_NODE *getrn(OPENSSL_LHASH *lh, const void *data,
+                              unsigned long *rhash, OPENSSL_LH_NODE **rfree)
 {
-    OPENSSL_LH_NODE **ret, *n1;
-    unsigned long hash, nn;
+    OPENSSL_LH_NODE *n1, *marker = NULL;
+    unsigned long hash;
+    unsigned int i;
     OPENSSL_LH_COMPFUNC cf;
 
     hash = (*(lh->hash)) (data);
     tsan_counter(&lh->num_hash_calls);
     *rhash = hash;
 
-    nn = hash % lh->pmax;
-    if (nn < lh->p)
-        nn = hash % lh->num_alloc_nodes;
-
     cf = lh->comp;
-    ret = &(lh->b[(int)nn]);
-    for (n1 = *ret; n1 != NULL; n1 = n1->next) {
-        tsan_counter(&lh->num_hash_comps);
-        if (n1->hash != hash) {
-            ret = &(n1->next);
+    for (i = lh_home_slot(lh, hash); ; i = (i + 1) & lh->mask) {
+        n1 = &(lh->b[i]);
+        if (n1->data == NULL)
+            break;
+        if (n1->data == LH_DELETED) {
+            if (marker == NULL)
+                marker = n1;
             continue;
         }
+        tsan_counter(&lh->num_hash_comps);
+        if (n1->hash != hash)
+            continue;
         tsan_counter(&lh->num_comp_calls);
         if (cf(n1->data, data) == 0)
-            break;
-        ret = &(n1->next);
+            return n1;
     }
-    return ret;
+    if (rfree != NULL)
+        *rfree = marker != NULL ? marker : n1;
+    return NULL;
 }
 
 /*
@@ -384,8 +400,17 @@ unsigned long OPENSSL_LH_get_down_load(const OPENSSL_LHASH *lh)
     return lh->down_load;
 }
 
+/*
+ * Halving the table doubles its load, so a down_load above a quarter of
+ * up_load would shrink the table right back to the point where it has
+ * to grow again.  Higher values are clamped to up_load / 4 (48 with the
+ * default up_load), so OPENSSL_LH_get_down_load() may not return what
+ * was set here.
+ */
 void OPENSSL_LH_set_down_load(OPENSSL_LHASH *lh, unsigned long down_load)
 {
+    if (down_load > lh->up_load / 4)
+        down_load = lh->up_load / 4;
     lh->down_load = down_load;
 }
 
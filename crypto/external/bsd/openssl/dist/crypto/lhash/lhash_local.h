@@ -12,21 +12,21 @@
 
 struct lhash_node_st {
     void *data;
-    struct lhash_node_st *next;
     unsigned long hash;
 };
 
 struct lhash_st {
-    OPENSSL_LH_NODE **b;
+    OPENSSL_LH_NODE *b;
     OPENSSL_LH_COMPFUNC comp;
     OPENSSL_LH_HASHFUNC hash;
     unsigned int num_nodes;
     unsigned int num_alloc_nodes;
-    unsigned int p;
-    unsigned int pmax;
+    unsigned int mask;          /* num_nodes - 1 */
+    unsigned int shift;         /* 32 - log2(num_nodes) */
     unsigned long up_load;      /* load times 256 */
     unsigned long down_load;    /* load times 256 */
     unsigned long num_items;
+    unsigned long num_deleted;  /* slots holding a deletion marker */
     unsigned long num_expands;
     unsigned long num_expand_reallocs;
     unsigned long num_contracts;
@@ -40,5 +40,20 @@ struct lhash_st {
     TSAN_QUALIFIER unsigned long num_retrieve;
     TSAN_QUALIFIER unsigned long num_retrieve_miss;
     TSAN_QUALIFIER unsigned long num_hash_comps;
+    unsigned long max_probe;    /* longest displacement since last resize */
+    int doall;                  /* nonzero while a doall is running */
     int error;
 };
+
+/* Stands in for the data pointer of a deleted item, see lhash.c */
+extern const char openssl_lh_deleted;
+#define LH_DELETED      ((void *)&openssl_lh_deleted)
+
+/* Fibonacci hash of |hash| onto the table */
+static ossl_inline unsigned int lh_home_slot(const OPENSSL_LHASH *lh,
+                                             unsigned long hash)
+{
+    uint64_t h = hash;
+
+    return (uint32_t)((uint32_t)(h ^ (h >> 32)) * 0x9E3779B9U) >> lh->shift;
+}
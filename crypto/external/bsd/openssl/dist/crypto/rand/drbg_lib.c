@@ -657,6 +657,8 @@ int RAND_DRBG_bytes(RAND_DRBG *drbg, unsigned char *out, size_t outlen)
 {
     unsigned char *additional = NULL;
     size_t additional_len;
+    const unsigned char *adin;
+    size_t adinlen;
     size_t chunk;
     size_t ret = 0;
 
@@ -671,13 +673,22 @@ int RAND_DRBG_bytes(RAND_DRBG *drbg, unsigned char *out, size_t outlen)
     additional_len = rand_drbg_get_additional_data(drbg->adin_pool,
                                                    &additional);
 
+    /*
+     * The additional data only needs to go into the first chunk of a
+     * large request; the later chunks are already diversified by it,
+     * and skipping it saves a derivation per max_request bytes.
+     */
+    adin = additional;
+    adinlen = additional_len;
     for ( ; outlen > 0; outlen -= chunk, out += chunk) {
         chunk = outlen;
         if (chunk > drbg->max_request)
             chunk = drbg->max_request;
-        ret = RAND_DRBG_generate(drbg, out, chunk, 0, additional, additional_len);
+        ret = RAND_DRBG_generate(drbg, out, chunk, 0, adin, adinlen);
         if (!ret)
             goto err;
+        adin = NULL;
+        adinlen = 0;
     }
     ret = 1;
 
@@ -860,6 +871,28 @@ void *RAND_DRBG_get_ex_data(const RAND_DRBG *drbg, int idx)
  * global DRBG.  They lock.
  */
 
+/*
+ * Shortens the reseed intervals of a freshly instantiated per-thread
+ * DRBG by a random amount of up to 1/8th.  Threads which are started
+ * together would otherwise all come back to the master DRBG, and queue
+ * on its lock, for their reseeds at the same moment.
+ */
+static void drbg_jitter_reseed(RAND_DRBG *drbg)
+{
+    uint32_t r;
+
+    if (drbg->state != DRBG_READY
+        || !RAND_DRBG_generate(drbg, (unsigned char *)&r, sizeof(r), 0,
+                               NULL, 0))
+        return;
+
+    if (drbg->reseed_interval >= 8)
+        drbg->reseed_interval -= (r & 0xffff) % (drbg->reseed_interval / 8);
+    if (drbg->reseed_time_interval >= 8)
+        drbg->reseed_time_interval -=
+            (time_t)((r >> 16) % (drbg->reseed_time_interval / 8));
+}
+
 /*
  * Allocates a new global DRBG on the secure heap (if enabled) and
  * initializes it with default settings.
@@ -891,6 +924,8 @@ static RAND_DRBG *drbg_setup(RAND_DRBG *parent)
     (void)RAND_DRBG_instantiate(drbg,
                                 (const unsigned char *) ossl_pers_string,
                                 sizeof(ossl_pers_string) - 1);
+    if (parent != NULL)
+        drbg_jitter_reseed(drbg);
     return drbg;
 
 err:
@@ -39,6 +39,11 @@ typedef struct async_wait_ctx_st ASYNC_WAIT_CTX;
 
 int ASYNC_init_thread(size_t max_size, size_t init_size);
 void ASYNC_cleanup_thread(void);
+int ASYNC_get_pool_stats(size_t *curr_size, size_t *idle,
+                         unsigned long *misses, unsigned long *no_jobs,
+                         unsigned long *pauses);
+int ASYNC_set_stack_size(size_t size);
+size_t ASYNC_get_stack_size(void);
 
 #ifdef OSSL_ASYNC_FD
 ASYNC_WAIT_CTX *ASYNC_WAIT_CTX_new(void);
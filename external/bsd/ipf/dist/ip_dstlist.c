@@ -139,7 +139,8 @@ ipf_lookup_t ipf_dstlist_backend = {
 	ipf_dstlist_select_ref,
 	ipf_dstlist_select_node,
 	ipf_dstlist_expire,
-	ipf_dstlist_sync
+	ipf_dstlist_sync,
+	NULL
 };
 
 
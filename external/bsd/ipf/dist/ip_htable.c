@@ -50,16 +50,43 @@ struct file;
 #include "netinet/ip_fil.h"
 #include "netinet/ip_lookup.h"
 #include "netinet/ip_htable.h"
+#if defined(__NetBSD__)
+# include <sys/atomic.h>
+#endif
+#if !defined(_KERNEL)
+# include <sched.h>
+#endif
 /* END OF INCLUDES */
 
 #if !defined(lint)
 static const char rcsid[] = "@(#)Id: ip_htable.c,v 1.1.1.2 2012/07/22 13:44:17 darrenr Exp";
 #endif
 
+/*
+ * Memory barriers for the lookups that run without ipf_poolrw, and what a
+ * writer does while it waits for them to finish.
+ */
+#if defined(__NetBSD__)
+# define	IPH_MEMBAR_SYNC()	membar_sync()
+# define	IPH_MEMBAR_PRODUCER()	membar_producer()
+# define	IPH_MEMBAR_CONSUMER()	membar_consumer()
+#elif defined(__GNUC__)
+# define	IPH_MEMBAR_SYNC()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+# define	IPH_MEMBAR_PRODUCER()	__atomic_thread_fence(__ATOMIC_RELEASE)
+# define	IPH_MEMBAR_CONSUMER()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#endif
+#if defined(_KERNEL) && defined(__NetBSD__)
+# define	IPH_YIELD()		preempt()
+#elif !defined(_KERNEL)
+# define	IPH_YIELD()		sched_yield()
+#else
+# define	IPH_YIELD()		DELAY(1)
+#endif
+
 # ifdef USE_INET6
-static iphtent_t *ipf_iphmfind6 __P((iphtable_t *, i6addr_t *));
+static iphtent_t *ipf_iphmfind6 __P((iphtable_t *, i6addr_t *, u_int *));
 # endif
-static iphtent_t *ipf_iphmfind __P((iphtable_t *, struct in_addr *));
+static iphtent_t *ipf_iphmfind __P((iphtable_t *, struct in_addr *, u_int *));
 static int ipf_iphmfindip __P((ipf_main_softc_t *, void *, int, void *, u_int));
 static int ipf_htable_clear __P((ipf_main_softc_t *, void *, iphtable_t *));
 static int ipf_htable_create __P((ipf_main_softc_t *, void *, iplookupop_t *));
@@ -88,6 +115,21 @@ static int ipf_htable_table_add __P((ipf_main_softc_t *, void *,
 				     iplookupop_t *));
 static int ipf_htable_table_del __P((ipf_main_softc_t *, void *,
 				     iplookupop_t *));
+static int ipf_htable_table_swap __P((ipf_main_softc_t *, void *,
+				      iplookupop_t *));
+static iphtent_t **ipf_htable_bucket __P((iphtable_t *, u_int));
+static void ipf_htable_grow __P((void *, iphtable_t *));
+static void ipf_htable_rehash __P((iphtable_t *, int));
+static void ipf_htable_adopt __P((iphtable_t *));
+static u_int ipf_htable_enter __P((void *));
+static void ipf_htable_exit __P((void *, u_int));
+static void ipf_htable_quiesce __P((void *));
+static void ipf_htable_reap __P((void *));
+static u_int ipf_htable_rbegin __P((iphtable_t *, u_int *));
+static int ipf_htable_rvalid __P((iphtable_t *, u_int));
+static void ipf_htable_wbegin __P((iphtable_t *));
+static void ipf_htable_wend __P((iphtable_t *));
+static u_int ipf_htent_hash __P((iphtent_t *));
 static int ipf_htent_deref __P((void *, iphtent_t *));
 static iphtent_t *ipf_htent_find __P((iphtable_t *, iphtent_t *));
 static int ipf_htent_insert __P((ipf_main_softc_t *, void *, iphtable_t *,
@@ -104,8 +146,34 @@ typedef struct ipf_htable_softc_s {
 	u_long		ipf_nhtnodes[LOOKUP_POOL_SZ];
 	iphtable_t	*ipf_htables[LOOKUP_POOL_SZ];
 	iphtent_t	*ipf_node_explist;
+	iphtent_t	*ipht_dead;	/* entries waiting to be freed */
+	volatile u_int	ipht_epoch;	/* which count new lookups add to */
+	volatile u_int	ipht_readers[2]; /* lookups in progress */
 } ipf_htable_softc_t;
 
+/*
+ * Each table is allocated with the state of growing it after it, rather
+ * than in the iphtable_t itself, so that the iphtable_t which is copied
+ * in by SIOCLOOKUPADDTABLE and out by the iterator keeps its size.
+ *
+ * Lookups do not take ipf_poolrw.  Instead, anything that changes what a
+ * lookup would find makes iphp_gen odd while it does so, and a lookup
+ * that sees iphp_gen change starts again.  Memory a lookup might still be
+ * looking at is only freed once ipf_htable_quiesce() has waited for the
+ * lookups that were in progress to finish.
+ */
+typedef struct iphtable_priv_s {
+	iphtable_t	iphp_table;	/* must be first */
+	iphtent_t	**iphp_otable;	/* table being grown out of */
+	size_t		iphp_osize;	/* size of iphp_otable */
+	size_t		iphp_omoved;	/* buckets of iphp_otable rehashed */
+	u_long		iphp_nodes;	/* number of entries */
+	ipf_htable_softc_t *iphp_softh;	/* context the table belongs to */
+	volatile u_int	iphp_gen;	/* odd while the table is changing */
+} iphtable_priv_t;
+
+#define	IPH_PRIV(iph)	((iphtable_priv_t *)(iph))
+
 ipf_lookup_t ipf_htable_backend = {
 	IPLT_HASH,
 	ipf_htable_soft_create,
@@ -126,7 +194,8 @@ ipf_lookup_t ipf_htable_backend = {
 	ipf_htable_select_add_ref,
 	NULL,
 	ipf_htable_expire,
-	NULL
+	NULL,
+	ipf_htable_table_swap
 };
 
 
@@ -280,6 +349,7 @@ ipf_htable_create(softc, arg, op)
 {
 	ipf_htable_softc_t *softh = arg;
 	iphtable_t htab, *iph, *oiph;
+	iphtable_priv_t *iphp;
 	char name[FR_GROUPLEN];
 	int err, i, unit;
 
@@ -317,12 +387,13 @@ ipf_htable_create(softc, arg, op)
 		}
 	}
 
-	KMALLOC(iph, iphtable_t *);
-	if (iph == NULL) {
+	KMALLOC(iphp, iphtable_priv_t *);
+	if (iphp == NULL) {
 		softh->ipht_nomem[op->iplo_unit + 1]++;
 		IPFERROR(30002);
 		return ENOMEM;
 	}
+	iph = &iphp->iphp_table;
 	*iph = htab;
 
 	if ((op->iplo_arg & IPHASH_ANON) != 0) {
@@ -353,13 +424,19 @@ ipf_htable_create(softc, arg, op)
 	KMALLOCS(iph->iph_table, iphtent_t **,
 		 iph->iph_size * sizeof(*iph->iph_table));
 	if (iph->iph_table == NULL) {
-		KFREE(iph);
+		KFREE(iphp);
 		softh->ipht_nomem[unit + 1]++;
 		IPFERROR(30006);
 		return ENOMEM;
 	}
 
 	bzero((char *)iph->iph_table, iph->iph_size * sizeof(*iph->iph_table));
+	iphp->iphp_otable = NULL;
+	iphp->iphp_osize = 0;
+	iphp->iphp_omoved = 0;
+	iphp->iphp_nodes = 0;
+	iphp->iphp_softh = softh;
+	iphp->iphp_gen = 0;
 	iph->iph_maskset[0] = 0;
 	iph->iph_maskset[1] = 0;
 	iph->iph_maskset[2] = 0;
@@ -459,11 +536,16 @@ ipf_htable_clear(softc, arg, iph)
 	iphtable_t *iph;
 {
 	iphtent_t *ipe;
+	int rval;
 
+	rval = 0;
 	while ((ipe = iph->iph_list) != NULL)
-		if (ipf_htent_remove(softc, arg, iph, ipe) != 0)
-			return 1;
-	return 0;
+		if (ipf_htent_remove(softc, arg, iph, ipe) != 0) {
+			rval = 1;
+			break;
+		}
+	ipf_htable_reap(arg);
+	return rval;
 }
 
 
@@ -480,6 +562,7 @@ ipf_htable_free(arg, iph)
 	iphtable_t *iph;
 {
 	ipf_htable_softc_t *softh = arg;
+	iphtable_priv_t *iphp = IPH_PRIV(iph);
 
 	if (iph->iph_next != NULL)
 		iph->iph_next->iph_pnext = iph->iph_pnext;
@@ -490,8 +573,12 @@ ipf_htable_free(arg, iph)
 
 	softh->ipf_nhtables[iph->iph_unit + 1]--;
 
+	ipf_htable_quiesce(softh);
+	if (iphp->iphp_otable != NULL)
+		KFREES(iphp->iphp_otable,
+		       iphp->iphp_osize * sizeof(*iphp->iphp_otable));
 	KFREES(iph->iph_table, iph->iph_size * sizeof(*iph->iph_table));
-	KFREE(iph);
+	KFREE(iphp);
 }
 
 
@@ -575,6 +662,7 @@ ipf_htable_node_del(softc, arg, op, uid)
 	}
 
 	err = ipf_htent_remove(softc, arg, iph, ent);
+	ipf_htable_reap(arg);
 
 	return err;
 }
@@ -628,6 +716,7 @@ ipf_htent_remove(softc, arg, iph, ipe)
 	if (iph->iph_tail == &ipe->ipe_next)
 		iph->iph_tail = ipe->ipe_pnext;
 
+	ipf_htable_wbegin(iph);
 	if (ipe->ipe_hnext != NULL)
 		ipe->ipe_hnext->ipe_phnext = ipe->ipe_phnext;
 	if (ipe->ipe_phnext != NULL)
@@ -649,6 +738,10 @@ ipf_htent_remove(softc, arg, iph, ipe)
 	ipe->ipe_pnext = NULL;
 	ipe->ipe_next = NULL;
 
+	IPH_PRIV(iph)->iphp_nodes--;
+	ipf_htable_rehash(iph, IPHASH_MOVE);
+	ipf_htable_wend(iph);
+
 	switch (iph->iph_type & ~IPHASH_ANON)
 	{
 	case IPHASH_GROUPMAP :
@@ -710,7 +803,12 @@ ipf_htent_deref(arg, ipe)
 	ipe->ipe_ref--;
 	if (ipe->ipe_ref == 0) {
 		softh->ipf_nhtnodes[ipe->ipe_unit + 1]--;
-		KFREE(ipe);
+		/*
+		 * A lookup may still be looking at it, so leave it for
+		 * ipf_htable_reap().  Lookups don't follow ipe_next.
+		 */
+		ipe->ipe_next = softh->ipht_dead;
+		softh->ipht_dead = ipe;
 
 		return 0;
 	}
@@ -911,8 +1009,7 @@ ipf_htent_insert(softc, arg, iph, ipeo)
 	iphtent_t *ipeo;
 {
 	ipf_htable_softc_t *softh = arg;
-	iphtent_t *ipe;
-	u_int hv;
+	iphtent_t *ipe, **bucket;
 	int bits;
 
 	KMALLOC(ipe, iphtent_t *);
@@ -929,8 +1026,6 @@ ipf_htent_insert(softc, arg, iph, ipeo)
 		ipe->ipe_mask.i6[1] = 0;
 		ipe->ipe_mask.i6[2] = 0;
 		ipe->ipe_mask.i6[3] = 0;
-		hv = IPE_V4_HASH_FN(ipe->ipe_addr.in4_addr,
-				    ipe->ipe_mask.in4_addr, iph->iph_size);
 	} else
 #ifdef USE_INET6
 	if (ipe->ipe_family == AF_INET6) {
@@ -939,8 +1034,6 @@ ipf_htent_insert(softc, arg, iph, ipeo)
 		ipe->ipe_addr.i6[3] &= ipe->ipe_mask.i6[3];
 
 		bits = count6bits(ipe->ipe_mask.i6);
-		hv = IPE_V6_HASH_FN(ipe->ipe_addr.i6,
-				    ipe->ipe_mask.i6, iph->iph_size);
 	} else
 #endif
 	{
@@ -950,12 +1043,23 @@ ipf_htent_insert(softc, arg, iph, ipeo)
 
 	ipe->ipe_owner = iph;
 	ipe->ipe_ref = 1;
-	ipe->ipe_hnext = iph->iph_table[hv];
-	ipe->ipe_phnext = iph->iph_table + hv;
 
-	if (iph->iph_table[hv] != NULL)
-		iph->iph_table[hv]->ipe_phnext = &ipe->ipe_hnext;
-	iph->iph_table[hv] = ipe;
+	switch (iph->iph_type & ~IPHASH_ANON)
+	{
+	case IPHASH_GROUPMAP :
+		ipe->ipe_ptr = ipf_group_add(softc, ipe->ipe_group, NULL,
+					   iph->iph_flags, IPL_LOGIPF,
+					   softc->ipf_active);
+		break;
+
+	default :
+		ipe->ipe_ptr = NULL;
+		ipe->ipe_value = 0;
+		break;
+	}
+
+	ipe->ipe_unit = iph->iph_unit;
+	softh->ipf_nhtnodes[ipe->ipe_unit + 1]++;
 
 	ipe->ipe_pnext = iph->iph_tail;
 	*iph->iph_tail = ipe;
@@ -999,6 +1103,16 @@ ipf_htent_insert(softc, arg, iph, ipeo)
 		}
 	}
 
+	ipf_htable_wbegin(iph);
+	bucket = ipf_htable_bucket(iph, ipf_htent_hash(ipe));
+	ipe->ipe_hnext = *bucket;
+	ipe->ipe_phnext = bucket;
+
+	if (*bucket != NULL)
+		(*bucket)->ipe_phnext = &ipe->ipe_hnext;
+	IPH_MEMBAR_PRODUCER();
+	*bucket = ipe;
+
 	if (ipe->ipe_family == AF_INET) {
 		ipf_inet_mask_add(bits, &iph->iph_v4_masks);
 	}
@@ -1008,22 +1122,10 @@ ipf_htent_insert(softc, arg, iph, ipeo)
 	}
 #endif
 
-	switch (iph->iph_type & ~IPHASH_ANON)
-	{
-	case IPHASH_GROUPMAP :
-		ipe->ipe_ptr = ipf_group_add(softc, ipe->ipe_group, NULL,
-					   iph->iph_flags, IPL_LOGIPF,
-					   softc->ipf_active);
-		break;
-
-	default :
-		ipe->ipe_ptr = NULL;
-		ipe->ipe_value = 0;
-		break;
-	}
-
-	ipe->ipe_unit = iph->iph_unit;
-	softh->ipf_nhtnodes[ipe->ipe_unit + 1]++;
+	IPH_PRIV(iph)->iphp_nodes++;
+	ipf_htable_rehash(iph, IPHASH_MOVE);
+	ipf_htable_grow(softh, iph);
+	ipf_htable_wend(iph);
 
 	return 0;
 }
@@ -1045,8 +1147,6 @@ ipf_htent_find(iph, ipeo)
 	iphtent_t *ipeo;
 {
 	iphtent_t ipe, *ent;
-	u_int hv;
-	int bits;
 
 	bcopy((char *)ipeo, (char *)&ipe, sizeof(ipe));
 	ipe.ipe_addr.i6[0] &= ipe.ipe_mask.i6[0];
@@ -1054,26 +1154,20 @@ ipf_htent_find(iph, ipeo)
 	ipe.ipe_addr.i6[2] &= ipe.ipe_mask.i6[2];
 	ipe.ipe_addr.i6[3] &= ipe.ipe_mask.i6[3];
 	if (ipe.ipe_family == AF_INET) {
-		bits = count4bits(ipe.ipe_mask.in4_addr);
 		ipe.ipe_addr.i6[1] = 0;
 		ipe.ipe_addr.i6[2] = 0;
 		ipe.ipe_addr.i6[3] = 0;
 		ipe.ipe_mask.i6[1] = 0;
 		ipe.ipe_mask.i6[2] = 0;
 		ipe.ipe_mask.i6[3] = 0;
-		hv = IPE_V4_HASH_FN(ipe.ipe_addr.in4_addr,
-				    ipe.ipe_mask.in4_addr, iph->iph_size);
 	} else
 #ifdef USE_INET6
-	if (ipe.ipe_family == AF_INET6) {
-		bits = count6bits(ipe.ipe_mask.i6);
-		hv = IPE_V6_HASH_FN(ipe.ipe_addr.i6,
-				    ipe.ipe_mask.i6, iph->iph_size);
-	} else
+	if (ipe.ipe_family != AF_INET6)
 #endif
 		return NULL;
 
-	for (ent = iph->iph_table[hv]; ent != NULL; ent = ent->ipe_hnext) {
+	for (ent = *ipf_htable_bucket(iph, ipf_htent_hash(&ipe)); ent != NULL;
+	     ent = ent->ipe_hnext) {
 		if (ent->ipe_family != ipe.ipe_family)
 			continue;
 		if (IP6_NEQ(&ipe.ipe_addr, &ent->ipe_addr))
@@ -1087,6 +1181,465 @@ ipf_htent_find(iph, ipeo)
 }
 
 
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htent_hash                                              */
+/* Returns:     u_int  - hash value for the entry                           */
+/* Parameters:  ipe(I) - pointer to hash table entry                        */
+/*                                                                          */
+/* Compute the (unreduced) hash for an entry whose address has already been */
+/* masked.  The value is reduced modulo the size of whichever bucket array  */
+/* the caller is looking in, see ipf_htable_bucket().                       */
+/* ------------------------------------------------------------------------ */
+static u_int
+ipf_htent_hash(ipe)
+	iphtent_t *ipe;
+{
+#ifdef USE_INET6
+	if (ipe->ipe_family == AF_INET6)
+		return IPE_V6_HASH(ipe->ipe_addr.i6, ipe->ipe_mask.i6);
+#endif
+	return IPE_V4_HASH(ipe->ipe_addr.in4_addr, ipe->ipe_mask.in4_addr);
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_bucket                                           */
+/* Returns:     iphtent_t ** - pointer to head of hash chain                */
+/* Parameters:  iph(I)  - pointer to hash table                             */
+/*              hash(I) - unreduced hash value from IPE_V*_HASH             */
+/*                                                                          */
+/* While a table is being grown, the buckets of the old array that have not */
+/* yet been moved across are still authoritative, so look there first.      */
+/* Buckets are moved in ascending order, so anything below iphp_omoved has  */
+/* already been rehashed into the new array.                                */
+/* ------------------------------------------------------------------------ */
+static iphtent_t **
+ipf_htable_bucket(iph, hash)
+	iphtable_t *iph;
+	u_int hash;
+{
+	iphtable_priv_t *iphp = IPH_PRIV(iph);
+	size_t hv;
+
+	if (iphp->iphp_otable != NULL) {
+		hv = hash % iphp->iphp_osize;
+		if (hv >= iphp->iphp_omoved)
+			return iphp->iphp_otable + hv;
+	}
+	return iph->iph_table + hash % iph->iph_size;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_grow                                             */
+/* Returns:     Nil                                                         */
+/* Parameters:  arg(I) - pointer to local context to use                    */
+/*              iph(I) - pointer to hash table                              */
+/*                                                                          */
+/* If the average chain length has gone above IPHASH_MAXLOAD, allocate a    */
+/* bucket array about twice as big and start moving entries into it.  The   */
+/* old array is kept around and drained a few buckets at a time by          */
+/* ipf_htable_rehash() so that no single insert has to touch every entry in */
+/* the table while holding the lock.  Failing to get the memory is not an   */
+/* error: the table still works, just with longer chains.                   */
+/* ------------------------------------------------------------------------ */
+static void
+ipf_htable_grow(arg, iph)
+	void *arg;
+	iphtable_t *iph;
+{
+	ipf_htable_softc_t *softh = arg;
+	iphtable_priv_t *iphp = IPH_PRIV(iph);
+	iphtent_t **table;
+	size_t size;
+
+	if (iphp->iphp_otable != NULL)
+		return;
+	if (iphp->iphp_nodes <= iph->iph_size * IPHASH_MAXLOAD)
+		return;
+	if (iph->iph_size >= IPHASH_MAXSIZE)
+		return;
+
+	size = iph->iph_size * 2 + 1;
+	KMALLOCS(table, iphtent_t **, size * sizeof(*table));
+	if (table == NULL) {
+		softh->ipht_nomem[iph->iph_unit + 1]++;
+		return;
+	}
+	bzero((char *)table, size * sizeof(*table));
+
+	iphp->iphp_otable = iph->iph_table;
+	iphp->iphp_osize = iph->iph_size;
+	iphp->iphp_omoved = 0;
+	iph->iph_table = table;
+	iph->iph_size = size;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_rehash                                           */
+/* Returns:     Nil                                                         */
+/* Parameters:  iph(I) - pointer to hash table                              */
+/*              n(I)   - maximum number of old buckets to move              */
+/*                                                                          */
+/* Move up to n buckets from the array being grown out of into the current  */
+/* one.  Once the old array is empty, and no lookup can still be looking    */
+/* at it, it is freed.                                                      */
+/* ------------------------------------------------------------------------ */
+static void
+ipf_htable_rehash(iph, n)
+	iphtable_t *iph;
+	int n;
+{
+	iphtable_priv_t *iphp = IPH_PRIV(iph);
+	iphtent_t *ipe, **bucket;
+
+	if (iphp->iphp_otable == NULL)
+		return;
+
+	for (; n > 0 && iphp->iphp_omoved < iphp->iphp_osize; n--) {
+		while ((ipe = iphp->iphp_otable[iphp->iphp_omoved]) != NULL) {
+			iphp->iphp_otable[iphp->iphp_omoved] = ipe->ipe_hnext;
+
+			bucket = iph->iph_table +
+				 ipf_htent_hash(ipe) % iph->iph_size;
+			ipe->ipe_hnext = *bucket;
+			ipe->ipe_phnext = bucket;
+			if (*bucket != NULL)
+				(*bucket)->ipe_phnext = &ipe->ipe_hnext;
+			IPH_MEMBAR_PRODUCER();
+			*bucket = ipe;
+		}
+		iphp->iphp_omoved++;
+	}
+
+	if (iphp->iphp_omoved == iphp->iphp_osize) {
+		ipf_htable_quiesce(iphp->iphp_softh);
+		KFREES(iphp->iphp_otable,
+		       iphp->iphp_osize * sizeof(*iphp->iphp_otable));
+		iphp->iphp_otable = NULL;
+		iphp->iphp_osize = 0;
+		iphp->iphp_omoved = 0;
+	}
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_adopt                                            */
+/* Returns:     Nil                                                         */
+/* Parameters:  iph(I) - pointer to hash table                              */
+/*                                                                          */
+/* After the contents of two tables have been exchanged, the back pointers  */
+/* that refer to the table structure itself need to be fixed up.  Pointers  */
+/* into the bucket arrays do not move as the arrays themselves are swapped. */
+/* ------------------------------------------------------------------------ */
+static void
+ipf_htable_adopt(iph)
+	iphtable_t *iph;
+{
+	if (iph->iph_list != NULL)
+		iph->iph_list->ipe_pnext = &iph->iph_list;
+	else
+		iph->iph_tail = &iph->iph_list;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_enter                                            */
+/* Returns:     u_int  - which count of lookups this one was added to       */
+/* Parameters:  arg(I) - pointer to local context to use                    */
+/*                                                                          */
+/* Note that a lookup is in progress.  From here until ipf_htable_exit(),   */
+/* nothing the lookup can reach is freed.                                   */
+/* ------------------------------------------------------------------------ */
+static u_int
+ipf_htable_enter(arg)
+	void *arg;
+{
+	ipf_htable_softc_t *softh = arg;
+	u_int slot;
+
+	slot = softh->ipht_epoch;
+	ATOMIC_INC32(softh->ipht_readers[slot]);
+	IPH_MEMBAR_SYNC();
+	return slot;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_exit                                             */
+/* Returns:     Nil                                                         */
+/* Parameters:  arg(I)  - pointer to local context to use                   */
+/*              slot(I) - value returned by ipf_htable_enter()              */
+/*                                                                          */
+/* ------------------------------------------------------------------------ */
+static void
+ipf_htable_exit(arg, slot)
+	void *arg;
+	u_int slot;
+{
+	ipf_htable_softc_t *softh = arg;
+
+	IPH_MEMBAR_SYNC();
+	ATOMIC_DEC32(softh->ipht_readers[slot]);
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_quiesce                                          */
+/* Returns:     Nil                                                         */
+/* Parameters:  arg(I) - pointer to local context to use                    */
+/* Locks:       WRITE(ipf_poolrw)                                           */
+/*                                                                          */
+/* Wait for the lookups that might have seen something that has just been   */
+/* unlinked to finish, so that it can be freed.  Lookups that start from    */
+/* now on are counted separately, so a steady stream of them can't hold up  */
+/* the wait; and as nothing that they can find has been unlinked, it does   */
+/* not need to wait for them.  Lookups don't block, so this doesn't either  */
+/* for long.                                                                */
+/* ------------------------------------------------------------------------ */
+static void
+ipf_htable_quiesce(arg)
+	void *arg;
+{
+	ipf_htable_softc_t *softh = arg;
+	u_int old;
+
+	IPH_MEMBAR_SYNC();
+	old = softh->ipht_epoch;
+	softh->ipht_epoch = old ^ 1;
+	IPH_MEMBAR_SYNC();
+	while (softh->ipht_readers[old] != 0)
+		IPH_YIELD();
+	IPH_MEMBAR_SYNC();
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_reap                                             */
+/* Returns:     Nil                                                         */
+/* Parameters:  arg(I) - pointer to local context to use                    */
+/* Locks:       WRITE(ipf_poolrw)                                           */
+/*                                                                          */
+/* Free the entries that ipf_htent_deref() has let go of, once no lookup    */
+/* can still be looking at them.  Doing this once after each operation,     */
+/* rather than once per entry, means emptying out a table of a million      */
+/* entries only has to wait for lookups once.                               */
+/* ------------------------------------------------------------------------ */
+static void
+ipf_htable_reap(arg)
+	void *arg;
+{
+	ipf_htable_softc_t *softh = arg;
+	iphtent_t *ipe;
+
+	if (softh->ipht_dead == NULL)
+		return;
+
+	ipf_htable_quiesce(softh);
+	while ((ipe = softh->ipht_dead) != NULL) {
+		softh->ipht_dead = ipe->ipe_next;
+		KFREE(ipe);
+	}
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_rbegin                                           */
+/* Returns:     u_int  - generation of the table to check against           */
+/* Parameters:  iph(I)   - pointer to hash table                            */
+/*              slotp(IO) - value returned by ipf_htable_enter()            */
+/*                                                                          */
+/* Wait until the table isn't being changed and return its generation; the  */
+/* lookup that follows is good if ipf_htable_rvalid() says the generation   */
+/* is still the same.  While waiting, the lookup stops being counted for a  */
+/* moment, as the change might itself be waiting in ipf_htable_quiesce().   */
+/* ------------------------------------------------------------------------ */
+static u_int
+ipf_htable_rbegin(iph, slotp)
+	iphtable_t *iph;
+	u_int *slotp;
+{
+	iphtable_priv_t *iphp = IPH_PRIV(iph);
+	u_int gen;
+
+	for (;;) {
+		gen = iphp->iphp_gen;
+		IPH_MEMBAR_CONSUMER();
+		if ((gen & 1) == 0)
+			return gen;
+		ipf_htable_exit(iphp->iphp_softh, *slotp);
+		*slotp = ipf_htable_enter(iphp->iphp_softh);
+	}
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_rvalid                                           */
+/* Returns:     int    - 1 = nothing has changed, 0 = start again           */
+/* Parameters:  iph(I) - pointer to hash table                              */
+/*              gen(I) - value returned by ipf_htable_rbegin()              */
+/*                                                                          */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_htable_rvalid(iph, gen)
+	iphtable_t *iph;
+	u_int gen;
+{
+	IPH_MEMBAR_CONSUMER();
+	return IPH_PRIV(iph)->iphp_gen == gen;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_wbegin                                           */
+/* Returns:     Nil                                                         */
+/* Parameters:  iph(I) - pointer to hash table                              */
+/* Locks:       WRITE(ipf_poolrw)                                           */
+/*                                                                          */
+/* Mark the start of a change to the buckets, chains or masks of a table.   */
+/* ------------------------------------------------------------------------ */
+static void
+ipf_htable_wbegin(iph)
+	iphtable_t *iph;
+{
+	IPH_PRIV(iph)->iphp_gen++;
+	IPH_MEMBAR_PRODUCER();
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_wend                                             */
+/* Returns:     Nil                                                         */
+/* Parameters:  iph(I) - pointer to hash table                              */
+/* Locks:       WRITE(ipf_poolrw)                                           */
+/*                                                                          */
+/* ------------------------------------------------------------------------ */
+static void
+ipf_htable_wend(iph)
+	iphtable_t *iph;
+{
+	IPH_MEMBAR_PRODUCER();
+	IPH_PRIV(iph)->iphp_gen++;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_htable_table_swap                                       */
+/* Returns:     int      - 0 = success, else error                          */
+/* Parameters:  softc(I) - pointer to soft context main structure           */
+/*              arg(I)   - pointer to local context to use                  */
+/*              op(I)    - pointer to lookup operation data                 */
+/*                                                                          */
+/* Exchange the contents of the table named by iplo_name with those of the  */
+/* table whose name is pointed to by iplo_struct.  This lets a new set of   */
+/* entries be loaded into a scratch table without the lock being held and   */
+/* then made live in one step, with rules that refer to the table by name   */
+/* or by pointer seeing either the old contents or the new, never a mix.    */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_htable_table_swap(softc, arg, op)
+	ipf_main_softc_t *softc;
+	void *arg;
+	iplookupop_t *op;
+{
+	ipf_htable_softc_t *softh = arg;
+	char name[FR_GROUPLEN];
+	iphtable_t *a, *b, t;
+	iphtable_priv_t *pa, *pb, pt;
+	iphtent_t *ipe;
+	int err;
+
+	if (op->iplo_size != sizeof(name)) {
+		IPFERROR(30027);
+		return EINVAL;
+	}
+
+	err = COPYIN(op->iplo_struct, name, sizeof(name));
+	if (err != 0) {
+		IPFERROR(30028);
+		return EFAULT;
+	}
+	name[sizeof(name) - 1] = '\0';
+
+	a = ipf_htable_find(arg, op->iplo_unit, op->iplo_name);
+	b = ipf_htable_find(arg, op->iplo_unit, name);
+	if (a == NULL || b == NULL) {
+		IPFERROR(30029);
+		return ESRCH;
+	}
+	if (a == b ||
+	    (a->iph_type & ~IPHASH_ANON) != (b->iph_type & ~IPHASH_ANON)) {
+		IPFERROR(30030);
+		return EINVAL;
+	}
+
+	ipf_htable_wbegin(a);
+	ipf_htable_wbegin(b);
+
+	t.iph_table = a->iph_table;
+	t.iph_list = a->iph_list;
+	t.iph_tail = a->iph_tail;
+#ifdef USE_INET6
+	t.iph_v6_masks = a->iph_v6_masks;
+#endif
+	t.iph_v4_masks = a->iph_v4_masks;
+	t.iph_size = a->iph_size;
+	bcopy(a->iph_maskset, t.iph_maskset, sizeof(t.iph_maskset));
+
+	a->iph_table = b->iph_table;
+	a->iph_list = b->iph_list;
+	a->iph_tail = b->iph_tail;
+#ifdef USE_INET6
+	a->iph_v6_masks = b->iph_v6_masks;
+#endif
+	a->iph_v4_masks = b->iph_v4_masks;
+	a->iph_size = b->iph_size;
+	bcopy(b->iph_maskset, a->iph_maskset, sizeof(a->iph_maskset));
+
+	b->iph_table = t.iph_table;
+	b->iph_list = t.iph_list;
+	b->iph_tail = t.iph_tail;
+#ifdef USE_INET6
+	b->iph_v6_masks = t.iph_v6_masks;
+#endif
+	b->iph_v4_masks = t.iph_v4_masks;
+	b->iph_size = t.iph_size;
+	bcopy(t.iph_maskset, b->iph_maskset, sizeof(b->iph_maskset));
+
+	pa = IPH_PRIV(a);
+	pb = IPH_PRIV(b);
+	pt = *pa;
+	pa->iphp_otable = pb->iphp_otable;
+	pa->iphp_osize = pb->iphp_osize;
+	pa->iphp_omoved = pb->iphp_omoved;
+	pa->iphp_nodes = pb->iphp_nodes;
+	pb->iphp_otable = pt.iphp_otable;
+	pb->iphp_osize = pt.iphp_osize;
+	pb->iphp_omoved = pt.iphp_omoved;
+	pb->iphp_nodes = pt.iphp_nodes;
+
+	ipf_htable_wend(b);
+	ipf_htable_wend(a);
+
+	ipf_htable_adopt(a);
+	ipf_htable_adopt(b);
+
+	/*
+	 * Only entries with a timeout look at ipe_owner, and they are all on
+	 * the expire list, so there is no need to walk either table.
+	 */
+	for (ipe = softh->ipf_node_explist; ipe != NULL; ipe = ipe->ipe_dnext) {
+		if (ipe->ipe_owner == a)
+			ipe->ipe_owner = b;
+		else if (ipe->ipe_owner == b)
+			ipe->ipe_owner = a;
+	}
+
+	return 0;
+}
+
+
 /* ------------------------------------------------------------------------ */
 /* Function:    ipf_iphmfindgroup                                           */
 /* Returns:     int      - 0 = success, else error                          */
@@ -1108,17 +1661,18 @@ ipf_iphmfindgroup(softc, tptr, aptr)
 	iphtable_t *iph;
 	iphtent_t *ipe;
 	void *rval;
+	u_int slot;
 
-	READ_ENTER(&softc->ipf_poolrw);
 	iph = tptr;
 	addr = aptr;
 
-	ipe = ipf_iphmfind(iph, addr);
+	slot = ipf_htable_enter(IPH_PRIV(iph)->iphp_softh);
+	ipe = ipf_iphmfind(iph, addr, &slot);
 	if (ipe != NULL)
 		rval = ipe->ipe_ptr;
 	else
 		rval = NULL;
-	RWLOCK_EXIT(&softc->ipf_poolrw);
+	ipf_htable_exit(IPH_PRIV(iph)->iphp_softh, slot);
 	return rval;
 }
 
@@ -1144,6 +1698,7 @@ ipf_iphmfindip(softc, tptr, ipversion, aptr, bytes)
 	struct in_addr *addr;
 	iphtable_t *iph;
 	iphtent_t *ipe;
+	u_int slot;
 	int rval;
 
 	if (tptr == NULL || aptr == NULL)
@@ -1152,12 +1707,12 @@ ipf_iphmfindip(softc, tptr, ipversion, aptr, bytes)
 	iph = tptr;
 	addr = aptr;
 
-	READ_ENTER(&softc->ipf_poolrw);
+	slot = ipf_htable_enter(IPH_PRIV(iph)->iphp_softh);
 	if (ipversion == 4) {
-		ipe = ipf_iphmfind(iph, addr);
+		ipe = ipf_iphmfind(iph, addr, &slot);
 #ifdef USE_INET6
 	} else if (ipversion == 6) {
-		ipe = ipf_iphmfind6(iph, (i6addr_t *)addr);
+		ipe = ipf_iphmfind6(iph, (i6addr_t *)addr, &slot);
 #endif
 	} else {
 		ipe = NULL;
@@ -1170,34 +1725,43 @@ ipf_iphmfindip(softc, tptr, ipversion, aptr, bytes)
 	} else {
 		rval = 1;
 	}
-	RWLOCK_EXIT(&softc->ipf_poolrw);
+	ipf_htable_exit(IPH_PRIV(iph)->iphp_softh, slot);
 	return rval;
 }
 
 
 /* ------------------------------------------------------------------------ */
-/* Function:    ipf_iphmfindip                                              */
-/* Parameters:  iph(I)  - pointer to hash table                             */
-/*              addr(I) - pointer to IPv4 address                           */
-/* Locks:  ipf_poolrw                                                       */
+/* Function:    ipf_iphmfind                                                */
+/* Parameters:  iph(I)    - pointer to hash table                           */
+/*              addr(I)   - pointer to IPv4 address                         */
+/*              slotp(IO) - value returned by ipf_htable_enter()            */
 /*                                                                          */
+/* The caller has called ipf_htable_enter(), rather than taking ipf_poolrw, */
+/* so the table can change underneath us.  The bucket is only looked in     */
+/* once it is known to belong to the table's current bucket array, and the  */
+/* result only stands if the table didn't change while we looked.           */
 /* ------------------------------------------------------------------------ */
 static iphtent_t *
-ipf_iphmfind(iph, addr)
+ipf_iphmfind(iph, addr, slotp)
 	iphtable_t *iph;
 	struct in_addr *addr;
+	u_int *slotp;
 {
+	iphtent_t *ipe, **bucket;
 	u_32_t msk, ips;
-	iphtent_t *ipe;
-	u_int hv;
+	u_int gen;
 	int i;
 
+again:
+	gen = ipf_htable_rbegin(iph, slotp);
 	i = 0;
 maskloop:
 	msk = iph->iph_v4_masks.imt4_active[i];
 	ips = addr->s_addr & msk;
-	hv = IPE_V4_HASH_FN(ips, msk, iph->iph_size);
-	for (ipe = iph->iph_table[hv]; (ipe != NULL); ipe = ipe->ipe_hnext) {
+	bucket = ipf_htable_bucket(iph, IPE_V4_HASH(ips, msk));
+	if (!ipf_htable_rvalid(iph, gen))
+		goto again;
+	for (ipe = *bucket; (ipe != NULL); ipe = ipe->ipe_hnext) {
 		if ((ipe->ipe_family != AF_INET) ||
 		    (ipe->ipe_mask.in4_addr != msk) ||
 		    (ipe->ipe_addr.in4_addr != ips)) {
@@ -1211,6 +1775,8 @@ maskloop:
 		if (i < iph->iph_v4_masks.imt4_max)
 			goto maskloop;
 	}
+	if (!ipf_htable_rvalid(iph, gen))
+		goto again;
 	return ipe;
 }
 
@@ -1326,7 +1892,8 @@ ipf_htable_iter_next(softc, arg, token, ilp)
 		}
 		if (node != NULL) {
 			WRITE_ENTER(&softc->ipf_poolrw);
-			ipf_htent_deref(softc, node);
+			ipf_htent_deref(softh, node);
+			ipf_htable_reap(softh);
 			RWLOCK_EXIT(&softc->ipf_poolrw);
 		}
 		break;
@@ -1372,6 +1939,7 @@ ipf_htable_iter_deref(softc, arg, otype, unit, data)
 
 	case IPFLOOKUPITER_NODE :
 		ipf_htent_deref(arg, (iphtent_t *)data);
+		ipf_htable_reap(arg);
 		break;
 	default :
 		break;
@@ -1384,21 +1952,25 @@ ipf_htable_iter_deref(softc, arg, otype, unit, data)
 #ifdef USE_INET6
 /* ------------------------------------------------------------------------ */
 /* Function:    ipf_iphmfind6                                               */
-/* Parameters:  iph(I)  - pointer to hash table                             */
-/*              addr(I) - pointer to IPv6 address                           */
-/* Locks:  ipf_poolrw                                                       */
+/* Parameters:  iph(I)    - pointer to hash table                           */
+/*              addr(I)   - pointer to IPv6 address                         */
+/*              slotp(IO) - value returned by ipf_htable_enter()            */
 /*                                                                          */
+/* See ipf_iphmfind().                                                      */
 /* ------------------------------------------------------------------------ */
 static iphtent_t *
-ipf_iphmfind6(iph, addr)
+ipf_iphmfind6(iph, addr, slotp)
 	iphtable_t *iph;
 	i6addr_t *addr;
+	u_int *slotp;
 {
+	iphtent_t *ipe, **bucket;
 	i6addr_t *msk, ips;
-	iphtent_t *ipe;
-	u_int hv;
+	u_int gen;
 	int i;
 
+again:
+	gen = ipf_htable_rbegin(iph, slotp);
 	i = 0;
 maskloop:
 	msk = iph->iph_v6_masks.imt6_active + i;
@@ -1406,8 +1978,10 @@ maskloop:
 	ips.i6[1] = addr->i6[1] & msk->i6[1];
 	ips.i6[2] = addr->i6[2] & msk->i6[2];
 	ips.i6[3] = addr->i6[3] & msk->i6[3];
-	hv = IPE_V6_HASH_FN(ips.i6, msk->i6, iph->iph_size);
-	for (ipe = iph->iph_table[hv]; (ipe != NULL); ipe = ipe->ipe_next) {
+	bucket = ipf_htable_bucket(iph, IPE_V6_HASH(ips.i6, msk->i6));
+	if (!ipf_htable_rvalid(iph, gen))
+		goto again;
+	for (ipe = *bucket; (ipe != NULL); ipe = ipe->ipe_hnext) {
 		if ((ipe->ipe_family != AF_INET6) ||
 		    IP6_NEQ(&ipe->ipe_mask, msk) ||
 		    IP6_NEQ(&ipe->ipe_addr, &ips)) {
@@ -1421,6 +1995,8 @@ maskloop:
 		if (i < iph->iph_v6_masks.imt6_max)
 			goto maskloop;
 	}
+	if (!ipf_htable_rvalid(iph, gen))
+		goto again;
 	return ipe;
 }
 #endif
@@ -1440,6 +2016,7 @@ ipf_htable_expire(softc, arg)
 
 		ipf_htent_remove(softc, softh, n->ipe_owner, n);
 	}
+	ipf_htable_reap(softh);
 }
 
 
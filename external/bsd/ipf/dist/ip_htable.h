@@ -31,11 +31,13 @@ typedef	struct	iphtent_s	{
 #define	ipe_value	ipe_un.ipeu_int
 #define	ipe_group	ipe_un.ipeu_char
 
-#define	IPE_V4_HASH_FN(a, m, s)	((((m) ^ (a)) - 1 - ((a) >> 8)) % (s))
-#define	IPE_V6_HASH_FN(a, m, s)	(((((m)[0] ^ (a)[0]) - ((a)[0] >> 8)) + \
-				  (((m)[1] & (a)[1]) - ((a)[1] >> 8)) + \
-				  (((m)[2] & (a)[2]) - ((a)[2] >> 8)) + \
-				  (((m)[3] & (a)[3]) - ((a)[3] >> 8))) % (s))
+#define	IPE_V4_HASH(a, m)	(((m) ^ (a)) - 1 - ((a) >> 8))
+#define	IPE_V6_HASH(a, m)	((((m)[0] ^ (a)[0]) - ((a)[0] >> 8)) + \
+				 (((m)[1] & (a)[1]) - ((a)[1] >> 8)) + \
+				 (((m)[2] & (a)[2]) - ((a)[2] >> 8)) + \
+				 (((m)[3] & (a)[3]) - ((a)[3] >> 8)))
+#define	IPE_V4_HASH_FN(a, m, s)	(IPE_V4_HASH(a, m) % (s))
+#define	IPE_V6_HASH_FN(a, m, s)	(IPE_V6_HASH(a, m) % (s))
 
 typedef	struct	iphtable_s	{
 	ipfrwlock_t	iph_rwlock;
@@ -63,6 +65,15 @@ typedef	struct	iphtable_s	{
 #define	IPHASH_DELETE	2
 #define	IPHASH_ANON	0x80000000
 
+/*
+ * A table is grown to twice its size once it holds more than IPHASH_MAXLOAD
+ * entries per bucket.  The entries are moved across IPHASH_MOVE buckets at
+ * a time with each later add or delete, rather than all at once.
+ */
+#define	IPHASH_MAXLOAD	2
+#define	IPHASH_MOVE	16
+#define	IPHASH_MAXSIZE	(1 << 22)
+
 
 typedef	struct	iphtstat_s	{
 	iphtable_t	*iphs_tables;
@@ -77,6 +77,7 @@ static int ipf_lookup_addnode __P((ipf_main_softc_t *, caddr_t, int));
 static int ipf_lookup_delnode __P((ipf_main_softc_t *, caddr_t, int));
 static int ipf_lookup_addtable __P((ipf_main_softc_t *, caddr_t));
 static int ipf_lookup_deltable __P((ipf_main_softc_t *, caddr_t));
+static int ipf_lookup_swaptable __P((ipf_main_softc_t *, caddr_t));
 static int ipf_lookup_stats __P((ipf_main_softc_t *, caddr_t));
 static int ipf_lookup_flush __P((ipf_main_softc_t *, caddr_t));
 static int ipf_lookup_iterate __P((ipf_main_softc_t *, void *, int, void *));
@@ -290,6 +291,12 @@ ipf_lookup_ioctl(softc, data, cmd, mode, uid, ctx)
 		RWLOCK_EXIT(&softc->ipf_poolrw);
 		break;
 
+	case SIOCLOOKUPSWAPTABLE :
+		WRITE_ENTER(&softc->ipf_poolrw);
+		err = ipf_lookup_swaptable(softc, data);
+		RWLOCK_EXIT(&softc->ipf_poolrw);
+		break;
+
 	case SIOCLOOKUPSTAT :
 	case SIOCLOOKUPSTATW :
 		WRITE_ENTER(&softc->ipf_poolrw);
@@ -539,6 +546,57 @@ ipf_lookup_deltable(softc, data)
 }
 
 
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_lookup_swaptable                                        */
+/* Returns:     int     - 0 = success, else error                           */
+/* Parameters:  softc(I) - pointer to soft context main structure           */
+/*              data(I) - pointer to data from ioctl call                   */
+/*                                                                          */
+/* Exchange the contents of two tables of the same type, so that a table    */
+/* can be filled in the background and then put in place in one step.  Not  */
+/* all lookup types support this.                                           */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_lookup_swaptable(softc, data)
+	ipf_main_softc_t *softc;
+	caddr_t data;
+{
+	ipf_lookup_softc_t *softl = softc->ipf_lookup_soft;
+	iplookupop_t op;
+	ipf_lookup_t **l;
+	int err, i;
+
+	err = BCOPYIN(data, &op, sizeof(op));
+	if (err != 0) {
+		IPFERROR(50043);
+		return EFAULT;
+	}
+
+	if (op.iplo_unit < 0 || op.iplo_unit > IPL_LOGMAX) {
+		IPFERROR(50044);
+		return EINVAL;
+	}
+
+	op.iplo_name[sizeof(op.iplo_name) - 1] = '\0';
+
+	for (i = 0, l = backends; i < MAX_BACKENDS; i++, l++) {
+		if (op.iplo_type == (*l)->ipfl_type &&
+		    (*l)->ipfl_table_swap != NULL) {
+			err = (*(*l)->ipfl_table_swap)(softc,
+						       softl->ipf_back[i],
+						       &op);
+			break;
+		}
+	}
+
+	if (i == MAX_BACKENDS) {
+		IPFERROR(50045);
+		err = EINVAL;
+	}
+	return err;
+}
+
+
 /* ------------------------------------------------------------------------ */
 /* Function:    ipf_lookup_stats                                            */
 /* Returns:     int     - 0 = success, else error                           */
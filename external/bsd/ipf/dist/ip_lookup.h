@@ -20,6 +20,7 @@
 # define	SIOCLOOKUPADDNODEW	_IOW('r', 67, struct iplookupop)
 # define	SIOCLOOKUPDELNODE	_IOWR('r', 68, struct iplookupop)
 # define	SIOCLOOKUPDELNODEW	_IOW('r', 68, struct iplookupop)
+# define	SIOCLOOKUPSWAPTABLE	_IOWR('r', 69, struct iplookupop)
 #else
 # define	SIOCLOOKUPADDTABLE	_IOWR(r, 60, struct iplookupop)
 # define	SIOCLOOKUPDELTABLE	_IOWR(r, 61, struct iplookupop)
@@ -30,6 +31,7 @@
 # define	SIOCLOOKUPADDNODEW	_IOW(r, 67, struct iplookupop)
 # define	SIOCLOOKUPDELNODE	_IOWR(r, 68, struct iplookupop)
 # define	SIOCLOOKUPDELNODEW	_IOW(r, 68, struct iplookupop)
+# define	SIOCLOOKUPSWAPTABLE	_IOWR(r, 69, struct iplookupop)
 #endif
 
 #define	LOOKUP_POOL_MAX	(IPL_LOGSIZE)
@@ -130,6 +132,8 @@ typedef struct ipf_lookup {
 					 frdest_t *));
 	void	(*ipfl_expire) __P((ipf_main_softc_t *, void *));
 	void	(*ipfl_sync) __P((ipf_main_softc_t *, void *));
+	int	(*ipfl_table_swap) __P((ipf_main_softc_t *, void *,
+					iplookupop_t *));
 } ipf_lookup_t;
 
 extern int ipf_lookup_init __P((void));
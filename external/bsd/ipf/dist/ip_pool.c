@@ -133,6 +133,7 @@ ipf_lookup_t ipf_pool_backend = {
 	ipf_pool_select_add_ref,
 	NULL,
 	ipf_pool_expire,
+	NULL,
 	NULL
 };
 
@@ -103,6 +103,18 @@ static const char rcsid[] = "@(#)Id: ip_sync.c,v 1.1.1.2 2012/07/22 13:44:24 dar
 
 #define	SYNC_STATETABSZ	256
 #define	SYNC_NATTABSZ	256
+#define	SYNC_WAKE_MAX	2	/* most ticks to let updates coalesce for */
+
+/*
+ * The sync numbers of the entries in one table that are still to be sent
+ * again as SMC_CREATE messages after a SIOCSYNCRESYNC.
+ */
+typedef struct ipf_sync_resync_s {
+	u_int		*sr_nums;
+	u_int		sr_size;	/* number of slots in sr_nums */
+	u_int		sr_count;	/* number of slots in use */
+	u_int		sr_next;	/* next slot to resend */
+} ipf_sync_resync_t;
 
 typedef struct ipf_sync_softc_s {
 	ipfmutex_t	ipf_syncadd;
@@ -135,6 +147,9 @@ typedef struct ipf_sync_softc_s {
 	int		ipf_sync_event_high_wm;
 	int		ipf_sync_queue_high_wm;
 	int		ipf_sync_inited;
+	int		ipf_sync_batch;		/* read updates as SMC_BATCH */
+	int		ipf_sync_tickevents;	/* events since last tick */
+	ipf_sync_resync_t	ipf_sync_resync[SMC_MAXTBL + 1];
 } ipf_sync_softc_t;
 
 static int ipf_sync_flush_table __P((ipf_sync_softc_t *, int, synclist_t **));
@@ -143,6 +158,15 @@ static void ipf_sync_del __P((ipf_sync_softc_t *, synclist_t *));
 static void ipf_sync_poll_wakeup __P((ipf_main_softc_t *));
 static int ipf_sync_nat __P((ipf_main_softc_t *, synchdr_t *, void *));
 static int ipf_sync_state __P((ipf_main_softc_t *, synchdr_t *, void *));
+static int ipf_sync_unbatch __P((ipf_main_softc_t *, synchdr_t *, void *));
+static int ipf_sync_batch __P((ipf_sync_softc_t *, u_char *, int));
+static u_char *ipf_sync_encode __P((u_char *, syncupdent_t *, u_int));
+static u_char *ipf_sync_putnum __P((u_char *, u_32_t));
+static u_char *ipf_sync_getnum __P((u_char *, u_char *, u_32_t *));
+static int ipf_sync_log __P((ipf_sync_softc_t *, synclist_t *, void *));
+static int ipf_sync_resync_start __P((ipf_sync_softc_t *, int, int *));
+static int ipf_sync_resync_fill __P((ipf_main_softc_t *));
+static int ipf_sync_resend __P((ipf_main_softc_t *, int, u_int));
 
 # if !defined(sparc) && !defined(__hppa)
 void ipf_sync_tcporder __P((int, struct tcpdata *));
@@ -168,8 +192,8 @@ ipf_sync_soft_create(softc)
 	softs->ipf_sync_log_sz = SYNCLOG_SZ;
 	softs->ipf_sync_nat_tab_sz = SYNC_STATETABSZ;
 	softs->ipf_sync_state_tab_sz = SYNC_STATETABSZ;
-	softs->ipf_sync_event_high_wm = SYNCLOG_SZ * 100 / 90;	/* 90% */
-	softs->ipf_sync_queue_high_wm = SYNCLOG_SZ * 100 / 90;	/* 90% */
+	softs->ipf_sync_event_high_wm = SYNCLOG_SZ * 90 / 100;	/* 90% */
+	softs->ipf_sync_queue_high_wm = SYNCLOG_SZ * 90 / 100;	/* 90% */
 
 	return softs;
 }
@@ -256,6 +280,16 @@ ipf_sync_soft_fini(softc, arg)
 	void *arg;
 {
 	ipf_sync_softc_t *softs = arg;
+	ipf_sync_resync_t *sr;
+	int i;
+
+	for (i = 0; i <= SMC_MAXTBL; i++) {
+		sr = &softs->ipf_sync_resync[i];
+		if (sr->sr_nums != NULL) {
+			KFREES(sr->sr_nums, sr->sr_size * sizeof(*sr->sr_nums));
+			sr->sr_nums = NULL;
+		}
+	}
 
 	if (softs->syncnattab != NULL) {
 		ipf_sync_flush_table(softs, softs->ipf_sync_nat_tab_sz,
@@ -534,6 +568,14 @@ ipf_sync_write(softc, uio)
 			return EINVAL;
 		}
 
+		if (sh.sm_len < 0 || sh.sm_len > sizeof(data)) {
+			if (softs->ipf_sync_debug > 2)
+				printf("uiomove(data) length %d too large\n",
+					sh.sm_len);
+			IPFERROR(110025);
+			return EINVAL;
+		}
+
 		if (uio->uio_resid >= sh.sm_len) {
 
 			err = UIOMOVE(data, sh.sm_len, UIO_WRITE, uio);
@@ -549,7 +591,9 @@ ipf_sync_write(softc, uio)
 				printf("uiomove(data) %d bytes read\n",
 					sh.sm_len);
 
-			if (sh.sm_table == SMC_STATE)
+			if (sh.sm_cmd == SMC_BATCH)
+				err = ipf_sync_unbatch(softc, &sh, data);
+			else if (sh.sm_table == SMC_STATE)
 				err = ipf_sync_state(softc, &sh, data);
 			else if (sh.sm_table == SMC_NAT)
 				err = ipf_sync_nat(softc, &sh, data);
@@ -588,9 +632,11 @@ ipf_sync_read(softc, uio)
 	struct uio *uio;
 {
 	ipf_sync_softc_t *softs = softc->ipf_sync_soft;
+	u_char batch[sizeof(synchdr_t) + SYNC_BATCHSZ];
 	syncupdent_t *su;
 	synclogent_t *sl;
-	int err = 0;
+	int err = 0, len;
+	int resync;
 
 	if ((uio->uio_resid & 3) || (uio->uio_resid < 8)) {
 		IPFERROR(110008);
@@ -602,8 +648,24 @@ ipf_sync_read(softc, uio)
 #  endif
 
 	MUTEX_ENTER(&softs->ipsl_mutex);
-	while ((softs->sl_tail == softs->sl_idx) &&
-	       (softs->su_tail == softs->su_idx)) {
+	for (;;) {
+		/*
+		 * Top the ring up from any resync each time around, so that
+		 * one started while we slept is seen.  If a resync was all
+		 * that made the device readable and none of its entries are
+		 * left, return nothing rather than block a reader that was
+		 * told by poll/select that it would not.
+		 */
+		MUTEX_EXIT(&softs->ipsl_mutex);
+		resync = ipf_sync_resync_fill(softc);
+		MUTEX_ENTER(&softs->ipsl_mutex);
+		if ((softs->sl_tail != softs->sl_idx) ||
+		    (softs->su_tail != softs->su_idx))
+			break;
+		if (resync != 0) {
+			MUTEX_EXIT(&softs->ipsl_mutex);
+			return 0;
+		}
 #  if defined(_KERNEL)
 #   if SOLARIS
 		if (!cv_wait_sig(&softs->ipslwait, &softs->ipsl_mutex.ipf_lk)) {
@@ -657,6 +719,22 @@ ipf_sync_read(softc, uio)
 		MUTEX_ENTER(&softs->ipsl_mutex);
 	}
 
+	/*
+	 * When batching, pack as many updates as will fit into each SMC_BATCH
+	 * message.  The records are built while holding ipsl_mutex as that is
+	 * what stops the entries being reused under us.
+	 */
+	while ((softs->ipf_sync_batch != 0) &&
+	       (softs->su_tail < softs->su_idx) &&
+	       (uio->uio_resid >= sizeof(synchdr_t) + SYNC_RECMAX + 8)) {
+		len = ipf_sync_batch(softs, batch, uio->uio_resid);
+		MUTEX_EXIT(&softs->ipsl_mutex);
+		err = UIOMOVE(batch, len, UIO_READ, uio);
+		if (err != 0)
+			goto goterror;
+		MUTEX_ENTER(&softs->ipsl_mutex);
+	}
+
 	while ((softs->su_tail < softs->su_idx) &&
 	       (uio->uio_resid > sizeof(*su))) {
 		su = softs->syncupd + softs->su_tail;
@@ -679,6 +757,131 @@ goterror:
 }
 
 
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_batch                                              */
+/* Returns:     int     - number of bytes of buf used                       */
+/* Parameters:  softs(I) - pointer to sync context                          */
+/*              buf(O)   - where to build the SMC_BATCH message             */
+/*              space(I) - most bytes that the caller can take              */
+/*                                                                          */
+/* Move as many pending updates as fit into an SMC_BATCH message and mark   */
+/* them as read.  Must be called with ipsl_mutex held and at least one      */
+/* update waiting.                                                          */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_sync_batch(softs, buf, space)
+	ipf_sync_softc_t *softs;
+	u_char *buf;
+	int space;
+{
+	synchdr_t *sh;
+	syncupdent_t *su;
+	u_char *s, *end;
+	u_int last, n;
+
+	if (space > (int)(sizeof(*sh) + SYNC_BATCHSZ))
+		space = sizeof(*sh) + SYNC_BATCHSZ;
+	end = buf + (space & ~7);
+
+	sh = (synchdr_t *)buf;
+	s = (u_char *)(sh + 1);
+	for (n = 0, last = 0; (softs->su_tail < softs->su_idx) &&
+	     (s + SYNC_RECMAX <= end); n++) {
+		su = softs->syncupd + softs->su_tail++;
+		s = ipf_sync_encode(s, su, last);
+		last = ntohl(su->sup_hdr.sm_num);
+		if (su->sup_hdr.sm_sl != NULL)
+			su->sup_hdr.sm_sl->sl_idx = -1;
+	}
+	while ((s - buf) & 7)
+		*s++ = 0;
+
+	bzero((char *)sh, sizeof(*sh));
+	sh->sm_magic = htonl(SYNHDRMAGIC);
+	sh->sm_v = 4;
+	sh->sm_cmd = SMC_BATCH;
+	sh->sm_table = SMC_STATE;
+	sh->sm_num = htonl(n);
+	sh->sm_len = htonl(s - (u_char *)(sh + 1));
+
+	return s - buf;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_encode                                             */
+/* Returns:     u_char * - pointer to the byte after the record             */
+/* Parameters:  s(O)    - where to write the record                         */
+/*              su(I)   - pointer to update to encode                       */
+/*              last(I) - sync number of the previous record, or 0          */
+/*                                                                          */
+/* Write one update record in the form described in ip_sync.h.  At most     */
+/* SYNC_RECMAX bytes are used.                                              */
+/* ------------------------------------------------------------------------ */
+static u_char *
+ipf_sync_encode(s, su, last)
+	u_char *s;
+	syncupdent_t *su;
+	u_int last;
+{
+	synctcp_update_t *st = &su->sup_tcp;
+	u_32_t end;
+	int flags, i;
+
+	flags = 0;
+	if (su->sup_hdr.sm_table == SMC_NAT)
+		flags |= SYNC_BF_NAT;
+	if (su->sup_hdr.sm_rev != 0)
+		flags |= SYNC_BF_REV;
+	if (su->sup_hdr.sm_p == IPPROTO_TCP)
+		flags |= SYNC_BF_TCP;
+
+	*s++ = flags;
+	s = ipf_sync_putnum(s, SYNC_ZZENC(ntohl(su->sup_hdr.sm_num) - last));
+	if ((flags & SYNC_BF_TCP) == 0)
+		return s;
+
+	s = ipf_sync_putnum(s, ntohl(st->stu_age));
+	if ((flags & SYNC_BF_NAT) != 0)
+		return s;
+
+	for (i = 0; i < 2; i++) {
+		end = st->stu_data[i].td_end;
+		s = ipf_sync_putnum(s, st->stu_state[i]);
+		s = ipf_sync_putnum(s, st->stu_data[i].td_maxwin);
+		s = ipf_sync_putnum(s, st->stu_data[i].td_maxend - end);
+		*s++ = (end >> 24) & 0xff;
+		*s++ = (end >> 16) & 0xff;
+		*s++ = (end >> 8) & 0xff;
+		*s++ = end & 0xff;
+	}
+	return s;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_putnum                                             */
+/* Returns:     u_char * - pointer to the byte after the number             */
+/* Parameters:  s(O) - where to write the number                            */
+/*              v(I) - number to write                                      */
+/*                                                                          */
+/* Write v 7 bits at a time, least significant first, using at most 5      */
+/* bytes.                                                                   */
+/* ------------------------------------------------------------------------ */
+static u_char *
+ipf_sync_putnum(s, v)
+	u_char *s;
+	u_32_t v;
+{
+	while (v >= 0x80) {
+		*s++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*s++ = v;
+	return s;
+}
+
+
 /* ------------------------------------------------------------------------ */
 /* Function:    ipf_sync_state                                              */
 /* Returns:     int    - 0 == success, else error value.                    */
@@ -711,6 +914,23 @@ ipf_sync_state(softc, sp, data)
 	{
 	case SMC_CREATE :
 
+		/*
+		 * A resync sends entries that may already be here, so
+		 * leave those alone rather than creating a second copy.
+		 */
+		READ_ENTER(&softs->ipf_syncstate);
+		for (sl = softs->syncstatetab[hv]; (sl != NULL);
+		     sl = sl->sl_next)
+			if (sl->sl_hdr.sm_num == sp->sm_num)
+				break;
+		RWLOCK_EXIT(&softs->ipf_syncstate);
+		if (sl != NULL) {
+			if (softs->ipf_sync_debug > 4)
+				printf("[%d] State already present\n",
+					sp->sm_num);
+			return 0;
+		}
+
 		bcopy(data, &sn, sizeof(sn));
 		KMALLOC(is, ipstate_t *);
 		if (is == NULL) {
@@ -854,6 +1074,122 @@ ipf_sync_state(softc, sp, data)
 }
 
 
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_unbatch                                            */
+/* Returns:     int     - 0 == success, else error value.                   */
+/* Parameters:  sp(I)   - pointer to SMC_BATCH header                       */
+/*              data(I) - pointer to packed update records                  */
+/*                                                                          */
+/* Unpack each record in an SMC_BATCH message and apply it as if it had     */
+/* arrived on its own as an SMC_UPDATE.  As with single updates, failing to */
+/* find the entry being updated is not treated as an error.                 */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_sync_unbatch(softc, sp, data)
+	ipf_main_softc_t *softc;
+	synchdr_t *sp;
+	void *data;
+{
+	synctcp_update_t su;
+	u_char *s, *end;
+	u_32_t num, v;
+	synchdr_t sh;
+	int flags, i;
+	u_int n;
+
+	s = data;
+	end = s + sp->sm_len;
+	num = 0;
+
+	for (n = 0; n < sp->sm_num; n++) {
+		if (s >= end)
+			goto badbatch;
+		flags = *s++;
+		s = ipf_sync_getnum(s, end, &v);
+		if (s == NULL)
+			goto badbatch;
+		num += SYNC_ZZDEC(v);
+
+		bzero((char *)&su, sizeof(su));
+		if ((flags & SYNC_BF_TCP) != 0) {
+			s = ipf_sync_getnum(s, end, &v);
+			if (s == NULL)
+				goto badbatch;
+			su.stu_age = htonl(v);
+		}
+		if ((flags & (SYNC_BF_TCP|SYNC_BF_NAT)) == SYNC_BF_TCP) {
+			for (i = 0; i < 2; i++) {
+				s = ipf_sync_getnum(s, end, &v);
+				if (s == NULL)
+					goto badbatch;
+				su.stu_state[i] = v;
+				s = ipf_sync_getnum(s, end, &v);
+				if (s == NULL)
+					goto badbatch;
+				su.stu_data[i].td_maxwin = v;
+				s = ipf_sync_getnum(s, end, &v);
+				if (s == NULL || s + 4 > end)
+					goto badbatch;
+				su.stu_data[i].td_end = ((u_32_t)s[0] << 24) |
+							((u_32_t)s[1] << 16) |
+							((u_32_t)s[2] << 8) | s[3];
+				su.stu_data[i].td_maxend =
+				    su.stu_data[i].td_end + v;
+				s += 4;
+			}
+		}
+
+		bcopy((char *)sp, (char *)&sh, sizeof(sh));
+		sh.sm_cmd = SMC_UPDATE;
+		sh.sm_num = num;
+		sh.sm_len = sizeof(su);
+		sh.sm_rev = (flags & SYNC_BF_REV) ? 1 : 0;
+		sh.sm_p = (flags & SYNC_BF_TCP) ? IPPROTO_TCP : 0;
+		if ((flags & SYNC_BF_NAT) != 0) {
+			sh.sm_table = SMC_NAT;
+			(void) ipf_sync_nat(softc, &sh, &su);
+		} else {
+			sh.sm_table = SMC_STATE;
+			(void) ipf_sync_state(softc, &sh, &su);
+		}
+	}
+	return 0;
+
+badbatch:
+	IPFERROR(110026);
+	return EINVAL;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_getnum                                             */
+/* Returns:     u_char * - pointer to the byte after the number, NULL if    */
+/*                         it runs past the end of the data                 */
+/* Parameters:  s(I)   - pointer to number to read                          */
+/*              end(I) - pointer to end of data                             */
+/*              vp(O)  - where to store the number                          */
+/*                                                                          */
+/* Read a number written by ipf_sync_putnum().                              */
+/* ------------------------------------------------------------------------ */
+static u_char *
+ipf_sync_getnum(s, end, vp)
+	u_char *s, *end;
+	u_32_t *vp;
+{
+	u_32_t v;
+	int shift;
+
+	for (v = 0, shift = 0; s < end && shift < 35; shift += 7) {
+		v |= (u_32_t)(*s & 0x7f) << shift;
+		if ((*s++ & 0x80) == 0) {
+			*vp = v;
+			return s;
+		}
+	}
+	return NULL;
+}
+
+
 /* ------------------------------------------------------------------------ */
 /* Function:    ipf_sync_del                                                */
 /* Returns:     Nil                                                         */
@@ -938,14 +1274,23 @@ ipf_sync_nat(softc, sp, data)
 	syncupdent_t su;
 	nat_t *n, *nat;
 	synclist_t *sl;
-	u_int hv = 0;
+	u_int hv;
 	int err;
 
+	hv = sp->sm_num & (softs->ipf_sync_nat_tab_sz - 1);
+
 	READ_ENTER(&softs->ipf_syncnat);
 
 	switch (sp->sm_cmd)
 	{
 	case SMC_CREATE :
+		for (sl = softs->syncnattab[hv]; (sl != NULL);
+		     sl = sl->sl_next)
+			if (sl->sl_hdr.sm_num == sp->sm_num)
+				break;
+		if (sl != NULL)
+			break;
+
 		KMALLOC(n, nat_t *);
 		if (n == NULL) {
 			IPFERROR(110017);
@@ -967,11 +1312,11 @@ ipf_sync_nat(softc, sp, data)
 		      sizeof(*n) - offsetof(nat_t, nat_age));
 		ipf_sync_natorder(0, n);
 		n->nat_sync = sl;
-		n->nat_rev = sl->sl_rev;
+		n->nat_rev = sp->sm_rev;
 
+		bcopy(sp, &sl->sl_hdr, sizeof(struct synchdr));
 		sl->sl_idx = -1;
 		sl->sl_ipn = n;
-		sl->sl_num = ntohl(sp->sm_num);
 
 		WRITE_ENTER(&softc->ipf_nat);
 		sl->sl_pnext = softs->syncnattab + hv;
@@ -1040,7 +1385,6 @@ ipf_sync_new(softc, tab, fin, ptr)
 {
 	ipf_sync_softc_t *softs = softc->ipf_sync_soft;
 	synclist_t *sl, *ss;
-	synclogent_t *sle;
 	u_int hv, sz;
 
 	if (softs->sl_idx == softs->ipf_sync_log_sz)
@@ -1135,24 +1479,52 @@ ipf_sync_new(softc, tab, fin, ptr)
 	 * Create the log entry to be read by a user daemon.  When it has been
 	 * finished and put on the queue, send a signal to wakeup any waiters.
 	 */
+	(void) ipf_sync_log(softs, sl, ptr);
+
+	ipf_sync_wakeup(softc);
+	return sl;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_log                                                */
+/* Returns:     int    - 0 == success, -1 == log is full                    */
+/* Parameters:  softs(I) - pointer to sync context                          */
+/*              sl(I)    - pointer to synchronisation object                */
+/*              ptr(I)   - pointer to owning object, NULL for none          */
+/*                                                                          */
+/* Put an SMC_CREATE message for the object on the queue to be read by the  */
+/* user daemon.                                                             */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_sync_log(softs, sl, ptr)
+	ipf_sync_softc_t *softs;
+	synclist_t *sl;
+	void *ptr;
+{
+	synclogent_t *sle;
+
 	MUTEX_ENTER(&softs->ipf_syncadd);
+	if (softs->sl_idx == softs->ipf_sync_log_sz) {
+		MUTEX_EXIT(&softs->ipf_syncadd);
+		return -1;
+	}
 	sle = softs->synclog + softs->sl_idx++;
 	bcopy((char *)&sl->sl_hdr, (char *)&sle->sle_hdr,
 	      sizeof(sle->sle_hdr));
 	sle->sle_hdr.sm_num = htonl(sle->sle_hdr.sm_num);
 	sle->sle_hdr.sm_len = htonl(sle->sle_hdr.sm_len);
 	if (ptr != NULL) {
-		bcopy((char *)ptr, (char *)&sle->sle_un, sz);
-		if (tab == SMC_STATE) {
+		bcopy((char *)ptr, (char *)&sle->sle_un, sl->sl_len);
+		if (sl->sl_table == SMC_STATE) {
 			ipf_sync_storder(1, &sle->sle_un.sleu_ips);
-		} else if (tab == SMC_NAT) {
+		} else if (sl->sl_table == SMC_NAT) {
 			ipf_sync_natorder(1, &sle->sle_un.sleu_ipn);
 		}
 	}
 	MUTEX_EXIT(&softs->ipf_syncadd);
 
-	ipf_sync_wakeup(softc);
-	return sl;
+	return 0;
 }
 
 
@@ -1192,6 +1564,12 @@ ipf_sync_update(softc, tab, fin, sl)
 	READ_ENTER(lock);
 	if (sl->sl_idx == -1) {
 		MUTEX_ENTER(&softs->ipf_syncadd);
+		if (softs->su_idx == softs->ipf_sync_log_sz) {
+			MUTEX_EXIT(&softs->ipf_syncadd);
+			RWLOCK_EXIT(lock);
+			ipf_sync_wakeup(softc);
+			return;
+		}
 		slu = softs->syncupd + softs->su_idx;
 		sl->sl_idx = softs->su_idx++;
 		MUTEX_EXIT(&softs->ipf_syncadd);
@@ -1289,6 +1667,202 @@ ipf_sync_flush_table(softs, tabsize, table)
 }
 
 
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_resync_start                                       */
+/* Returns:     int - 0 == success, else error value.                       */
+/* Parameters:  softs(I)  - pointer to sync context                         */
+/*              tab(I)    - sync table to send again (SMC_NAT/SMC_STATE)    */
+/*              countp(O) - where to store the number of entries queued     */
+/*                                                                          */
+/* Take a copy of the sync numbers of every entry in the table so that they */
+/* can be sent again as SMC_CREATE messages, to bring a peer that has just  */
+/* started up level with this one.  The ring of messages waiting to be read */
+/* is only SYNCLOG_SZ long, so rather than the entries themselves, only     */
+/* their numbers are kept here and each is looked up again when there is    */
+/* room on the ring; anything that has gone away by then is skipped.        */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_sync_resync_start(softs, tab, countp)
+	ipf_sync_softc_t *softs;
+	int tab, *countp;
+{
+	ipf_sync_resync_t *sr;
+	synclist_t **table, *sl;
+	ipfrwlock_t *lock;
+	u_int count, n, *nums;
+	int i, tabsz;
+
+	switch (tab)
+	{
+	case SMC_STATE :
+		table = softs->syncstatetab;
+		tabsz = softs->ipf_sync_state_tab_sz;
+		lock = &softs->ipf_syncstate;
+		break;
+	case SMC_NAT :
+		table = softs->syncnattab;
+		tabsz = softs->ipf_sync_nat_tab_sz;
+		lock = &softs->ipf_syncnat;
+		break;
+	default :
+		IPFERROR(110029);
+		return EINVAL;
+	}
+
+	sr = &softs->ipf_sync_resync[tab];
+	if (sr->sr_nums != NULL) {
+		IPFERROR(110030);
+		return EBUSY;
+	}
+
+	count = 0;
+	READ_ENTER(lock);
+	for (i = 0; i < tabsz; i++)
+		for (sl = table[i]; sl != NULL; sl = sl->sl_next)
+			count++;
+	RWLOCK_EXIT(lock);
+
+	*countp = 0;
+	if (count == 0)
+		return 0;
+
+	KMALLOCS(nums, u_int *, count * sizeof(*nums));
+	if (nums == NULL) {
+		IPFERROR(110031);
+		return ENOMEM;
+	}
+
+	n = 0;
+	READ_ENTER(lock);
+	for (i = 0; i < tabsz; i++)
+		for (sl = table[i]; sl != NULL && n < count; sl = sl->sl_next)
+			nums[n++] = sl->sl_num;
+	RWLOCK_EXIT(lock);
+
+	MUTEX_ENTER(&softs->ipf_syncadd);
+	if (sr->sr_nums != NULL) {
+		MUTEX_EXIT(&softs->ipf_syncadd);
+		KFREES(nums, count * sizeof(*nums));
+		IPFERROR(110030);
+		return EBUSY;
+	}
+	sr->sr_nums = nums;
+	sr->sr_size = count;
+	sr->sr_count = n;
+	sr->sr_next = 0;
+	MUTEX_EXIT(&softs->ipf_syncadd);
+
+	*countp = n;
+	return 0;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_resync_fill                                        */
+/* Returns:     int - 1 == a resync was in progress, 0 == none was          */
+/* Parameters:  softc(I) - pointer to soft context main structure           */
+/*                                                                          */
+/* Move entries still waiting to be resent onto the ring of messages to be  */
+/* read, for as long as there is room on it.  Once all of a table has been  */
+/* sent, the list of numbers is freed.                                      */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_sync_resync_fill(softc)
+	ipf_main_softc_t *softc;
+{
+	ipf_sync_softc_t *softs = softc->ipf_sync_soft;
+	ipf_sync_resync_t *sr;
+	u_int num, *nums;
+	size_t sz;
+	int tab, busy;
+
+	busy = 0;
+	for (tab = 0; tab <= SMC_MAXTBL; tab++) {
+		sr = &softs->ipf_sync_resync[tab];
+		for (;;) {
+			MUTEX_ENTER(&softs->ipf_syncadd);
+			if (sr->sr_nums != NULL)
+				busy = 1;
+			if (sr->sr_nums == NULL ||
+			    softs->sl_idx == softs->ipf_sync_log_sz) {
+				MUTEX_EXIT(&softs->ipf_syncadd);
+				break;
+			}
+			if (sr->sr_next == sr->sr_count) {
+				nums = sr->sr_nums;
+				sz = sr->sr_size * sizeof(*nums);
+				sr->sr_nums = NULL;
+				MUTEX_EXIT(&softs->ipf_syncadd);
+				KFREES(nums, sz);
+				break;
+			}
+			num = sr->sr_nums[sr->sr_next++];
+			MUTEX_EXIT(&softs->ipf_syncadd);
+
+			if (ipf_sync_resend(softc, tab, num) == -1) {
+				/*
+				 * The ring filled up after the check above,
+				 * so try this one again next time.
+				 */
+				MUTEX_ENTER(&softs->ipf_syncadd);
+				if (sr->sr_nums != NULL && sr->sr_next > 0)
+					sr->sr_next--;
+				MUTEX_EXIT(&softs->ipf_syncadd);
+				return 1;
+			}
+		}
+	}
+	return busy;
+}
+
+
+/* ------------------------------------------------------------------------ */
+/* Function:    ipf_sync_resend                                             */
+/* Returns:     int - 0 == queued or no longer present, -1 == log is full   */
+/* Parameters:  softc(I) - pointer to soft context main structure           */
+/*              tab(I)   - sync table the entry is in                       */
+/*              num(I)   - sync number of the entry                         */
+/*                                                                          */
+/* Find the entry with the given sync number and, if it is still there,     */
+/* queue an SMC_CREATE message for it.                                      */
+/* ------------------------------------------------------------------------ */
+static int
+ipf_sync_resend(softc, tab, num)
+	ipf_main_softc_t *softc;
+	int tab;
+	u_int num;
+{
+	ipf_sync_softc_t *softs = softc->ipf_sync_soft;
+	ipfrwlock_t *lock, *tablock;
+	synclist_t *sl;
+	int err;
+
+	if (tab == SMC_STATE) {
+		tablock = &softc->ipf_state;
+		lock = &softs->ipf_syncstate;
+		sl = softs->syncstatetab[num &
+					 (softs->ipf_sync_state_tab_sz - 1)];
+	} else {
+		tablock = &softc->ipf_nat;
+		lock = &softs->ipf_syncnat;
+		sl = softs->syncnattab[num & (softs->ipf_sync_nat_tab_sz - 1)];
+	}
+
+	err = 0;
+	READ_ENTER(tablock);
+	READ_ENTER(lock);
+	for (; sl != NULL; sl = sl->sl_next)
+		if (sl->sl_num == num)
+			break;
+	if (sl != NULL && sl->sl_ptr != NULL)
+		err = ipf_sync_log(softs, sl, sl->sl_ptr);
+	RWLOCK_EXIT(lock);
+	RWLOCK_EXIT(tablock);
+
+	return err;
+}
+
+
 /* ------------------------------------------------------------------------ */
 /* Function:    ipf_sync_ioctl                                              */
 /* Returns:     int - 0 == success, != 0 == failure                         */
@@ -1296,8 +1870,9 @@ ipf_sync_flush_table(softs, tabsize, table)
 /*              cmd(I)  - ioctl command integer                             */
 /*              mode(I) - file mode bits used with open                     */
 /*                                                                          */
-/* This function currently does not handle any ioctls and so just returns   */
-/* EINVAL on all occasions.                                                 */
+/* SIOCIPFFL empties the queue of messages to be read or the sync tables,   */
+/* SIOCSYNCBATCH turns packing updates into SMC_BATCH messages on or off    */
+/* and SIOCSYNCRESYNC queues every entry in a sync table to be sent again.  */
 /* ------------------------------------------------------------------------ */
 int
 ipf_sync_ioctl(softc, data, cmd, mode, uid, ctx)
@@ -1362,6 +1937,51 @@ ipf_sync_ioctl(softc, data, cmd, mode, uid, ctx)
 		}
 		break;
 
+	case SIOCSYNCBATCH :
+		error = BCOPYIN(data, &i, sizeof(i));
+		if (error != 0) {
+			IPFERROR(110027);
+			error = EFAULT;
+			break;
+		}
+
+		/*
+		 * With batching on, there is no point waking the reader
+		 * for less than a full message unless updates have been
+		 * left waiting for a while.
+		 */
+		MUTEX_ENTER(&softs->ipsl_mutex);
+		softs->ipf_sync_batch = (i != 0);
+		if (softs->ipf_sync_batch != 0) {
+			softs->ipf_sync_event_high_wm = SYNC_BATCHRECS;
+		} else {
+			softs->ipf_sync_event_high_wm =
+			    softs->ipf_sync_log_sz * 90 / 100;
+			softs->ipf_sync_wake_interval = 0;
+		}
+		MUTEX_EXIT(&softs->ipsl_mutex);
+		break;
+
+	case SIOCSYNCRESYNC :
+		error = BCOPYIN(data, &i, sizeof(i));
+		if (error != 0) {
+			IPFERROR(110032);
+			error = EFAULT;
+			break;
+		}
+
+		error = ipf_sync_resync_start(softs, i, &i);
+		if (error != 0)
+			break;
+		error = BCOPYOUT(&i, data, sizeof(i));
+		if (error != 0) {
+			IPFERROR(110028);
+			error = EFAULT;
+			break;
+		}
+		ipf_sync_poll_wakeup(softc);
+		break;
+
 	default :
 		IPFERROR(110021);
 		error = EINVAL;
@@ -1385,8 +2005,15 @@ ipf_sync_canread(arg)
 	void *arg;
 {
 	ipf_sync_softc_t *softs = arg;
-	return !((softs->sl_tail == softs->sl_idx) &&
-		 (softs->su_tail == softs->su_idx));
+	int i;
+
+	if (!((softs->sl_tail == softs->sl_idx) &&
+	      (softs->su_tail == softs->su_idx)))
+		return 1;
+	for (i = 0; i <= SMC_MAXTBL; i++)
+		if (softs->ipf_sync_resync[i].sr_nums != NULL)
+			return 1;
+	return 0;
 }
 
 
@@ -1432,12 +2059,13 @@ ipf_sync_wakeup(softc)
 	ipf_sync_softc_t *softs = softc->ipf_sync_soft;
 
 	softs->ipf_sync_events++;
+	softs->ipf_sync_tickevents++;
 	if ((softc->ipf_ticks >
 	    softs->ipf_sync_lastwakeup + softs->ipf_sync_wake_interval) ||
 	    (softs->ipf_sync_events > softs->ipf_sync_event_high_wm) ||
-	    ((softs->sl_tail - softs->sl_idx) >
+	    ((softs->sl_idx - softs->sl_tail) >
 	     softs->ipf_sync_queue_high_wm) ||
-	    ((softs->su_tail - softs->su_idx) >
+	    ((softs->su_idx - softs->su_tail) >
 	     softs->ipf_sync_queue_high_wm)) {
 
 		ipf_sync_poll_wakeup(softc);
@@ -1482,6 +2110,11 @@ ipf_sync_poll_wakeup(softc)
 /*                                                                          */
 /* This is the function called even ipf_tick.  It implements one of the     */
 /* three heuristics above *IF* there are events waiting.                    */
+/*                                                                          */
+/* When batching, it also adapts ipf_sync_wake_interval to the rate events  */
+/* arrive at: while more than a message's worth arrive each tick, updates   */
+/* are left to coalesce for longer and the reader is mostly woken by full   */
+/* batches, and as the rate falls the interval shrinks back to nothing.     */
 /* ------------------------------------------------------------------------ */
 void
 ipf_sync_expire(softc)
@@ -1489,6 +2122,16 @@ ipf_sync_expire(softc)
 {
 	ipf_sync_softc_t *softs = softc->ipf_sync_soft;
 
+	if (softs->ipf_sync_batch != 0) {
+		if (softs->ipf_sync_tickevents > SYNC_BATCHRECS) {
+			if (softs->ipf_sync_wake_interval < SYNC_WAKE_MAX)
+				softs->ipf_sync_wake_interval++;
+		} else if (softs->ipf_sync_wake_interval > 0) {
+			softs->ipf_sync_wake_interval--;
+		}
+	}
+	softs->ipf_sync_tickevents = 0;
+
 	if ((softs->ipf_sync_events > 0) &&
 	    (softc->ipf_ticks >
 	     softs->ipf_sync_lastwakeup + softs->ipf_sync_wake_interval)) {
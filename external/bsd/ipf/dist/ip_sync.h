@@ -12,6 +12,14 @@
 #ifndef __IP_SYNC_H__
 #define __IP_SYNC_H__
 
+#if defined(__STDC__) || defined(__GNUC__) || defined(_AIX51)
+# define	SIOCSYNCBATCH	_IOWR('r', 60, int)
+# define	SIOCSYNCRESYNC	_IOWR('r', 61, int)
+#else
+# define	SIOCSYNCBATCH	_IOWR(r, 60, int)
+# define	SIOCSYNCRESYNC	_IOWR(r, 61, int)
+#endif
+
 typedef	struct	synchdr	{
 	u_32_t		sm_magic;	/* magic */
 	u_char		sm_v;		/* version: 4,6 */
@@ -33,7 +41,9 @@ typedef	struct	synchdr	{
  */
 #define	SMC_CREATE	0	/* pass ipstate_t after synchdr_t */
 #define	SMC_UPDATE	1
-#define	SMC_MAXCMD	1
+#define	SMC_BATCH	2	/* sm_num packed updates after synchdr_t */
+#define	SMC_MAXCMD	2
+#define	SMC_RESYNC	3	/* peer request, never passed to the kernel */
 
 /*
  * Tables
@@ -102,6 +112,29 @@ typedef	struct	syncupdent	{		/* 28 or 32 bytes */
 	struct	synctcp_update	sup_tcp;
 } syncupdent_t;
 
+/*
+ * An SMC_BATCH message carries sm_num updates packed into sm_len bytes
+ * rather than one syncupdent_t per update.  Each record starts with a flags
+ * byte followed by the difference between its sync number and that of the
+ * record before it (zig-zag encoded so small negative steps stay small).
+ * TCP records then carry the age and, for state entries, each direction's
+ * TCP state, maximum window, td_maxend relative to td_end and td_end itself.
+ * All numbers except td_end are written 7 bits to a byte, low bits first,
+ * with the top bit set on every byte but the last.  td_end is written as 4
+ * bytes in network byte order.  The data is padded with zero bytes to a
+ * multiple of 8 bytes so that the next header is aligned.
+ */
+#define	SYNC_BATCHSZ	1024	/* largest SMC_BATCH data section */
+#define	SYNC_BATCHRECS	32	/* updates to wait for before a wakeup */
+#define	SYNC_RECMAX	49	/* largest encoded update record */
+
+#define	SYNC_BF_NAT	0x01	/* record is for SMC_NAT, else SMC_STATE */
+#define	SYNC_BF_REV	0x02	/* sm_rev is set */
+#define	SYNC_BF_TCP	0x04	/* TCP data follows */
+
+#define	SYNC_ZZENC(x)	(((u_32_t)(x) << 1) ^ (u_32_t)((int)(x) >> 31))
+#define	SYNC_ZZDEC(x)	(((u_32_t)(x) >> 1) ^ (u_32_t)-(int)((x) & 1))
+
 extern	void *ipf_sync_create __P((ipf_main_softc_t *));
 extern	int ipf_sync_soft_init __P((ipf_main_softc_t *, void *));
 extern	int ipf_sync_soft_fini __P((ipf_main_softc_t *, void *));
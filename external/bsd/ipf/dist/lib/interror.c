@@ -231,6 +231,10 @@ static ipf_error_entry_t ipf_errors[IPF_NUM_ERRORS] = {
 	{	30024,	"object size incorrect for hash table" },
 	{	30025,	"hash table size must be at least 1"},
 	{	30026,	"cannot allocate memory for hash table context" },
+	{	30027,	"incorrect object size for hash table swap" },
+	{	30028,	"error copying in name of hash table to swap with" },
+	{	30029,	"could not find hash tables to swap" },
+	{	30030,	"hash tables to swap are the same or differ in type" },
 /* -------------------------------------------------------------------------- */
 	{	40001,	"invalid minor device numebr for log read" },
 	{	40002,	"read size too small" },
@@ -281,6 +285,9 @@ static ipf_error_entry_t ipf_errors[IPF_NUM_ERRORS] = {
 	{	50040,	"could not find token for lookup iterator" },
 	{	50041,	"unrecognised object type for lookup interator" },
 	{	50042,	"error copying in lookup delete node operation" },
+	{	50043,	"error copying in lookup swap table operation" },
+	{	50044,	"invalid unit for lookup swap table" },
+	{	50045,	"unrecognised object type for lookup swap table" },
 /* -------------------------------------------------------------------------- */
 	{	60001,	"insufficient privilege for NAT write operation" },
 	{	60002,	"need write permissions to flush NAT logs" },
@@ -472,6 +479,14 @@ log" },
 	{	110019,	"sync update could not find NAT entry" },
 	{	110020,	"unrecognised sync NAT command" },
 	{	110021,	"ioctls are not handled with sync" },
+	{	110025,	"sync write data length is too large" },
+	{	110026,	"malformed batch of sync updates" },
+	{	110027,	"error copying in sync batch setting" },
+	{	110028,	"error copying out sync resync count" },
+	{	110029,	"unknown sync table to resync" },
+	{	110030,	"sync resync already in progress for table" },
+	{	110031,	"could not malloc memory for sync resync list" },
+	{	110032,	"error copying in sync resync table" },
 /* -------------------------------------------------------------------------- */
 	{	120001,	"null data pointer for iterator" },
 	{	120002,	"unit outside of acceptable range" },
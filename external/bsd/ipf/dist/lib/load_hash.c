@@ -21,11 +21,12 @@ load_hash(iphp, list, iocfunc)
 	iphtent_t *list;
 	ioctlfunc_t iocfunc;
 {
+	char target[FR_GROUPLEN];
 	iplookupop_t op;
 	iphtable_t iph;
 	iphtent_t *a;
 	size_t size;
-	int n;
+	int err, n;
 
 	if (pool_open() == -1)
 		return -1;
@@ -59,8 +60,24 @@ load_hash(iphp, list, iocfunc)
 	iph.iph_list = NULL;
 	iph.iph_ref = 0;
 
+	*target = '\0';
 	if ((opts & OPT_REMOVE) == 0) {
-		if (pool_ioctl(iocfunc, SIOCLOOKUPADDTABLE, &op))
+		err = pool_ioctl(iocfunc, SIOCLOOKUPADDTABLE, &op);
+		if (err != 0 && errno == EEXIST && (opts & OPT_REPLACE) != 0) {
+			/*
+			 * The table is already there, so fill a new anonymous
+			 * table and swap it into place once it is complete,
+			 * rather than have the old and new entries mixed up
+			 * while the load is in progress.
+			 */
+			strncpy(target, op.iplo_name, sizeof(target));
+			*op.iplo_name = '\0';
+			op.iplo_arg = IPHASH_ANON;
+			err = pool_ioctl(iocfunc, SIOCLOOKUPADDTABLE, &op);
+			if (err != 0)
+				*target = '\0';
+		}
+		if (err != 0)
 			if ((opts & OPT_DONOTHING) == 0) {
 				return ipf_perror_fd(pool_fd(), iocfunc,
 					"add lookup hash table");
@@ -92,6 +109,26 @@ load_hash(iphp, list, iocfunc)
 	for (a = list; a != NULL; a = a->ipe_next)
 		load_hashnode(iphp->iph_unit, iph.iph_name, a, 0, iocfunc);
 
+	if (*target != '\0') {
+		strncpy(op.iplo_name, target, sizeof(op.iplo_name));
+		op.iplo_arg = 0;
+		op.iplo_size = sizeof(iph.iph_name);
+		op.iplo_struct = iph.iph_name;
+		if (pool_ioctl(iocfunc, SIOCLOOKUPSWAPTABLE, &op))
+			if ((opts & OPT_DONOTHING) == 0) {
+				return ipf_perror_fd(pool_fd(), iocfunc,
+					"swap lookup hash table");
+			}
+
+		strncpy(op.iplo_name, iph.iph_name, sizeof(op.iplo_name));
+		if (pool_ioctl(iocfunc, SIOCLOOKUPDELTABLE, &op))
+			if ((opts & OPT_DONOTHING) == 0) {
+				return ipf_perror_fd(pool_fd(), iocfunc,
+					"delete lookup hash table");
+			}
+		strncpy(iphp->iph_name, target, sizeof(iphp->iph_name) - 1);
+	}
+
 	if ((opts & OPT_REMOVE) != 0) {
 		if (pool_ioctl(iocfunc, SIOCLOOKUPDELTABLE, &op))
 			if ((opts & OPT_DONOTHING) == 0) {
@@ -48,6 +48,7 @@
 #define	OPT_NORESOLVE	0x8000000
 #define	OPT_DONTOPEN	0x10000000
 #define	OPT_PURGE	0x20000000
+#define	OPT_REPLACE	0x40000000
 
 #define	OPT_STAT	OPT_FRSTATES
 #define	OPT_LIST	OPT_SHOWLIST
@@ -785,7 +785,7 @@ static void emitGroup(num, dir, v, fr, group, incount, outcount)
 		case FRC_TOS :
 			if (m[i].s) {
 				indent(fp, in);
-				fprintf(fp, "if (fin->fin_tos");
+				fprintf(fp, "if (");
 				printeq(fp, "fin->fin_tos",
 					ipf->fri_mip.fi_tos, 0xff,
 					ipf->fri_ip.fi_tos);
@@ -55,6 +55,7 @@ int	do_kbuff __P((int, char *, int *));
 int	do_packet __P((int, char *));
 int	buildsocket __P((char *, struct sockaddr_in *));
 void	do_io __P((void));
+void	do_resync __P((void));
 void	handleterm __P((int));
 
 int	terminate = 0;
@@ -62,13 +63,15 @@ int	igmpfd = -1;
 int	nfd = -1;
 int	lfd = -1;
 int	opts = 0;
+int	batch = 0;
+int	resync = 0;
 
 void
 usage(progname)
 	char *progname;
 {
 	fprintf(stderr,
-		"Usage: %s [-d] [-p port] [-i address] -I <interface>\n",
+		"Usage: %s [-bdr] [-p port] [-i address] -I <interface>\n",
 		progname);
 }
 
@@ -109,9 +112,12 @@ main(argc, argv)
 	sin.sin_port = htons(0xaf6c);
 	sin.sin_addr.s_addr = htonl(INADDR_UNSPEC_GROUP | 0x697066);
 
-	while ((opt = getopt(argc, argv, "di:I:p:")) != -1)
+	while ((opt = getopt(argc, argv, "bdi:I:p:r")) != -1)
 		switch (opt)
 		{
+		case 'b' :
+			batch = 1;
+			break;
 		case 'd' :
 			debuglevel++;
 			break;
@@ -124,6 +130,9 @@ main(argc, argv)
 		case 'p' :
 			sin.sin_port = htons(atoi(optarg));
 			break;
+		case 'r' :
+			resync = 1;
+			break;
 		}
 
 	if (interface == NULL) {
@@ -194,6 +203,15 @@ main(argc, argv)
 			goto tryagain;
 		}
 
+		if (batch && ioctl(lfd, SIOCSYNCBATCH, &batch) == -1) {
+			syslog(LOG_ERR, "ioctl(SIOCSYNCBATCH):%m");
+			debug(1, "ioctl(SIOCSYNCBATCH): %s\n", STRERROR(errno));
+			goto tryagain;
+		}
+
+		if (resync)
+			do_resync();
+
 		tries = -1;
 		do_io();
 tryagain:
@@ -265,7 +283,11 @@ do_io()
 
 			debug(3, "read(K):%d\n", n1);
 
-			if (n1 <= 0) {
+			/*
+			 * A read can return nothing when a resync finds that
+			 * none of its entries are left to send.
+			 */
+			if (n1 < 0) {
 				syslog(LOG_ERR, "read error (k-header): %m");
 				debug(1, "read error (k-header): %s\n",
 				      STRERROR(errno));
@@ -274,12 +296,12 @@ do_io()
 
 			left = 0;
 
-			switch (do_kbuff(n1, buff, &left))
+			switch (do_kbuff(inbuf + n1, buff, &left))
 			{
 			case R_IO_ERROR :
 				return;
 			case R_MORE :
-				inbuf += left;
+				inbuf = left;
 				break;
 			default :
 				inbuf = 0;
@@ -450,6 +472,28 @@ buildsocket(nicname, sinp)
 }
 
 
+/*
+ * Ask the other hosts to send us everything in their sync tables, as we
+ * have just started and they will otherwise only tell us about new
+ * entries and changes.
+ */
+void
+do_resync()
+{
+	synchdr_t sh;
+
+	bzero((char *)&sh, sizeof(sh));
+	sh.sm_magic = htonl(SYNHDRMAGIC);
+	sh.sm_v = 4;
+	sh.sm_cmd = SMC_RESYNC;
+
+	if (send(nfd, &sh, sizeof(sh), 0) == -1) {
+		syslog(LOG_ERR, "send(resync):%m");
+		debug(1, "send(resync): %s\n", STRERROR(errno));
+	}
+}
+
+
 int
 do_packet(pklen, buff)
 	int pklen;
@@ -491,6 +535,24 @@ do_packet(pklen, buff)
 			printsmcproto(buff);
 		}
 
+		if (sh->sm_cmd == SMC_RESYNC) {
+			for (n2 = 0; n2 <= SMC_MAXTBL; n2++) {
+				n3 = n2;
+				if (ioctl(lfd, SIOCSYNCRESYNC, &n3) == -1) {
+					syslog(LOG_ERR,
+					       "ioctl(SIOCSYNCRESYNC):%m");
+					debug(1, "ioctl(SIOCSYNCRESYNC): %s\n",
+					      STRERROR(errno));
+				} else {
+					debug(2, "resync table %d: %d\n",
+					      n2, n3);
+				}
+			}
+			buff += sizeof(*sh);
+			pklen -= sizeof(*sh);
+			continue;
+		}
+
 		n2 = sizeof(*sh) + len;
 
 		do {
@@ -533,6 +595,11 @@ do_kbuff(inbuf, buf, left)
 	sh = (synchdr_t *)buf;
 
 	for (complete = 0; bytes > 0; complete++) {
+		if (bytes < sizeof(*sh)) {
+			error = R_MORE;
+			break;
+		}
+
 		len = ntohl(sh->sm_len);
 		magic = ntohl(sh->sm_magic);
 
@@ -565,9 +632,10 @@ do_kbuff(inbuf, buf, left)
 			printsmcproto(buf);
 		}
 
-		sendlen += len + sizeof(*sh);
+		n2 = len + sizeof(*sh);
+		sendlen += n2;
 		sh = (synchdr_t *)(buf + sendlen);
-		bytes -= sendlen;
+		bytes -= n2;
 	}
 
 	if (complete) {
@@ -587,7 +655,7 @@ do_kbuff(inbuf, buf, left)
 	 * we are reaching the end
 	 */
 	if (bytes > 0) {
-		bcopy(buf + bytes, buf, bytes);
+		bcopy(buf + sendlen, buf, bytes);
 		error = R_MORE;
 	}
 	debug(4, "complete %d bytes %d error %d\n", complete, bytes, error);
@@ -611,6 +679,12 @@ printcommand(cmd)
 	case SMC_UPDATE :
 		printf(" cmd:UPDATE");
 		break;
+	case SMC_BATCH :
+		printf(" cmd:BATCH");
+		break;
+	case SMC_RESYNC :
+		printf(" cmd:RESYNC");
+		break;
 	default :
 		printf(" cmd:Unknown(%d)", cmd);
 		break;
@@ -657,6 +731,11 @@ printsmcproto(buff)
 				su->sup_tcp.stu_state[0],
 				su->sup_tcp.stu_state[1]);
 		}
+	} else if (sh->sm_cmd == SMC_BATCH) {
+		printf(" %d updates in %d bytes\n", ntohl(sh->sm_num),
+		       ntohl(sh->sm_len));
+	} else if (sh->sm_cmd == SMC_RESYNC) {
+		putchar('\n');
 	} else {
 		printf("Unknown command\n");
 	}
@@ -41,6 +41,7 @@ void	dumpnat __P((void *));
 void	dumpgroups __P((ipf_main_softc_t *));
 void	dumprules __P((frentry_t *));
 void	drain_log __P((char *));
+void	drain_sync __P((void));
 void	fixv4sums __P((mb_t *, ip_t *));
 
 #if defined(__NetBSD__) || defined(__OpenBSD__) || SOLARIS || \
@@ -72,6 +73,9 @@ static	ioctlfunc_t	iocfunctions[IPL_LOGSIZE] = { ipftestioctl,
 						      ipooltestioctl,
 						      NULL };
 static	ipf_main_softc_t	*softc = NULL;
+static	u_long	syncreads = 0;
+static	u_long	syncmsgs = 0;
+static	u_long	syncbytes = 0;
 
 
 int
@@ -80,11 +84,14 @@ main(argc,argv)
 	char *argv[];
 {
 	char	*datain, *iface, *ifname, *logout;
-	int	fd, i, dir, c, loaded, dump, hlen;
+	int	fd, i, j, dir, c, loaded, dump, hlen, bench, npkts, sync;
+	int	syncevery, syncpkts;
+	struct	timeval	tv1, tv2, btime, ptime, stime;
 	struct	in_addr	sip;
 	struct	ifnet	*ifp;
 	struct	ipread	*r;
 	mb_t	mb, *m, *n;
+	static	mb_t	bmb;
 	ip_t	*ip;
 
 	m = &mb;
@@ -93,6 +100,14 @@ main(argc,argv)
 	dump = 0;
 	hlen = 0;
 	loaded = 0;
+	bench = 0;
+	npkts = 0;
+	timerclear(&btime);
+	timerclear(&ptime);
+	timerclear(&stime);
+	sync = 0;
+	syncevery = 1;
+	syncpkts = 0;
 	r = &iptext;
 	iface = NULL;
 	logout = NULL;
@@ -115,7 +130,7 @@ main(argc,argv)
 	if (ipftestioctl(IPL_LOGIPF, SIOCFRENB, &i) != 0)
 		exit(1);
 
-	while ((c = getopt(argc, argv, "6bCdDF:i:I:l:N:P:or:RS:T:vxX")) != -1)
+	while ((c = getopt(argc, argv, "6B:bCdDF:i:I:l:N:P:or:RS:T:vxXy:Y:")) != -1)
 		switch (c)
 		{
 		case '6' :
@@ -126,6 +141,9 @@ main(argc,argv)
 			exit(1);
 #endif
 			break;
+		case 'B' :
+			bench = atoi(optarg);
+			break;
 		case 'b' :
 			opts |= OPT_BRIEF;
 			break;
@@ -166,8 +184,12 @@ main(argc,argv)
 			opts |= OPT_SAVEOUT;
 			break;
 		case 'P' :
+			gettimeofday(&tv1, NULL);
 			if (ippool_parsefile(-1, optarg, ipooltestioctl) == -1)
 				return -1;
+			gettimeofday(&tv2, NULL);
+			timersub(&tv2, &tv1, &tv2);
+			timeradd(&ptime, &tv2, &ptime);
 			loaded = 1;
 			break;
 		case 'r' :
@@ -191,6 +213,14 @@ main(argc,argv)
 		case 'x' :
 			opts |= OPT_HEX;
 			break;
+		case 'y' :
+			sync = 1;
+			syncevery = atoi(optarg);
+			break;
+		case 'Y' :
+			sync = 2;
+			syncevery = atoi(optarg);
+			break;
 		}
 
 	if (loaded == 0) {
@@ -201,6 +231,14 @@ main(argc,argv)
 	if (opts & OPT_SAVEOUT)
 		init_ifp();
 
+	if (syncevery < 1)
+		syncevery = 1;
+	if (sync == 2) {
+		i = 1;
+		if (ipsynctestioctl(IPL_LOGSYNC, SIOCSYNCBATCH, &i) != 0)
+			exit(1);
+	}
+
 	if (datain)
 		fd = (*r->r_open)(datain);
 	else
@@ -231,6 +269,36 @@ main(argc,argv)
 		else
 			hlen = sizeof(ip6_t);
 #endif
+		/*
+		 * Time bench calls to ipf_check() on a copy of the packet,
+		 * restoring it and flushing any state created each time so
+		 * every call sees the packet as the one reported below does.
+		 * This measures the rule interpreter in fil.c with the rules
+		 * loaded by -r; code generated by ipf -cc isn't used.
+		 */
+		if (bench > 0) {
+			bcopy((char *)mb.mb_buf, (char *)bmb.mb_buf, i);
+			gettimeofday(&tv1, NULL);
+			for (j = 0; j < bench; j++) {
+				m = &mb;
+				m->mb_data = (char *)m->mb_buf;
+				m->mb_ifp = ifp;
+				m->mb_len = i;
+				(void) ipf_check(softc, ip, hlen, ifp, dir, &m);
+				while ((m != NULL) && (m != &mb)) {
+					n = m->mb_next;
+					freembt(m);
+					m = n;
+				}
+				ipf_state_flush(softc, 1, 0);
+				bcopy((char *)bmb.mb_buf, (char *)mb.mb_buf, i);
+			}
+			gettimeofday(&tv2, NULL);
+			timersub(&tv2, &tv1, &tv2);
+			timeradd(&btime, &tv2, &btime);
+			npkts++;
+		}
+
 		/* ipfr_slowtimer(); */
 		blockreason = 0;
 		m = &mb;
@@ -290,6 +358,21 @@ main(argc,argv)
 				PRINTF("%d\n", blockreason);
 		}
 
+		/*
+		 * Every syncevery packets, read back whatever has been
+		 * queued for the sync daemon, as it would, timing that
+		 * separately.  Reading after each packet leaves nothing
+		 * for a batch to carry but that one packet's updates.
+		 */
+		if ((sync != 0) && (++syncpkts >= syncevery)) {
+			syncpkts = 0;
+			gettimeofday(&tv1, NULL);
+			drain_sync();
+			gettimeofday(&tv2, NULL);
+			timersub(&tv2, &tv1, &tv2);
+			timeradd(&stime, &tv2, &stime);
+		}
+
 		ipf_state_flush(softc, 1, 0);
 
 		if (dir && (ifp != NULL) && IP_V(ip) && (m != NULL))
@@ -328,6 +411,37 @@ main(argc,argv)
 		drain_log(logout);
 	}
 
+	if (sync != 0) {
+		if (syncpkts > 0) {
+			gettimeofday(&tv1, NULL);
+			drain_sync();
+			gettimeofday(&tv2, NULL);
+			timersub(&tv2, &tv1, &tv2);
+			timeradd(&stime, &tv2, &stime);
+		}
+		fprintf(stderr, "sync: %lu reads, %lu messages, %lu bytes, ",
+			syncreads, syncmsgs, syncbytes);
+		fprintf(stderr, "%ld.%06ld seconds\n",
+			(long)stime.tv_sec, (long)stime.tv_usec);
+		if (syncmsgs > 0 && timerisset(&stime))
+			fprintf(stderr,
+				"sync: %.1f bytes/message, %.1f messages/read, "
+				"%.0f messages/second\n",
+				(double)syncbytes / syncmsgs,
+				(double)syncmsgs / syncreads,
+				syncmsgs / (stime.tv_sec + stime.tv_usec / 1e6));
+	}
+	if (bench > 0 && timerisset(&ptime))
+		fprintf(stderr, "pool load: %ld.%06ld seconds\n",
+			(long)ptime.tv_sec, (long)ptime.tv_usec);
+	if (bench > 0 && npkts > 0) {
+		fprintf(stderr, "%d packets x %d: %ld.%06ld seconds, ",
+			npkts, bench, (long)btime.tv_sec, (long)btime.tv_usec);
+		fprintf(stderr, "%.3f usec per interpreted check\n",
+			(btime.tv_sec * 1000000.0 + btime.tv_usec) /
+			((double)npkts * bench));
+	}
+
 	if (dump == 1)  {
 		dumpnat(softc->ipf_nat_soft);
 		ipf_state_dump(softc, softc->ipf_state_soft);
@@ -804,6 +918,48 @@ void drain_log(filename)
 }
 
 
+/*
+ * Read everything waiting on the sync device in BUFFERLEN sized pieces, as
+ * ipfsyncd would, counting the reads, messages and bytes that it sees.
+ */
+void drain_sync()
+{
+	char buffer[1400];
+	struct iovec iov;
+	struct uio uio;
+	synchdr_t *sh;
+	size_t len, n;
+
+	while (ipf_sync_canread(softc->ipf_sync_soft)) {
+		bzero((char *)&iov, sizeof(iov));
+		iov.iov_base = buffer;
+		iov.iov_len = sizeof(buffer);
+
+		bzero((char *)&uio, sizeof(uio));
+		uio.uio_iov = &iov;
+		uio.uio_iovcnt = 1;
+		uio.uio_resid = iov.iov_len;
+
+		if (ipf_sync_read(softc, &uio) != 0)
+			break;
+		len = sizeof(buffer) - uio.uio_resid;
+		if (len == 0)
+			break;
+
+		syncreads++;
+		syncbytes += len;
+		for (n = 0; n + sizeof(*sh) <= len;
+		     n += sizeof(*sh) + ntohl(sh->sm_len)) {
+			sh = (synchdr_t *)(buffer + n);
+			if (sh->sm_cmd == SMC_BATCH)
+				syncmsgs += ntohl(sh->sm_num);
+			else
+				syncmsgs++;
+		}
+	}
+}
+
+
 void fixv4sums(m, ip)
 	mb_t *m;
 	ip_t *ip;
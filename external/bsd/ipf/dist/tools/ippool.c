@@ -80,7 +80,7 @@ usage(prog)
 	fprintf(stderr, "Usage:\t%s\n", prog);
 	fprintf(stderr, "\t-a [-dnv] [-m <name>] [-o <role>] [-t type] [-T ttl] -i <ipaddr>[/netmask]\n");
 	fprintf(stderr, "\t-A [-dnv] [-m <name>] [-o <role>] [-S <seed>] [-t <type>]\n");
-	fprintf(stderr, "\t-f <file> [-dnuv]\n");
+	fprintf(stderr, "\t-f <file> [-dnuvx]\n");
 	fprintf(stderr, "\t-F [-dv] [-o <role>] [-t <type>]\n");
 	fprintf(stderr, "\t-l [-dv] [-m <name>] [-t <type>] [-O <fields>]\n");
 	fprintf(stderr, "\t-r [-dnv] [-m <name>] [-o <role>] [-t type] -i <ipaddr>[/netmask]\n");
@@ -366,7 +366,7 @@ loadpoolfile(argc, argv, infile)
 
 	infile = optarg;
 
-	while ((c = getopt(argc, argv, "dnRuv")) != -1)
+	while ((c = getopt(argc, argv, "dnRuvx")) != -1)
 		switch (c)
 		{
 		case 'd' :
@@ -385,6 +385,9 @@ loadpoolfile(argc, argv, infile)
 		case 'v' :
 			opts |= OPT_VERBOSE;
 			break;
+		case 'x' :
+			opts |= OPT_REPLACE;
+			break;
 		}
 
 	if (opts & OPT_DEBUG)
@@ -0,0 +1,596 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 2020 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Translate a validated BPF program into native code, so that
+ * filtering packets read from a savefile, or filtering in userland
+ * because the kernel refused the filter, doesn't go through the
+ * interpreter once per instruction per packet.
+ *
+ * The generated function has the same semantics as bpf_filter(),
+ * including the run-time bounds checks on packet loads; it is called
+ * as f(packet, wirelen, buflen).  Only x86-64 is supported for now;
+ * pcap_bpf_jit_compile() returns NULL elsewhere, or for any program it
+ * doesn't handle, and the caller then keeps using the interpreter.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pcap-types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(PCAP_NO_BPF_JIT)
+
+#include <sys/mman.h>
+
+#ifndef PROT_MPROTECT
+#define PROT_MPROTECT(x)	0
+#endif
+
+/*
+ * Register usage:
+ *	%eax	A
+ *	%ecx	X (shifts by X want it in %cl)
+ *	%rdi	packet
+ *	%esi	wirelen
+ *	%r8	buflen (moved out of %edx, which div clobbers)
+ *	%r10, %r11, %edx scratch
+ * The scratch memory lives in the red zone below %rsp; the generated
+ * function calls nothing, so it needs no frame.
+ */
+#define MEM_DISP(k)	((u_char)(-4 * BPF_MEMWORDS + 4 * (int)(k)))
+
+/* condition codes for jcc, as the second byte of the 0x0f 0x8X opcode */
+#define CC_B		0x82
+#define CC_AE		0x83
+#define CC_E		0x84
+#define CC_NE		0x85
+#define CC_BE		0x86
+#define CC_A		0x87
+
+struct jit_state {
+	u_char	*buf;		/* NULL on the sizing pass */
+	size_t	len;		/* bytes emitted so far */
+	size_t	*addrs;		/* offset of each BPF instruction */
+	size_t	ret0;		/* offset of the shared "return 0" */
+};
+
+static void
+emit(struct jit_state *js, const u_char *b, size_t n)
+{
+	if (js->buf != NULL)
+		memcpy(js->buf + js->len, b, n);
+	js->len += n;
+}
+
+#define EMIT(js, ...) do {					\
+	static const u_char _b[] = { __VA_ARGS__ };		\
+	emit((js), _b, sizeof(_b));				\
+} while (0)
+
+static void
+emit32(struct jit_state *js, bpf_u_int32 v)
+{
+	u_char b[4];
+
+	b[0] = (u_char)v;
+	b[1] = (u_char)(v >> 8);
+	b[2] = (u_char)(v >> 16);
+	b[3] = (u_char)(v >> 24);
+	emit(js, b, sizeof(b));
+}
+
+/* opcode bytes followed by a 32-bit immediate or displacement */
+static void
+emit_op32(struct jit_state *js, const u_char *op, size_t n, bpf_u_int32 v)
+{
+	emit(js, op, n);
+	emit32(js, v);
+}
+
+#define EMIT_OP32(js, v, ...) do {				\
+	static const u_char _b[] = { __VA_ARGS__ };		\
+	emit_op32((js), _b, sizeof(_b), (v));			\
+} while (0)
+
+static void
+emit_jmp(struct jit_state *js, size_t target)
+{
+	EMIT_OP32(js, (bpf_u_int32)(target - (js->len + 5)), 0xe9);
+}
+
+static void
+emit_jcc(struct jit_state *js, u_char cc, size_t target)
+{
+	u_char op[2];
+
+	op[0] = 0x0f;
+	op[1] = cc;
+	emit_op32(js, op, sizeof(op), (bpf_u_int32)(target - (js->len + 6)));
+}
+
+/* bail out to "return 0" unless buflen >= end */
+static void
+emit_abs_check(struct jit_state *js, bpf_u_int32 end)
+{
+	EMIT_OP32(js, end, 0x41, 0x81, 0xf8);	/* cmp $end, %r8d */
+	emit_jcc(js, CC_B, js->ret0);
+}
+
+/*
+ * %r10 = X + k; bail out to "return 0" unless buflen >= X + k + size,
+ * computed in 64 bits so that nothing wraps
+ */
+static void
+emit_ind_check(struct jit_state *js, bpf_u_int32 k, u_char size)
+{
+	u_char lea[4];
+
+	EMIT(js, 0x41, 0x89, 0xca);		/* mov %ecx, %r10d */
+	EMIT_OP32(js, k, 0x41, 0xbb);		/* mov $k, %r11d */
+	EMIT(js, 0x4d, 0x01, 0xda);		/* add %r11, %r10 */
+	lea[0] = 0x4d;				/* lea size(%r10), %r11 */
+	lea[1] = 0x8d;
+	lea[2] = 0x5a;
+	lea[3] = size;
+	emit(js, lea, sizeof(lea));
+	EMIT(js, 0x4d, 0x39, 0xc3);		/* cmp %r8, %r11 */
+	emit_jcc(js, CC_A, js->ret0);
+}
+
+static void
+emit_mem(struct jit_state *js, u_char op, u_char reg, bpf_u_int32 k)
+{
+	u_char b[4];
+
+	b[0] = op;				/* op reg, disp8(%rsp) */
+	b[1] = 0x44 | (u_char)(reg << 3);
+	b[2] = 0x24;
+	b[3] = MEM_DISP(k);
+	emit(js, b, sizeof(b));
+}
+
+static void
+emit_cond(struct jit_state *js, u_int i, const struct bpf_insn *pc,
+    u_char cc, u_char ncc)
+{
+	size_t jt = js->addrs[i + 1 + pc->jt];
+	size_t jf = js->addrs[i + 1 + pc->jf];
+
+	if (pc->jt == pc->jf) {
+		if (pc->jt != 0)
+			emit_jmp(js, jt);
+	} else if (pc->jt == 0) {
+		emit_jcc(js, ncc, jf);
+	} else {
+		emit_jcc(js, cc, jt);
+		if (pc->jf != 0)
+			emit_jmp(js, jf);
+	}
+}
+
+/*
+ * Generate code for the program; returns 0 if it uses something we
+ * don't translate.
+ */
+static int
+jit_pass(struct jit_state *js, const struct bpf_insn *insns, u_int len)
+{
+	const struct bpf_insn *pc;
+	u_int i;
+	int usesmem = 0;
+
+	for (i = 0; i < len; i++) {
+		if (insns[i].code == (BPF_LD|BPF_MEM) ||
+		    insns[i].code == (BPF_LDX|BPF_MEM))
+			usesmem = 1;
+	}
+
+	js->len = 0;
+	EMIT(js, 0x41, 0x89, 0xd0);		/* mov %edx, %r8d */
+	EMIT(js, 0x31, 0xc0);			/* xor %eax, %eax */
+	EMIT(js, 0x31, 0xc9);			/* xor %ecx, %ecx */
+	if (usesmem) {
+		/*
+		 * The interpreter's scratch memory is uninitialized;
+		 * start ours out zeroed so that results don't depend
+		 * on what the caller left in the red zone.
+		 */
+		EMIT(js, 0x45, 0x31, 0xdb);	/* xor %r11d, %r11d */
+		for (i = 0; i < BPF_MEMWORDS; i += 2) {
+			u_char b[5];
+
+			b[0] = 0x4c;		/* mov %r11, disp8(%rsp) */
+			b[1] = 0x89;
+			b[2] = 0x5c;
+			b[3] = 0x24;
+			b[4] = MEM_DISP(i);
+			emit(js, b, sizeof(b));
+		}
+	}
+
+	for (i = 0, pc = insns; i < len; i++, pc++) {
+		bpf_u_int32 k = pc->k;
+
+		js->addrs[i] = js->len;
+		switch (pc->code) {
+
+		default:
+			return 0;
+
+		case BPF_RET|BPF_K:
+			EMIT_OP32(js, k, 0xb8);		/* mov $k, %eax */
+			EMIT(js, 0xc3);			/* ret */
+			break;
+
+		case BPF_RET|BPF_A:
+			EMIT(js, 0xc3);			/* ret */
+			break;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+		case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS:
+		case BPF_LDX|BPF_MSH|BPF_B:
+			/*
+			 * Offsets this large can't be addressed with a
+			 * 32-bit displacement; leave them to the
+			 * interpreter.
+			 */
+			if (k > 0x7ffffff0)
+				return 0;
+			switch (pc->code) {
+			case BPF_LD|BPF_W|BPF_ABS:
+				emit_abs_check(js, k + 4);
+				/* mov k(%rdi), %eax; bswap %eax */
+				EMIT_OP32(js, k, 0x8b, 0x87);
+				EMIT(js, 0x0f, 0xc8);
+				break;
+			case BPF_LD|BPF_H|BPF_ABS:
+				emit_abs_check(js, k + 2);
+				/* movzwl k(%rdi), %eax; rol $8, %ax */
+				EMIT_OP32(js, k, 0x0f, 0xb7, 0x87);
+				EMIT(js, 0x66, 0xc1, 0xc0, 0x08);
+				break;
+			case BPF_LD|BPF_B|BPF_ABS:
+				emit_abs_check(js, k + 1);
+				/* movzbl k(%rdi), %eax */
+				EMIT_OP32(js, k, 0x0f, 0xb6, 0x87);
+				break;
+			case BPF_LDX|BPF_MSH|BPF_B:
+				emit_abs_check(js, k + 1);
+				/* movzbl k(%rdi), %ecx; and $0xf, %ecx; shl $2, %ecx */
+				EMIT_OP32(js, k, 0x0f, 0xb6, 0x8f);
+				EMIT(js, 0x83, 0xe1, 0x0f);
+				EMIT(js, 0xc1, 0xe1, 0x02);
+				break;
+			}
+			break;
+
+		case BPF_LD|BPF_W|BPF_IND:
+			emit_ind_check(js, k, 4);
+			/* mov (%rdi,%r10), %eax; bswap %eax */
+			EMIT(js, 0x42, 0x8b, 0x04, 0x17);
+			EMIT(js, 0x0f, 0xc8);
+			break;
+
+		case BPF_LD|BPF_H|BPF_IND:
+			emit_ind_check(js, k, 2);
+			/* movzwl (%rdi,%r10), %eax; rol $8, %ax */
+			EMIT(js, 0x42, 0x0f, 0xb7, 0x04, 0x17);
+			EMIT(js, 0x66, 0xc1, 0xc0, 0x08);
+			break;
+
+		case BPF_LD|BPF_B|BPF_IND:
+			emit_ind_check(js, k, 1);
+			/* movzbl (%rdi,%r10), %eax */
+			EMIT(js, 0x42, 0x0f, 0xb6, 0x04, 0x17);
+			break;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			EMIT(js, 0x89, 0xf0);		/* mov %esi, %eax */
+			break;
+
+		case BPF_LDX|BPF_W|BPF_LEN:
+			EMIT(js, 0x89, 0xf1);		/* mov %esi, %ecx */
+			break;
+
+		case BPF_LD|BPF_IMM:
+			EMIT_OP32(js, k, 0xb8);		/* mov $k, %eax */
+			break;
+
+		case BPF_LDX|BPF_IMM:
+			EMIT_OP32(js, k, 0xb9);		/* mov $k, %ecx */
+			break;
+
+		case BPF_LD|BPF_MEM:
+			emit_mem(js, 0x8b, 0, k);	/* mov mem[k], %eax */
+			break;
+
+		case BPF_LDX|BPF_MEM:
+			emit_mem(js, 0x8b, 1, k);	/* mov mem[k], %ecx */
+			break;
+
+		case BPF_ST:
+			emit_mem(js, 0x89, 0, k);	/* mov %eax, mem[k] */
+			break;
+
+		case BPF_STX:
+			emit_mem(js, 0x89, 1, k);	/* mov %ecx, mem[k] */
+			break;
+
+		case BPF_JMP|BPF_JA:
+			/* backward jumps are allowed, for protochain */
+			emit_jmp(js, js->addrs[(bpf_u_int32)(i + 1 + k)]);
+			break;
+
+		case BPF_JMP|BPF_JGT|BPF_K:
+			EMIT_OP32(js, k, 0x3d);		/* cmp $k, %eax */
+			emit_cond(js, i, pc, CC_A, CC_BE);
+			break;
+
+		case BPF_JMP|BPF_JGE|BPF_K:
+			EMIT_OP32(js, k, 0x3d);		/* cmp $k, %eax */
+			emit_cond(js, i, pc, CC_AE, CC_B);
+			break;
+
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			EMIT_OP32(js, k, 0x3d);		/* cmp $k, %eax */
+			emit_cond(js, i, pc, CC_E, CC_NE);
+			break;
+
+		case BPF_JMP|BPF_JSET|BPF_K:
+			EMIT_OP32(js, k, 0xa9);		/* test $k, %eax */
+			emit_cond(js, i, pc, CC_NE, CC_E);
+			break;
+
+		case BPF_JMP|BPF_JGT|BPF_X:
+			EMIT(js, 0x39, 0xc8);		/* cmp %ecx, %eax */
+			emit_cond(js, i, pc, CC_A, CC_BE);
+			break;
+
+		case BPF_JMP|BPF_JGE|BPF_X:
+			EMIT(js, 0x39, 0xc8);		/* cmp %ecx, %eax */
+			emit_cond(js, i, pc, CC_AE, CC_B);
+			break;
+
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			EMIT(js, 0x39, 0xc8);		/* cmp %ecx, %eax */
+			emit_cond(js, i, pc, CC_E, CC_NE);
+			break;
+
+		case BPF_JMP|BPF_JSET|BPF_X:
+			EMIT(js, 0x85, 0xc8);		/* test %ecx, %eax */
+			emit_cond(js, i, pc, CC_NE, CC_E);
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_X:
+			EMIT(js, 0x01, 0xc8);		/* add %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_X:
+			EMIT(js, 0x29, 0xc8);		/* sub %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_X:
+			EMIT(js, 0x0f, 0xaf, 0xc1);	/* imul %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_X:
+		case BPF_ALU|BPF_MOD|BPF_X:
+			EMIT(js, 0x85, 0xc9);		/* test %ecx, %ecx */
+			emit_jcc(js, CC_E, js->ret0);
+			EMIT(js, 0x31, 0xd2);		/* xor %edx, %edx */
+			EMIT(js, 0xf7, 0xf1);		/* div %ecx */
+			if (BPF_OP(pc->code) == BPF_MOD)
+				EMIT(js, 0x89, 0xd0);	/* mov %edx, %eax */
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_X:
+			EMIT(js, 0x21, 0xc8);		/* and %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_X:
+			EMIT(js, 0x09, 0xc8);		/* or %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_X:
+			EMIT(js, 0x31, 0xc8);		/* xor %ecx, %eax */
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_X:
+		case BPF_ALU|BPF_RSH|BPF_X:
+			/* the shift masks %cl; shifts by 32 or more give 0 */
+			if (BPF_OP(pc->code) == BPF_LSH)
+				EMIT(js, 0xd3, 0xe0);	/* shl %cl, %eax */
+			else
+				EMIT(js, 0xd3, 0xe8);	/* shr %cl, %eax */
+			EMIT(js, 0x45, 0x31, 0xdb);	/* xor %r11d, %r11d */
+			EMIT(js, 0x83, 0xf9, 0x20);	/* cmp $32, %ecx */
+			EMIT(js, 0x41, 0x0f, 0x43, 0xc3); /* cmovae %r11d, %eax */
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_K:
+			EMIT_OP32(js, k, 0x05);		/* add $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_K:
+			EMIT_OP32(js, k, 0x2d);		/* sub $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_K:
+			EMIT_OP32(js, k, 0x69, 0xc0);	/* imul $k, %eax, %eax */
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+		case BPF_ALU|BPF_MOD|BPF_K:
+			if (k == 0)
+				return 0;
+			EMIT_OP32(js, k, 0x41, 0xbb);	/* mov $k, %r11d */
+			EMIT(js, 0x31, 0xd2);		/* xor %edx, %edx */
+			EMIT(js, 0x41, 0xf7, 0xf3);	/* div %r11d */
+			if (BPF_OP(pc->code) == BPF_MOD)
+				EMIT(js, 0x89, 0xd0);	/* mov %edx, %eax */
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_K:
+			EMIT_OP32(js, k, 0x25);		/* and $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_K:
+			EMIT_OP32(js, k, 0x0d);		/* or $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_K:
+			EMIT_OP32(js, k, 0x35);		/* xor $k, %eax */
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_K:
+		case BPF_ALU|BPF_RSH|BPF_K:
+			{
+				u_char b[3];
+
+				/*
+				 * What the interpreter does with a
+				 * constant shift of 32 or more depends on
+				 * how it was compiled; don't guess.
+				 */
+				if (k >= 32)
+					return 0;
+				b[0] = 0xc1;		/* shl/shr $k, %eax */
+				b[1] = BPF_OP(pc->code) == BPF_LSH ?
+				    0xe0 : 0xe8;
+				b[2] = (u_char)k;
+				emit(js, b, sizeof(b));
+			}
+			break;
+
+		case BPF_ALU|BPF_NEG:
+			EMIT(js, 0xf7, 0xd8);		/* neg %eax */
+			break;
+
+		case BPF_MISC|BPF_TAX:
+			EMIT(js, 0x89, 0xc1);		/* mov %eax, %ecx */
+			break;
+
+		case BPF_MISC|BPF_TXA:
+			EMIT(js, 0x89, 0xc8);		/* mov %ecx, %eax */
+			break;
+		}
+	}
+
+	js->ret0 = js->len;
+	EMIT(js, 0x31, 0xc0);			/* xor %eax, %eax */
+	EMIT(js, 0xc3);				/* ret */
+	return 1;
+}
+
+/*
+ * Compile a program that has passed bpf_validate(); on success, return
+ * the generated function and set *sizep to what pcap_bpf_jit_free()
+ * needs, otherwise return NULL.
+ */
+pcap_bpf_jit_func
+pcap_bpf_jit_compile(const struct bpf_insn *insns, u_int len, size_t *sizep)
+{
+	struct jit_state js;
+	void *code;
+	size_t size;
+
+	/*
+	 * Userland programs aren't limited to BPF_MAXINSNS, but keep
+	 * the generated code well within reach of a 32-bit jump.
+	 */
+	if (insns == NULL || len == 0 || len > (1U << 24))
+		return NULL;
+	memset(&js, 0, sizeof(js));
+	js.addrs = calloc(len, sizeof(*js.addrs));
+	if (js.addrs == NULL)
+		return NULL;
+
+	/*
+	 * Every jump is emitted with a 32-bit displacement, so the
+	 * length of each instruction doesn't depend on where it jumps
+	 * to: one pass to find the offsets, one to emit the code.
+	 */
+	if (!jit_pass(&js, insns, len)) {
+		free(js.addrs);
+		return NULL;
+	}
+	size = js.len;
+	code = mmap(NULL, size, PROT_READ|PROT_WRITE|PROT_MPROTECT(PROT_EXEC),
+	    MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (code == MAP_FAILED) {
+		free(js.addrs);
+		return NULL;
+	}
+	js.buf = code;
+	(void)jit_pass(&js, insns, len);
+	free(js.addrs);
+	if (mprotect(code, size, PROT_READ|PROT_EXEC) == -1) {
+		(void)munmap(code, size);
+		return NULL;
+	}
+	*sizep = size;
+	return (pcap_bpf_jit_func)code;
+}
+
+void
+pcap_bpf_jit_free(pcap_bpf_jit_func f, size_t size)
+{
+	if (f != NULL)
+		(void)munmap((void *)f, size);
+}
+
+#else /* x86-64 */
+
+pcap_bpf_jit_func
+pcap_bpf_jit_compile(const struct bpf_insn *insns _U_, u_int len _U_,
+    size_t *sizep _U_)
+{
+	return NULL;
+}
+
+void
+pcap_bpf_jit_free(pcap_bpf_jit_func f _U_, size_t size _U_)
+{
+}
+
+#endif /* x86-64 */
@@ -248,6 +248,15 @@ struct chunk {
 	void *m;
 };
 
+/*
+ * Sets of constants made by gen_or_fold() with fewer than KSET_OPAQUE
+ * members are turned back into plain comparisons before optimizing;
+ * larger ones become binary searches whose leaves hold at most
+ * KSET_CHAIN comparisons.
+ */
+#define KSET_OPAQUE	16
+#define KSET_CHAIN	4
+
 /* Code generator state */
 
 struct _compiler_state {
@@ -290,6 +299,13 @@ struct _compiler_state {
 	 */
 	u_char *e;
 
+	/*
+	 * Set if the expression named a host, network, port or protocol
+	 * that had to be looked up; what such a name resolves to can
+	 * change, so the program isn't remembered for reuse.
+	 */
+	int names_resolved;
+
 	/*
 	 * Various code constructs need to know the layout of the packet.
 	 * These values give the necessary offsets from the beginning
@@ -429,6 +445,16 @@ struct _compiler_state {
 	 */
 	struct chunk chunks[NCHUNKS];
 	int cur_chunk;
+
+	/*
+	 * Blocks of terms that gen_or_fold() folded away, for reuse.
+	 */
+	struct block *free_blocks;
+
+	/*
+	 * Number of constant sets made by gen_or_fold().
+	 */
+	int n_ksets;
 };
 
 /*
@@ -483,6 +509,7 @@ static inline void syntax(compiler_state_t *cstate);
 
 static void backpatch(struct block *, struct block *);
 static void merge(struct block *, struct block *);
+static int expand_ksets(compiler_state_t *, int);
 static struct block *gen_cmp(compiler_state_t *, enum e_offrel, u_int,
     u_int, bpf_int32);
 static struct block *gen_cmp_gt(compiler_state_t *, enum e_offrel, u_int,
@@ -674,7 +701,11 @@ new_block(compiler_state_t *cstate, int code)
 {
 	struct block *p;
 
-	p = (struct block *)newchunk(cstate, sizeof(*p));
+	if ((p = cstate->free_blocks) != NULL) {
+		cstate->free_blocks = p->link;
+		memset(p, 0, sizeof(*p));
+	} else
+		p = (struct block *)newchunk(cstate, sizeof(*p));
 	p->s.code = code;
 	p->head = p;
 
@@ -707,6 +738,82 @@ syntax(compiler_state_t *cstate)
 	bpf_error(cstate, "syntax error in filter expression");
 }
 
+/*
+ * Filters generated from long lists of hosts or ports are expensive
+ * to compile, and applications tend to compile the same filter more
+ * than once, so each pcap_t remembers the last program it compiled.
+ * A filter compiles to the same program as long as the expression,
+ * the arguments to pcap_compile() and the link-layer type, snapshot
+ * length and code generation flags of the pcap_t are unchanged, as
+ * long as it doesn't name anything that has to be looked up: a host
+ * or service name may have come to mean something else since, so
+ * programs compiled from such expressions aren't remembered.
+ */
+static int
+compile_cache_match(pcap_t *p, const char *buf, int optimize,
+    bpf_u_int32 mask)
+{
+	return p->cc_expr != NULL && strcmp(p->cc_expr, buf) == 0 &&
+	    p->cc_optimize == optimize && p->cc_mask == mask &&
+	    p->cc_linktype == p->linktype &&
+	    p->cc_snaplen == pcap_snapshot(p) &&
+	    p->cc_flags == p->bpf_codegen_flags;
+}
+
+/*
+ * Copy the program pcap_compile() last produced for 'buf' into
+ * 'program'; return 0 if there is no such program.
+ */
+static int
+compile_cache_get(pcap_t *p, struct bpf_program *program, const char *buf,
+    int optimize, bpf_u_int32 mask)
+{
+	struct bpf_insn *insns;
+	size_t size;
+
+	if (!compile_cache_match(p, buf, optimize, mask))
+		return 0;
+	size = p->cc_prog.bf_len * sizeof(*insns);
+	if ((insns = malloc(size)) == NULL)
+		return 0;
+	memcpy(insns, p->cc_prog.bf_insns, size);
+	program->bf_insns = insns;
+	program->bf_len = p->cc_prog.bf_len;
+	return 1;
+}
+
+/*
+ * Remember a copy of 'program' as compiled from 'buf'.  This is only
+ * an optimization, so failing to allocate memory for it is not an
+ * error.
+ */
+static void
+compile_cache_put(pcap_t *p, const struct bpf_program *program,
+    const char *buf, int optimize, bpf_u_int32 mask)
+{
+	size_t size;
+
+	if (p->cc_expr != NULL) {
+		free(p->cc_expr);
+		p->cc_expr = NULL;
+	}
+	pcap_freecode(&p->cc_prog);
+	size = program->bf_len * sizeof(*program->bf_insns);
+	if ((p->cc_prog.bf_insns = malloc(size)) == NULL)
+		return;
+	if ((p->cc_expr = strdup(buf)) == NULL) {
+		pcap_freecode(&p->cc_prog);
+		return;
+	}
+	memcpy(p->cc_prog.bf_insns, program->bf_insns, size);
+	p->cc_prog.bf_len = program->bf_len;
+	p->cc_optimize = optimize;
+	p->cc_mask = mask;
+	p->cc_linktype = p->linktype;
+	p->cc_snaplen = pcap_snapshot(p);
+	p->cc_flags = p->bpf_codegen_flags;
+}
+
 int
 pcap_compile(pcap_t *p, struct bpf_program *program,
 	     const char *buf, int optimize, bpf_u_int32 mask)
@@ -758,14 +865,20 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 		(p->save_current_filter_op)(p, buf);
 #endif
 
+	if (compile_cache_get(p, program, xbuf ? xbuf : "", optimize, mask))
+		return (0);
+
 	initchunks(&cstate);
 	cstate.no_optimize = 0;
 #ifdef INET6
 	cstate.ai = NULL;
 #endif
 	cstate.e = NULL;
+	cstate.names_resolved = 0;
 	cstate.ic.root = NULL;
 	cstate.ic.cur_mark = 0;
+	cstate.n_ksets = 0;
+	cstate.free_blocks = NULL;
 	cstate.bpf_pcap = p;
 	init_regs(&cstate);
 
@@ -817,6 +930,16 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 	}
 
 	if (optimize && !cstate.no_optimize) {
+		/*
+		 * Sets too small for a search tree to pay off go back
+		 * to plain comparisons that the optimizer can see
+		 * through; larger ones stay single blocks until it is
+		 * done with them.
+		 */
+		if (expand_ksets(&cstate, 0) == -1) {
+			rc = -1;
+			goto quit;
+		}
 		if (bpf_optimize(&cstate.ic, p->errbuf) == -1) {
 			/* Failure */
 			rc = -1;
@@ -830,6 +953,10 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 			goto quit;
 		}
 	}
+	if (expand_ksets(&cstate, 1) == -1) {
+		rc = -1;
+		goto quit;
+	}
 	program->bf_insns = icode_to_fcode(&cstate.ic,
 	    cstate.ic.root, &len, p->errbuf);
 	if (program->bf_insns == NULL) {
@@ -838,6 +965,9 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 		goto quit;
 	}
 	program->bf_len = len;
+	if (!cstate.names_resolved)
+		compile_cache_put(p, program, xbuf ? xbuf : "", optimize,
+		    mask);
 
 	rc = 0;  /* We're all okay */
 
@@ -1016,6 +1146,510 @@ gen_not(struct block *b)
 	b->sense = !b->sense;
 }
 
+/*
+ * A term such as "host a" or "port a" compiles to a dag in which "a"
+ * only shows up as the constant of some "jeq" blocks, each of which
+ * ends the term with a match when it succeeds.  Or-ing two such terms
+ * that differ only in those constants gives the same result as
+ * testing each of those fields for membership in the set of both
+ * constants, so rather than chain the two dags, gen_or_fold() keeps
+ * one of them and hangs the other's constants off it.  A filter that
+ * lists thousands of hosts then costs the optimizer no more than one
+ * that lists a few, and expand_ksets() turns each set into a binary
+ * search rather than a linear run of comparisons.
+ *
+ * While two terms are being compared, the 'link' field of each block
+ * points at its counterpart in the other term, and 'level' records
+ * which exit list, if any, the block is on.  Neither is used before
+ * the optimizer sets them itself.
+ */
+#define KFOLD_MAXBLKS	256	/* give up on terms bigger than this */
+#define KFOLD_TRUE	1	/* block is on the term's true exit list */
+#define KFOLD_FALSE	2	/* block is on the term's false exit list */
+
+struct kfold {
+	struct block *tail[2];
+	struct block *seen[2 * KFOLD_MAXBLKS];
+	u_int nseen;
+	struct block *diff[KFOLD_MAXBLKS][2];
+	u_int ndiff;
+	struct block *dead[KFOLD_MAXBLKS];
+	u_int ndead;
+};
+
+static int
+kfold_seen(struct kfold *kf, struct block *b)
+{
+	if (kf->nseen >= sizeof(kf->seen) / sizeof(kf->seen[0]))
+		return 0;
+	kf->seen[kf->nseen++] = b;
+	return 1;
+}
+
+/*
+ * Tag the blocks on the exit list of the term ending at 'tail' that
+ * starts with its 'jt' branch; return the length of the list, or -1
+ * if it is longer than 'max'.
+ */
+static int
+kfold_tag(struct kfold *kf, struct block *tail, int jt, int tag, int max)
+{
+	struct block *b;
+	int n;
+
+	b = jt ? JT(tail) : JF(tail);
+	for (n = 0; b != NULL; n++) {
+		if (n >= max || !kfold_seen(kf, b))
+			return -1;
+		b->level = tag;
+		b = !b->sense ? JT(b) : JF(b);
+	}
+	return n;
+}
+
+/*
+ * Return the exit list the 'jt' branch of 'b' is on, or 0 if that
+ * branch is resolved.
+ */
+static int
+kfold_exit(struct block *b, struct block *tail, int jt)
+{
+	if (b == tail)
+		return jt == !b->sense ? KFOLD_TRUE : KFOLD_FALSE;
+	if (jt != !b->sense)
+		return 0;
+	return b->level;
+}
+
+static int
+kfold_eq_slist(struct slist *x, struct slist *y)
+{
+	for (; x != NULL && y != NULL; x = x->next, y = y->next)
+		if (x->s.code != y->s.code || x->s.k != y->s.k ||
+		    x->s.jt != NULL || x->s.jf != NULL ||
+		    y->s.jt != NULL || y->s.jf != NULL)
+			return 0;
+	return x == y;
+}
+
+/*
+ * Check that 'x' and 'y' head the same dag apart from the constants
+ * of "jeq" blocks that jump straight to a match, which are collected
+ * in kf->diff.
+ */
+static int
+kfold_match(struct kfold *kf, struct block *x, struct block *y)
+{
+	struct block *sx, *sy;
+	int jt, ex, ey;
+
+	if (x->link != NULL || y->link != NULL)
+		return x->link == y && y->link == x;
+	if (!kfold_seen(kf, x) || !kfold_seen(kf, y) ||
+	    kf->ndead >= KFOLD_MAXBLKS)
+		return 0;
+	kf->dead[kf->ndead++] = x;
+	x->link = y;
+	y->link = x;
+
+	if (x->s.code != y->s.code || !kfold_eq_slist(x->stmts, y->stmts))
+		return 0;
+	if (x->s.k != y->s.k || x->kset != NULL || y->kset != NULL) {
+		if (x->s.code != (BPF_JMP|BPF_JEQ|BPF_K) ||
+		    kfold_exit(x, kf->tail[0], 1) != KFOLD_TRUE ||
+		    kfold_exit(y, kf->tail[1], 1) != KFOLD_TRUE ||
+		    kf->ndiff >= KFOLD_MAXBLKS)
+			return 0;
+		kf->diff[kf->ndiff][0] = x;
+		kf->diff[kf->ndiff][1] = y;
+		kf->ndiff++;
+	}
+	if (BPF_CLASS(x->s.code) != BPF_JMP)
+		return 1;
+	for (jt = 1; jt >= 0; jt--) {
+		ex = kfold_exit(x, kf->tail[0], jt);
+		ey = kfold_exit(y, kf->tail[1], jt);
+		if (ex != ey)
+			return 0;
+		if (ex != 0)
+			continue;
+		sx = jt ? JT(x) : JF(x);
+		sy = jt ? JT(y) : JF(y);
+		if (sx == NULL || sy == NULL || !kfold_match(kf, sx, sy))
+			return 0;
+	}
+	return 1;
+}
+
+static int
+kset_add(compiler_state_t *cstate, struct kset *ks, bpf_u_int32 v)
+{
+	bpf_u_int32 *k;
+
+	if (ks->n == ks->max) {
+		k = newchunk_nolongjmp(cstate, 2 * ks->max * sizeof(*k));
+		if (k == NULL)
+			return -1;
+		memcpy(k, ks->k, ks->n * sizeof(*k));
+		ks->k = k;
+		ks->max *= 2;
+	}
+	ks->k[ks->n++] = v;
+	return 0;
+}
+
+/*
+ * Give 'y' a set holding its own constants and those of its
+ * counterpart 'x'.  If this fails part way, 'y' is left with its own
+ * constants and some of those of 'x', which is still correct when
+ * 'y' ends up or-ed with 'x'.
+ */
+static int
+kfold_merge(compiler_state_t *cstate, struct block *x, struct block *y)
+{
+	struct kset *ks, *from;
+	u_int i;
+
+	if (x->kset == NULL && y->kset == NULL) {
+		ks = newchunk_nolongjmp(cstate, sizeof(*ks));
+		if (ks == NULL)
+			return -1;
+		ks->k = newchunk_nolongjmp(cstate, 4 * sizeof(*ks->k));
+		if (ks->k == NULL)
+			return -1;
+		ks->max = 4;
+		ks->n = 2;
+		ks->k[0] = (bpf_u_int32)y->s.k;
+		ks->k[1] = (bpf_u_int32)x->s.k;
+		ks->id = cstate->n_ksets++;
+		y->kset = ks;
+		return 0;
+	}
+	if (y->kset == NULL) {
+		if (kset_add(cstate, x->kset, (bpf_u_int32)y->s.k) == -1)
+			return -1;
+		y->kset = x->kset;
+		return 0;
+	}
+	if (x->kset == NULL)
+		return kset_add(cstate, y->kset, (bpf_u_int32)x->s.k);
+	ks = y->kset;
+	from = x->kset;
+	for (i = 0; i < from->n; i++)
+		if (kset_add(cstate, ks, from->k[i]) == -1)
+			return -1;
+	return 0;
+}
+
+/*
+ * Or 'b0' with 'b1', as gen_or() does, folding 'b0' into 'b1' if the
+ * two terms only differ in the constants they match a field against.
+ * The result is 'b1' either way.
+ */
+void
+gen_or_fold(compiler_state_t *cstate, struct block *b0, struct block *b1)
+{
+	struct kfold kf;
+	int nt, nf, ok;
+	u_int i;
+
+	kf.tail[0] = b0;
+	kf.tail[1] = b1;
+	kf.nseen = 0;
+	kf.ndiff = 0;
+	kf.ndead = 0;
+	ok = (nt = kfold_tag(&kf, b1, !b1->sense, KFOLD_TRUE,
+	    KFOLD_MAXBLKS)) >= 0 &&
+	    (nf = kfold_tag(&kf, b1, b1->sense, KFOLD_FALSE,
+	    KFOLD_MAXBLKS)) >= 0 &&
+	    kfold_tag(&kf, b0, !b0->sense, KFOLD_TRUE, nt) == nt &&
+	    kfold_tag(&kf, b0, b0->sense, KFOLD_FALSE, nf) == nf &&
+	    kfold_match(&kf, b0->head, b1->head) &&
+	    kf.ndiff > 0;
+	for (i = 0; i < kf.nseen; i++) {
+		kf.seen[i]->link = NULL;
+		kf.seen[i]->level = 0;
+	}
+	if (ok) {
+		for (i = 0; i < kf.ndiff; i++)
+			if (kfold_merge(cstate, kf.diff[i][0],
+			    kf.diff[i][1]) == -1)
+				break;
+		if (i == kf.ndiff) {
+			/*
+			 * Nothing refers to the blocks of 'b0' any more.
+			 */
+			for (i = 0; i < kf.ndead; i++) {
+				kf.dead[i]->link = cstate->free_blocks;
+				cstate->free_blocks = kf.dead[i];
+			}
+			return;
+		}
+	}
+	gen_or(b0, b1);
+}
+
+static int
+kset_cmp(const void *a, const void *b)
+{
+	bpf_u_int32 x = *(const bpf_u_int32 *)a;
+	bpf_u_int32 y = *(const bpf_u_int32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Return a block to branch to instead of 'b', which is 'b' itself
+ * unless it is a return, in which case it is a copy that can be laid
+ * out next to the branch rather than needing a long jump to reach.
+ */
+static struct block *
+kset_target(compiler_state_t *cstate, struct block *b)
+{
+	struct block *b1;
+
+	if (BPF_CLASS(b->s.code) != BPF_RET)
+		return b;
+	b1 = new_block(cstate, b->s.code);
+	b1->s.k = b->s.k;
+	return b1;
+}
+
+/*
+ * Build a search for the accumulator in the 'n' sorted constants at
+ * 'k', going to 't' if it is found and to 'f' if not: "jgt" blocks
+ * halve the range until it is small enough for a run of "jeq"s.
+ */
+static struct block *
+kset_tree(compiler_state_t *cstate, const bpf_u_int32 *k, u_int n,
+    struct block *t, struct block *f)
+{
+	struct block *b, *b1;
+	u_int mid;
+
+	if (n <= KSET_CHAIN) {
+		t = kset_target(cstate, t);
+		b = kset_target(cstate, f);
+		while (n-- > 0) {
+			b1 = new_block(cstate, BPF_JMP|BPF_JEQ|BPF_K);
+			b1->s.k = (bpf_int32)k[n];
+			JT(b1) = t;
+			JF(b1) = b;
+			b = b1;
+		}
+		return b;
+	}
+	mid = n / 2;
+	b = new_block(cstate, BPF_JMP|BPF_JGT|BPF_K);
+	b->s.k = (bpf_int32)k[mid - 1];
+	JT(b) = kset_tree(cstate, k + mid, n - mid, t, f);
+	JF(b) = kset_tree(cstate, k, mid, t, f);
+	return b;
+}
+
+/*
+ * Sets seen by expand_ksets(), and the searches built for them, so
+ * that blocks testing the same constants can share one set (and then
+ * be merged by the optimizer) and one search.
+ */
+struct kset_built {
+	struct kset *ks;
+	struct block *t, *f, *r;
+	struct kset_built *next;
+};
+
+static int
+kset_eq(const struct kset *a, const struct kset *b)
+{
+	return a == b || (a->n == b->n &&
+	    memcmp(a->k, b->k, a->n * sizeof(*a->k)) == 0);
+}
+
+static struct kset *
+kset_share(compiler_state_t *cstate, struct kset_built **built,
+    struct kset *ks)
+{
+	struct kset_built *kb;
+
+	for (kb = *built; kb != NULL; kb = kb->next)
+		if (kset_eq(kb->ks, ks))
+			return kb->ks;
+	kb = (struct kset_built *)newchunk(cstate, sizeof(*kb));
+	kb->ks = ks;
+	kb->next = *built;
+	*built = kb;
+	return ks;
+}
+
+static struct block *
+kset_search(compiler_state_t *cstate, struct kset_built **built,
+    struct kset *ks, struct block *t, struct block *f)
+{
+	struct kset_built *kb;
+
+	for (kb = *built; kb != NULL; kb = kb->next)
+		if (kb->t == t && kb->f == f && kset_eq(kb->ks, ks))
+			return kb->r;
+	kb = (struct kset_built *)newchunk(cstate, sizeof(*kb));
+	kb->ks = ks;
+	kb->t = t;
+	kb->f = f;
+	kb->r = kset_tree(cstate, ks->k, ks->n, t, f);
+	kb->next = *built;
+	*built = kb;
+	return kb->r;
+}
+
+/*
+ * Return a copy of 's' if running it a second time, straight after the
+ * first, leaves the same values behind; otherwise NULL.  That is so
+ * unless it reads a register, or a scratch memory word, before it
+ * writes it and then writes it afterwards.
+ */
+#define KSET_A		((bpf_u_int32)1 << BPF_MEMWORDS)
+#define KSET_X		((bpf_u_int32)1 << (BPF_MEMWORDS + 1))
+#define KSET_M(k)	((bpf_u_int32)1 << ((k) & (BPF_MEMWORDS - 1)))
+
+static struct slist *
+kset_reload(compiler_state_t *cstate, struct slist *s)
+{
+	struct slist *s0 = NULL, *s1, **sp = &s0;
+	bpf_u_int32 use, def, used = 0, defd = 0;
+
+	for (; s != NULL; s = s->next) {
+		use = def = 0;
+		switch (BPF_CLASS(s->s.code)) {
+		case BPF_LD:
+			def = KSET_A;
+			if (BPF_MODE(s->s.code) == BPF_IND)
+				use = KSET_X;
+			else if (BPF_MODE(s->s.code) == BPF_MEM)
+				use = KSET_M(s->s.k);
+			break;
+		case BPF_LDX:
+			def = KSET_X;
+			if (BPF_MODE(s->s.code) == BPF_MEM)
+				use = KSET_M(s->s.k);
+			break;
+		case BPF_ST:
+			use = KSET_A;
+			def = KSET_M(s->s.k);
+			break;
+		case BPF_STX:
+			use = KSET_X;
+			def = KSET_M(s->s.k);
+			break;
+		case BPF_ALU:
+			use = KSET_A;
+			if (BPF_SRC(s->s.code) == BPF_X)
+				use |= KSET_X;
+			def = KSET_A;
+			break;
+		case BPF_MISC:
+			if (BPF_MISCOP(s->s.code) == BPF_TAX) {
+				use = KSET_A;
+				def = KSET_X;
+			} else {
+				use = KSET_X;
+				def = KSET_A;
+			}
+			break;
+		default:
+			return NULL;
+		}
+		if (s->s.jt != NULL || s->s.jf != NULL)
+			return NULL;
+		used |= use & ~defd;
+		defd |= def;
+		s1 = new_stmt(cstate, s->s.code);
+		s1->s.k = s->s.k;
+		*sp = s1;
+		sp = &s1->next;
+	}
+	return (used & defd) ? NULL : s0;
+}
+
+/*
+ * Turn 'b' back into the run of comparisons that or-ing one term per
+ * constant would have produced, each reloading the field, so that
+ * the optimizer treats it as it always has.
+ */
+static void
+kset_chain(compiler_state_t *cstate, struct block *b)
+{
+	struct kset *ks = b->kset;
+	struct block *b1, *next;
+	u_int n;
+
+	next = JF(b);
+	for (n = ks->n; --n > 0; ) {
+		b1 = new_block(cstate, BPF_JMP|BPF_JEQ|BPF_K);
+		b1->s.k = (bpf_int32)ks->k[n];
+		b1->stmts = kset_reload(cstate, b->stmts);
+		JT(b1) = JT(b);
+		JF(b1) = next;
+		next = b1;
+	}
+	b->s.k = (bpf_int32)ks->k[0];
+	JF(b) = next;
+}
+
+static void
+expand_ksets_r(compiler_state_t *cstate, struct kset_built **built,
+    struct block *b, int all)
+{
+	struct kset *ks;
+	struct block *t, *f, *r;
+	u_int i, n;
+
+	if (b == NULL || isMarked(&cstate->ic, b))
+		return;
+	Mark(&cstate->ic, b);
+	t = JT(b);
+	f = JF(b);
+	if ((ks = b->kset) != NULL) {
+		qsort(ks->k, ks->n, sizeof(*ks->k), kset_cmp);
+		for (i = n = 1; i < ks->n; i++)
+			if (ks->k[i] != ks->k[n - 1])
+				ks->k[n++] = ks->k[i];
+		ks->n = n;
+		if (!all) {
+			if (n < KSET_OPAQUE) {
+				kset_chain(cstate, b);
+				b->kset = NULL;
+			} else
+				b->kset = kset_share(cstate, built, ks);
+		} else {
+			r = kset_search(cstate, built, ks, t, f);
+			b->s = r->s;
+			JT(b) = JT(r);
+			JF(b) = JF(r);
+			b->kset = NULL;
+		}
+	}
+	expand_ksets_r(cstate, built, t, all);
+	expand_ksets_r(cstate, built, f, all);
+}
+
+/*
+ * Replace the sets of constants left by gen_or_fold() with real
+ * branches: all of them if 'all' is set, otherwise just those too
+ * small to be worth hiding from the optimizer.
+ */
+static int
+expand_ksets(compiler_state_t *cstate, int all)
+{
+	struct kset_built *built = NULL;
+
+	if (cstate->n_ksets == 0)
+		return (0);
+	if (setjmp(cstate->top_ctx))
+		return (-1);
+	unMarkAll(&cstate->ic);
+	expand_ksets_r(cstate, &built, cstate->ic.root, all);
+	return (0);
+}
+
 static struct block *
 gen_cmp(compiler_state_t *cstate, enum e_offrel offrel, u_int offset,
     u_int size, bpf_int32 v)
@@ -6661,6 +7295,11 @@ gen_scode(compiler_state_t *cstate, const char *name, struct qual q)
 	if (setjmp(cstate->top_ctx))
 		return (NULL);
 
+	/*
+	 * Every case below looks the name up one way or another.
+	 */
+	cstate->names_resolved = 1;
+
 	switch (q.addr) {
 
 	case Q_NET:
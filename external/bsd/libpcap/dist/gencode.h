@@ -242,6 +242,19 @@ struct edge {
 	struct edge *next;	/* link list of incoming edges for a node */
 };
 
+/*
+ * The constants a block's "jeq #k" is really compared against, when
+ * gen_or_fold() has folded "x == a or x == b or ..." into one block.
+ * 'k' is unsorted and may hold duplicates until expand_ksets() turns
+ * the block back into real BPF branches.
+ */
+struct kset {
+	u_int n;
+	u_int max;
+	bpf_u_int32 *k;
+	int id;
+};
+
 struct block {
 	int id;
 	struct slist *stmts;	/* side effect stmts */
@@ -264,6 +277,7 @@ struct block {
 	atomset out_use;
 	int oval;
 	int val[N_ATOMS];
+	struct kset *kset;	/* non-null: "jeq" tests membership in a set */
 };
 
 /*
@@ -296,6 +310,7 @@ struct arth *gen_arth(compiler_state_t *, int, struct arth *, struct arth *);
 
 void gen_and(struct block *, struct block *);
 void gen_or(struct block *, struct block *);
+void gen_or_fold(compiler_state_t *, struct block *, struct block *);
 void gen_not(struct block *);
 
 struct block *gen_scode(compiler_state_t *, const char *, struct qual);
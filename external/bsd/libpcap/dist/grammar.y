@@ -374,8 +374,8 @@ null:	  /* null */		{ $$.q = qerr; }
 expr:	  term
 	| expr and term		{ gen_and($1.b, $3.b); $$ = $3; }
 	| expr and id		{ gen_and($1.b, $3.b); $$ = $3; }
-	| expr or term		{ gen_or($1.b, $3.b); $$ = $3; }
-	| expr or id		{ gen_or($1.b, $3.b); $$ = $3; }
+	| expr or term		{ gen_or_fold(cstate, $1.b, $3.b); $$ = $3; }
+	| expr or id		{ gen_or_fold(cstate, $1.b, $3.b); $$ = $3; }
 	;
 and:	  AND			{ $$ = $<blk>0; }
 	;
@@ -442,7 +442,7 @@ paren:	  '('			{ $$ = $<blk>0; }
 	;
 pid:	  nid
 	| qid and id		{ gen_and($1.b, $3.b); $$ = $3; }
-	| qid or id		{ gen_or($1.b, $3.b); $$ = $3; }
+	| qid or id		{ gen_or_fold(cstate, $1.b, $3.b); $$ = $3; }
 	;
 qid:	  pnum			{ CHECK_PTR_VAL(($$.b = gen_ncode(cstate, NULL, (bpf_u_int32)$1,
 						   $$.q = $<blk>0.q))); }
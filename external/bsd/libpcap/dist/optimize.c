@@ -324,6 +324,14 @@ typedef struct {
 	struct vmapinfo *vmap;
 	struct valnode *vnode_base;
 	struct valnode *next_vnode;
+
+	/*
+	 * Hash chains used by intern_blocks(): 'ihead' has 'imask' + 1
+	 * entries, 'inext' one per block.
+	 */
+	int *ihead;
+	int *inext;
+	u_int imask;
 } opt_state_t;
 
 typedef struct {
@@ -345,6 +353,12 @@ typedef struct {
 	 */
 	struct bpf_insn *fstart;
 	struct bpf_insn *ftail;
+
+	/*
+	 * Set when a branch was found to need a long jump during this
+	 * pass, so the code has to be laid out again.
+	 */
+	int relayout;
 } conv_state_t;
 
 static void opt_init(opt_state_t *, struct icode *);
@@ -823,6 +837,17 @@ this_op(struct slist *s)
 	return s;
 }
 
+static int
+kset_member(const struct kset *ks, bpf_int32 v)
+{
+	u_int i;
+
+	for (i = 0; i < ks->n; i++)
+		if (ks->k[i] == (bpf_u_int32)v)
+			return 1;
+	return 0;
+}
+
 static void
 opt_not(struct block *b)
 {
@@ -968,7 +993,7 @@ opt_peep(opt_state_t *opt_state, struct block *b)
 	 * the operation preceding the comparison is an arithmetic
 	 * operation, we can sometime optimize it away.
 	 */
-	if (b->s.code == (BPF_JMP|BPF_JEQ|BPF_K) &&
+	if (b->s.code == (BPF_JMP|BPF_JEQ|BPF_K) && b->kset == NULL &&
 	    !ATOMELEM(b->out_use, A_ATOM)) {
 	    	/*
 	    	 * We can optimize away certain subtractions of the
@@ -1062,7 +1087,10 @@ opt_peep(opt_state_t *opt_state, struct block *b)
 		switch (BPF_OP(b->s.code)) {
 
 		case BPF_JEQ:
-			v = v == b->s.k;
+			if (b->kset != NULL)
+				v = kset_member(b->kset, v);
+			else
+				v = v == b->s.k;
 			break;
 
 		case BPF_JGT:
@@ -1458,9 +1486,12 @@ opt_blk(opt_state_t *opt_state, struct block *b, int do_stmts)
 		opt_deadstores(opt_state, b);
 	}
 	/*
-	 * Set up values for branch optimizer.
+	 * Set up values for branch optimizer.  A set membership test
+	 * gets a value of its own, so it only ever matches itself.
 	 */
-	if (BPF_SRC(b->s.code) == BPF_K)
+	if (b->kset != NULL)
+		b->oval = F(opt_state, BPF_JMP|BPF_JEQ|BPF_K, b->kset->id, 0);
+	else if (BPF_SRC(b->s.code) == BPF_K)
 		b->oval = K(b->s.k);
 	else
 		b->oval = b->val[X_ATOM];
@@ -1521,7 +1552,8 @@ fold_edge(struct block *child, struct edge *ep)
 		 */
 		return sense ? JT(child) : JF(child);
 
-	if (sense && code == (BPF_JMP|BPF_JEQ|BPF_K))
+	if (sense && code == (BPF_JMP|BPF_JEQ|BPF_K) &&
+	    child->kset == NULL && ep->pred->kset == NULL)
 		/*
 		 * At this point, we only know the comparison if we
 		 * came down the true branch, and it was an equality
@@ -1534,7 +1566,8 @@ fold_edge(struct block *child, struct edge *ep)
 		 * constant, we don't know what was in the accumulator.
 		 *
 		 * We rely on the fact that distinct constants have distinct
-		 * value numbers.
+		 * value numbers.  None of this holds if either branch tests
+		 * membership in a set of constants.
 		 */
 		return JF(child);
 
@@ -1982,17 +2015,38 @@ eq_blk(struct block *b0, struct block *b1)
 {
 	if (b0->s.code == b1->s.code &&
 	    b0->s.k == b1->s.k &&
+	    b0->kset == b1->kset &&
 	    b0->et.succ == b1->et.succ &&
 	    b0->ef.succ == b1->ef.succ)
 		return eq_slist(b0->stmts, b1->stmts);
 	return 0;
 }
 
+/*
+ * Hash everything eq_blk() compares.
+ */
+static u_int
+hash_blk(struct block *b)
+{
+	struct slist *s;
+	u_int h;
+
+	h = (u_int)b->s.code * 31 + (u_int)b->s.k;
+	h = h * 31 + (u_int)(uintptr_t)b->et.succ;
+	h = h * 31 + (u_int)(uintptr_t)b->ef.succ;
+	h = h * 31 + (u_int)(uintptr_t)b->kset;
+	for (s = b->stmts; s; s = s->next)
+		if (s->s.code != NOP)
+			h = (h * 31 + (u_int)s->s.code) * 31 + (u_int)s->s.k;
+	return h ^ (h >> 16);
+}
+
 static void
 intern_blocks(opt_state_t *opt_state, struct icode *ic)
 {
-	struct block *p;
+	struct block *p, *q;
 	int i, j;
+	u_int h;
 	int done1; /* don't shadow global */
  top:
 	done1 = 1;
@@ -2001,18 +2055,28 @@ intern_blocks(opt_state_t *opt_state, struct icode *ic)
 
 	mark_code(ic);
 
-	for (i = opt_state->n_blocks - 1; --i >= 0; ) {
-		if (!isMarked(ic, opt_state->blocks[i]))
+	/*
+	 * Point each block at the highest-numbered live block equal to
+	 * it.  Walking down from the top and pushing each block on the
+	 * front of its hash chain means the first match found is the
+	 * nearest one above, whose own link already leads to the last.
+	 */
+	for (h = 0; h <= opt_state->imask; h++)
+		opt_state->ihead[h] = -1;
+	for (i = opt_state->n_blocks; --i >= 0; ) {
+		p = opt_state->blocks[i];
+		if (!isMarked(ic, p))
 			continue;
-		for (j = i + 1; j < opt_state->n_blocks; ++j) {
-			if (!isMarked(ic, opt_state->blocks[j]))
-				continue;
-			if (eq_blk(opt_state->blocks[i], opt_state->blocks[j])) {
-				opt_state->blocks[i]->link = opt_state->blocks[j]->link ?
-					opt_state->blocks[j]->link : opt_state->blocks[j];
+		h = hash_blk(p) & opt_state->imask;
+		for (j = opt_state->ihead[h]; j >= 0; j = opt_state->inext[j]) {
+			q = opt_state->blocks[j];
+			if (eq_blk(p, q)) {
+				p->link = q->link ? q->link : q;
 				break;
 			}
 		}
+		opt_state->inext[i] = opt_state->ihead[h];
+		opt_state->ihead[h] = i;
 	}
 	for (i = 0; i < opt_state->n_blocks; ++i) {
 		p = opt_state->blocks[i];
@@ -2040,6 +2104,8 @@ opt_cleanup(opt_state_t *opt_state)
 	free((void *)opt_state->space);
 	free((void *)opt_state->levels);
 	free((void *)opt_state->blocks);
+	free((void *)opt_state->ihead);
+	free((void *)opt_state->inext);
 }
 
 /*
@@ -2228,6 +2294,14 @@ opt_init(opt_state_t *opt_state, struct icode *ic)
 	if (opt_state->vnode_base == NULL) {
 		opt_error(opt_state, "malloc");
 	}
+
+	for (opt_state->imask = 15; opt_state->imask < (u_int)n;)
+		opt_state->imask = (opt_state->imask << 1) | 1;
+	opt_state->ihead = (int *)malloc((opt_state->imask + 1) * sizeof(*opt_state->ihead));
+	opt_state->inext = (int *)malloc(n * sizeof(*opt_state->inext));
+	if (opt_state->ihead == NULL || opt_state->inext == NULL) {
+		opt_error(opt_state, "malloc");
+	}
 }
 
 /*
@@ -2243,12 +2317,13 @@ static void PCAP_NORETURN conv_error(conv_state_t *, const char *, ...)
     PCAP_PRINTFLIKE(2, 3);
 
 /*
- * Returns true if successful.  Returns false if a branch has
- * an offset that is too large.  If so, we have marked that
- * branch so that on a subsequent iteration, it will be treated
- * properly.
+ * Lay out the code for 'p' and everything reachable from it.  If a
+ * branch turns out to need a long jump it did not have room for, it
+ * is marked so that the next pass will give it one, and
+ * conv_state->relayout is set; the rest of the pass carries on, so
+ * that all such branches are found at once rather than one per pass.
  */
-static int
+static void
 convert_code_r(conv_state_t *conv_state, struct icode *ic, struct block *p)
 {
 	struct bpf_insn *dst;
@@ -2259,13 +2334,11 @@ convert_code_r(conv_state_t *conv_state, struct icode *ic, struct block *p)
 	struct slist **offset = NULL;
 
 	if (p == 0 || isMarked(ic, p))
-		return (1);
+		return;
 	Mark(ic, p);
 
-	if (convert_code_r(conv_state, ic, JF(p)) == 0)
-		return (0);
-	if (convert_code_r(conv_state, ic, JT(p)) == 0)
-		return (0);
+	convert_code_r(conv_state, ic, JF(p));
+	convert_code_r(conv_state, ic, JT(p));
 
 	slen = slength(p->stmts);
 	dst = conv_state->ftail -= (slen + 1 + p->longjt + p->longjf);
@@ -2386,7 +2459,8 @@ filled:
 		    if (p->longjt == 0) {
 		    	/* mark this instruction and retry */
 			p->longjt++;
-			return(0);
+			conv_state->relayout = 1;
+			goto do_jf;
 		    }
 		    /* branch if T to following jump */
 		    if (extrajmps >= 256) {
@@ -2400,13 +2474,15 @@ filled:
 		}
 		else
 		    dst->jt = (u_char)off;
+	do_jf:
 		off = JF(p)->offset - (p->offset + slen) - 1;
 		if (off >= 256) {
 		    /* offset too large for branch, must add a jump */
 		    if (p->longjf == 0) {
 		    	/* mark this instruction and retry */
 			p->longjf++;
-			return(0);
+			conv_state->relayout = 1;
+			return;
 		    }
 		    /* branch if F to following jump */
 		    /* if two jumps are inserted, F goes to second one */
@@ -2422,7 +2498,6 @@ filled:
 		else
 		    dst->jf = (u_char)off;
 	}
-	return (1);
 }
 
 
@@ -2479,7 +2554,9 @@ icode_to_fcode(struct icode *ic, struct block *root, u_int *lenp,
 	    conv_state.ftail = fp + n;
 
 	    unMarkAll(ic);
-	    if (convert_code_r(&conv_state, ic, root))
+	    conv_state.relayout = 0;
+	    convert_code_r(&conv_state, ic, root);
+	    if (!conv_state.relayout)
 		break;
 	    free(fp);
 	}
@@ -2529,6 +2606,8 @@ install_bpf_program(pcap_t *p, struct bpf_program *fp)
 	 * Free up any already installed program.
 	 */
 	pcap_freecode(&p->fcode);
+	pcap_bpf_jit_free(p->fjit, p->fjit_size);
+	p->fjit = NULL;
 
 	prog_size = sizeof(*fp->bf_insns) * fp->bf_len;
 	p->fcode.bf_len = fp->bf_len;
@@ -2539,6 +2618,13 @@ install_bpf_program(pcap_t *p, struct bpf_program *fp)
 		return (-1);
 	}
 	memcpy(p->fcode.bf_insns, fp->bf_insns, prog_size);
+
+	/*
+	 * Compile it to native code if we can; if not, the
+	 * interpreter runs it.
+	 */
+	p->fjit = pcap_bpf_jit_compile(p->fcode.bf_insns, p->fcode.bf_len,
+	    &p->fjit_size);
 	return (0);
 }
 
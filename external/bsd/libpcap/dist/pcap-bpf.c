@@ -51,6 +51,7 @@ __RCSID("$NetBSD: pcap-bpf.c,v 1.10 2019/10/11 18:20:20 christos Exp $");
 #include <sys/utsname.h>
 #ifdef __NetBSD__
 #include <paths.h>
+#include <sys/sysctl.h>
 #endif
 
 #if defined(__FreeBSD__) && defined(SIOCIFCREATE2)
@@ -946,6 +947,7 @@ pcap_read_bpf(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 	struct pcap_bpf *pb = p->priv;
 	int cc;
 	int n = 0;
+	int limit;
 	register u_char *bp, *ep;
 	u_char *datap;
 #ifdef PCAP_FDDIPAD
@@ -1069,7 +1071,9 @@ pcap_read_bpf(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 		bp = p->bp;
 
 	/*
-	 * Loop through each packet.
+	 * Loop through each packet.  A read can return a large buffer
+	 * full of them, so work out beforehand how many we can hand to
+	 * the callback; -1 means no limit, which ++n never reaches.
 	 */
 #ifdef BIOCSTSTAMP
 #define bhp ((struct bpf_xhdr *)bp)
@@ -1080,6 +1084,7 @@ pcap_read_bpf(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 #ifdef PCAP_FDDIPAD
 	pad = p->fddipad;
 #endif
+	limit = PACKET_COUNT_IS_UNLIMITED(cnt) ? -1 : cnt;
 	while (bp < ep) {
 		register u_int caplen, hdrlen;
 
@@ -1135,7 +1140,7 @@ pcap_read_bpf(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 #endif
 		 */
 		if (pb->filtering_in_kernel ||
-		    bpf_filter(p->fcode.bf_insns, datap, bhp->bh_datalen, caplen)) {
+		    pcap_run_filter(p, datap, bhp->bh_datalen, caplen)) {
 			struct pcap_pkthdr pkthdr;
 #ifdef BIOCSTSTAMP
 			struct bintime bt;
@@ -1183,7 +1188,7 @@ pcap_read_bpf(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 #endif
 			(*callback)(user, &pkthdr, datap);
 			bp += BPF_WORDALIGN(caplen + hdrlen);
-			if (++n >= cnt && !PACKET_COUNT_IS_UNLIMITED(cnt)) {
+			if (++n == limit) {
 				p->bp = bp;
 				p->cc = ep - bp;
 				/*
@@ -1635,6 +1640,36 @@ check_setif_failure(pcap_t *p, int error)
 #define DEFAULT_BUFSIZE	524288
 #endif
 
+#ifdef __NetBSD__
+/*
+ * NetBSD's BPF has no zero-copy mode, but it does keep two buffers of
+ * the size we ask for, filling one while we read the other, and
+ * quietly caps that size at the value of the net.bpf.maxbufsize
+ * sysctl.  Busy links drop packets when the buffer being filled runs
+ * out before we come back for the other one, and the cure is to make
+ * them bigger; so if no size was asked for, use as large a buffer as
+ * the administrator allows, up to DEFAULT_MAXBUFSIZE, and let
+ * raising net.bpf.maxbufsize be all it takes.  bpf_maxbufsize()
+ * returns that size, or 'v' if it is larger.
+ */
+#define DEFAULT_MAXBUFSIZE	(16 * 1024 * 1024)
+
+static u_int
+bpf_maxbufsize(u_int v)
+{
+	int max;
+	size_t len;
+
+	len = sizeof(max);
+	if (sysctlbyname("net.bpf.maxbufsize", &max, &len, NULL, 0) < 0 ||
+	    max <= 0)
+		return (v);
+	if (max > DEFAULT_MAXBUFSIZE)
+		max = DEFAULT_MAXBUFSIZE;
+	return ((u_int)max > v ? (u_int)max : v);
+}
+#endif
+
 static int
 pcap_activate_bpf(pcap_t *p)
 {
@@ -2056,6 +2091,9 @@ pcap_activate_bpf(pcap_t *p)
 			if ((ioctl(fd, BIOCGBLEN, (caddr_t)&v) < 0) ||
 			    v < DEFAULT_BUFSIZE)
 				v = DEFAULT_BUFSIZE;
+#ifdef __NetBSD__
+			v = bpf_maxbufsize(v);
+#endif
 			for ( ; v != 0; v >>= 1) {
 				/*
 				 * Ignore the return value - this is because the
@@ -3206,6 +3244,8 @@ pcap_setfilter_bpf(pcap_t *p, struct bpf_program *fp)
 	 * Free any user-mode filter we might happen to have installed.
 	 */
 	pcap_freecode(&p->fcode);
+	pcap_bpf_jit_free(p->fjit, p->fjit_size);
+	p->fjit = NULL;
 
 	/*
 	 * Try to install the kernel filter.
@@ -148,6 +148,16 @@ typedef int	(*live_dump_ended_op_t)(pcap_t *, int);
 typedef PAirpcapHandle	(*get_airpcap_handle_op_t)(pcap_t *);
 #endif
 typedef void	(*cleanup_op_t)(pcap_t *);
+typedef u_int	(*pcap_bpf_jit_func)(const u_char *, u_int, u_int);
+
+/*
+ * We can read gzip-compressed savefiles if we have zlib and a way to
+ * make a FILE * that decompresses as it reads.
+ */
+#if defined(HAVE_ZLIB) && (defined(HAVE_FUNOPEN) || defined(HAVE_FOPENCOOKIE))
+#define SF_GZIP
+struct sf_gzip;
+#endif
 
 /*
  * We put all the stuff used in the read code path at the beginning,
@@ -188,6 +198,9 @@ struct pcap {
 
 	int swapped;
 	FILE *rfile;		/* null if live capture, non-null if savefile */
+#ifdef SF_GZIP
+	struct sf_gzip *rgz;	/* decompression state if rfile is compressed */
+#endif
 	u_int fddipad;
 	struct pcap *next;	/* list of open pcaps that need stuff cleared on close */
 
@@ -249,6 +262,25 @@ struct pcap {
 	 */
 	struct bpf_program fcode;
 
+	/*
+	 * Last program pcap_compile() produced, the expression it was
+	 * compiled from, and the arguments and settings it depends on.
+	 */
+	char *cc_expr;
+	struct bpf_program cc_prog;
+	int cc_optimize;
+	bpf_u_int32 cc_mask;
+	int cc_linktype;
+	int cc_snaplen;
+	int cc_flags;
+
+	/*
+	 * Native code for fcode, if it could be compiled, and the size
+	 * of its mapping.
+	 */
+	pcap_bpf_jit_func fjit;
+	size_t fjit_size;
+
 	char errbuf[PCAP_ERRBUF_SIZE + 1];
 	int dlt_count;
 	u_int *dlt_list;
@@ -490,6 +522,21 @@ pcap_t	*pcap_open_offline_common(char *ebuf, size_t size);
 bpf_u_int32 pcap_adjust_snapshot(bpf_u_int32 linktype, bpf_u_int32 snaplen);
 void	sf_cleanup(pcap_t *p);
 
+#ifdef SF_GZIP
+/*
+ * Internal interfaces for gzip-compressed savefiles.
+ *
+ * "sf_gzip_add_member()" notes that a gzip member holding the data from
+ * the given uncompressed offset on starts at the given offset in the
+ * compressed file, so that seeking to it, or past it, doesn't have to
+ * decompress everything in front of it.
+ *
+ * "sf_gzip_read_tail()" reads the last bytes of the compressed file.
+ */
+int	sf_gzip_add_member(struct sf_gzip *, uint64_t, uint64_t);
+int	sf_gzip_read_tail(struct sf_gzip *, void *, size_t);
+#endif
+
 /*
  * Internal interfaces for doing user-mode filtering of packets and
  * validating filter programs.
@@ -506,6 +553,23 @@ struct bpf_aux_data {
 };
 #endif
 
+/*
+ * Native code for a BPF program; called with the packet, its length on
+ * the wire and the amount captured, and returns what bpf_filter()
+ * would.  pcap_bpf_jit_compile() returns NULL if the program can't be
+ * compiled on this platform, in which case the interpreter is used.
+ */
+pcap_bpf_jit_func pcap_bpf_jit_compile(const struct bpf_insn *, u_int,
+    size_t *);
+void	pcap_bpf_jit_free(pcap_bpf_jit_func, size_t);
+
+/*
+ * Run the filter installed with install_bpf_program() on a packet.
+ */
+#define pcap_run_filter(p, pkt, wirelen, buflen) \
+	((p)->fjit != NULL ? (p)->fjit((pkt), (wirelen), (buflen)) : \
+	    bpf_filter((p)->fcode.bf_insns, (pkt), (wirelen), (buflen)))
+
 /*
  * Filtering routine that takes the auxiliary data as an additional
  * argument.
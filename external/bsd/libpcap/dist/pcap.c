@@ -3750,6 +3750,8 @@ pcap_cleanup_live_common(pcap_t *p)
 		p->tstamp_precision_count = 0;
 	}
 	pcap_freecode(&p->fcode);
+	pcap_bpf_jit_free(p->fjit, p->fjit_size);
+	p->fjit = NULL;
 #if !defined(_WIN32) && !defined(MSDOS)
 	if (p->fd >= 0) {
 		close(p->fd);
@@ -3788,6 +3790,9 @@ pcap_close(pcap_t *p)
 {
 	if (p->opt.device != NULL)
 		free(p->opt.device);
+	if (p->cc_expr != NULL)
+		free(p->cc_expr);
+	pcap_freecode(&p->cc_prog);
 	p->cleanup_op(p);
 	free(p);
 }
@@ -3804,6 +3809,13 @@ pcap_offline_filter(const struct bpf_program *fp, const struct pcap_pkthdr *h,
 {
 	const struct bpf_insn *fcode = fp->bf_insns;
 
+	/*
+	 * Always interpreted: a bare bpf_program has nowhere to keep
+	 * native code, and compiling it on every call would cost far
+	 * more than it saves.  Filters installed with pcap_setfilter()
+	 * are run as native code where pcap_bpf_jit_compile() can.
+	 */
+
 	if (fcode != NULL)
 		return (bpf_filter(fcode, pkt, h->len, h->caplen));
 	else
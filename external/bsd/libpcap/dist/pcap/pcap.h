@@ -123,6 +123,7 @@ typedef	u_int bpf_u_int32;
 
 typedef struct pcap pcap_t;
 typedef struct pcap_dumper pcap_dumper_t;
+typedef struct pcap_ng_dumper pcap_ng_dumper_t;
 typedef struct pcap_if pcap_if_t;
 typedef struct pcap_addr pcap_addr_t;
 
@@ -485,6 +486,10 @@ PCAP_API int	pcap_bufsize(pcap_t *);
 PCAP_API FILE	*pcap_file(pcap_t *);
 PCAP_API int	pcap_fileno(pcap_t *);
 
+PCAP_API int	pcap_offline_split(pcap_t *, int, int64_t *);
+PCAP_API int	pcap_offline_set_range(pcap_t *, int64_t, int64_t);
+PCAP_API int	pcap_offline_seek_time(pcap_t *, const struct timeval *);
+
 #ifdef _WIN32
   PCAP_API int	pcap_wsockinit(void);
 #endif
@@ -520,6 +525,14 @@ PCAP_API int	pcap_dump_flush(pcap_dumper_t *);
 PCAP_API void	pcap_dump_close(pcap_dumper_t *);
 PCAP_API void	pcap_dump(u_char *, const struct pcap_pkthdr *, const u_char *);
 
+PCAP_API pcap_ng_dumper_t *pcap_ng_dump_open(pcap_t *, const char *, int);
+PCAP_API pcap_ng_dumper_t *pcap_ng_dump_fopen(pcap_t *, FILE *, int);
+PCAP_API FILE	*pcap_ng_dump_file(pcap_ng_dumper_t *);
+PCAP_API int64_t	pcap_ng_dump_ftell(pcap_ng_dumper_t *);
+PCAP_API int	pcap_ng_dump_flush(pcap_ng_dumper_t *);
+PCAP_API int	pcap_ng_dump_close(pcap_ng_dumper_t *);
+PCAP_API void	pcap_ng_dump(u_char *, const struct pcap_pkthdr *, const u_char *);
+
 PCAP_API int	pcap_findalldevs(pcap_if_t **, char *);
 PCAP_API void	pcap_freealldevs(pcap_if_t *);
 
@@ -37,6 +37,8 @@ __RCSID("$NetBSD: savefile.c,v 1.6 2019/10/01 16:02:12 christos Exp $");
 #include <config.h>
 #endif
 
+#include "ftmacros.h"	/* for fopencookie() */
+
 #include <pcap-types.h>
 #ifdef _WIN32
 #include <io.h>
@@ -49,6 +51,9 @@ __RCSID("$NetBSD: savefile.c,v 1.6 2019/10/01 16:02:12 christos Exp $");
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h> /* for INT_MAX */
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "pcap-int.h"
 
@@ -250,6 +255,8 @@ sf_cleanup(pcap_t *p)
 	if (p->buffer != NULL)
 		free(p->buffer);
 	pcap_freecode(&p->fcode);
+	pcap_bpf_jit_free(p->fjit, p->fjit_size);
+	p->fjit = NULL;
 }
 
 pcap_t *
@@ -366,6 +373,366 @@ pcap_adjust_snapshot(bpf_u_int32 linktype, bpf_u_int32 snaplen)
 	return snaplen;
 }
 
+#ifdef SF_GZIP
+/*
+ * Reading gzip-compressed savefiles.
+ *
+ * The savefile is read through a FILE * that decompresses the file
+ * underneath it as it goes, so the code for the individual savefile
+ * formats doesn't have to know about it.  As gzip(1) allows, the file
+ * may be several gzip members one after another; if we're told where
+ * some of them start, seeking to one of those places, or past it,
+ * doesn't have to decompress everything in front of it.
+ */
+#define GZIP_MAGIC_1	0x1f
+#define GZIP_MAGIC_2	0x8b
+
+#define SF_GZIP_BUFSIZE	65536
+
+struct sf_gzip_member {
+	uint64_t uoff;		/* offset in the decompressed data */
+	uint64_t coff;		/* offset in the compressed data */
+};
+
+struct sf_gzip {
+	FILE	*fp;		/* the compressed file */
+	int	close_fp;	/* close it when we're closed? */
+	off_t	base;		/* offset of the compressed data in fp */
+	uint64_t upos;		/* offset of the next decompressed byte */
+	z_stream zs;
+	u_char	*inbuf;
+	struct sf_gzip_member *members;	/* known members, in order */
+	size_t	nmembers;
+	size_t	members_size;
+};
+
+/*
+ * Decompress up to len bytes into buf; return the number of bytes
+ * decompressed, 0 at the end of the file, or -1 on an error.
+ */
+static ssize_t
+sf_gzip_inflate(struct sf_gzip *gz, void *buf, size_t len)
+{
+	size_t n;
+	int status;
+
+	if (len > UINT_MAX)
+		len = UINT_MAX;
+	gz->zs.next_out = buf;
+	gz->zs.avail_out = (uInt)len;
+	while (gz->zs.avail_out != 0) {
+		if (gz->zs.avail_in == 0) {
+			n = fread(gz->inbuf, 1, SF_GZIP_BUFSIZE, gz->fp);
+			if (n == 0) {
+				if (ferror(gz->fp))
+					return (-1);
+				/*
+				 * End of file, possibly in the middle
+				 * of a member that's still being written;
+				 * the savefile reader will report a
+				 * truncated file if it cares.
+				 */
+				break;
+			}
+			gz->zs.next_in = gz->inbuf;
+			gz->zs.avail_in = (uInt)n;
+		}
+		status = inflate(&gz->zs, Z_NO_FLUSH);
+		if (status == Z_STREAM_END) {
+			/*
+			 * That's the end of this member; another one
+			 * may follow.
+			 */
+			(void)inflateReset(&gz->zs);
+			continue;
+		}
+		if (status != Z_OK) {
+			errno = EIO;
+			return (-1);
+		}
+	}
+	n = len - gz->zs.avail_out;
+	gz->upos += n;
+	return ((ssize_t)n);
+}
+
+/*
+ * Seek to an offset in the decompressed data.  Only absolute seeks,
+ * and relative ones (which is how stdio finds out where we are), are
+ * supported; the length of the decompressed data isn't known.
+ */
+static int64_t
+sf_gzip_seek(struct sf_gzip *gz, int64_t off, int whence)
+{
+	u_char skipbuf[4096];
+	struct sf_gzip_member *m;
+	size_t lo, hi, mid;
+	uint64_t want;
+	ssize_t n;
+
+	switch (whence) {
+
+	case SEEK_SET:
+		break;
+
+	case SEEK_CUR:
+		off += (int64_t)gz->upos;
+		break;
+
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+	if (off < 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	want = (uint64_t)off;
+
+	/*
+	 * Find the last member we know of that starts at or before the
+	 * offset.  Start from there if we have to go backwards, or if
+	 * it saves decompressing the data in between.
+	 */
+	m = NULL;
+	lo = 0;
+	hi = gz->nmembers;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (gz->members[mid].uoff <= want) {
+			m = &gz->members[mid];
+			lo = mid + 1;
+		} else
+			hi = mid;
+	}
+	if (want < gz->upos || (m != NULL && m->uoff > gz->upos)) {
+		if (m == NULL) {
+			errno = ESPIPE;
+			return (-1);
+		}
+		if (fseeko(gz->fp, gz->base + (off_t)m->coff, SEEK_SET) == -1)
+			return (-1);
+		(void)inflateReset(&gz->zs);
+		gz->zs.avail_in = 0;
+		gz->upos = m->uoff;
+	}
+	while (gz->upos < want) {
+		n = sf_gzip_inflate(gz, skipbuf,
+		    want - gz->upos < sizeof(skipbuf) ?
+		    (size_t)(want - gz->upos) : sizeof(skipbuf));
+		if (n == -1)
+			return (-1);
+		if (n == 0)
+			break;	/* past the end; stay there */
+	}
+	return ((int64_t)gz->upos);
+}
+
+static int
+sf_gzip_close(struct sf_gzip *gz)
+{
+	int ret;
+
+	ret = 0;
+	if (gz->close_fp)
+		ret = fclose(gz->fp);
+	(void)inflateEnd(&gz->zs);
+	free(gz->inbuf);
+	free(gz->members);
+	free(gz);
+	return (ret);
+}
+
+#ifdef HAVE_FUNOPEN
+static int
+sf_gzip_funopen_read(void *cookie, char *buf, int len)
+{
+	return ((int)sf_gzip_inflate(cookie, buf, (size_t)len));
+}
+
+static off_t
+sf_gzip_funopen_seek(void *cookie, off_t off, int whence)
+{
+	return ((off_t)sf_gzip_seek(cookie, (int64_t)off, whence));
+}
+
+static int
+sf_gzip_funopen_close(void *cookie)
+{
+	return (sf_gzip_close(cookie));
+}
+#else /* HAVE_FUNOPEN */
+static ssize_t
+sf_gzip_cookie_read(void *cookie, char *buf, size_t len)
+{
+	return (sf_gzip_inflate(cookie, buf, len));
+}
+
+static int
+sf_gzip_cookie_seek(void *cookie, off64_t *offp, int whence)
+{
+	int64_t off;
+
+	off = sf_gzip_seek(cookie, (int64_t)*offp, whence);
+	if (off == -1)
+		return (-1);
+	*offp = (off64_t)off;
+	return (0);
+}
+
+static int
+sf_gzip_cookie_close(void *cookie)
+{
+	return (sf_gzip_close(cookie));
+}
+#endif /* HAVE_FUNOPEN */
+
+int
+sf_gzip_add_member(struct sf_gzip *gz, uint64_t uoff, uint64_t coff)
+{
+	struct sf_gzip_member *members;
+	size_t lo, hi, mid, size;
+
+	/*
+	 * Keep the members in order, and ignore ones we already know.
+	 */
+	lo = 0;
+	hi = gz->nmembers;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (gz->members[mid].uoff < uoff)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < gz->nmembers && gz->members[lo].uoff == uoff)
+		return (0);
+	if (gz->nmembers == gz->members_size) {
+		size = gz->members_size == 0 ? 64 : 2 * gz->members_size;
+		members = realloc(gz->members, size * sizeof(*members));
+		if (members == NULL)
+			return (-1);
+		gz->members = members;
+		gz->members_size = size;
+	}
+	memmove(&gz->members[lo + 1], &gz->members[lo],
+	    (gz->nmembers - lo) * sizeof(*gz->members));
+	gz->members[lo].uoff = uoff;
+	gz->members[lo].coff = coff;
+	gz->nmembers++;
+	return (0);
+}
+
+int
+sf_gzip_read_tail(struct sf_gzip *gz, void *buf, size_t len)
+{
+	off_t pos;
+	int ret;
+
+	/*
+	 * Put the compressed file back where it was afterwards; the
+	 * decompressor has buffered what came before that.
+	 */
+	pos = ftello(gz->fp);
+	if (pos == -1)
+		return (-1);
+	ret = -1;
+	if (fseeko(gz->fp, -(off_t)len, SEEK_END) == 0 &&
+	    fread(buf, 1, len, gz->fp) == len)
+		ret = 0;
+	if (fseeko(gz->fp, pos, SEEK_SET) == -1)
+		ret = -1;
+	return (ret);
+}
+
+/*
+ * Return a FILE * that reads the decompressed contents of fp, whose
+ * first magiclen bytes, already read, are in magic.
+ */
+static FILE *
+sf_gzip_open(FILE *fp, const uint8_t *magic, size_t magiclen,
+    struct sf_gzip **gzp, char *errbuf)
+{
+	struct sf_gzip *gz;
+	FILE *zfp;
+	off_t pos;
+#ifndef HAVE_FUNOPEN
+	cookie_io_functions_t funcs;
+#endif
+
+	gz = calloc(1, sizeof(*gz));
+	if (gz == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	gz->inbuf = malloc(SF_GZIP_BUFSIZE);
+	if (gz->inbuf == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		free(gz);
+		return (NULL);
+	}
+	if (inflateInit2(&gz->zs, 15 + 16) != Z_OK) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "can't set up decompression of dump file");
+		free(gz->inbuf);
+		free(gz);
+		return (NULL);
+	}
+	gz->fp = fp;
+	gz->close_fp = (fp != stdin);
+
+	/*
+	 * The decompressor gets the magic number first.
+	 */
+	memcpy(gz->inbuf, magic, magiclen);
+	gz->zs.next_in = gz->inbuf;
+	gz->zs.avail_in = (uInt)magiclen;
+
+	/*
+	 * If the file is seekable, the first member starts where the
+	 * magic number did, and we can always go back there.
+	 */
+	pos = ftello(fp);
+	if (pos != -1) {
+		gz->base = pos - (off_t)magiclen;
+		(void)sf_gzip_add_member(gz, 0, 0);
+	}
+
+#ifdef HAVE_FUNOPEN
+	zfp = funopen(gz, sf_gzip_funopen_read, NULL, sf_gzip_funopen_seek,
+	    sf_gzip_funopen_close);
+#else
+	funcs.read = sf_gzip_cookie_read;
+	funcs.write = NULL;
+	funcs.seek = sf_gzip_cookie_seek;
+	funcs.close = sf_gzip_cookie_close;
+	zfp = fopencookie(gz, "rb", funcs);
+#endif
+	if (zfp == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't set up decompression of dump file");
+		gz->close_fp = 0;
+		(void)sf_gzip_close(gz);
+		return (NULL);
+	}
+	*gzp = gz;
+	return (zfp);
+}
+
+/*
+ * Give up on a decompressing FILE *, leaving the file under it open
+ * for our caller to close.
+ */
+static void
+sf_gzip_abandon(FILE *zfp, struct sf_gzip *gz)
+{
+	gz->close_fp = 0;
+	(void)fclose(zfp);
+}
+#endif /* SF_GZIP */
+
 static pcap_t *(*check_headers[])(const uint8_t *, FILE *, u_int, char *, int *) = {
 	pcap_check_header,
 	pcap_ng_check_header
@@ -373,6 +740,33 @@ static pcap_t *(*check_headers[])(const uint8_t *, FILE *, u_int, char *, int *)
 
 #define	N_FILE_TYPES	(sizeof check_headers / sizeof check_headers[0])
 
+/*
+ * Read the first 4 bytes of the file; the network analyzer dump
+ * file formats we support (pcap and pcapng), and several other
+ * formats we might support in the future (such as snoop, DOS and
+ * Windows Sniffer, and Microsoft Network Monitor) all have magic
+ * numbers that are unique in their first 4 bytes.
+ */
+static int
+sf_read_magic(FILE *fp, uint8_t *magic, char *errbuf)
+{
+	size_t amt_read;
+
+	amt_read = fread(magic, 1, 4, fp);
+	if (amt_read != 4) {
+		if (ferror(fp)) {
+			pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "error reading dump file");
+		} else {
+			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated dump file; tried to read %" PRIsize " file header bytes, only got %" PRIsize,
+			    (size_t)4, amt_read);
+		}
+		return (-1);
+	}
+	return (0);
+}
+
 #ifdef _WIN32
 static
 #endif
@@ -382,29 +776,32 @@ pcap_fopen_offline_with_tstamp_precision(FILE *fp, u_int precision,
 {
 	register pcap_t *p;
 	uint8_t magic[4];
-	size_t amt_read;
 	u_int i;
 	int err;
+#ifdef SF_GZIP
+	struct sf_gzip *gz;
+	FILE *zfp;
+#endif
+
+	if (sf_read_magic(fp, magic, errbuf) == -1)
+		return (NULL);
 
+#ifdef SF_GZIP
 	/*
-	 * Read the first 4 bytes of the file; the network analyzer dump
-	 * file formats we support (pcap and pcapng), and several other
-	 * formats we might support in the future (such as snoop, DOS and
-	 * Windows Sniffer, and Microsoft Network Monitor) all have magic
-	 * numbers that are unique in their first 4 bytes.
+	 * If the file is gzip-compressed, read the savefile inside it.
 	 */
-	amt_read = fread(&magic, 1, sizeof(magic), fp);
-	if (amt_read != sizeof(magic)) {
-		if (ferror(fp)) {
-			pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
-			    errno, "error reading dump file");
-		} else {
-			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
-			    "truncated dump file; tried to read %" PRIsize " file header bytes, only got %" PRIsize,
-			    sizeof(magic), amt_read);
+	gz = NULL;
+	if (magic[0] == GZIP_MAGIC_1 && magic[1] == GZIP_MAGIC_2) {
+		zfp = sf_gzip_open(fp, magic, sizeof(magic), &gz, errbuf);
+		if (zfp == NULL)
+			return (NULL);
+		if (sf_read_magic(zfp, magic, errbuf) == -1) {
+			sf_gzip_abandon(zfp, gz);
+			return (NULL);
 		}
-		return (NULL);
+		fp = zfp;
 	}
+#endif
 
 	/*
 	 * Try all file types.
@@ -419,7 +816,7 @@ pcap_fopen_offline_with_tstamp_precision(FILE *fp, u_int precision,
 			/*
 			 * Error trying to read the header.
 			 */
-			return (NULL);
+			goto fail;
 		}
 	}
 
@@ -427,10 +824,18 @@ pcap_fopen_offline_with_tstamp_precision(FILE *fp, u_int precision,
 	 * Well, who knows what this mess is....
 	 */
 	pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE, "unknown file format");
+fail:
+#ifdef SF_GZIP
+	if (gz != NULL)
+		sf_gzip_abandon(fp, gz);
+#endif
 	return (NULL);
 
 found:
 	p->rfile = fp;
+#ifdef SF_GZIP
+	p->rgz = gz;
+#endif
 
 	/* Padding only needed for live capture fcode */
 	p->fddipad = 0;
@@ -503,7 +908,6 @@ pcap_fopen_offline(FILE *fp, char *errbuf)
 int
 pcap_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 {
-	struct bpf_insn *fcode;
 	int status = 0;
 	int n = 0;
 	u_char *data;
@@ -535,8 +939,8 @@ pcap_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 			return (status);
 		}
 
-		if ((fcode = p->fcode.bf_insns) == NULL ||
-		    bpf_filter(fcode, data, h.len, h.caplen)) {
+		if (p->fcode.bf_insns == NULL ||
+		    pcap_run_filter(p, data, h.len, h.caplen)) {
 			(*callback)(user, &h, data);
 			if (++n >= cnt && cnt > 0)
 				break;
@@ -50,6 +50,12 @@ __RCSID("$NetBSD: sf-pcap.c,v 1.9 2019/10/01 16:02:12 christos Exp $");
 #include <string.h>
 #include <limits.h> /* for INT_MAX */
 
+#if defined(HAVE_FSEEKO) && !defined(_WIN32) && !defined(MSDOS)
+#define SF_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "pcap-int.h"
 
 #include "pcap-common.h"
@@ -114,6 +120,10 @@ __RCSID("$NetBSD: sf-pcap.c,v 1.9 2019/10/01 16:02:12 christos Exp $");
 #define LT_LINKTYPE_EXT(x)	((x) & 0xFC000000)
 
 static int pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **datap);
+#ifdef SF_MMAP
+static void sf_map(pcap_t *p, FILE *fp);
+static void sf_pcap_cleanup(pcap_t *p);
+#endif
 
 #ifdef _WIN32
 /*
@@ -148,6 +158,19 @@ struct pcap_sf {
 	size_t hdrsize;
 	swapped_type_t lengths_swapped;
 	tstamp_scale_type_t scale_type;
+#ifdef SF_MMAP
+	/*
+	 * If the savefile is a regular file, it's mapped, and packets
+	 * are handed out straight from the mapping rather than read
+	 * into p->buffer.
+	 */
+	u_char *map;		/* the mapping, or NULL */
+	size_t mapsize;		/* its size */
+	size_t mapstart;	/* offset of the first packet record */
+	size_t mapoff;		/* offset of the next packet record */
+	size_t mapend;		/* offset at which to stop */
+	int ranged;		/* pcap_offline_set_range() was called */
+#endif
 };
 
 /*
@@ -416,10 +439,83 @@ pcap_check_header(const uint8_t *magic, FILE *fp, u_int precision, char *errbuf,
 	}
 
 	p->cleanup_op = sf_cleanup;
+#ifdef SF_MMAP
+	sf_map(p, fp);
+#endif
 
 	return (p);
 }
 
+#ifdef SF_MMAP
+/*
+ * Map the savefile, if it's a regular file we can map; if not, or if
+ * that fails, we just read it with stdio.
+ */
+static void
+sf_map(pcap_t *p, FILE *fp)
+{
+	struct pcap_sf *ps = p->priv;
+	struct stat st;
+	off_t off;
+	void *map;
+
+	if (fstat(fileno(fp), &st) == -1 || !S_ISREG(st.st_mode))
+		return;
+	off = ftello(fp);
+	if (off == -1 || st.st_size <= off ||
+	    (uintmax_t)st.st_size > SIZE_MAX)
+		return;
+	/*
+	 * Private and writable, as swap_pseudo_headers() fixes up
+	 * byte-swapped files in place; nothing is written back.
+	 */
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+	    fileno(fp), 0);
+	if (map == MAP_FAILED)
+		return;
+	(void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+	ps->map = map;
+	ps->mapsize = (size_t)st.st_size;
+	ps->mapstart = ps->mapoff = (size_t)off;
+	ps->mapend = ps->mapsize;
+	p->cleanup_op = sf_pcap_cleanup;
+}
+
+/*
+ * Stop using the mapping, and carry on reading with stdio from where
+ * we got to; this is how a savefile that's still being written to is
+ * followed past the size it had when we mapped it, and how a record
+ * cut short by the end of the file gets the usual error.
+ */
+static int
+sf_unmap(pcap_t *p)
+{
+	struct pcap_sf *ps = p->priv;
+	size_t off = ps->mapoff;
+
+	(void)munmap(ps->map, ps->mapsize);
+	ps->map = NULL;
+	if (fseeko(p->rfile, (off_t)off, SEEK_SET) == -1) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "error seeking in dump file");
+		return (-1);
+	}
+	return (0);
+}
+
+static void
+sf_pcap_cleanup(pcap_t *p)
+{
+	struct pcap_sf *ps = p->priv;
+
+	if (ps->map != NULL) {
+		(void)munmap(ps->map, ps->mapsize);
+		ps->map = NULL;
+	}
+	sf_cleanup(p);
+}
+#endif /* SF_MMAP */
+
 /*
  * Grow the packet buffer to the specified size.
  */
@@ -451,7 +547,38 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 	FILE *fp = p->rfile;
 	size_t amt_read;
 	bpf_u_int32 t;
+#ifdef SF_MMAP
+	u_char *mapped = NULL;
+
+	if (ps->map != NULL && ps->ranged) {
+		if (ps->mapoff >= ps->mapend)
+			return (1);
+		if (ps->mapsize - ps->mapoff < ps->hdrsize) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated dump file; tried to read %" PRIsize " header bytes, only got %" PRIsize,
+			    ps->hdrsize, ps->mapsize - ps->mapoff);
+			return (-1);
+		}
+	}
+	if (ps->map != NULL && ps->mapsize - ps->mapoff < ps->hdrsize) {
+		struct stat st;
 
+		/*
+		 * EOF, unless the file has grown since we mapped it.
+		 */
+		if (ps->mapoff == ps->mapsize &&
+		    fstat(fileno(fp), &st) == 0 &&
+		    st.st_size == (off_t)ps->mapsize)
+			return (1);
+		if (sf_unmap(p) == -1)
+			return (-1);
+	}
+	if (ps->map != NULL) {
+		memcpy(&sf_hdr, ps->map + ps->mapoff, ps->hdrsize);
+		mapped = ps->map + ps->mapoff + ps->hdrsize;
+		amt_read = ps->hdrsize;
+	} else
+#endif
 	/*
 	 * Read the packet header; the structure we use as a buffer
 	 * is the longer structure for files generated by the patched
@@ -563,6 +690,35 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 		return (-1);
 	}
 
+#ifdef SF_MMAP
+	if (mapped != NULL) {
+		/*
+		 * Hand the packet data out straight from the mapping.
+		 * If the record runs past the end of it, go back to
+		 * stdio for it, as above.
+		 */
+		if (ps->mapsize - (ps->mapoff + ps->hdrsize) < hdr->caplen) {
+			if (ps->ranged) {
+				pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+				    "truncated dump file; tried to read %u captured bytes, only got %" PRIsize,
+				    hdr->caplen,
+				    ps->mapsize - (ps->mapoff + ps->hdrsize));
+				return (-1);
+			}
+			ps->mapoff += ps->hdrsize;
+			if (sf_unmap(p) == -1)
+				return (-1);
+			mapped = NULL;
+		} else {
+			ps->mapoff += ps->hdrsize + hdr->caplen;
+			if (hdr->caplen > (bpf_u_int32)p->snapshot)
+				hdr->caplen = p->snapshot;
+			*data = mapped;
+			goto done;
+		}
+	}
+#endif
+
 	if (hdr->caplen > (bpf_u_int32)p->snapshot) {
 		/*
 		 * The packet is bigger than the snapshot length
@@ -712,12 +868,167 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 	}
 	*data = p->buffer;
 
+#ifdef SF_MMAP
+done:
+#endif
 	if (p->swapped)
 		swap_pseudo_headers(p->linktype, hdr, *data);
 
 	return (0);
 }
 
+/*
+ * Splitting a savefile into chunks that can be read independently,
+ * e.g. by one thread each.
+ *
+ * Record headers have no marker, so, as tcpslice does, we look for a
+ * record boundary near each split point by checking that a run of
+ * SF_SPLIT_CHAIN records starting there all look sane and follow on
+ * from each other, or run exactly up to the end of the file.  A split
+ * point for which nothing is found within SF_SPLIT_SCAN bytes is
+ * dropped, leaving fewer, larger chunks.
+ */
+#define SF_SPLIT_CHAIN	16
+#define SF_SPLIT_SCAN	(1024 * 1024)
+
+#ifdef SF_MMAP
+static int
+sf_plausible_record(pcap_t *p, size_t off)
+{
+	struct pcap_sf *ps = p->priv;
+	struct pcap_sf_pkthdr sf_hdr;
+	bpf_u_int32 caplen, len, sec, frac, sec0 = 0, maxfrac;
+	u_int i;
+
+	if (ps->scale_type == SCALE_DOWN ||
+	    (ps->scale_type == PASS_THROUGH &&
+	     p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO))
+		maxfrac = 1000000000;
+	else
+		maxfrac = 1000000;
+	for (i = 0; i < SF_SPLIT_CHAIN; i++) {
+		if (off == ps->mapsize)
+			return (i != 0);
+		if (ps->mapsize - off < ps->hdrsize)
+			return (0);
+		memcpy(&sf_hdr, ps->map + off, sizeof(sf_hdr));
+		if (p->swapped) {
+			caplen = SWAPLONG(sf_hdr.caplen);
+			len = SWAPLONG(sf_hdr.len);
+			sec = SWAPLONG(sf_hdr.ts.tv_sec);
+			frac = SWAPLONG(sf_hdr.ts.tv_usec);
+		} else {
+			caplen = sf_hdr.caplen;
+			len = sf_hdr.len;
+			sec = sf_hdr.ts.tv_sec;
+			frac = sf_hdr.ts.tv_usec;
+		}
+		if (ps->lengths_swapped == SWAPPED ||
+		    (ps->lengths_swapped == MAYBE_SWAPPED && caplen > len)) {
+			bpf_u_int32 t = caplen;
+
+			caplen = len;
+			len = t;
+		}
+		if (caplen > (bpf_u_int32)p->snapshot || caplen > len ||
+		    frac >= maxfrac)
+			return (0);
+		/* all within a day of the first */
+		if (i == 0)
+			sec0 = sec;
+		else if (sec - sec0 + 86400U > 2 * 86400U)
+			return (0);
+		if (ps->mapsize - off - ps->hdrsize < caplen)
+			return (0);
+		off += ps->hdrsize + caplen;
+	}
+	return (1);
+}
+#endif
+
+/*
+ * Fill in bounds[0..n] with the file offsets of record boundaries that
+ * split the packet data of p into at most n chunks of roughly equal
+ * size, and return the number of chunks; chunk i is read by opening
+ * the file again and calling pcap_offline_set_range() with bounds[i]
+ * and bounds[i + 1].
+ */
+int
+pcap_offline_split(pcap_t *p, int n, int64_t *bounds)
+{
+#ifdef SF_MMAP
+	struct pcap_sf *ps = p->priv;
+	size_t size, off, lim;
+	int i, c;
+
+	if (p->next_packet_op != pcap_next_packet || ps->map == NULL) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Splitting is only supported for pcap savefiles that are regular files");
+		return (PCAP_ERROR);
+	}
+	if (n < 1) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Invalid number of chunks %d", n);
+		return (PCAP_ERROR);
+	}
+	size = ps->mapsize - ps->mapstart;
+	bounds[0] = (int64_t)ps->mapstart;
+	for (c = 0, i = 1; i < n; i++) {
+		off = ps->mapstart + size / n * i;
+		if (off <= (size_t)bounds[c])
+			off = (size_t)bounds[c] + 1;
+		if (ps->mapsize - off > SF_SPLIT_SCAN)
+			lim = off + SF_SPLIT_SCAN;
+		else
+			lim = ps->mapsize;
+		for (; off < lim; off++) {
+			if (sf_plausible_record(p, off)) {
+				bounds[++c] = (int64_t)off;
+				break;
+			}
+		}
+	}
+	bounds[++c] = (int64_t)ps->mapsize;
+	return (c);
+#else
+	pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "Splitting savefiles is not supported on this platform");
+	return (PCAP_ERROR);
+#endif
+}
+
+/*
+ * Read only the records of p from file offset start, which must be a
+ * record boundary, up to (not including) the one at offset end.
+ */
+int
+pcap_offline_set_range(pcap_t *p, int64_t start, int64_t end)
+{
+#ifdef SF_MMAP
+	struct pcap_sf *ps = p->priv;
+
+	if (p->next_packet_op != pcap_next_packet || ps->map == NULL) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Ranges are only supported for pcap savefiles that are regular files");
+		return (PCAP_ERROR);
+	}
+	if (start < (int64_t)ps->mapstart || start > end ||
+	    end > (int64_t)ps->mapsize) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Invalid range %" PRId64 "-%" PRId64, start, end);
+		return (PCAP_ERROR);
+	}
+	ps->mapoff = (size_t)start;
+	ps->mapend = (size_t)end;
+	ps->ranged = 1;
+	return (0);
+#else
+	pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "Ranges are not supported on this platform");
+	return (PCAP_ERROR);
+#endif
+}
+
 static int
 sf_write_header(pcap_t *p, FILE *fp, int linktype, int thiszone, int snaplen)
 {
@@ -32,10 +32,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 #include "pcap-int.h"
 
 #include "pcap-common.h"
+#include "extract.h"
 
 #ifdef HAVE_OS_PROTO_H
 #include "os-proto.h"
@@ -174,6 +182,59 @@ struct packet_block {
 	/* followed by packet data, options, and trailer */
 };
 
+/*
+ * Local-use blocks written after the packets of a compressed file by
+ * pcap_ng_dump_close(): an index of the chunks the file was compressed
+ * in, and a locator saying where the index is.  Other readers skip
+ * them, as they do all blocks they don't know.
+ */
+#define BT_CHUNK_INDEX		0x80000001
+
+struct chunk_index_entry {
+	bpf_u_int32	uoff_high;	/* offset of the chunk, uncompressed */
+	bpf_u_int32	uoff_low;
+	bpf_u_int32	coff_high;	/* offset of its gzip member */
+	bpf_u_int32	coff_low;
+	bpf_u_int32	maxts_high;	/* latest time stamp in the chunk */
+	bpf_u_int32	maxts_low;
+};
+
+#define BT_CHUNK_INDEX_LOCATOR	0x80000002
+
+struct chunk_index_locator {
+	bpf_u_int32	uoff_high;	/* offset of the index, uncompressed */
+	bpf_u_int32	uoff_low;
+	bpf_u_int32	coff_high;	/* offset of its gzip member */
+	bpf_u_int32	coff_low;
+};
+
+#define LOCATOR_BLOCK_LEN \
+	(sizeof(struct block_header) + \
+	 sizeof(struct chunk_index_locator) + \
+	 sizeof(struct block_trailer))
+
+/*
+ * The locator is the only thing in the last gzip member of the file,
+ * which is made by hand so that it always has the same size: a gzip
+ * header with no optional fields, a single stored deflate block, and
+ * the CRC and length of the data.
+ */
+#define GZIP_HEADER_LEN		10
+#define STORED_HEADER_LEN	5
+#define GZIP_TRAILER_LEN	8
+#define LOCATOR_MEMBER_LEN \
+	(GZIP_HEADER_LEN + STORED_HEADER_LEN + LOCATOR_BLOCK_LEN + \
+	 GZIP_TRAILER_LEN)
+
+/*
+ * A chunk of a compressed file, as kept by the writer and the reader.
+ */
+struct chunk_index {
+	uint64_t	uoff;
+	uint64_t	coff;
+	uint64_t	maxts;
+};
+
 /*
  * Block cursor - used when processing the contents of a block.
  * Contains a pointer into the data being processed and a count
@@ -228,6 +289,12 @@ struct pcap_ng_sf {
 	bpf_u_int32 ifcount;		/* number of interfaces seen in this capture */
 	bpf_u_int32 ifaces_size;	/* size of array below */
 	struct pcap_ng_if *ifaces;	/* array of interface information */
+	int seeking;			/* skipping packets before seek_ts? */
+	struct timeval seek_ts;
+	int index_loaded;		/* have we looked for a chunk index? */
+	struct chunk_index *index;	/* chunks, latest time stamps so far */
+	size_t nindex;
+	uint64_t index_uoff;		/* where the packets end */
 };
 
 /*
@@ -1071,6 +1138,7 @@ pcap_ng_cleanup(pcap_t *p)
 	struct pcap_ng_sf *ps = p->priv;
 
 	free(ps->ifaces);
+	free(ps->index);
 	sf_cleanup(p);
 }
 
@@ -1094,6 +1162,7 @@ pcap_ng_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 	FILE *fp = p->rfile;
 	uint64_t t, sec, frac;
 
+again:
 	/*
 	 * Look for an Enhanced Packet Block, a Simple Packet Block,
 	 * or a Packet Block.
@@ -1486,6 +1555,18 @@ found:
 	hdr->ts.tv_usec = (int)frac;
 #endif
 
+	/*
+	 * Skip packets from before the time pcap_offline_seek_time()
+	 * was asked for.
+	 */
+	if (ps->seeking) {
+		if (hdr->ts.tv_sec < ps->seek_ts.tv_sec ||
+		    (hdr->ts.tv_sec == ps->seek_ts.tv_sec &&
+		     hdr->ts.tv_usec < ps->seek_ts.tv_usec))
+			goto again;
+		ps->seeking = 0;
+	}
+
 	/*
 	 * Get a pointer to the packet data.
 	 */
@@ -1498,3 +1579,1031 @@ found:
 
 	return (0);
 }
+
+#ifdef HAVE_FSEEKO
+#define NG_SEEK(fp, off)	fseeko((fp), (off_t)(off), SEEK_SET)
+#else
+#define NG_SEEK(fp, off)	fseek((fp), (long)(off), SEEK_SET)
+#endif
+
+#ifdef SF_GZIP
+/*
+ * If this is a compressed file written by pcap_ng_dump_close(), load
+ * its chunk index, and tell the decompressor where the chunks start.
+ * If it isn't, or anything about the index looks wrong, we just don't
+ * have an index.
+ */
+static void
+load_chunk_index(pcap_t *p)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	u_char tail[LOCATOR_MEMBER_LEN];
+	char errbuf[PCAP_ERRBUF_SIZE];
+	const u_char *blk;
+	struct block_header bhdr;
+	struct chunk_index_locator loc;
+	struct block_cursor cursor;
+	struct chunk_index_entry *entries;
+	struct chunk_index *index;
+	uint64_t uoff, coff, maxts;
+	size_t i, n;
+
+	if (p->rgz == NULL ||
+	    sf_gzip_read_tail(p->rgz, tail, sizeof(tail)) == -1)
+		return;
+
+	/*
+	 * Check the member the locator is in.
+	 */
+	blk = tail + GZIP_HEADER_LEN + STORED_HEADER_LEN;
+	if (tail[0] != 0x1f || tail[1] != 0x8b || tail[2] != Z_DEFLATED ||
+	    tail[3] != 0 ||
+	    tail[GZIP_HEADER_LEN] != 0x01 ||
+	    EXTRACT_LE_16BITS(&tail[GZIP_HEADER_LEN + 1]) != LOCATOR_BLOCK_LEN ||
+	    EXTRACT_LE_16BITS(&tail[GZIP_HEADER_LEN + 3]) !=
+	      (~LOCATOR_BLOCK_LEN & 0xffff) ||
+	    EXTRACT_LE_32BITS(blk + LOCATOR_BLOCK_LEN) !=
+	      crc32(0, blk, LOCATOR_BLOCK_LEN) ||
+	    EXTRACT_LE_32BITS(blk + LOCATOR_BLOCK_LEN + 4) != LOCATOR_BLOCK_LEN)
+		return;
+
+	/*
+	 * Check the locator itself.
+	 */
+	memcpy(&bhdr, blk, sizeof(bhdr));
+	memcpy(&loc, blk + sizeof(bhdr), sizeof(loc));
+	if (p->swapped) {
+		bhdr.block_type = SWAPLONG(bhdr.block_type);
+		bhdr.total_length = SWAPLONG(bhdr.total_length);
+		loc.uoff_high = SWAPLONG(loc.uoff_high);
+		loc.uoff_low = SWAPLONG(loc.uoff_low);
+		loc.coff_high = SWAPLONG(loc.coff_high);
+		loc.coff_low = SWAPLONG(loc.coff_low);
+	}
+	if (bhdr.block_type != BT_CHUNK_INDEX_LOCATOR ||
+	    bhdr.total_length != LOCATOR_BLOCK_LEN)
+		return;
+	uoff = ((uint64_t)loc.uoff_high) << 32 | loc.uoff_low;
+	coff = ((uint64_t)loc.coff_high) << 32 | loc.coff_low;
+
+	/*
+	 * Read the index.
+	 */
+	if (sf_gzip_add_member(p->rgz, uoff, coff) == -1 ||
+	    NG_SEEK(p->rfile, uoff) == -1 ||
+	    read_block(p->rfile, p, &cursor, errbuf) != 1 ||
+	    cursor.block_type != BT_CHUNK_INDEX)
+		return;
+	n = cursor.data_remaining / sizeof(*entries);
+	if (n == 0)
+		return;
+	entries = get_from_block_data(&cursor, n * sizeof(*entries), errbuf);
+	if (entries == NULL)
+		return;
+	index = malloc(n * sizeof(*index));
+	if (index == NULL)
+		return;
+	maxts = 0;
+	for (i = 0; i < n; i++) {
+		if (p->swapped) {
+			entries[i].uoff_high = SWAPLONG(entries[i].uoff_high);
+			entries[i].uoff_low = SWAPLONG(entries[i].uoff_low);
+			entries[i].coff_high = SWAPLONG(entries[i].coff_high);
+			entries[i].coff_low = SWAPLONG(entries[i].coff_low);
+			entries[i].maxts_high = SWAPLONG(entries[i].maxts_high);
+			entries[i].maxts_low = SWAPLONG(entries[i].maxts_low);
+		}
+		index[i].uoff = ((uint64_t)entries[i].uoff_high) << 32 |
+		    entries[i].uoff_low;
+		index[i].coff = ((uint64_t)entries[i].coff_high) << 32 |
+		    entries[i].coff_low;
+
+		/*
+		 * Time stamps needn't increase from one chunk to the
+		 * next; keep the latest one up to and including each
+		 * chunk, so that we can search for the first chunk that
+		 * has a packet at or after a given time.
+		 */
+		if (i == 0 || (((uint64_t)entries[i].maxts_high) << 32 |
+		    entries[i].maxts_low) > maxts)
+			maxts = ((uint64_t)entries[i].maxts_high) << 32 |
+			    entries[i].maxts_low;
+		index[i].maxts = maxts;
+		if (index[i].uoff >= uoff ||
+		    (i != 0 && index[i].uoff <= index[i - 1].uoff) ||
+		    sf_gzip_add_member(p->rgz, index[i].uoff,
+		      index[i].coff) == -1) {
+			free(index);
+			return;
+		}
+	}
+	ps->index = index;
+	ps->nindex = n;
+	ps->index_uoff = uoff;
+}
+#endif /* SF_GZIP */
+
+/*
+ * Is raw time stamp t, from the first interface, earlier than tv?
+ */
+static int
+ts_before(pcap_t *p, uint64_t t, const struct timeval *tv)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	struct pcap_ng_if *ifp = &ps->ifaces[0];
+	uint64_t sec, frac;
+
+	sec = t / ifp->tsresol + ifp->tsoffset;
+	if (sec != (uint64_t)tv->tv_sec)
+		return (sec < (uint64_t)tv->tv_sec);
+	frac = t % ifp->tsresol;
+	switch (ifp->scale_type) {
+
+	case PASS_THROUGH:
+		break;
+
+	case SCALE_UP_DEC:
+		frac *= ifp->scale_factor;
+		break;
+
+	case SCALE_DOWN_DEC:
+		frac /= ifp->scale_factor;
+		break;
+
+	case SCALE_UP_BIN:
+	case SCALE_DOWN_BIN:
+		frac *= ps->user_tsresol;
+		frac /= ifp->tsresol;
+		break;
+	}
+	return (frac < (uint64_t)tv->tv_usec);
+}
+
+/*
+ * Arrange for the next packet read to be the first one in the file
+ * whose time stamp isn't earlier than tv.  With a chunk index, we can
+ * go straight to the chunk it's in; otherwise, we go back to the
+ * beginning and skip packets until we find it.
+ */
+int
+pcap_offline_seek_time(pcap_t *p, const struct timeval *tv)
+{
+	struct pcap_ng_sf *ps;
+	uint64_t uoff;
+	size_t lo, hi, mid;
+
+	if (p->rfile == NULL || p->next_packet_op != pcap_ng_next_packet) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "pcap_offline_seek_time is only supported on pcapng savefiles");
+		return (PCAP_ERROR);
+	}
+	ps = p->priv;
+
+#ifdef SF_GZIP
+	if (!ps->index_loaded) {
+		load_chunk_index(p);
+		ps->index_loaded = 1;
+	}
+#endif
+	uoff = 0;
+	if (ps->nindex != 0) {
+		lo = 0;
+		hi = ps->nindex;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (ts_before(p, ps->index[mid].maxts, tv))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		uoff = lo < ps->nindex ? ps->index[lo].uoff : ps->index_uoff;
+	}
+	if (NG_SEEK(p->rfile, uoff) == -1) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "pcap_offline_seek_time: can't seek in the file");
+		return (PCAP_ERROR);
+	}
+	ps->seek_ts = *tv;
+	ps->seeking = 1;
+	return (0);
+}
+
+/*
+ * Writing compressed, indexed pcapng files.
+ *
+ * The file has a Section Header Block and an Interface Description
+ * Block, followed by the packets in Enhanced Packet Blocks.  The blocks
+ * are gathered into chunks of about NG_CHUNK_SIZE bytes, and each chunk
+ * is compressed into a gzip member of its own; the file as a whole can
+ * be decompressed by gzip(1), and read by anything that reads pcapng,
+ * but a reader that knows where a chunk's member is can start
+ * decompressing there.  Closing the file adds an index of the chunks,
+ * giving where each one starts and the latest time stamp in it, and
+ * then the index locator, so that pcap_offline_seek_time() can find the
+ * chunk a time is in.
+ *
+ * If we have threads, the chunks are compressed and written by a thread
+ * of the dumper's own, so that pcap_ng_dump() only waits for it when it
+ * gets NG_MAXQUEUE chunks ahead.
+ */
+#ifdef HAVE_ZLIB
+#define NG_CHUNK_SIZE	(256*1024)
+#define NG_MAXQUEUE	32
+
+struct ng_chunk {
+	struct ng_chunk	*next;
+	u_char		*data;
+	size_t		len;
+	size_t		size;
+	uint64_t	uoff;		/* offset in the uncompressed file */
+	uint64_t	maxts;		/* latest time stamp in it */
+	u_int		npackets;
+};
+
+struct pcap_ng_dumper {
+	FILE		*f;
+	uint64_t	tsscale;	/* time stamp units per second */
+	struct ng_chunk	*cur;		/* the chunk being filled */
+	uint64_t	uoff;		/* bytes put into chunks */
+
+	/*
+	 * The writer's counts as of the last chunk handed over, so that
+	 * pcap_ng_dump_ftell() needn't take the lock for every packet.
+	 */
+	uint64_t	seen_coff;	/* compressed bytes written */
+	uint64_t	seen_uoff;	/* uncompressed bytes they came from */
+	uint64_t	seen_pcoff;	/* compressed bytes of packet chunks */
+	uint64_t	seen_puoff;	/* uncompressed bytes they came from */
+
+	/*
+	 * The rest belongs to whoever writes out the chunks; the counts
+	 * and the error are protected by the lock, if there is one.
+	 */
+	z_stream	zs;
+	u_char		*zbuf;
+	size_t		zbufsize;
+	uint64_t	coff;		/* compressed bytes written */
+	uint64_t	done_uoff;	/* uncompressed bytes they came from */
+	struct chunk_index *index;
+	size_t		nindex;
+	size_t		index_size;
+	int		error;		/* errno of the first failure */
+#ifdef HAVE_PTHREADS
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	work;		/* a chunk was queued */
+	pthread_cond_t	space;		/* a queued chunk was written */
+	struct ng_chunk	*queue;
+	struct ng_chunk	**queue_tail;
+	struct ng_chunk	*free_chunks;
+	u_int		queued;
+	int		done;
+#endif
+};
+
+static struct ng_chunk *
+ng_chunk_alloc(void)
+{
+	struct ng_chunk *c;
+
+	c = malloc(sizeof(*c));
+	if (c == NULL)
+		return (NULL);
+	c->data = malloc(NG_CHUNK_SIZE);
+	if (c->data == NULL) {
+		free(c);
+		return (NULL);
+	}
+	c->size = NG_CHUNK_SIZE;
+	return (c);
+}
+
+static void
+ng_chunk_free(struct ng_chunk *c)
+{
+	free(c->data);
+	free(c);
+}
+
+/*
+ * Compress a chunk into a gzip member, write it out and add it to the
+ * index.  Returns the compressed size, or 0 on an error, with errno set.
+ */
+static size_t
+ng_compress(pcap_ng_dumper_t *d, struct ng_chunk *c)
+{
+	size_t bound, clen;
+
+	bound = deflateBound(&d->zs, (uLong)c->len);
+	if (bound > d->zbufsize) {
+		free(d->zbuf);
+		d->zbuf = malloc(bound);
+		if (d->zbuf == NULL) {
+			d->zbufsize = 0;
+			return (0);
+		}
+		d->zbufsize = bound;
+	}
+	(void)deflateReset(&d->zs);
+	d->zs.next_in = c->data;
+	d->zs.avail_in = (uInt)c->len;
+	d->zs.next_out = d->zbuf;
+	d->zs.avail_out = (uInt)d->zbufsize;
+	if (deflate(&d->zs, Z_FINISH) != Z_STREAM_END) {
+		errno = EIO;
+		return (0);
+	}
+	clen = d->zbufsize - d->zs.avail_out;
+	if (fwrite(d->zbuf, 1, clen, d->f) != clen)
+		return (0);
+	return (clen);
+}
+
+/*
+ * Account for a chunk that's been written out.
+ */
+static int
+ng_chunk_written(pcap_ng_dumper_t *d, struct ng_chunk *c, size_t clen)
+{
+	struct chunk_index *index;
+	size_t size;
+
+	if (c->npackets != 0) {
+		if (d->nindex == d->index_size) {
+			size = d->index_size == 0 ? 256 : 2 * d->index_size;
+			index = realloc(d->index, size * sizeof(*index));
+			if (index == NULL)
+				return (-1);
+			d->index = index;
+			d->index_size = size;
+		}
+		d->index[d->nindex].uoff = c->uoff;
+		d->index[d->nindex].coff = d->coff;
+		d->index[d->nindex].maxts = c->maxts;
+		d->nindex++;
+	}
+	d->coff += clen;
+	d->done_uoff += c->len;
+	return (0);
+}
+
+#ifdef HAVE_PTHREADS
+static void *
+ng_writer(void *arg)
+{
+	pcap_ng_dumper_t *d = arg;
+	struct ng_chunk *c;
+	size_t clen;
+	int error;
+
+	pthread_mutex_lock(&d->lock);
+	for (;;) {
+		while (d->queue == NULL && !d->done)
+			pthread_cond_wait(&d->work, &d->lock);
+		c = d->queue;
+		if (c == NULL)
+			break;
+		error = d->error;
+		pthread_mutex_unlock(&d->lock);
+
+		/*
+		 * After an error, chunks are thrown away.
+		 */
+		clen = 0;
+		if (error == 0) {
+			clen = ng_compress(d, c);
+			if (clen == 0)
+				error = errno;
+		}
+
+		pthread_mutex_lock(&d->lock);
+		if (error == 0 && ng_chunk_written(d, c, clen) == -1)
+			error = errno;
+		if (d->error == 0)
+			d->error = error;
+		d->queue = c->next;
+		if (d->queue == NULL)
+			d->queue_tail = &d->queue;
+		c->next = d->free_chunks;
+		d->free_chunks = c;
+		d->queued--;
+		pthread_cond_broadcast(&d->space);
+	}
+	pthread_mutex_unlock(&d->lock);
+	return (NULL);
+}
+#endif
+
+/*
+ * Take a copy of the writer's counts for pcap_ng_dump_ftell(); called
+ * with the lock held, if there is one.
+ */
+static void
+ng_counts(pcap_ng_dumper_t *d)
+{
+	d->seen_coff = d->coff;
+	d->seen_uoff = d->done_uoff;
+	if (d->nindex != 0) {
+		d->seen_pcoff = d->coff - d->index[0].coff;
+		d->seen_puoff = d->done_uoff - d->index[0].uoff;
+	}
+}
+
+/*
+ * Hand the current chunk over to be written out, and start a new one.
+ */
+static int
+ng_next_chunk(pcap_ng_dumper_t *d)
+{
+	struct ng_chunk *c = d->cur;
+#ifdef HAVE_PTHREADS
+	struct ng_chunk *nc;
+#else
+	size_t clen;
+#endif
+
+	if (c->len == 0)
+		return (0);
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&d->lock);
+	while (d->queued >= NG_MAXQUEUE)
+		pthread_cond_wait(&d->space, &d->lock);
+	c->next = NULL;
+	*d->queue_tail = c;
+	d->queue_tail = &c->next;
+	d->queued++;
+	pthread_cond_signal(&d->work);
+	nc = d->free_chunks;
+	if (nc != NULL)
+		d->free_chunks = nc->next;
+	ng_counts(d);
+	pthread_mutex_unlock(&d->lock);
+	if (nc == NULL) {
+		nc = ng_chunk_alloc();
+		if (nc == NULL) {
+			/*
+			 * Nothing more will be written; let the caller
+			 * find out when it flushes or closes.
+			 */
+			d->cur = NULL;
+			pthread_mutex_lock(&d->lock);
+			if (d->error == 0)
+				d->error = ENOMEM;
+			pthread_mutex_unlock(&d->lock);
+			return (-1);
+		}
+	}
+	d->cur = c = nc;
+#else
+	if (d->error == 0) {
+		clen = ng_compress(d, c);
+		if (clen == 0 || ng_chunk_written(d, c, clen) == -1)
+			d->error = errno;
+	}
+	ng_counts(d);
+#endif
+	c->len = 0;
+	c->uoff = d->uoff;
+	c->maxts = 0;
+	c->npackets = 0;
+	return (0);
+}
+
+/*
+ * Make room for len more bytes in the current chunk.
+ */
+static u_char *
+ng_reserve(pcap_ng_dumper_t *d, size_t len)
+{
+	struct ng_chunk *c = d->cur;
+	u_char *data;
+	size_t size;
+
+	if (c == NULL)
+		return (NULL);
+	if (c->len != 0 && c->len + len > NG_CHUNK_SIZE) {
+		if (ng_next_chunk(d) == -1)
+			return (NULL);
+		c = d->cur;
+	}
+	if (c->len + len > c->size) {
+		/*
+		 * A single block bigger than a chunk.
+		 */
+		size = c->len + len;
+		data = realloc(c->data, size);
+		if (data == NULL)
+			return (NULL);
+		c->data = data;
+		c->size = size;
+	}
+	data = c->data + c->len;
+	c->len += len;
+	d->uoff += len;
+	return (data);
+}
+
+static void
+ng_free(pcap_ng_dumper_t *d)
+{
+#ifdef HAVE_PTHREADS
+	struct ng_chunk *c;
+
+	while ((c = d->free_chunks) != NULL) {
+		d->free_chunks = c->next;
+		ng_chunk_free(c);
+	}
+	pthread_cond_destroy(&d->space);
+	pthread_cond_destroy(&d->work);
+	pthread_mutex_destroy(&d->lock);
+#endif
+	if (d->cur != NULL)
+		ng_chunk_free(d->cur);
+	(void)deflateEnd(&d->zs);
+	free(d->zbuf);
+	free(d->index);
+	free(d);
+}
+
+static pcap_ng_dumper_t *
+ng_setup_dump(pcap_t *p, int linktype, FILE *f, const char *fname,
+    int level)
+{
+	pcap_ng_dumper_t *d;
+	struct block_header bhdr;
+	struct block_trailer btrlr;
+	struct section_header_block shb;
+	struct interface_description_block idb;
+	struct option_header opthdr;
+	u_char *bp;
+	size_t idblen;
+#ifdef HAVE_PTHREADS
+	sigset_t all, old;
+	int status;
+#endif
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL)
+		goto nomem;
+	if (deflateInit2(&d->zs, level, Z_DEFLATED, 15 + 16, 8,
+	    Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(d);
+		goto nomem;
+	}
+	d->f = f;
+	d->cur = ng_chunk_alloc();
+	if (d->cur == NULL) {
+		(void)deflateEnd(&d->zs);
+		free(d);
+		goto nomem;
+	}
+	d->cur->len = 0;
+	d->cur->uoff = 0;
+	d->cur->maxts = 0;
+	d->cur->npackets = 0;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->work, NULL);
+	pthread_cond_init(&d->space, NULL);
+	d->queue_tail = &d->queue;
+#endif
+
+	/*
+	 * The Section Header Block and the Interface Description Block
+	 * go in a chunk of their own, with no time stamps.  The time
+	 * stamp resolution is microseconds unless we say otherwise.
+	 */
+	if (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
+		d->tsscale = 1000000000;
+		idblen = sizeof(bhdr) + sizeof(idb) + 2 * sizeof(opthdr) + 4 +
+		    sizeof(btrlr);
+	} else {
+		d->tsscale = 1000000;
+		idblen = sizeof(bhdr) + sizeof(idb) + sizeof(btrlr);
+	}
+	bhdr.block_type = BT_SHB;
+	bhdr.total_length = sizeof(bhdr) + sizeof(shb) + sizeof(btrlr);
+	shb.byte_order_magic = BYTE_ORDER_MAGIC;
+	shb.major_version = PCAP_NG_VERSION_MAJOR;
+	shb.minor_version = PCAP_NG_VERSION_MINOR;
+	shb.section_length = 0xFFFFFFFFFFFFFFFFULL;	/* unknown */
+	btrlr.total_length = bhdr.total_length;
+	bp = ng_reserve(d, bhdr.total_length);
+	memcpy(bp, &bhdr, sizeof(bhdr));
+	memcpy(bp + sizeof(bhdr), &shb, sizeof(shb));
+	memcpy(bp + sizeof(bhdr) + sizeof(shb), &btrlr, sizeof(btrlr));
+
+	bhdr.block_type = BT_IDB;
+	bhdr.total_length = (bpf_u_int32)idblen;
+	idb.linktype = (u_short)linktype;
+	idb.reserved = 0;
+	idb.snaplen = p->snapshot;
+	btrlr.total_length = bhdr.total_length;
+	bp = ng_reserve(d, idblen);
+	memcpy(bp, &bhdr, sizeof(bhdr));
+	bp += sizeof(bhdr);
+	memcpy(bp, &idb, sizeof(idb));
+	bp += sizeof(idb);
+	if (d->tsscale != 1000000) {
+		opthdr.option_code = IF_TSRESOL;
+		opthdr.option_length = 1;
+		memcpy(bp, &opthdr, sizeof(opthdr));
+		bp += sizeof(opthdr);
+		memset(bp, 0, 4);
+		bp[0] = 9;			/* 10^-9 */
+		bp += 4;
+		opthdr.option_code = OPT_ENDOFOPT;
+		opthdr.option_length = 0;
+		memcpy(bp, &opthdr, sizeof(opthdr));
+		bp += sizeof(opthdr);
+	}
+	memcpy(bp, &btrlr, sizeof(btrlr));
+
+#ifdef HAVE_PTHREADS
+	/*
+	 * The writer doesn't want our signals.
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	status = pthread_create(&d->thread, NULL, ng_writer, d);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (status != 0) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    status, "%s: can't start writer thread", fname);
+		ng_free(d);
+		if (f != stdout)
+			(void)fclose(f);
+		return (NULL);
+	}
+#endif
+	if (ng_next_chunk(d) == -1) {
+		(void)pcap_ng_dump_close(d);
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    ENOMEM, "%s", fname);
+		return (NULL);
+	}
+	return (d);
+
+nomem:
+	pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+	    ENOMEM, "%s", fname);
+	if (f != stdout)
+		(void)fclose(f);
+	return (NULL);
+}
+
+/*
+ * Open fname to write a compressed pcapng file to, compressing at zlib
+ * level level.
+ */
+pcap_ng_dumper_t *
+pcap_ng_dump_open(pcap_t *p, const char *fname, int level)
+{
+	FILE *f;
+	int linktype;
+
+	/*
+	 * If this pcap_t hasn't been activated, it doesn't have a
+	 * link-layer type, so we can't use it.
+	 */
+	if (!p->activated) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: not-yet-activated pcap_t passed to pcap_ng_dump_open",
+		    fname);
+		return (NULL);
+	}
+	linktype = dlt_to_linktype(p->linktype);
+	if (linktype == -1) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: link-layer type %d isn't supported in savefiles",
+		    fname, p->linktype);
+		return (NULL);
+	}
+	if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: compression level %d isn't between -1 and 9",
+		    fname, level);
+		return (NULL);
+	}
+
+	if (fname == NULL) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "A null pointer was supplied as the file name");
+		return NULL;
+	}
+	if (fname[0] == '-' && fname[1] == '\0') {
+		f = stdout;
+		fname = "standard output";
+	} else {
+		f = fopen(fname, "wb");
+		if (f == NULL) {
+			pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "%s", fname);
+			return (NULL);
+		}
+	}
+	return (ng_setup_dump(p, linktype, f, fname, level));
+}
+
+/*
+ * Write a compressed pcapng file to a stream.
+ */
+pcap_ng_dumper_t *
+pcap_ng_dump_fopen(pcap_t *p, FILE *f, int level)
+{
+	int linktype;
+
+	if (!p->activated) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "not-yet-activated pcap_t passed to pcap_ng_dump_fopen");
+		return (NULL);
+	}
+	linktype = dlt_to_linktype(p->linktype);
+	if (linktype == -1) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "stream: link-layer type %d isn't supported in savefiles",
+		    p->linktype);
+		return (NULL);
+	}
+	if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "stream: compression level %d isn't between -1 and 9",
+		    level);
+		return (NULL);
+	}
+	return (ng_setup_dump(p, linktype, f, "stream", level));
+}
+
+/*
+ * Output a packet to the current chunk.
+ */
+void
+pcap_ng_dump(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	pcap_ng_dumper_t *d = (pcap_ng_dumper_t *)user;
+	struct ng_chunk *c;
+	struct block_header bhdr;
+	struct enhanced_packet_block epb;
+	struct block_trailer btrlr;
+	size_t padded;
+	uint64_t t;
+	u_char *bp;
+
+	padded = ((size_t)h->caplen + 3) & ~(size_t)3;
+	bhdr.block_type = BT_EPB;
+	bhdr.total_length = (bpf_u_int32)(sizeof(bhdr) + sizeof(epb) +
+	    padded + sizeof(btrlr));
+	bp = ng_reserve(d, bhdr.total_length);
+	if (bp == NULL)
+		return;
+	t = (uint64_t)h->ts.tv_sec * d->tsscale + (uint64_t)h->ts.tv_usec;
+	epb.interface_id = 0;
+	epb.timestamp_high = (bpf_u_int32)(t >> 32);
+	epb.timestamp_low = (bpf_u_int32)t;
+	epb.caplen = h->caplen;
+	epb.len = h->len;
+	btrlr.total_length = bhdr.total_length;
+	memcpy(bp, &bhdr, sizeof(bhdr));
+	bp += sizeof(bhdr);
+	memcpy(bp, &epb, sizeof(epb));
+	bp += sizeof(epb);
+	memcpy(bp, sp, h->caplen);
+	memset(bp + h->caplen, 0, padded - h->caplen);
+	bp += padded;
+	memcpy(bp, &btrlr, sizeof(btrlr));
+
+	c = d->cur;
+	if (c->npackets == 0 || t > c->maxts)
+		c->maxts = t;
+	c->npackets++;
+}
+
+FILE *
+pcap_ng_dump_file(pcap_ng_dumper_t *d)
+{
+	return (d->f);
+}
+
+/*
+ * The size the file would have if it were flushed now, taking the
+ * packets not yet compressed to compress as well as those that have
+ * been, going by the counts taken when the last chunk was handed over.
+ * Until a chunk of packets has been compressed there's no ratio to go
+ * on, so the packets not yet compressed are counted at full size; that
+ * errs on the side of starting a new file early.
+ */
+int64_t
+pcap_ng_dump_ftell(pcap_ng_dumper_t *d)
+{
+	uint64_t pending;
+
+	pending = d->uoff - d->seen_uoff;
+	if (d->seen_puoff != 0)
+		pending = (uint64_t)((double)pending * d->seen_pcoff /
+		    d->seen_puoff);
+	return ((int64_t)(d->seen_coff + pending));
+}
+
+/*
+ * Wait for the chunks handed over so far to be written out.
+ */
+static int
+ng_drain(pcap_ng_dumper_t *d)
+{
+	int error;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&d->lock);
+	while (d->queued != 0)
+		pthread_cond_wait(&d->space, &d->lock);
+	error = d->error;
+	ng_counts(d);
+	pthread_mutex_unlock(&d->lock);
+#else
+	error = d->error;
+#endif
+	return (error);
+}
+
+int
+pcap_ng_dump_flush(pcap_ng_dumper_t *d)
+{
+	int error;
+
+	if (d->cur != NULL)
+		(void)ng_next_chunk(d);
+	error = ng_drain(d);
+	if (error == 0 && fflush(d->f) == EOF)
+		error = errno;
+	if (error != 0) {
+		errno = error;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Write out the index and the locator.
+ */
+static int
+ng_write_index(pcap_ng_dumper_t *d)
+{
+	struct block_header bhdr;
+	struct block_trailer btrlr;
+	struct chunk_index_entry entry;
+	struct chunk_index_locator loc;
+	u_char member[LOCATOR_MEMBER_LEN], *bp;
+	uLong crc;
+	size_t i, clen;
+
+	/*
+	 * The index goes in a chunk of its own.
+	 */
+	if (ng_next_chunk(d) == -1 || ng_drain(d) != 0)
+		return (-1);
+	loc.uoff_high = (bpf_u_int32)(d->uoff >> 32);
+	loc.uoff_low = (bpf_u_int32)d->uoff;
+	loc.coff_high = (bpf_u_int32)(d->coff >> 32);
+	loc.coff_low = (bpf_u_int32)d->coff;
+	bhdr.block_type = BT_CHUNK_INDEX;
+	bhdr.total_length = (bpf_u_int32)(sizeof(bhdr) +
+	    d->nindex * sizeof(entry) + sizeof(btrlr));
+	btrlr.total_length = bhdr.total_length;
+	bp = ng_reserve(d, bhdr.total_length);
+	if (bp == NULL)
+		return (-1);
+	memcpy(bp, &bhdr, sizeof(bhdr));
+	bp += sizeof(bhdr);
+	for (i = 0; i < d->nindex; i++) {
+		entry.uoff_high = (bpf_u_int32)(d->index[i].uoff >> 32);
+		entry.uoff_low = (bpf_u_int32)d->index[i].uoff;
+		entry.coff_high = (bpf_u_int32)(d->index[i].coff >> 32);
+		entry.coff_low = (bpf_u_int32)d->index[i].coff;
+		entry.maxts_high = (bpf_u_int32)(d->index[i].maxts >> 32);
+		entry.maxts_low = (bpf_u_int32)d->index[i].maxts;
+		memcpy(bp, &entry, sizeof(entry));
+		bp += sizeof(entry);
+	}
+	memcpy(bp, &btrlr, sizeof(btrlr));
+	clen = ng_compress(d, d->cur);
+	if (clen == 0)
+		return (-1);
+
+	/*
+	 * The locator goes in a member made by hand.
+	 */
+	bp = member;
+	*bp++ = 0x1f;			/* gzip magic */
+	*bp++ = 0x8b;
+	*bp++ = Z_DEFLATED;
+	memset(bp, 0, 5);		/* flags, modification time */
+	bp += 5;
+	*bp++ = 0;			/* extra flags */
+	*bp++ = 0xff;			/* OS unknown */
+	*bp++ = 0x01;			/* final stored block */
+	*bp++ = LOCATOR_BLOCK_LEN & 0xff;
+	*bp++ = LOCATOR_BLOCK_LEN >> 8;
+	*bp++ = ~LOCATOR_BLOCK_LEN & 0xff;
+	*bp++ = (~LOCATOR_BLOCK_LEN >> 8) & 0xff;
+	bhdr.block_type = BT_CHUNK_INDEX_LOCATOR;
+	bhdr.total_length = LOCATOR_BLOCK_LEN;
+	btrlr.total_length = LOCATOR_BLOCK_LEN;
+	memcpy(bp, &bhdr, sizeof(bhdr));
+	memcpy(bp + sizeof(bhdr), &loc, sizeof(loc));
+	memcpy(bp + sizeof(bhdr) + sizeof(loc), &btrlr, sizeof(btrlr));
+	crc = crc32(0, bp, LOCATOR_BLOCK_LEN);
+	bp += LOCATOR_BLOCK_LEN;
+	for (i = 0; i < 4; i++)
+		*bp++ = (u_char)(crc >> (8 * i));
+	for (i = 0; i < 4; i++)
+		*bp++ = (u_char)(LOCATOR_BLOCK_LEN >> (8 * i));
+	if (fwrite(member, 1, sizeof(member), d->f) != sizeof(member))
+		return (-1);
+	return (0);
+}
+
+int
+pcap_ng_dump_close(pcap_ng_dumper_t *d)
+{
+	int error;
+
+	if (d->cur != NULL)
+		(void)ng_next_chunk(d);
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&d->lock);
+	d->done = 1;
+	pthread_cond_signal(&d->work);
+	pthread_mutex_unlock(&d->lock);
+	pthread_join(d->thread, NULL);
+#endif
+
+	/*
+	 * The writer is gone, so everything is ours now.
+	 */
+	error = d->error;
+	if (error == 0 && d->cur != NULL && ng_write_index(d) == -1)
+		error = errno;
+	if (d->f != stdout) {
+		if (fclose(d->f) == EOF && error == 0)
+			error = errno;
+	} else {
+		if (fflush(d->f) == EOF && error == 0)
+			error = errno;
+	}
+	ng_free(d);
+	if (error != 0) {
+		errno = error;
+		return (-1);
+	}
+	return (0);
+}
+#else /* HAVE_ZLIB */
+pcap_ng_dumper_t *
+pcap_ng_dump_open(pcap_t *p, const char *fname, int level _U_)
+{
+	pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "%s: compressed pcapng files aren't supported", fname);
+	return (NULL);
+}
+
+pcap_ng_dumper_t *
+pcap_ng_dump_fopen(pcap_t *p, FILE *f _U_, int level _U_)
+{
+	pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "compressed pcapng files aren't supported");
+	return (NULL);
+}
+
+/*
+ * Nothing can get hold of a dumper to call these with.
+ */
+void
+pcap_ng_dump(u_char *user _U_, const struct pcap_pkthdr *h _U_,
+    const u_char *sp _U_)
+{
+}
+
+FILE *
+pcap_ng_dump_file(pcap_ng_dumper_t *d _U_)
+{
+	return (NULL);
+}
+
+int64_t
+pcap_ng_dump_ftell(pcap_ng_dumper_t *d _U_)
+{
+	return (-1);
+}
+
+int
+pcap_ng_dump_flush(pcap_ng_dumper_t *d _U_)
+{
+	return (-1);
+}
+
+int
+pcap_ng_dump_close(pcap_ng_dumper_t *d _U_)
+{
+	return (-1);
+}
+#endif /* HAVE_ZLIB */
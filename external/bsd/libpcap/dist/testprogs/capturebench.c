@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Measures how many packets a second a capture keeps up with, and how
+ * many it drops, for a given buffer size, timeout and immediate mode
+ * setting.  The packets come from a child process writing frames as
+ * fast as it can to a tap(4) interface created for the purpose, so
+ * this only works where there is one (and requires the privileges to
+ * create it).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#ifdef __NetBSD__
+#include <net/if_tap.h>
+#endif
+
+#include "pcap/funcattrs.h"
+
+#ifdef TAPGIFNAME
+static char *program_name;
+
+/* Forwards */
+static void countme(u_char *, const struct pcap_pkthdr *, const u_char *);
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+/*
+ * Create a tap interface, bring it up and return a descriptor that
+ * injects the frames written to it as if the interface had received
+ * them; its name goes in 'ifr'.
+ */
+static int
+open_tap(struct ifreq *ifr)
+{
+	int fd, s;
+
+	fd = open("/dev/tap", O_RDWR);
+	if (fd < 0)
+		error("/dev/tap: %s", pcap_strerror(errno));
+	memset(ifr, 0, sizeof(*ifr));
+	if (ioctl(fd, TAPGIFNAME, ifr) < 0)
+		error("TAPGIFNAME: %s", pcap_strerror(errno));
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s < 0)
+		error("socket: %s", pcap_strerror(errno));
+	if (ioctl(s, SIOCGIFFLAGS, ifr) < 0)
+		error("SIOCGIFFLAGS: %s: %s", ifr->ifr_name,
+		    pcap_strerror(errno));
+	ifr->ifr_flags |= IFF_UP;
+	if (ioctl(s, SIOCSIFFLAGS, ifr) < 0)
+		error("SIOCSIFFLAGS: %s: %s", ifr->ifr_name,
+		    pcap_strerror(errno));
+	close(s);
+	return (fd);
+}
+
+/*
+ * Write 'count' Ethernet frames of 'size' bytes, each carrying a UDP
+ * datagram, to 'fd'; report how many the interface took on 'out'.
+ */
+static void
+generate(int fd, int out, u_int count, u_int size)
+{
+	static const u_char hdr[] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff,	/* dst */
+		0x02, 0x00, 0x00, 0x00, 0x00, 0x01,	/* src */
+		0x08, 0x00,				/* IPv4 */
+		0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x40, 0x11, 0x00, 0x00,
+		0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+		0x04, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+	u_char *frame;
+	u_int i, sent;
+
+	frame = calloc(1, size);
+	if (frame == NULL)
+		error("calloc: %s", pcap_strerror(errno));
+	memcpy(frame, hdr, sizeof(hdr));
+	frame[16] = (size - 14) >> 8;
+	frame[17] = (size - 14) & 0xff;
+	frame[38] = (size - 34) >> 8;
+	frame[39] = (size - 34) & 0xff;
+	for (sent = i = 0; i < count; i++) {
+		frame[sizeof(hdr)] = i & 0xff;
+		if (write(fd, frame, size) == (ssize_t)size)
+			sent++;
+		else if (errno != ENOBUFS)
+			error("write to tap: %s", pcap_strerror(errno));
+	}
+	if (write(out, &sent, sizeof(sent)) != sizeof(sent))
+		error("write to pipe: %s", pcap_strerror(errno));
+	free(frame);
+}
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	struct ifreq ifr;
+	pcap_t *pd;
+	struct pcap_stat ps;
+	struct timeval start, end;
+	double secs;
+	int tapfd, pfd[2], status, idle, done;
+	int bufsize, immediate, timeout;
+	u_int count, size, sent, received;
+	pid_t pid;
+
+	bufsize = 0;
+	immediate = 0;
+	timeout = 100;
+	count = 1000000;
+	size = 64;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "B:c:Is:t:")) != -1) {
+		switch (op) {
+
+		case 'B':
+			bufsize = atoi(optarg) * 1024;
+			if (bufsize <= 0)
+				error("invalid buffer size %s", optarg);
+			break;
+
+		case 'c':
+			count = (u_int)strtoul(optarg, NULL, 0);
+			if (count == 0)
+				error("invalid packet count %s", optarg);
+			break;
+
+		case 'I':
+			immediate = 1;
+			break;
+
+		case 's':
+			size = (u_int)strtoul(optarg, NULL, 0);
+			if (size < 64 || size > 1514)
+				error("invalid packet size %s", optarg);
+			break;
+
+		case 't':
+			timeout = atoi(optarg);
+			if (timeout <= 0)
+				error("invalid timeout %s", optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	tapfd = open_tap(&ifr);
+
+	pd = pcap_create(ifr.ifr_name, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	if (pcap_set_snaplen(pd, 65535) != 0)
+		error("%s: pcap_set_snaplen failed", ifr.ifr_name);
+	if (bufsize != 0 && pcap_set_buffer_size(pd, bufsize) != 0)
+		error("%s: pcap_set_buffer_size failed", ifr.ifr_name);
+	if (pcap_set_immediate_mode(pd, immediate) != 0)
+		error("%s: pcap_set_immediate_mode failed", ifr.ifr_name);
+	if (pcap_set_timeout(pd, timeout) != 0)
+		error("%s: pcap_set_timeout failed", ifr.ifr_name);
+	status = pcap_activate(pd);
+	if (status < 0)
+		error("%s: %s", ifr.ifr_name, pcap_geterr(pd));
+
+	if (pipe(pfd) < 0)
+		error("pipe: %s", pcap_strerror(errno));
+	gettimeofday(&start, NULL);
+	end = start;
+	pid = fork();
+	if (pid < 0)
+		error("fork: %s", pcap_strerror(errno));
+	if (pid == 0) {
+		close(pfd[0]);
+		generate(tapfd, pfd[1], count, size);
+		_exit(0);
+	}
+	close(pfd[1]);
+
+	/*
+	 * Read until the generator has finished and a timeout has
+	 * passed without anything more arriving.
+	 */
+	received = 0;
+	done = 0;
+	for (idle = 0; idle < 2; ) {
+		status = pcap_dispatch(pd, -1, countme, (u_char *)&received);
+		if (status < 0)
+			error("%s: pcap_dispatch: %s", ifr.ifr_name,
+			    pcap_geterr(pd));
+		if (!done) {
+			if (waitpid(pid, NULL, WNOHANG) == pid) {
+				gettimeofday(&end, NULL);
+				done = 1;
+			}
+		} else if (status == 0)
+			idle++;
+		else
+			idle = 0;
+	}
+	if (read(pfd[0], &sent, sizeof(sent)) != sizeof(sent))
+		error("generator failed");
+	if (pcap_stats(pd, &ps) < 0)
+		error("%s: pcap_stats: %s", ifr.ifr_name, pcap_geterr(pd));
+
+	secs = (end.tv_sec - start.tv_sec) +
+	    (end.tv_usec - start.tv_usec) / 1e6;
+	if (bufsize != 0)
+		printf("%s: %u-byte packets, %d KB buffer", ifr.ifr_name,
+		    size, bufsize / 1024);
+	else
+		printf("%s: %u-byte packets, default buffer", ifr.ifr_name,
+		    size);
+	printf(", %simmediate, timeout %d ms\n", immediate ? "" : "not ",
+	    timeout);
+	printf("sent %u, received %u in %.3f s: %.0f packets/s\n",
+	    sent, received, secs, secs > 0 ? sent / secs : 0.0);
+	printf("kernel: %u received, %u dropped\n", ps.ps_recv, ps.ps_drop);
+
+	pcap_close(pd);
+	close(tapfd);
+	exit(0);
+}
+
+static void
+countme(u_char *user, const struct pcap_pkthdr *h _U_, const u_char *sp _U_)
+{
+	u_int *counterp = (u_int *)user;
+
+	(*counterp)++;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [-I] [ -B bufsize ] [ -c count ] [ -s size ] [ -t timeout ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+#else /* TAPGIFNAME */
+int
+main(int argc _U_, char **argv)
+{
+	(void)fprintf(stderr, "%s: no tap interfaces to generate packets with\n",
+	    argv[0]);
+	exit(1);
+}
+#endif /* TAPGIFNAME */
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Time the compilation of filters of the kind generated from long
+ * lists of hosts or ports, such as "host a or host b or ...", and
+ * report the size of the resulting programs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#ifdef _WIN32
+  #include "getopt.h"
+#else
+  #include <unistd.h>
+#endif
+
+#include "pcap/funcattrs.h"
+
+static char *program_name;
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+/*
+ * Build the disjunction of 'n' terms of the given kind, each naming
+ * a different host, network or port.
+ */
+static char *
+make_filter(const char *kind, u_int n)
+{
+	char *buf, *cp;
+	size_t size;
+	u_int i;
+
+	size = (size_t)n * 48 + 1;
+	buf = malloc(size);
+	if (buf == NULL)
+		error("malloc(%lu) failed", (unsigned long)size);
+	cp = buf;
+	*cp = '\0';
+	for (i = 0; i < n; i++) {
+		if (i != 0)
+			cp += sprintf(cp, " or ");
+		if (strcmp(kind, "host") == 0 || strcmp(kind, "src") == 0)
+			cp += sprintf(cp, "%s 10.%u.%u.%u", kind,
+			    (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+		else if (strcmp(kind, "net") == 0)
+			cp += sprintf(cp, "net 10.%u.%u.0/24",
+			    (i >> 8) & 0xff, i & 0xff);
+		else if (strcmp(kind, "port") == 0)
+			cp += sprintf(cp, "port %u", 1 + i % 65535);
+		else if (strcmp(kind, "tcpport") == 0)
+			cp += sprintf(cp, "tcp dst port %u", 1 + i % 65535);
+		else
+			error("unknown kind of term %s", kind);
+	}
+	return (buf);
+}
+
+static double
+elapsed(clock_t start)
+{
+	return ((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *cp;
+	int op;
+	int Oflag;
+	u_int nterms;
+	char *kind;
+	char *cmdbuf;
+	pcap_t *pd;
+	struct bpf_program fcode;
+	clock_t start;
+	double t_compile, t_cached;
+
+	Oflag = 1;
+	nterms = 10000;
+	kind = "host";
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "n:Ot:")) != -1) {
+		switch (op) {
+
+		case 'n': {
+			char *end;
+			long n;
+
+			n = strtol(optarg, &end, 10);
+			if (optarg == end || *end != '\0' || n <= 0 ||
+			    n > 1000000)
+				error("invalid number of terms %s", optarg);
+			nterms = (u_int)n;
+			break;
+		}
+
+		case 'O':
+			Oflag = 0;
+			break;
+
+		case 't':
+			kind = optarg;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	cmdbuf = make_filter(kind, nterms);
+
+	pd = pcap_open_dead(DLT_EN10MB, 65535);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+
+	start = clock();
+	if (pcap_compile(pd, &fcode, cmdbuf, Oflag, PCAP_NETMASK_UNKNOWN) < 0)
+		error("%s", pcap_geterr(pd));
+	t_compile = elapsed(start);
+	printf("%u %s terms, %soptimized: %u instructions, compiled in %.3f s\n",
+	    nterms, kind, Oflag ? "" : "not ", fcode.bf_len, t_compile);
+	pcap_freecode(&fcode);
+
+	/*
+	 * Compiling the same filter again should only cost a copy of
+	 * the program.
+	 */
+	start = clock();
+	if (pcap_compile(pd, &fcode, cmdbuf, Oflag, PCAP_NETMASK_UNKNOWN) < 0)
+		error("%s", pcap_geterr(pd));
+	t_cached = elapsed(start);
+	printf("recompiled in %.6f s\n", t_cached);
+	pcap_freecode(&fcode);
+
+	free(cmdbuf);
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [-O] [ -n terms ] [ -t host|src|net|port|tcpport ]\n",
+	    program_name);
+	exit(1);
+}
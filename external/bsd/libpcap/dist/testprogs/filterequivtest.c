@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Check that filters made of long disjunctions, which the compiler
+ * folds into set tests and binary searches, match the same packets as
+ * their terms compiled one by one.
+ *
+ * Each filter is "t1 or t2 or ... or tn" for terms of one kind (host,
+ * port, net, ...), optionally negated or combined with a second such
+ * disjunction by "and" or "and not".  A term on its own is never
+ * folded, so the expected result for a packet is worked out from the
+ * terms' own programs.  Both are run, with and without optimization,
+ * over generated Ethernet packets whose addresses and ports are drawn
+ * mostly from the ones the terms name.  Compiling a filter a second
+ * time must give the same program.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#ifdef _WIN32
+  #include "getopt.h"
+#else
+  #include <unistd.h>
+#endif
+
+#include "pcap/funcattrs.h"
+
+#define PKTSIZE		128
+#define MAXTERMS	64
+#define TERMSIZE	96
+
+static char *program_name;
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+static unsigned long long rstate = 88172645463325252ULL;
+
+static u_int
+rnd(void)
+{
+	rstate ^= rstate << 13;
+	rstate ^= rstate >> 7;
+	rstate ^= rstate << 17;
+	return ((u_int)rstate);
+}
+
+/*
+ * Kinds of term; each names its i'th host, port, network, ...  There
+ * is no "vlan": it moves the offsets of everything after it, so "vlan 1
+ * or vlan 2" is not the "or" of its terms.
+ */
+static const char *kinds[] = {
+	"host", "src", "dst", "port", "tcpport", "udpdst", "net", "ether",
+	"ip6", "proto", "len", "tcpflags", "notsrc", "hostport", "srcdst",
+	"ethproto", "portrange",
+};
+#define NKINDS	(sizeof(kinds) / sizeof(kinds[0]))
+
+static void
+make_term(char *buf, const char *kind, u_int i)
+{
+	static const u_int protos[] = { 6, 17, 132, 1, 58, 44 };
+	static const u_int ethertypes[] = { 0x800, 0x806, 0x86dd, 0x8035, 0x1234 };
+
+	if (strcmp(kind, "host") == 0)
+		sprintf(buf, "host 10.0.0.%u", i);
+	else if (strcmp(kind, "src") == 0)
+		sprintf(buf, "src host 10.0.0.%u", i);
+	else if (strcmp(kind, "dst") == 0)
+		sprintf(buf, "dst 10.0.0.%u", i);
+	else if (strcmp(kind, "port") == 0)
+		sprintf(buf, "port %u", i * 7);
+	else if (strcmp(kind, "tcpport") == 0)
+		sprintf(buf, "tcp port %u", i * 7);
+	else if (strcmp(kind, "udpdst") == 0)
+		sprintf(buf, "udp dst port %u", i * 7);
+	else if (strcmp(kind, "net") == 0)
+		sprintf(buf, "net 10.0.0.%u/30", i * 4 % 64);
+	else if (strcmp(kind, "ether") == 0)
+		sprintf(buf, "ether host 00:00:5e:00:00:%02x", i);
+	else if (strcmp(kind, "ip6") == 0)
+		sprintf(buf, "ip6 host ::%x", i);
+	else if (strcmp(kind, "proto") == 0)
+		sprintf(buf, "ip proto %u", protos[i % 6]);
+	else if (strcmp(kind, "len") == 0)
+		sprintf(buf, "len = %u", 40 + i);
+	else if (strcmp(kind, "tcpflags") == 0)
+		sprintf(buf, "tcp[13] = %u", i);
+	else if (strcmp(kind, "notsrc") == 0)
+		sprintf(buf, "not src host 10.0.0.%u", i);
+	else if (strcmp(kind, "hostport") == 0)
+		sprintf(buf, "(host 10.0.0.%u and port %u)", i, i * 7);
+	else if (strcmp(kind, "srcdst") == 0)
+		sprintf(buf, "(src 10.0.0.%u and dst 10.0.0.%u)", i, i + 1);
+	else if (strcmp(kind, "ethproto") == 0)
+		sprintf(buf, "ether proto %u", ethertypes[i % 5]);
+	else if (strcmp(kind, "portrange") == 0)
+		sprintf(buf, "portrange %u-%u", i * 7, i * 7 + 3);
+	else
+		error("unknown kind of term %s", kind);
+}
+
+/* One side of a filter: a disjunction of terms, each compiled alone. */
+struct disjunction {
+	u_int nterms;
+	char terms[MAXTERMS][TERMSIZE];
+	struct bpf_program progs[MAXTERMS];
+};
+
+enum combine { OR_ONLY, NOT, AND, AND_NOT };
+
+static void
+make_disjunction(pcap_t *pd, struct disjunction *d, const char *kind,
+    u_int nterms, int Oflag)
+{
+	u_int i, pick;
+	int used[MAXTERMS];
+
+	memset(used, 0, sizeof(used));
+	d->nterms = nterms;
+	for (i = 0; i < nterms; i++) {
+		/* distinct terms, in random order */
+		pick = rnd() % MAXTERMS;
+		while (used[pick])
+			pick = (pick + 1) % MAXTERMS;
+		used[pick] = 1;
+		make_term(d->terms[i], kind, pick);
+		if (pcap_compile(pd, &d->progs[i], d->terms[i], Oflag,
+		    PCAP_NETMASK_UNKNOWN) < 0)
+			error("%s: %s", d->terms[i], pcap_geterr(pd));
+	}
+}
+
+static void
+free_disjunction(struct disjunction *d)
+{
+	u_int i;
+
+	for (i = 0; i < d->nterms; i++)
+		pcap_freecode(&d->progs[i]);
+}
+
+static char *
+append_disjunction(char *cp, const struct disjunction *d)
+{
+	u_int i;
+
+	*cp++ = '(';
+	for (i = 0; i < d->nterms; i++)
+		cp += sprintf(cp, "%s%s", i ? " or " : "", d->terms[i]);
+	*cp++ = ')';
+	*cp = '\0';
+	return (cp);
+}
+
+static int
+match_disjunction(const struct disjunction *d, const struct pcap_pkthdr *h,
+    const u_char *pkt)
+{
+	u_int i;
+
+	for (i = 0; i < d->nterms; i++)
+		if (pcap_offline_filter(&d->progs[i], h, pkt) != 0)
+			return (1);
+	return (0);
+}
+
+static void
+put16(u_char *p, u_int v)
+{
+	p[0] = (u_char)(v >> 8);
+	p[1] = (u_char)v;
+}
+
+static void
+put32(u_char *p, u_int v)
+{
+	p[0] = (u_char)(v >> 24);
+	p[1] = (u_char)(v >> 16);
+	p[2] = (u_char)(v >> 8);
+	p[3] = (u_char)v;
+}
+
+static u_int
+random_host(void)
+{
+	return ((rnd() % 4) ? 0x0a000000 | (rnd() % MAXTERMS) : rnd());
+}
+
+static u_int
+random_port(void)
+{
+	return ((rnd() % 4) ? (rnd() % (MAXTERMS + 6)) * 7 : rnd() & 0xffff);
+}
+
+/*
+ * An Ethernet packet of one of a few types, with addresses and ports
+ * mostly taken from the ones make_term() uses.
+ */
+static void
+make_packet(u_char *pkt, struct pcap_pkthdr *h)
+{
+	static const u_int ethertypes[] = {
+		0x800, 0x806, 0x8035, 0x86dd, 0x8100, 0x1234
+	};
+	static const u_int protos[] = { 6, 17, 132, 1, 58, 44 };
+	u_int i, type, off;
+
+	for (i = 0; i < PKTSIZE; i++)
+		pkt[i] = (u_char)rnd();
+	if (rnd() % 8) {
+		memcpy(pkt, "\0\0\x5e\0\0", 5);
+		pkt[3] = rnd() % 2;
+		pkt[5] = rnd() % MAXTERMS;
+	}
+	if (rnd() % 8) {
+		memcpy(pkt + 6, "\0\0\x5e\0\0", 5);
+		pkt[9] = rnd() % 2;
+		pkt[11] = rnd() % MAXTERMS;
+	}
+	type = ethertypes[rnd() % 6];
+	put16(pkt + 12, type);
+	if (type == 0x8100) {
+		put16(pkt + 14, rnd() % MAXTERMS);
+		put16(pkt + 16, 0x800);
+	} else if (type == 0x800) {
+		pkt[14] = (rnd() % 4) ? 0x45 : 0x46;
+		if (rnd() % 4)
+			pkt[20] = pkt[21] = 0;
+		pkt[23] = protos[rnd() % 6];
+		put32(pkt + 26, random_host());
+		put32(pkt + 30, random_host());
+		off = 14 + (pkt[14] & 0xf) * 4;
+		put16(pkt + off, random_port());
+		put16(pkt + off + 2, random_port());
+		if (rnd() % 2)
+			pkt[off + 13] = rnd() % MAXTERMS;
+	} else if (type == 0x806 || type == 0x8035) {
+		put32(pkt + 28, random_host());
+		put32(pkt + 38, random_host());
+	} else if (type == 0x86dd) {
+		pkt[20] = protos[rnd() % 6];
+		memset(pkt + 22, 0, 12);
+		memset(pkt + 38, 0, 12);
+		put32(pkt + 34, rnd() % MAXTERMS);
+		put32(pkt + 50, rnd() % MAXTERMS);
+		put16(pkt + 54, random_port());
+		put16(pkt + 56, random_port());
+	}
+	/*
+	 * Always the whole packet: a load past the captured data rejects
+	 * it outright, so on a cut-off packet a filter depends on the
+	 * order its terms are tested in.
+	 */
+	h->caplen = PKTSIZE;
+	h->len = 40 + rnd() % (PKTSIZE - 40 + 1);
+}
+
+/*
+ * Compile one filter, check it against its terms on npackets packets
+ * and check that compiling it again gives the same program.  Returns
+ * the number of instructions.
+ */
+static u_int
+check_filter(pcap_t *pd, enum combine how, const char *kind1, u_int n1,
+    const char *kind2, u_int n2, int Oflag, u_int npackets)
+{
+	static struct disjunction d1, d2;
+	static char filter[2 * MAXTERMS * TERMSIZE + 32];
+	struct bpf_program fcode, again;
+	struct pcap_pkthdr h;
+	u_char pkt[PKTSIZE];
+	char *cp;
+	u_int i, len;
+	int got, want;
+
+	make_disjunction(pd, &d1, kind1, n1, Oflag);
+	cp = filter;
+	if (how == NOT)
+		cp += sprintf(cp, "not ");
+	cp = append_disjunction(cp, &d1);
+	d2.nterms = 0;
+	if (how == AND || how == AND_NOT) {
+		make_disjunction(pd, &d2, kind2, n2, Oflag);
+		cp += sprintf(cp, how == AND ? " and " : " and not ");
+		cp = append_disjunction(cp, &d2);
+	}
+
+	if (pcap_compile(pd, &fcode, filter, Oflag, PCAP_NETMASK_UNKNOWN) < 0)
+		error("%s: %s", filter, pcap_geterr(pd));
+	for (i = 0; i < npackets; i++) {
+		make_packet(pkt, &h);
+		want = match_disjunction(&d1, &h, pkt);
+		switch (how) {
+		case OR_ONLY:
+			break;
+		case NOT:
+			want = !want;
+			break;
+		case AND:
+			want = want && match_disjunction(&d2, &h, pkt);
+			break;
+		case AND_NOT:
+			want = want && !match_disjunction(&d2, &h, pkt);
+			break;
+		}
+		got = pcap_offline_filter(&fcode, &h, pkt) != 0;
+		if (got != want)
+			error("%soptimized \"%s\" %s a packet its terms %s",
+			    Oflag ? "" : "un", filter,
+			    got ? "matches" : "doesn't match",
+			    want ? "match" : "don't match");
+	}
+
+	if (pcap_compile(pd, &again, filter, Oflag, PCAP_NETMASK_UNKNOWN) < 0)
+		error("%s: %s", filter, pcap_geterr(pd));
+	if (again.bf_len != fcode.bf_len ||
+	    memcmp(again.bf_insns, fcode.bf_insns,
+	    fcode.bf_len * sizeof(*fcode.bf_insns)) != 0)
+		error("\"%s\" compiled differently the second time", filter);
+
+	len = fcode.bf_len;
+	pcap_freecode(&again);
+	pcap_freecode(&fcode);
+	free_disjunction(&d1);
+	free_disjunction(&d2);
+	return (len);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u_int sizes[] = { 1, 2, 3, 15, 16, 17, 40 };
+	static const u_int mixed[] = { 2, 20, 40 };
+	char *cp;
+	int op, Oflag, vflag;
+	u_int npackets, nfilters, i, k, len;
+	pcap_t *pd;
+	struct bpf_program fcode;
+	int have_ip6;
+
+	npackets = 2000;
+	vflag = 0;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "p:s:v")) != -1) {
+		switch (op) {
+
+		case 'p':
+			npackets = (u_int)strtoul(optarg, NULL, 10);
+			break;
+
+		case 's':
+			rstate = strtoull(optarg, NULL, 10) | 1;
+			break;
+
+		case 'v':
+			vflag = 1;
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	pd = pcap_open_dead(DLT_EN10MB, 65535);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+
+	/* libpcap may have been built without IPv6 address support */
+	have_ip6 = pcap_compile(pd, &fcode, "ip6 host ::1", 1,
+	    PCAP_NETMASK_UNKNOWN) == 0;
+	if (have_ip6)
+		pcap_freecode(&fcode);
+
+	nfilters = 0;
+	for (Oflag = 1; Oflag >= 0; Oflag--) {
+		/* every kind of term, at sizes around the folding limits */
+		for (k = 0; k < NKINDS; k++) {
+			if (!have_ip6 && strcmp(kinds[k], "ip6") == 0)
+				continue;
+			for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+				len = check_filter(pd, OR_ONLY, kinds[k],
+				    sizes[i], NULL, 0, Oflag, npackets);
+				if (vflag)
+					printf("%s x%u%s: %u instructions\n",
+					    kinds[k], sizes[i],
+					    Oflag ? "" : " (not optimized)",
+					    len);
+				nfilters++;
+			}
+		}
+		/* folded sets inside larger expressions */
+		for (i = 0; i < sizeof(mixed) / sizeof(mixed[0]); i++) {
+			check_filter(pd, NOT, "host", mixed[i], NULL, 0,
+			    Oflag, npackets);
+			check_filter(pd, AND, "host", mixed[i], "port",
+			    mixed[i], Oflag, npackets);
+			check_filter(pd, AND_NOT, "host", mixed[i], "port",
+			    mixed[i] / 2, Oflag, npackets);
+			check_filter(pd, AND, "ethproto", mixed[i],
+			    "len", mixed[i], Oflag, npackets);
+			check_filter(pd, AND, "src", mixed[i], "dst",
+			    mixed[i], Oflag, npackets);
+			check_filter(pd, AND_NOT, "srcdst", mixed[i],
+			    "hostport", mixed[i], Oflag, npackets);
+			nfilters += 6;
+		}
+	}
+	printf("%u filters, %u packets each: no differences\n",
+	    nfilters, npackets);
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr, "Usage: %s [-v] [ -p packets ] [ -s seed ]\n",
+	    program_name);
+	exit(1);
+}
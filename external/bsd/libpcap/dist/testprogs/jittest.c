@@ -0,0 +1,438 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Check that the native code produced by pcap_bpf_jit_compile() gives
+ * the same result as bpf_filter(), and time the two.
+ *
+ * Without -b, random validated BPF programs, and the programs compiled
+ * from a list of filter expressions with and without optimization, are
+ * run over random and crafted packets, with random captured and wire
+ * lengths.  The first difference is reported and makes the exit status
+ * non-zero.
+ *
+ * With -b, the given expression is run over synthetic Ethernet/IPv4/TCP
+ * packets and the time per packet of both is printed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#ifdef _WIN32
+  #include "getopt.h"
+#else
+  #include <unistd.h>
+#endif
+
+#include "pcap-int.h"
+
+#define PKTSIZE		128
+#define MAXINSNS	48
+
+static char *program_name;
+
+static const char *exprs[] = {
+	"",
+	"tcp",
+	"tcp port 80",
+	"tcp dst port 80 or udp src port 53",
+	"host 10.1.2.3",
+	"net 10.0.0.0/8 and not host 10.0.0.1",
+	"ip6 and tcp",
+	"ip[6:2] & 0x1fff = 0",
+	"tcp[tcpflags] & (tcp-syn|tcp-fin) != 0",
+	"len > 100",
+	"len <= 64 or ip[0] & 0xf > 5",
+	"ip[2:2] - ((ip[0] & 0xf) << 2) > 40",
+	"ip[8] * 3 / 2 % 7 = 1",
+	"ether[12:2] ^ 0x800 = 0",
+	"vlan and tcp",
+	"icmp[icmptype] = icmp-echo",
+	"portrange 1000-2000",
+	"ether broadcast or ether multicast",
+};
+
+/* opcodes random programs are made of */
+static const u_short ops[] = {
+	BPF_RET|BPF_K, BPF_RET|BPF_A,
+	BPF_LD|BPF_W|BPF_ABS, BPF_LD|BPF_H|BPF_ABS, BPF_LD|BPF_B|BPF_ABS,
+	BPF_LD|BPF_W|BPF_IND, BPF_LD|BPF_H|BPF_IND, BPF_LD|BPF_B|BPF_IND,
+	BPF_LD|BPF_W|BPF_LEN, BPF_LDX|BPF_W|BPF_LEN, BPF_LDX|BPF_MSH|BPF_B,
+	BPF_LD|BPF_IMM, BPF_LDX|BPF_IMM, BPF_LD|BPF_MEM, BPF_LDX|BPF_MEM,
+	BPF_ST, BPF_STX,
+	BPF_JMP|BPF_JA,
+	BPF_JMP|BPF_JGT|BPF_K, BPF_JMP|BPF_JGE|BPF_K,
+	BPF_JMP|BPF_JEQ|BPF_K, BPF_JMP|BPF_JSET|BPF_K,
+	BPF_JMP|BPF_JGT|BPF_X, BPF_JMP|BPF_JGE|BPF_X,
+	BPF_JMP|BPF_JEQ|BPF_X, BPF_JMP|BPF_JSET|BPF_X,
+	BPF_ALU|BPF_ADD|BPF_X, BPF_ALU|BPF_SUB|BPF_X, BPF_ALU|BPF_MUL|BPF_X,
+	BPF_ALU|BPF_DIV|BPF_X, BPF_ALU|BPF_MOD|BPF_X, BPF_ALU|BPF_AND|BPF_X,
+	BPF_ALU|BPF_OR|BPF_X, BPF_ALU|BPF_XOR|BPF_X, BPF_ALU|BPF_LSH|BPF_X,
+	BPF_ALU|BPF_RSH|BPF_X,
+	BPF_ALU|BPF_ADD|BPF_K, BPF_ALU|BPF_SUB|BPF_K, BPF_ALU|BPF_MUL|BPF_K,
+	BPF_ALU|BPF_DIV|BPF_K, BPF_ALU|BPF_MOD|BPF_K, BPF_ALU|BPF_AND|BPF_K,
+	BPF_ALU|BPF_OR|BPF_K, BPF_ALU|BPF_XOR|BPF_K, BPF_ALU|BPF_LSH|BPF_K,
+	BPF_ALU|BPF_RSH|BPF_K,
+	BPF_ALU|BPF_NEG, BPF_MISC|BPF_TAX, BPF_MISC|BPF_TXA,
+};
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+/*
+ * A constant biased towards the values where the edge cases are:
+ * small offsets, shift counts around 32, and values near 2^31 and 2^32.
+ */
+static bpf_u_int32
+random_k(void)
+{
+	switch (rand() % 8) {
+	case 0:
+		return (rand() % 16);
+	case 1:
+		return (rand() % 64);
+	case 2:
+		return ((bpf_u_int32)rand() * 2654435761U);
+	case 3:
+		return (0xffffffffU - rand() % 8);
+	case 4:
+		return (0x7ffffff0U + rand() % 32);
+	case 5:
+		return (rand() % 33);
+	default:
+		return (rand() % (PKTSIZE - 48));
+	}
+}
+
+/*
+ * Fill in a random program of at most MAXINSNS instructions, only
+ * jumping forward, and return its length.  The result may still be
+ * rejected by bpf_validate().
+ */
+static u_int
+random_program(struct bpf_insn *prog)
+{
+	u_int i, n, rem;
+
+	n = 1 + rand() % (MAXINSNS - 1);
+	for (i = 0; i < n - 1; i++) {
+		prog[i].code = ops[rand() % (sizeof(ops) / sizeof(ops[0]))];
+		prog[i].jt = prog[i].jf = 0;
+		prog[i].k = random_k();
+		if (BPF_CLASS(prog[i].code) == BPF_ST ||
+		    BPF_CLASS(prog[i].code) == BPF_STX ||
+		    BPF_MODE(prog[i].code) == BPF_MEM)
+			prog[i].k %= BPF_MEMWORDS;
+		if (BPF_CLASS(prog[i].code) == BPF_ALU &&
+		    BPF_SRC(prog[i].code) == BPF_K &&
+		    (BPF_OP(prog[i].code) == BPF_DIV ||
+		     BPF_OP(prog[i].code) == BPF_MOD) && prog[i].k == 0)
+			prog[i].k = 3;
+		if (BPF_CLASS(prog[i].code) == BPF_JMP) {
+			rem = n - i - 2;
+			prog[i].jt = rand() % (rem + 1);
+			prog[i].jf = rand() % (rem + 1);
+			if (prog[i].code == (BPF_JMP|BPF_JA))
+				prog[i].k = rand() % (rem + 1);
+		}
+	}
+	prog[n - 1].code = (rand() % 2) ? BPF_RET|BPF_A : BPF_RET|BPF_K;
+	prog[n - 1].jt = prog[n - 1].jf = 0;
+	prog[n - 1].k = random_k();
+	return (n);
+}
+
+/*
+ * An Ethernet/IPv4/TCP packet with a few fields varied by 'i', so
+ * that real filters take their different branches.
+ */
+static void
+make_packet(u_char *pkt, u_int i)
+{
+	u_int j;
+
+	for (j = 0; j < PKTSIZE; j++)
+		pkt[j] = (u_char)rand();
+	pkt[12] = (i % 5 == 0) ? 0x86 : 0x08;		/* IPv6 or IPv4 */
+	pkt[13] = (i % 5 == 0) ? 0xdd : 0x00;
+	pkt[14] = 0x45;
+	pkt[20] = (i % 7 == 0) ? 0x20 : 0;		/* fragment */
+	pkt[21] = 0;
+	pkt[23] = (i % 3 == 0) ? 17 : 6;		/* UDP or TCP */
+	pkt[26] = 10;
+	pkt[36] = 0;
+	pkt[37] = (i % 2) ? 80 : 53;
+}
+
+static void
+dump_program(const struct bpf_insn *prog, u_int n)
+{
+	u_int i;
+
+	for (i = 0; i < n; i++)
+		fprintf(stderr, "%s\n", bpf_image(&prog[i], i));
+}
+
+/*
+ * Run a program through both and complain about the first packet they
+ * disagree on.  Returns the number of packets run, or 0 if the program
+ * couldn't be compiled to native code.
+ */
+static u_long
+compare(const struct bpf_insn *prog, u_int n, u_int npackets,
+    const char *what)
+{
+	pcap_bpf_jit_func f;
+	u_char pkt[PKTSIZE];
+	size_t size;
+	u_int i, buflen, wirelen, a, b;
+
+	f = pcap_bpf_jit_compile(prog, n, &size);
+	if (f == NULL)
+		return (0);
+	for (i = 0; i < npackets; i++) {
+		if (i % 2)
+			make_packet(pkt, i);
+		else
+			for (buflen = 0; buflen < PKTSIZE; buflen++)
+				pkt[buflen] = (u_char)rand();
+		buflen = (i % 4) ? PKTSIZE - rand() % 16 : rand() % (PKTSIZE + 1);
+		wirelen = (rand() % 3) ? buflen : random_k();
+		a = bpf_filter(prog, pkt, wirelen, buflen);
+		b = f(pkt, wirelen, buflen);
+		if (a != b) {
+			fprintf(stderr,
+			    "%s: interpreter returned %u, native code %u "
+			    "(wirelen %u, buflen %u), program:\n",
+			    what, a, b, wirelen, buflen);
+			dump_program(prog, n);
+			exit(1);
+		}
+	}
+	pcap_bpf_jit_free(f, size);
+	return (npackets);
+}
+
+static double
+elapsed(clock_t start)
+{
+	return ((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+static void
+bench(pcap_t *pd, const char *expr, u_int npackets)
+{
+	static u_char pkts[1024][PKTSIZE];
+	struct bpf_program fcode;
+	pcap_bpf_jit_func f;
+	clock_t start;
+	double t_interp, t_jit;
+	u_long a, b;
+	size_t size;
+	u_int i, r, rounds;
+
+	if (pcap_compile(pd, &fcode, expr, 1, PCAP_NETMASK_UNKNOWN) < 0)
+		error("%s", pcap_geterr(pd));
+	f = pcap_bpf_jit_compile(fcode.bf_insns, fcode.bf_len, &size);
+	if (f == NULL)
+		error("\"%s\" can't be compiled to native code here", expr);
+	for (i = 0; i < 1024; i++)
+		make_packet(pkts[i], i);
+	rounds = (npackets + 1023) / 1024;
+
+	a = 0;
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < 1024; i++)
+			a += bpf_filter(fcode.bf_insns, pkts[i], PKTSIZE,
+			    PKTSIZE) != 0;
+	t_interp = elapsed(start);
+
+	b = 0;
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < 1024; i++)
+			b += f(pkts[i], PKTSIZE, PKTSIZE) != 0;
+	t_jit = elapsed(start);
+
+	if (a != b)
+		error("interpreter matched %lu packets, native code %lu", a, b);
+	printf("\"%s\": %u instructions, %lu of %u packets match\n",
+	    expr, fcode.bf_len, a, rounds * 1024);
+	printf("interpreter %.1f ns/packet, native code %.1f ns/packet\n",
+	    t_interp * 1e9 / (rounds * 1024.0), t_jit * 1e9 / (rounds * 1024.0));
+	pcap_bpf_jit_free(f, size);
+	pcap_freecode(&fcode);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *cp;
+	int op;
+	int bflag;
+	u_int nprogs, npackets, seed, n, i, compiled;
+	u_long runs;
+	pcap_t *pd;
+	struct bpf_program fcode;
+	struct bpf_insn prog[MAXINSNS];
+	int Oflag;
+
+	bflag = 0;
+	nprogs = 100000;
+	npackets = 0;
+	seed = (u_int)time(NULL);
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "bn:p:s:")) != -1) {
+		switch (op) {
+
+		case 'b':
+			bflag = 1;
+			break;
+
+		case 'n':
+			nprogs = (u_int)strtoul(optarg, NULL, 10);
+			break;
+
+		case 'p':
+			npackets = (u_int)strtoul(optarg, NULL, 10);
+			break;
+
+		case 's':
+			seed = (u_int)strtoul(optarg, NULL, 10);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (bflag ? optind != argc - 1 : optind != argc)
+		usage();
+	srand(seed);
+
+	pd = pcap_open_dead(DLT_EN10MB, 65535);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+
+	if (bflag) {
+		bench(pd, argv[optind], npackets ? npackets : 20000000);
+		pcap_close(pd);
+		exit(0);
+	}
+	if (npackets == 0)
+		npackets = 20;
+
+	prog[0].code = BPF_RET|BPF_K;
+	prog[0].jt = prog[0].jf = 0;
+	prog[0].k = 0;
+	if (compare(prog, 1, 1, "probe") == 0) {
+		printf("no native BPF code on this platform\n");
+		pcap_close(pd);
+		exit(0);
+	}
+
+	runs = 0;
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+		for (Oflag = 0; Oflag <= 1; Oflag++) {
+			if (pcap_compile(pd, &fcode, exprs[i], Oflag,
+			    PCAP_NETMASK_UNKNOWN) < 0)
+				error("%s: %s", exprs[i], pcap_geterr(pd));
+			n = (u_int)compare(fcode.bf_insns, fcode.bf_len,
+			    npackets * 100, exprs[i]);
+			if (n == 0)
+				error("\"%s\" wasn't compiled to native code",
+				    exprs[i]);
+			runs += n;
+			pcap_freecode(&fcode);
+		}
+	}
+	printf("%u filter expressions: %lu packets, no differences\n",
+	    (u_int)(sizeof(exprs) / sizeof(exprs[0])), runs);
+
+	runs = 0;
+	compiled = 0;
+	for (i = 0; i < nprogs; i++) {
+		n = random_program(prog);
+		if (!bpf_validate(prog, (int)n))
+			continue;
+		n = (u_int)compare(prog, n, npackets, "random program");
+		if (n != 0)
+			compiled++;
+		runs += n;
+	}
+	printf("%u random programs (seed %u), %u valid and compiled: "
+	    "%lu packets, no differences\n", nprogs, seed, compiled, runs);
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -n programs ] [ -p packets ] [ -s seed ]\n"
+	    "       %s -b [ -p packets ] expression\n",
+	    program_name, program_name);
+	exit(1);
+}
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Round trip of the compressed pcapng writer and the gzip reader.
+ *
+ * Random packets, with time stamps that mostly go forwards but now and
+ * then repeat or go back, are written to 'file' with pcap_ng_dump_open().
+ * Halfway through, the dumper is flushed and what has been written so
+ * far is copied to 'file'.noindex, which is a compressed file without the
+ * chunk index that pcap_ng_dump_close() adds at the end.  Both files are
+ * read back with pcap_open_offline() and must give the packets that were
+ * written; then pcap_offline_seek_time() is given random times, and the
+ * packets read after each seek must be the ones from the first packet
+ * not earlier than the time on, which is found by looking through the
+ * packets written.  The time per seek is printed for both files.
+ *
+ * Last, the packets are written to 'file'.pcap with pcap_dump_open(),
+ * compressed to 'file'.pcap.gz with zlib, and read back from that.
+ *
+ * The first difference is reported and makes the exit status non-zero.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#ifdef _WIN32
+  #include "getopt.h"
+#else
+  #include <unistd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <pcap.h>
+
+#define MAXCAPLEN	1514
+
+struct packet {
+	struct pcap_pkthdr hdr;
+	u_char *data;
+};
+
+static char *program_name;
+
+static struct packet *packets;
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+/*
+ * Make up the packets.  Their contents are repetitive enough to
+ * compress, like real traffic, and the time stamps advance by up to
+ * a few milliseconds, except that one in 50 is the same as the one
+ * before and one in 200 goes back a little.
+ */
+static void
+make_packets(u_int n)
+{
+	struct packet *pk;
+	struct timeval ts;
+	u_int i, j, caplen;
+
+	packets = calloc(n, sizeof(*packets));
+	if (packets == NULL)
+		error("out of memory");
+	ts.tv_sec = 1600000000;
+	ts.tv_usec = 0;
+	for (i = 0; i < n; i++) {
+		pk = &packets[i];
+		switch (rand() % 200) {
+
+		case 0:
+			ts.tv_usec -= rand() % 50000;
+			if (ts.tv_usec < 0) {
+				ts.tv_usec += 1000000;
+				ts.tv_sec--;
+			}
+			break;
+
+		case 1: case 2: case 3: case 4:
+			break;
+
+		default:
+			ts.tv_usec += rand() % 5000;
+			if (ts.tv_usec >= 1000000) {
+				ts.tv_usec -= 1000000;
+				ts.tv_sec++;
+			}
+			break;
+		}
+		caplen = 14 + rand() % (MAXCAPLEN - 14 + 1);
+		pk->hdr.ts = ts;
+		pk->hdr.caplen = caplen;
+		pk->hdr.len = (rand() % 4) ? caplen : caplen + rand() % 1000;
+		pk->data = malloc(caplen);
+		if (pk->data == NULL)
+			error("out of memory");
+		for (j = 0; j < caplen; j++)
+			pk->data[j] = (j < 54 || rand() % 4 == 0) ?
+			    (u_char)rand() : (u_char)(i + j / 16);
+	}
+}
+
+static int
+ts_before(const struct timeval *a, const struct timeval *b)
+{
+	return (a->tv_sec < b->tv_sec ||
+	    (a->tv_sec == b->tv_sec && a->tv_usec < b->tv_usec));
+}
+
+/*
+ * Read the next packet and check that it's packet i, or, if i is n,
+ * that we're at the end of the file.
+ */
+static void
+expect(pcap_t *pd, const char *fname, u_int i, u_int n, const char *what)
+{
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	const struct packet *pk;
+	int status;
+
+	status = pcap_next_ex(pd, &h, &data);
+	if (i == n) {
+		if (status != PCAP_ERROR_BREAK)
+			error("%s: %s: expected the end of the file, got %d%s%s",
+			    fname, what, status, status == PCAP_ERROR ? ": " : "",
+			    status == PCAP_ERROR ? pcap_geterr(pd) : "");
+		return;
+	}
+	if (status != 1)
+		error("%s: %s: expected packet %u, got %d%s%s", fname, what,
+		    i, status, status == PCAP_ERROR ? ": " : "",
+		    status == PCAP_ERROR ? pcap_geterr(pd) : "");
+	pk = &packets[i];
+	if (h->ts.tv_sec != pk->hdr.ts.tv_sec ||
+	    h->ts.tv_usec != pk->hdr.ts.tv_usec ||
+	    h->caplen != pk->hdr.caplen || h->len != pk->hdr.len ||
+	    memcmp(data, pk->data, h->caplen) != 0)
+		error("%s: %s: packet %u differs from the one written",
+		    fname, what, i);
+}
+
+static pcap_t *
+open_file(const char *fname)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd;
+
+	pd = pcap_open_offline(fname, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	return (pd);
+}
+
+/*
+ * Read back the first n packets from fname, then seek to random times.
+ */
+static void
+check_file(const char *fname, u_int n, u_int nseeks)
+{
+	struct timeval tv;
+	clock_t start;
+	pcap_t *pd;
+	u_int i, j, k, first;
+
+	pd = open_file(fname);
+	for (i = 0; i <= n; i++)
+		expect(pd, fname, i, n, "reading through");
+
+	start = clock();
+	for (k = 0; k < nseeks; k++) {
+		/*
+		 * Go to the time of a packet, to just before it, to before
+		 * the start or to after the end.
+		 */
+		j = rand() % (n + 2);
+		if (j == 0) {
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+		} else if (j == n + 1) {
+			tv = packets[n - 1].hdr.ts;
+			tv.tv_sec += 3600;
+		} else {
+			tv = packets[j - 1].hdr.ts;
+			if (rand() % 2 && tv.tv_usec > 0)
+				tv.tv_usec--;
+		}
+		for (first = 0; first < n; first++)
+			if (!ts_before(&packets[first].hdr.ts, &tv))
+				break;
+		if (pcap_offline_seek_time(pd, &tv) != 0)
+			error("%s: %s", fname, pcap_geterr(pd));
+		for (i = first; i < first + 4 && i < n; i++)
+			expect(pd, fname, i, n, "after a seek");
+		if (i == n)
+			expect(pd, fname, n, n, "after a seek");
+	}
+	if (nseeks != 0)
+		printf("%s: %u packets, %u seeks, %.3f ms/seek\n", fname, n,
+		    nseeks, (double)(clock() - start) * 1000.0 /
+		    CLOCKS_PER_SEC / nseeks);
+	pcap_close(pd);
+}
+
+static void
+copy_file(const char *from, const char *to)
+{
+	char buf[8192];
+	FILE *in, *out;
+	size_t len;
+
+	if ((in = fopen(from, "rb")) == NULL)
+		error("%s: %s", from, strerror(errno));
+	if ((out = fopen(to, "wb")) == NULL)
+		error("%s: %s", to, strerror(errno));
+	while ((len = fread(buf, 1, sizeof(buf), in)) != 0)
+		if (fwrite(buf, 1, len, out) != len)
+			error("%s: %s", to, strerror(errno));
+	if (ferror(in))
+		error("%s: %s", from, strerror(errno));
+	if (fclose(out) == EOF)
+		error("%s: %s", to, strerror(errno));
+	fclose(in);
+}
+
+#ifdef HAVE_ZLIB
+static void
+gzip_file(const char *from, const char *to)
+{
+	char buf[8192];
+	FILE *in;
+	gzFile out;
+	size_t len;
+
+	if ((in = fopen(from, "rb")) == NULL)
+		error("%s: %s", from, strerror(errno));
+	if ((out = gzopen(to, "wb")) == NULL)
+		error("%s: can't open for compressing", to);
+	while ((len = fread(buf, 1, sizeof(buf), in)) != 0)
+		if (gzwrite(out, buf, (unsigned)len) != (int)len)
+			error("%s: can't compress", to);
+	if (gzclose(out) != Z_OK)
+		error("%s: can't compress", to);
+	fclose(in);
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+	char *cp, *fname, *noindex, *plain, *gz;
+	int op, level;
+	u_int n, nseeks, seed, i;
+	size_t len;
+	pcap_t *pd;
+	pcap_ng_dumper_t *nd;
+	pcap_dumper_t *d;
+
+	n = 20000;
+	nseeks = 200;
+	level = 6;
+	seed = (u_int)time(NULL);
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "l:n:p:s:")) != -1) {
+		switch (op) {
+
+		case 'l':
+			level = atoi(optarg);
+			break;
+
+		case 'n':
+			nseeks = (u_int)strtoul(optarg, NULL, 10);
+			break;
+
+		case 'p':
+			n = (u_int)strtoul(optarg, NULL, 10);
+			break;
+
+		case 's':
+			seed = (u_int)strtoul(optarg, NULL, 10);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc - 1 || n < 2)
+		usage();
+	fname = argv[optind];
+	srand(seed);
+
+	len = strlen(fname) + sizeof(".noindex");
+	if ((noindex = malloc(len)) == NULL ||
+	    (plain = malloc(len)) == NULL ||
+	    (gz = malloc(len)) == NULL)
+		error("out of memory");
+	snprintf(noindex, len, "%s.noindex", fname);
+	snprintf(plain, len, "%s.pcap", fname);
+	snprintf(gz, len, "%s.pcap.gz", fname);
+
+	pd = pcap_open_dead(DLT_EN10MB, 65535);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+	nd = pcap_ng_dump_open(pd, fname, level);
+	if (nd == NULL) {
+		printf("%s\n", pcap_geterr(pd));
+		pcap_close(pd);
+		exit(0);
+	}
+	make_packets(n);
+	for (i = 0; i < n; i++) {
+		pcap_ng_dump((u_char *)nd, &packets[i].hdr, packets[i].data);
+		if (i == n / 2 - 1) {
+			if (pcap_ng_dump_flush(nd) != 0)
+				error("%s: %s", fname, strerror(errno));
+			copy_file(fname, noindex);
+		}
+	}
+	if (pcap_ng_dump_close(nd) != 0)
+		error("%s: %s", fname, strerror(errno));
+
+	check_file(fname, n, nseeks);
+	check_file(noindex, n / 2, nseeks / 10);
+
+	d = pcap_dump_open(pd, plain);
+	if (d == NULL)
+		error("%s", pcap_geterr(pd));
+	for (i = 0; i < n; i++)
+		pcap_dump((u_char *)d, &packets[i].hdr, packets[i].data);
+	pcap_dump_close(d);
+#ifdef HAVE_ZLIB
+	gzip_file(plain, gz);
+	check_file(gz, n, 0);
+	printf("%s: %u packets\n", gz, n);
+#endif
+	pcap_close(pd);
+
+	printf("seed %u, level %d: no differences\n", seed, level);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -l level ] [ -n seeks ] [ -p packets ] [ -s seed ] file\n",
+	    program_name);
+	exit(1);
+}
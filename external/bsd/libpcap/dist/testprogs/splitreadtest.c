@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Parallel reading of a savefile with pcap_offline_split() and
+ * pcap_offline_set_range().
+ *
+ * 'file' is read once from start to end on a single handle.  Then it
+ * is opened once per thread, split into that many chunks, and each
+ * thread reads its chunk on its own handle.  The threads together must
+ * see the same number of packets, the same number of bytes and the same
+ * packet contents (compared as a sum of per-packet checksums, since the
+ * order between chunks is lost) as the single reader.  With -F, each
+ * packet is also run through the filter with pcap_offline_filter(),
+ * and the number that match must agree too.
+ *
+ * The elapsed time of each pass is printed.  The first difference is
+ * reported and makes the exit status non-zero.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <pcap.h>
+
+#define MAXTHREADS	64
+
+struct reader {
+	pthread_t thread;
+	pcap_t *pd;
+	u_int64_t packets;
+	u_int64_t bytes;
+	u_int64_t matched;
+	u_int32_t sum;
+	const char *err;
+};
+
+static char *program_name;
+static char *fname;
+static struct bpf_program fcode;
+static int filtering;
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static pcap_t *
+open_file(void)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd;
+
+	pd = pcap_open_offline(fname, ebuf);
+	if (pd == NULL)
+		error("%s", ebuf);
+	return pd;
+}
+
+/*
+ * Read every packet 'r->pd' will give, adding up what was seen.  The
+ * checksum of a packet is a Fletcher-style sum of its bytes, so it
+ * depends on their order within the packet.
+ */
+static void *
+read_packets(void *arg)
+{
+	struct reader *r = arg;
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	u_int32_t a, b;
+	bpf_u_int32 i;
+	int status;
+
+	while ((status = pcap_next_ex(r->pd, &h, &data)) == 1) {
+		r->packets++;
+		r->bytes += h->caplen;
+		a = h->len;
+		b = 0;
+		for (i = 0; i < h->caplen; i++) {
+			a += data[i];
+			b += a;
+		}
+		r->sum += a ^ (b << 7);
+		if (filtering && pcap_offline_filter(&fcode, h, data))
+			r->matched++;
+	}
+	if (status != PCAP_ERROR_BREAK)
+		r->err = pcap_geterr(r->pd);
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct reader whole, readers[MAXTHREADS];
+	int64_t bounds[MAXTHREADS + 1];
+	struct reader total;
+	char *cp, *filter;
+	double start, t1, tn;
+	int op, nthreads, nchunks, i;
+
+	nthreads = 4;
+	filter = NULL;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "F:t:")) != -1) {
+		switch (op) {
+
+		case 'F':
+			filter = optarg;
+			break;
+
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc - 1 || nthreads < 1 || nthreads > MAXTHREADS)
+		usage();
+	fname = argv[optind];
+
+	memset(&whole, 0, sizeof(whole));
+	whole.pd = open_file();
+	if (filter != NULL) {
+		if (pcap_compile(whole.pd, &fcode, filter, 1,
+		    PCAP_NETMASK_UNKNOWN) < 0)
+			error("%s", pcap_geterr(whole.pd));
+		filtering = 1;
+	}
+	start = now();
+	read_packets(&whole);
+	t1 = now() - start;
+	if (whole.err != NULL)
+		error("%s: %s", fname, whole.err);
+	pcap_close(whole.pd);
+
+	memset(readers, 0, sizeof(readers));
+	start = now();
+	readers[0].pd = open_file();
+	nchunks = pcap_offline_split(readers[0].pd, nthreads, bounds);
+	if (nchunks == PCAP_ERROR)
+		error("%s: %s", fname, pcap_geterr(readers[0].pd));
+	for (i = 0; i < nchunks; i++) {
+		if (i != 0)
+			readers[i].pd = open_file();
+		if (pcap_offline_set_range(readers[i].pd, bounds[i],
+		    bounds[i + 1]) != 0)
+			error("%s: %s", fname, pcap_geterr(readers[i].pd));
+		if (pthread_create(&readers[i].thread, NULL, read_packets,
+		    &readers[i]) != 0)
+			error("can't create thread %d", i);
+	}
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nchunks; i++) {
+		pthread_join(readers[i].thread, NULL);
+		if (readers[i].err != NULL)
+			error("%s, chunk %d: %s", fname, i, readers[i].err);
+		total.packets += readers[i].packets;
+		total.bytes += readers[i].bytes;
+		total.matched += readers[i].matched;
+		total.sum += readers[i].sum;
+		pcap_close(readers[i].pd);
+	}
+	tn = now() - start;
+
+	printf("%llu packets, %llu bytes",
+	    (unsigned long long)whole.packets,
+	    (unsigned long long)whole.bytes);
+	if (filtering)
+		printf(", %llu matched", (unsigned long long)whole.matched);
+	printf("\n1 reader: %.3fs; %d readers: %.3fs\n", t1, nchunks, tn);
+
+	if (total.packets != whole.packets)
+		error("%d readers saw %llu packets, 1 reader %llu", nchunks,
+		    (unsigned long long)total.packets,
+		    (unsigned long long)whole.packets);
+	if (total.bytes != whole.bytes)
+		error("%d readers saw %llu bytes, 1 reader %llu", nchunks,
+		    (unsigned long long)total.bytes,
+		    (unsigned long long)whole.bytes);
+	if (total.sum != whole.sum)
+		error("packet contents differ between 1 and %d readers",
+		    nchunks);
+	if (total.matched != whole.matched)
+		error("%d readers matched %llu packets, 1 reader %llu",
+		    nchunks, (unsigned long long)total.matched,
+		    (unsigned long long)whole.matched);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "%s, with %s\n", program_name,
+	    pcap_lib_version());
+	(void)fprintf(stderr,
+	    "Usage: %s [ -F filter ] [ -t threads ] file\n",
+	    program_name);
+	exit(1);
+}
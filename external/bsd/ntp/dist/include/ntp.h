@@ -783,6 +783,7 @@ struct pkt {
 typedef struct mon_data	mon_entry;
 struct mon_data {
 	mon_entry *	hash_next;	/* next structure in hash list */
+	mon_entry **	hash_pprev;	/* previous hash_next pointing here */
 	DECL_DLIST_LINK(mon_entry, mru);/* MRU list link pointers */
 	struct interface * lcladr;	/* address on which this arrived */
 	l_fp		first;		/* first time seen */
@@ -841,10 +842,13 @@ typedef struct res_addr6_tag {
 typedef struct restrict_u_tag	restrict_u;
 struct restrict_u_tag {
 	restrict_u *	link;		/* link to next entry */
+	restrict_u *	hlink;		/* link to next in index bucket */
 	u_int32		count;		/* number of packets matched */
 	u_short		rflags;		/* restrict (accesslist) flags */
 	u_short		mflags;		/* match flags */
 	short		ippeerlimit;	/* IP peer limit */
+	short		plen;		/* prefix length, -1 if mask is
+					   not contiguous */
 	int		srvfuzrftpoll;	/* server response: fuzz reftime */
 	u_long		expire;		/* valid until time */
 	union {				/* variant starting here */
@@ -159,9 +159,9 @@ extern 	int	freq_cnt;
 
 /* ntp_monitor.c */
 #define MON_HASH_SIZE		((size_t)1U << mon_hash_bits)
-#define MON_HASH_MASK		(MON_HASH_SIZE - 1)
-#define	MON_HASH(addr)		(sock_hash(addr) & MON_HASH_MASK)
+#define	MON_HASH(addr)		mon_hash_addr(addr)
 extern	void	init_mon	(void);
+extern	u_int	mon_hash_addr	(const sockaddr_u *);
 extern	void	mon_start	(int);
 extern	void	mon_stop	(int);
 extern	u_short	ntp_monitor	(struct recvbuf *, u_short);
@@ -37,7 +37,9 @@
  * cutting it up into littler pieces. The exception to this when we hit
  * the memory limit. Then we free memory by grabbing entries off the
  * tail for the MRU list, unlinking from the hash table, and
- * reinitializing.
+ * reinitializing.  Each entry also points back at the hash_next pointer
+ * which links it into its hash chain, so reclaiming an entry takes
+ * constant time however long the chain is.
  *
  * INC_MONLIST is the default allocation granularity in entries.
  * INIT_MONLIST is the default initial allocation in entries.
@@ -55,8 +57,16 @@
 #endif
 
 /*
- * Hashing stuff
+ * Hashing stuff.  The table is sized for MON_HASH_LOAD entries per
+ * bucket when every entry allocated so far is in use, within the
+ * bounds of MON_HASH_MINBITS and MON_HASH_MAXBITS, and grows with the
+ * allocation rather than being sized up front for mru_maxdepth, which
+ * may be unlimited.
  */
+#define	MON_HASH_LOAD		2
+#define	MON_HASH_MINBITS	4
+#define	MON_HASH_MAXBITS	24
+
 u_char	mon_hash_bits;
 
 /*
@@ -99,6 +109,8 @@ u_char	ntp_minpoll = NTP_MINPOLL;	/* increment (log 2 s) */
 	int	mon_age = 3000;		/* preemption limit */
 
 static	void		mon_getmoremem(void);
+static	void		mon_hash_grow(void);
+static	void		link_to_hash(mon_entry *, u_int);
 static	void		remove_from_hash(mon_entry *);
 static	inline void	mon_free_entry(mon_entry *);
 static	inline void	mon_reclaim_entry(mon_entry *);
@@ -119,6 +131,54 @@ init_mon(void)
 }
 
 
+/*
+ * mon_hash_addr - hash a remote address to an MRU hash table slot.
+ *
+ * Unlike sock_hash() this is not limited to 16 bits, so the table can
+ * be sized to keep chains short with millions of entries.
+ */
+u_int
+mon_hash_addr(
+	const sockaddr_u *addr
+	)
+{
+	u_int32	hash;
+	u_int32	word;
+	size_t	i;
+
+	hash = (u_int32)AF(addr) * 0x85ebca6bU;
+	if (IS_IPV4(addr)) {
+		hash = (hash ^ NSRCADR(addr)) * 0x9e3779b1U;
+	} else {
+		for (i = 0; i < sizeof(SOCK_ADDR6(addr)); i += sizeof(word)) {
+			memcpy(&word, &PSOCK_ADDR6(addr)->s6_addr[i],
+			       sizeof(word));
+			hash = (hash ^ word) * 0x9e3779b1U;
+			hash ^= hash >> 15;
+		}
+		hash *= 0x9e3779b1U;
+	}
+	return (u_int)(hash >> (32 - mon_hash_bits));
+}
+
+
+/*
+ * link_to_hash - links an entry at the head of a hash chain.
+ */
+static void
+link_to_hash(
+	mon_entry *mon,
+	u_int hash
+	)
+{
+	mon->hash_next = mon_hash[hash];
+	if (mon->hash_next != NULL)
+		mon->hash_next->hash_pprev = &mon->hash_next;
+	mon->hash_pprev = &mon_hash[hash];
+	mon_hash[hash] = mon;
+}
+
+
 /*
  * remove_from_hash - removes an entry from the address hash table and
  *		      decrements mru_entries.
@@ -128,14 +188,14 @@ remove_from_hash(
 	mon_entry *mon
 	)
 {
-	u_int hash;
-	mon_entry *punlinked;
+	REQUIRE(NULL != mon->hash_pprev && mon == *mon->hash_pprev);
 
 	mru_entries--;
-	hash = MON_HASH(&mon->rmtadr);
-	UNLINK_SLIST(punlinked, mon_hash[hash], mon, hash_next,
-		     mon_entry);
-	ENSURE(punlinked == mon);
+	*mon->hash_pprev = mon->hash_next;
+	if (mon->hash_next != NULL)
+		mon->hash_next->hash_pprev = mon->hash_pprev;
+	mon->hash_next = NULL;
+	mon->hash_pprev = NULL;
 }
 
 
@@ -173,6 +233,10 @@ mon_reclaim_entry(
 
 /*
  * mon_getmoremem - get more memory and put it on the free list
+ *
+ * The allocation is trimmed so that mru_alloc does not pass
+ * mru_maxdepth by more than the single entry needed when mru_mindepth
+ * is configured above mru_maxdepth.
  */
 static void
 mon_getmoremem(void)
@@ -183,6 +247,10 @@ mon_getmoremem(void)
 	entries = (0 == mon_mem_increments)
 		      ? mru_initalloc
 		      : mru_incalloc;
+	if (mru_alloc + entries > mru_maxdepth)
+		entries = (mru_maxdepth > mru_alloc)
+			      ? mru_maxdepth - mru_alloc
+			      : 1;
 
 	if (entries) {
 		chunk = eallocarray(entries, sizeof(*chunk));
@@ -191,10 +259,40 @@ mon_getmoremem(void)
 			mon_free_entry(--chunk);
 
 		mon_mem_increments++;
+		if (mon_hash != NULL)
+			mon_hash_grow();
 	}
 }
 
 
+/*
+ * mon_hash_grow - enlarge the MRU hash table to MON_HASH_LOAD entries
+ *		   per bucket at mru_alloc, rehashing the MRU list.
+ */
+static void
+mon_hash_grow(void)
+{
+	mon_entry *mon;
+	u_int min_hash_slots;
+	u_char bits;
+
+	min_hash_slots = (mru_alloc / MON_HASH_LOAD) + 1;
+	bits = MON_HASH_MINBITS;
+	while (bits < MON_HASH_MAXBITS && (1U << bits) < min_hash_slots)
+		bits++;
+	if (mon_hash != NULL && bits <= mon_hash_bits)
+		return;
+
+	free(mon_hash);
+	mon_hash_bits = bits;
+	mon_hash = emalloc_zero(sizeof(*mon_hash) * MON_HASH_SIZE);
+
+	ITER_DLIST_BEGIN(mon_mru_list, mon, mru, mon_entry)
+		link_to_hash(mon, MON_HASH(&mon->rmtadr));
+	ITER_DLIST_END()
+}
+
+
 /*
  * mon_start - start up the monitoring software
  */
@@ -203,9 +301,6 @@ mon_start(
 	int mode
 	)
 {
-	size_t octets;
-	u_int min_hash_slots;
-
 	if (MON_OFF == mode)		/* MON_OFF is 0 */
 		return;
 	if (mon_enabled) {
@@ -215,18 +310,11 @@ mon_start(
 	if (0 == mon_mem_increments)
 		mon_getmoremem();
 	/*
-	 * Select the MRU hash table size to limit the average count
-	 * per bucket at capacity (mru_maxdepth) to 8, if possible
-	 * given our hash is limited to 16 bits.
+	 * The hash table is sized for what has been allocated so far
+	 * and grown by mon_getmoremem() as more is.  After mon_stop()
+	 * it is already empty and sized for mru_alloc.
 	 */
-	min_hash_slots = (mru_maxdepth / 8) + 1;
-	mon_hash_bits = 0;
-	while (min_hash_slots >>= 1)
-		mon_hash_bits++;
-	mon_hash_bits = max(4, mon_hash_bits);
-	mon_hash_bits = min(16, mon_hash_bits);
-	octets = sizeof(*mon_hash) * MON_HASH_SIZE;
-	mon_hash = erealloc_zero(mon_hash, octets, 0);
+	mon_hash_grow();
 
 	mon_enabled = mode;
 }
@@ -491,9 +579,10 @@ ntp_monitor(
 
 	/*
 	 * Drop him into front of the hash table. Also put him on top of
-	 * the MRU list.
+	 * the MRU list.  The hash is taken again as mon_getmoremem()
+	 * may have grown the table since it was first.
 	 */
-	LINK_SLIST(mon_hash[hash], mon, hash_next);
+	link_to_hash(mon, MON_HASH(&mon->rmtadr));
 	LINK_DLIST(mon_mru_list, mon, mru);
 
 	return mon->flags;
@@ -33,6 +33,17 @@
  * flags you found. Because of the ordering of the list, the most
  * specific match will provide the final set of flags.
  *
+ * Walking the list costs a comparison per entry for every packet, which
+ * hurts on busy servers with many "restrict source" or blocklist
+ * entries.  So each entry is also kept in a hash table keyed by its
+ * masked address and prefix length.  A lookup probes the table once
+ * for each prefix length in use, longest first, and the first probe
+ * which finds a usable entry returns the same entry the list walk
+ * would have.  The cost therefore depends on the number of distinct
+ * prefix lengths rather than the number of entries.  A mask which is
+ * not contiguous has no prefix length; while any such entry exists the
+ * list walk is used instead.
+ *
  * This was originally intended to restrict you from sync'ing to your
  * own broadcasts when you are doing that, by restricting yourself from
  * your own interfaces. It was also thought it would sometimes be useful
@@ -62,6 +73,24 @@
 #define	INC_RESLIST4	((1024 - 16) / V4_SIZEOF_RESTRICT_U)
 #define	INC_RESLIST6	((1024 - 16) / V6_SIZEOF_RESTRICT_U)
 
+/*
+ * The prefix length index.  The bucket count is a power of two which
+ * is doubled whenever there are more entries than buckets.
+ */
+#define	RES_INDEX_MINBITS	4
+#define	RES_INDEX_MAXBITS	24
+#define	RES_MAXPLEN		128
+
+typedef struct res_index_tag {
+	restrict_u **	hash;		/* buckets linked by hlink */
+	u_int		hash_bits;	/* log2 of bucket count */
+	u_int		entries;	/* entries in hash */
+	u_int		noncontig;	/* entries not in hash */
+	u_int		nlens;		/* count of lens[] in use */
+	u_char		lens[RES_MAXPLEN + 1];	/* in use, descending */
+	u_int		lencount[RES_MAXPLEN + 1]; /* entries per length */
+} res_index;
+
 /*
  * The restriction list
  */
@@ -76,6 +105,9 @@ static int restrictcount;	/* count in the restrict lists */
 static restrict_u *resfree4;	/* available entries (free list) */
 static restrict_u *resfree6;
 
+static res_index resindex4;	/* index of restrictlist4 */
+static res_index resindex6;	/* index of restrictlist6 */
+
 static u_long res_calls;
 static u_long res_found;
 static u_long res_not_found;
@@ -110,6 +142,18 @@ static restrict_u *	alloc_res6(void);
 static void		free_res(restrict_u *, int);
 static void		inc_res_limited(void);
 static void		dec_res_limited(void);
+static int		res_prefixlen4(u_int32);
+static int		res_prefixlen6(const struct in6_addr *);
+static void		res_mask6(struct in6_addr *,
+				  const struct in6_addr *, int);
+static u_int		res_hash4(u_int32, int, u_int);
+static u_int		res_hash6(const struct in6_addr *, int, u_int);
+static void		res_index_add(restrict_u *, int);
+static void		res_index_del(restrict_u *, int);
+static void		res_index_grow(res_index *, int);
+static restrict_u *	match_restrict4_list(u_int32, u_short);
+static restrict_u *	match_restrict6_list(const struct in6_addr *,
+					     u_short);
 static restrict_u *	match_restrict4_addr(u_int32, u_short);
 static restrict_u *	match_restrict6_addr(const struct in6_addr *,
 					     u_short);
@@ -230,6 +274,9 @@ init_restrict(void)
 	LINK_SLIST(restrictlist4, &restrict_def4, link);
 	LINK_SLIST(restrictlist6, &restrict_def6, link);
 	restrictcount = 2;
+
+	res_index_add(&restrict_def4, 0);
+	res_index_add(&restrict_def6, 1);
 }
 
 
@@ -297,6 +344,7 @@ free_res(
 	restrictcount--;
 	if (RES_LIMITED & res->rflags)
 		dec_res_limited();
+	res_index_del(res, v6);
 
 	if (v6)
 		plisthead = &restrictlist6;
@@ -334,8 +382,248 @@ dec_res_limited(void)
 }
 
 
+/*
+ * res_prefixlen4 - return the prefix length of a host order IPv4 mask,
+ *		    or -1 if the mask is not contiguous.
+ */
+static int
+res_prefixlen4(
+	u_int32	mask
+	)
+{
+	u_int32	inv;
+	int	plen;
+
+	inv = ~mask;
+	if (inv & (inv + 1))
+		return -1;
+	for (plen = 0; plen < 32 && (mask & (0x80000000U >> plen)); plen++)
+		/* empty */;
+	return plen;
+}
+
+
+/*
+ * res_prefixlen6 - return the prefix length of an IPv6 mask, or -1 if
+ *		    the mask is not contiguous.
+ */
+static int
+res_prefixlen6(
+	const struct in6_addr *	mask
+	)
+{
+	int	plen;
+	int	i;
+	u_char	b;
+
+	plen = 0;
+	for (i = 0; i < 16 && 0xff == mask->s6_addr[i]; i++)
+		plen += 8;
+	if (i == 16)
+		return plen;
+	for (b = mask->s6_addr[i]; b & 0x80; b = (u_char)(b << 1))
+		plen++;
+	if (b != 0)
+		return -1;
+	for (i++; i < 16; i++)
+		if (mask->s6_addr[i] != 0)
+			return -1;
+	return plen;
+}
+
+
+/*
+ * res_mask6 - copy the first plen bits of src to dst, zeroing the rest.
+ */
+static void
+res_mask6(
+	struct in6_addr *	dst,
+	const struct in6_addr *	src,
+	int			plen
+	)
+{
+	int	i;
+
+	for (i = 0; i < 16; i++) {
+		if (plen >= 8) {
+			dst->s6_addr[i] = src->s6_addr[i];
+			plen -= 8;
+		} else {
+			dst->s6_addr[i] = src->s6_addr[i] &
+					  (u_char)(0xff00 >> plen);
+			plen = 0;
+		}
+	}
+}
+
+
+/*
+ * res_hash4/res_hash6 - index bucket of a masked address and its
+ *			 prefix length.
+ */
+static u_int
+res_hash4(
+	u_int32	addr,
+	int	plen,
+	u_int	bits
+	)
+{
+	u_int32	h;
+
+	h = (addr ^ ((u_int32)plen * 0x85ebca6bU)) * 0x9e3779b1U;
+	return (u_int)(h >> (32 - bits));
+}
+
+
+static u_int
+res_hash6(
+	const struct in6_addr *	addr,
+	int			plen,
+	u_int			bits
+	)
+{
+	u_int32	h;
+	u_int32	w;
+	int	i;
+
+	h = (u_int32)plen * 0x85ebca6bU;
+	for (i = 0; i < 16; i += sizeof(w)) {
+		memcpy(&w, &addr->s6_addr[i], sizeof(w));
+		h = (h ^ w) * 0x9e3779b1U;
+		h ^= h >> 15;
+	}
+	h *= 0x9e3779b1U;
+	return (u_int)(h >> (32 - bits));
+}
+
+
+/*
+ * res_index_grow - double the bucket count of an index.
+ */
+static void
+res_index_grow(
+	res_index *	idx,
+	int		v6
+	)
+{
+	restrict_u **	ohash;
+	restrict_u *	res;
+	u_int		obuckets;
+	u_int		h;
+	u_int		i;
+
+	ohash = idx->hash;
+	obuckets = (NULL == ohash) ? 0 : 1U << idx->hash_bits;
+	if (NULL == ohash)
+		idx->hash_bits = RES_INDEX_MINBITS;
+	else
+		idx->hash_bits++;
+	idx->hash = emalloc_zero(sizeof(*idx->hash) << idx->hash_bits);
+
+	for (i = 0; i < obuckets; i++) {
+		while (NULL != (res = ohash[i])) {
+			ohash[i] = res->hlink;
+			if (v6)
+				h = res_hash6(&res->u.v6.addr, res->plen,
+					      idx->hash_bits);
+			else
+				h = res_hash4(res->u.v4.addr, res->plen,
+					      idx->hash_bits);
+			LINK_SLIST(idx->hash[h], res, hlink);
+		}
+	}
+	free(ohash);
+}
+
+
+/*
+ * res_index_add - add an entry already on a restrict list to the index
+ */
+static void
+res_index_add(
+	restrict_u *	res,
+	int		v6
+	)
+{
+	res_index *	idx;
+	u_int		h;
+	u_int		i;
+	int		plen;
+
+	idx = (v6) ? &resindex6 : &resindex4;
+	plen = (v6)
+		   ? res_prefixlen6(&res->u.v6.mask)
+		   : res_prefixlen4(res->u.v4.mask);
+	res->plen = (short)plen;
+	res->hlink = NULL;
+	if (plen < 0) {
+		idx->noncontig++;
+		return;
+	}
+
+	if (NULL == idx->hash || (idx->entries >= (1U << idx->hash_bits)
+	    && idx->hash_bits < RES_INDEX_MAXBITS))
+		res_index_grow(idx, v6);
+	h = (v6)
+		? res_hash6(&res->u.v6.addr, plen, idx->hash_bits)
+		: res_hash4(res->u.v4.addr, plen, idx->hash_bits);
+	LINK_SLIST(idx->hash[h], res, hlink);
+	idx->entries++;
+
+	if (0 == idx->lencount[plen]++) {
+		/* keep lens[] sorted longest first */
+		for (i = idx->nlens; i > 0 && idx->lens[i - 1] < plen; i--)
+			idx->lens[i] = idx->lens[i - 1];
+		idx->lens[i] = (u_char)plen;
+		idx->nlens++;
+	}
+}
+
+
+/*
+ * res_index_del - remove an entry from the index
+ */
+static void
+res_index_del(
+	restrict_u *	res,
+	int		v6
+	)
+{
+	res_index *	idx;
+	restrict_u *	unlinked;
+	u_int		h;
+	u_int		i;
+	int		plen;
+
+	idx = (v6) ? &resindex6 : &resindex4;
+	plen = res->plen;
+	if (plen < 0) {
+		idx->noncontig--;
+		return;
+	}
+
+	h = (v6)
+		? res_hash6(&res->u.v6.addr, plen, idx->hash_bits)
+		: res_hash4(res->u.v4.addr, plen, idx->hash_bits);
+	UNLINK_SLIST(unlinked, idx->hash[h], res, hlink, restrict_u);
+	INSIST(unlinked == res);
+	idx->entries--;
+
+	if (0 == --idx->lencount[plen]) {
+		for (i = 0; idx->lens[i] != plen; i++)
+			/* empty */;
+		for (idx->nlens--; i < idx->nlens; i++)
+			idx->lens[i] = idx->lens[i + 1];
+	}
+}
+
+
+/*
+ * match_restrict4_list - find the first restrictlist4 entry matching
+ *			  addr and port by walking the list.
+ */
 static restrict_u *
-match_restrict4_addr(
+match_restrict4_list(
 	u_int32	addr,
 	u_short	port
 	)
@@ -351,8 +639,10 @@ match_restrict4_addr(
 		DPRINTF(2, ("match_restrict4_addr: Checking %s, port %d ... ",
 			    inet_ntoa(sia), port));
 		if (   res->expire
-		    && res->expire <= current_time)
+		    && res->expire <= current_time) {
 			free_res(res, v6);	/* zeroes the contents */
+			continue;
+		}
 		if (   res->u.v4.addr == (addr & res->u.v4.mask)
 		    && (   !(RESM_NTPONLY & res->mflags)
 			|| NTP_PORT == port)) {
@@ -365,11 +655,114 @@ match_restrict4_addr(
 }
 
 
+/*
+ * match_restrict4_addr - find the restrictlist4 entry for addr and port
+ */
+static restrict_u *
+match_restrict4_addr(
+	u_int32	addr,
+	u_short	port
+	)
+{
+	const int	v6 = 0;
+	restrict_u *	res;
+	restrict_u *	next;
+	restrict_u *	best;
+	u_int32		masked;
+	u_int		i;
+	int		plen;
+
+	if (resindex4.noncontig)
+		return match_restrict4_list(addr, port);
+  again:
+	for (i = 0; i < resindex4.nlens; i++) {
+		plen = resindex4.lens[i];
+		masked = (plen) ? addr & (~(u_int32)0 << (32 - plen)) : 0;
+		best = NULL;
+		res = resindex4.hash[res_hash4(masked, plen,
+					       resindex4.hash_bits)];
+		for (; res != NULL; res = next) {
+			next = res->hlink;
+			if (res->plen != plen || res->u.v4.addr != masked)
+				continue;
+			if (res->expire && res->expire <= current_time) {
+				/* may change lens[], start over */
+				free_res(res, v6);
+				goto again;
+			}
+			if ((RESM_NTPONLY & res->mflags) && NTP_PORT != port)
+				continue;
+			/* same sort order as the list */
+			if (NULL == best || res->mflags > best->mflags)
+				best = res;
+		}
+		if (best != NULL) {
+			DPRINTF(2, ("match_restrict4_addr: /%d MATCH: ippeerlimit %d\n",
+				    plen, best->ippeerlimit));
+			return best;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ * match_restrict6_addr - find the restrictlist6 entry for addr and port
+ */
 static restrict_u *
 match_restrict6_addr(
 	const struct in6_addr *	addr,
 	u_short			port
 	)
+{
+	const int	v6 = 1;
+	restrict_u *	res;
+	restrict_u *	next;
+	restrict_u *	best;
+	struct in6_addr	masked;
+	u_int		i;
+	int		plen;
+
+	if (resindex6.noncontig)
+		return match_restrict6_list(addr, port);
+  again:
+	for (i = 0; i < resindex6.nlens; i++) {
+		plen = resindex6.lens[i];
+		res_mask6(&masked, addr, plen);
+		best = NULL;
+		res = resindex6.hash[res_hash6(&masked, plen,
+					       resindex6.hash_bits)];
+		for (; res != NULL; res = next) {
+			next = res->hlink;
+			if (res->plen != plen ||
+			    !ADDR6_EQ(&res->u.v6.addr, &masked))
+				continue;
+			if (res->expire && res->expire <= current_time) {
+				free_res(res, v6);
+				goto again;
+			}
+			if ((RESM_NTPONLY & res->mflags) &&
+			    NTP_PORT != (int)port)
+				continue;
+			if (NULL == best || res->mflags > best->mflags)
+				best = res;
+		}
+		if (best != NULL)
+			return best;
+	}
+	return NULL;
+}
+
+
+/*
+ * match_restrict6_list - find the first restrictlist6 entry matching
+ *			  addr and port by walking the list.
+ */
+static restrict_u *
+match_restrict6_list(
+	const struct in6_addr *	addr,
+	u_short			port
+	)
 {
 	const int	v6 = 1;
 	restrict_u *	res;
@@ -380,8 +773,10 @@ match_restrict6_addr(
 		next = res->link;
 		INSIST(next != res);
 		if (res->expire &&
-		    res->expire <= current_time)
+		    res->expire <= current_time) {
 			free_res(res, v6);
+			continue;
+		}
 		MASK_IPV6_ADDR(&masked, addr, &res->u.v6.mask);
 		if (ADDR6_EQ(&masked, &res->u.v6.addr)
 		    && (!(RESM_NTPONLY & res->mflags)
@@ -409,14 +804,36 @@ match_restrict_entry(
 {
 	restrict_u *res;
 	restrict_u *rlist;
+	res_index *idx;
 	size_t cb;
+	u_int h;
+	int plen;
 
 	if (v6) {
 		rlist = restrictlist6;
 		cb = sizeof(pmatch->u.v6);
+		idx = &resindex6;
+		plen = res_prefixlen6(&pmatch->u.v6.mask);
 	} else {
 		rlist = restrictlist4;
 		cb = sizeof(pmatch->u.v4);
+		idx = &resindex4;
+		plen = res_prefixlen4(pmatch->u.v4.mask);
+	}
+
+	/* an entry with a contiguous mask can only be in the index */
+	if (plen >= 0) {
+		if (0 == idx->lencount[plen])
+			return NULL;
+		h = (v6)
+			? res_hash6(&pmatch->u.v6.addr, plen, idx->hash_bits)
+			: res_hash4(pmatch->u.v4.addr, plen, idx->hash_bits);
+		rlist = idx->hash[h];
+		for (res = rlist; res != NULL; res = res->hlink)
+			if (res->mflags == pmatch->mflags &&
+			    !memcmp(&res->u, &pmatch->u, cb))
+				break;
+		return res;
 	}
 
 	for (res = rlist; res != NULL; res = res->link)
@@ -689,6 +1106,7 @@ hack_restrict(
 				  ? res_sorts_before6(res, L_S_S_CUR())
 				  : res_sorts_before4(res, L_S_S_CUR()),
 				link, restrict_u);
+			res_index_add(res, v6);
 			restrictcount++;
 			if (RES_LIMITED & rflags)
 				inc_res_limited();
@@ -0,0 +1,335 @@
+/*
+ * bench-ntp_monitor.c - replay client packets through restrictions()
+ *			 and ntp_monitor() and report packets per second.
+ *
+ * usage: bench-ntp_monitor [-c clients] [-d maxdepth] [-n packets]
+ *			    [-p rate] [-r restrictions] [file]
+ *
+ * Without a file, -n packets are generated at -p packets per second
+ * from -c clients, some of which send far more often than others, one
+ * in ten of them IPv6.  A file holds one packet per line, the arrival
+ * time in seconds followed by the source address, for instance
+ *
+ *	tcpdump -tt -n -r capture 'udp dst port 123' | awk '{print $1, $3}'
+ *
+ * where a trailing ".port" on the address is used as the source port.
+ * -r random host and subnet restrictions are added below a
+ * "restrict default limited kod", which also turns on the MRU list,
+ * and -d sets "mru maxdepth".  Packets are loaded before the clock
+ * starts, so only the lookups are timed.
+ */
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "ntpd.h"
+#include "ntp_stdlib.h"
+#include "recvbuff.h"
+
+char const *	progname = "bench-ntp_monitor";
+
+typedef struct replay_pkt_tag {
+	double		when;		/* arrival, seconds from start */
+	sockaddr_u	srcadr;		/* source address and port */
+} replay_pkt;
+
+static replay_pkt *	pkts;
+static size_t		npkts;
+
+static void	usage(void);
+static int	parse_addr(const char *, sockaddr_u *);
+static void	load_file(const char *);
+static void	load_synthetic(u_long, u_long, double);
+static void	add_restrictions(u_long);
+static double	now(void);
+
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: %s [-c clients] [-d maxdepth] [-n packets] [-p rate] [-r restrictions] [file]\n",
+		progname);
+	exit(1);
+}
+
+
+/*
+ * parse_addr - parse an address as printed by tcpdump -n, with an
+ *		optional trailing ".port".
+ */
+static int
+parse_addr(
+	const char *	str,
+	sockaddr_u *	addr
+	)
+{
+	char	buf[INET6_ADDRSTRLEN + 8];
+	char *	dot;
+	u_short	port;
+
+	strlcpy(buf, str, sizeof(buf));
+	dot = strrchr(buf, ':');	/* drop tcpdump's trailing ':' */
+	if (dot != NULL && '\0' == dot[1])
+		*dot = '\0';
+
+	port = NTP_PORT;
+	ZERO(*addr);
+	if (inet_pton(AF_INET6, buf, PSOCK_ADDR6(addr)) != 1 &&
+	    inet_pton(AF_INET, buf, &SOCK_ADDR4(addr)) != 1) {
+		dot = strrchr(buf, '.');
+		if (NULL == dot)
+			return -1;
+		*dot++ = '\0';
+		port = (u_short)atoi(dot);
+		if (inet_pton(AF_INET6, buf, PSOCK_ADDR6(addr)) == 1)
+			AF(addr) = AF_INET6;
+		else if (inet_pton(AF_INET, buf, &SOCK_ADDR4(addr)) == 1)
+			AF(addr) = AF_INET;
+		else
+			return -1;
+	} else if (strchr(buf, ':') != NULL) {
+		AF(addr) = AF_INET6;
+	} else {
+		AF(addr) = AF_INET;
+	}
+	SET_PORT(addr, port);
+	return 0;
+}
+
+
+/*
+ * load_file - read packets to replay from a file
+ */
+static void
+load_file(
+	const char *	path
+	)
+{
+	FILE *	fp;
+	char	line[256];
+	char	addr[INET6_ADDRSTRLEN + 8];
+	double	when;
+	double	first;
+	size_t	alloced;
+
+	fp = fopen(path, "r");
+	if (NULL == fp) {
+		perror(path);
+		exit(1);
+	}
+	alloced = 0;
+	first = -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%lf %47s", &when, addr) != 2)
+			continue;
+		if (npkts == alloced) {
+			alloced = (alloced) ? 2 * alloced : 65536;
+			pkts = erealloc(pkts, alloced * sizeof(*pkts));
+		}
+		if (parse_addr(addr, &pkts[npkts].srcadr) != 0)
+			continue;
+		if (first < 0)
+			first = when;
+		pkts[npkts].when = when - first;
+		npkts++;
+	}
+	fclose(fp);
+}
+
+
+/*
+ * load_synthetic - make up packets from a population of clients, each
+ *		    picked with a probability falling off with its number
+ */
+static void
+load_synthetic(
+	u_long	count,
+	u_long	clients,
+	double	rate
+	)
+{
+	u_long	i;
+	u_long	client;
+	double	r;
+
+	pkts = eallocarray(count, sizeof(*pkts));
+	for (i = 0; i < count; i++) {
+		r = ntp_random() / 2147483648.;
+		client = (u_long)(clients * r * r);
+		ZERO(pkts[i].srcadr);
+		if (0 == client % 10) {
+			AF(&pkts[i].srcadr) = AF_INET6;
+			NSRCADR6(&pkts[i].srcadr)[0] = 0x20;
+			NSRCADR6(&pkts[i].srcadr)[1] = 0x01;
+			NSRCADR6(&pkts[i].srcadr)[2] = 0x0d;
+			NSRCADR6(&pkts[i].srcadr)[3] = 0xb8;
+			NSRCADR6(&pkts[i].srcadr)[5] = (u_char)(client >> 16);
+			NSRCADR6(&pkts[i].srcadr)[6] = (u_char)(client >> 8);
+			NSRCADR6(&pkts[i].srcadr)[7] = (u_char)client;
+			NSRCADR6(&pkts[i].srcadr)[15] = 1;
+		} else {
+			AF(&pkts[i].srcadr) = AF_INET;
+			SET_ADDR4(&pkts[i].srcadr, 0x0a000000 | client);
+		}
+		SET_PORT(&pkts[i].srcadr, (client & 1) ? NTP_PORT : 40000);
+		pkts[i].when = i / rate;
+	}
+	npkts = count;
+}
+
+
+/*
+ * add_restrictions - add a default and count random restrictions
+ */
+static void
+add_restrictions(
+	u_long	count
+	)
+{
+	sockaddr_u	addr;
+	sockaddr_u	mask;
+	u_long		i;
+	int		plen;
+
+	ZERO(addr);
+	ZERO(mask);
+	AF(&addr) = AF(&mask) = AF_INET;
+	hack_restrict(RESTRICT_FLAGS, &addr, &mask, -1, 0,
+		      RES_LIMITED | RES_KOD | RES_NOMODIFY, 0);
+	AF(&addr) = AF(&mask) = AF_INET6;
+	hack_restrict(RESTRICT_FLAGS, &addr, &mask, -1, 0,
+		      RES_LIMITED | RES_KOD | RES_NOMODIFY, 0);
+
+	for (i = 0; i < count; i++) {
+		ZERO(addr);
+		ZERO(mask);
+		if (i % 4) {
+			/* a host or a /24 within the synthetic clients */
+			plen = (i % 8) ? 32 : 24;
+			AF(&addr) = AF(&mask) = AF_INET;
+			SET_ADDR4(&addr, 0x0a000000 | (ntp_random() &
+							0xffffff));
+			SET_ADDR4(&mask, ~(u_int32)0 << (32 - plen));
+		} else {
+			/* a /64 */
+			AF(&addr) = AF(&mask) = AF_INET6;
+			NSRCADR6(&addr)[0] = 0x20;
+			NSRCADR6(&addr)[1] = 0x01;
+			NSRCADR6(&addr)[2] = 0x0d;
+			NSRCADR6(&addr)[3] = 0xb8;
+			NSRCADR6(&addr)[5] = (u_char)ntp_random();
+			NSRCADR6(&addr)[6] = (u_char)ntp_random();
+			NSRCADR6(&addr)[7] = (u_char)ntp_random();
+			memset(NSRCADR6(&mask), 0xff, 8);
+		}
+		hack_restrict(RESTRICT_FLAGS, &addr, &mask, -1, 0,
+			      RES_NOQUERY | RES_NOPEER, 0);
+	}
+}
+
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+int
+main(
+	int	argc,
+	char **	argv
+	)
+{
+	struct recvbuf	rbuf;
+	endpt		ep;
+	r4addr		r4a;
+	u_long		count;
+	u_long		clients;
+	u_long		nres;
+	u_long		limited;
+	double		rate;
+	double		start;
+	double		elapsed;
+	l_fp		base;
+	size_t		i;
+	int		c;
+
+	count = 2000000;
+	clients = 1000000;
+	nres = 1000;
+	rate = 200000;
+	while ((c = getopt(argc, argv, "c:d:n:p:r:")) != -1) {
+		switch (c) {
+		case 'c':
+			clients = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			mru_maxdepth = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			rate = atof(optarg);
+			break;
+		case 'r':
+			nres = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 1 || 0 == clients || rate <= 0)
+		usage();
+
+	ntp_srandom(1);
+	if (argc)
+		load_file(argv[0]);
+	else
+		load_synthetic(count, clients, rate);
+
+	init_mon();
+	init_restrict();
+	add_restrictions(nres);
+
+	ZERO(ep);
+	ep.fd = 3;
+	ep.bfd = INVALID_SOCKET;
+	ZERO(rbuf);
+	rbuf.dstadr = &ep;
+	rbuf.fd = ep.fd;
+	rbuf.recv_pkt.li_vn_mode = PKT_LI_VN_MODE(LEAP_NOWARNING,
+						  NTP_VERSION, MODE_CLIENT);
+	base.l_ui = 3000000000U;
+	base.l_uf = 0;
+
+	limited = 0;
+	start = now();
+	for (i = 0; i < npkts; i++) {
+		current_time = (u_long)pkts[i].when;
+		DTOLFP(pkts[i].when, &rbuf.recv_time);
+		L_ADD(&rbuf.recv_time, &base);
+		rbuf.recv_srcadr = pkts[i].srcadr;
+		restrictions(&rbuf.recv_srcadr, &r4a);
+		if (RES_LIMITED & ntp_monitor(&rbuf, r4a.rflags))
+			limited++;
+	}
+	elapsed = now() - start;
+
+	printf("%lu packets in %.3f s: %.0f packets/s\n",
+	       (u_long)npkts, elapsed,
+	       (elapsed > 0) ? npkts / elapsed : 0.);
+	printf("restrict entries %lu, mru entries %u peak %u allocated %u, rate limited %lu\n",
+	       nres + 2, mru_entries, mru_peakentries, mru_alloc, limited);
+	return 0;
+}
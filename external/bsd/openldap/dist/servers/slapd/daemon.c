@@ -149,6 +149,11 @@ typedef struct slap_daemon_st {
 	int			sd_nfds;
 	ldap_pvt_thread_t	sd_tid;
 
+	/* per listener thread statistics, see slapd_daemon_stats() */
+	unsigned long		sd_nopened;	/* sessions ever added */
+	unsigned long		sd_nwakeups;	/* waits that returned events */
+	unsigned long		sd_nevents;	/* descriptors reported ready */
+
 #if defined(HAVE_KQUEUE)
 	uint8_t*        sd_fdmodes; /* indexed by fd */
 	Listener**      sd_l;       /* indexed by fd */
@@ -162,6 +167,7 @@ typedef struct slap_daemon_st {
 	}               sd_kqc[2];
 	int             sd_changeidx; /* index to current change buffer */
 	int             sd_kq;
+	struct kevent*  sd_events;  /* per-thread result buffer */
 #elif defined(HAVE_EPOLL)
 
 	struct epoll_event	*sd_epolls;
@@ -204,12 +210,16 @@ static slap_daemon_st *slap_daemon;
 # define SLAP_EVENT_MAX(t)             (2 * dtblsize)  /* each fd can have a read & a write event */
 
 # define SLAP_EVENT_DECL \
-     static struct kevent* events = NULL
+     struct kevent* events = NULL
 
+/* Each listener thread waits on its own kqueue, so the result
+ * buffer must not be shared between them.
+ */
 # define SLAP_EVENT_INIT(t) do {\
-    if (!events) { \
-        events = ch_malloc(sizeof(*events) * SLAP_EVENT_MAX(t)); \
+    if (!slap_daemon[t].sd_events) { \
+        slap_daemon[t].sd_events = ch_malloc(sizeof(*events) * SLAP_EVENT_MAX(t)); \
     } \
+    events = slap_daemon[t].sd_events; \
 } while (0)
 
 # define SLAP_SOCK_INIT(t) do { \
@@ -262,6 +272,10 @@ static slap_daemon_st *slap_daemon;
         ch_free(slap_daemon[t].sd_fdmodes); \
         slap_daemon[t].sd_fdmodes = NULL; \
     } \
+    if (slap_daemon[t].sd_events != NULL) { \
+        ch_free(slap_daemon[t].sd_events); \
+        slap_daemon[t].sd_events = NULL; \
+    } \
     slap_daemon[t].sd_nfds = 0; \
 } while (0)
 
@@ -1120,7 +1134,10 @@ slapd_add( ber_socket_t s, int isactive, Listener *sl, int id )
 
 	assert( SLAP_SOCK_NOT_ACTIVE(id, s) );
 
-	if ( isactive ) slap_daemon[id].sd_nactives++;
+	if ( isactive ) {
+		slap_daemon[id].sd_nactives++;
+		slap_daemon[id].sd_nopened++;
+	}
 
 	SLAP_SOCK_ADD(id, s, sl);
 
@@ -2426,6 +2443,7 @@ slapd_daemon_task(
 	time_t last_idle_check = 0;
 	int ebadf = 0;
 	int tid = (slap_daemon_st *) ptr - slap_daemon;
+	unsigned long nwakeups = 0, nevents = 0;
 	char ebuf[128];
 
 #define SLAPD_IDLE_CHECK_LIMIT 4
@@ -2732,6 +2750,12 @@ loop:
 
 		ldap_pvt_thread_mutex_lock( &slap_daemon[tid].sd_mutex );
 
+		/* fold in the activity seen since the last pass, so that
+		 * the counters are only ever touched under sd_mutex */
+		slap_daemon[tid].sd_nwakeups += nwakeups;
+		slap_daemon[tid].sd_nevents += nevents;
+		nwakeups = nevents = 0;
+
 		nwriters = slap_daemon[tid].sd_nwriters;
 
 		if ( listening )
@@ -2875,6 +2899,8 @@ loop:
 			if ( slapd_shutdown ) continue;
 
 			ebadf = 0;
+			nwakeups++;
+			nevents += ns;
 			Debug( LDAP_DEBUG_CONNS,
 				"daemon: activity on %d descriptor%s\n",
 				ns, ns != 1 ? "s" : "" );
@@ -3194,6 +3220,27 @@ slapd_daemon_tid_cleanup(
 	return NULL;
 }
 
+/*
+ * Snapshot the event loop statistics of listener thread tid,
+ * e.g. for cn=Listeners,cn=Monitor.  Returns -1 if tid is out of range.
+ */
+int
+slapd_daemon_stats( int tid, slap_daemon_stats_t *st )
+{
+	if ( tid < 0 || tid >= slapd_daemon_threads || slap_daemon == NULL )
+		return -1;
+
+	ldap_pvt_thread_mutex_lock( &slap_daemon[tid].sd_mutex );
+	st->ds_nactives = slap_daemon[tid].sd_nactives;
+	st->ds_nwriters = slap_daemon[tid].sd_nwriters;
+	st->ds_nopened = slap_daemon[tid].sd_nopened;
+	st->ds_nwakeups = slap_daemon[tid].sd_nwakeups;
+	st->ds_nevents = slap_daemon[tid].sd_nevents;
+	ldap_pvt_thread_mutex_unlock( &slap_daemon[tid].sd_mutex );
+
+	return 0;
+}
+
 int
 slapd_daemon_resize( int newnum )
 {
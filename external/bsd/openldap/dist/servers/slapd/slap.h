@@ -2567,6 +2567,17 @@ typedef struct slap_counters_t {
 	ldap_pvt_mp_t		sc_ops_initiated_[SLAP_OP_LAST];
 } slap_counters_t;
 
+/*
+ * listener thread (event loop shard) statistics
+ */
+typedef struct slap_daemon_stats_t {
+	unsigned long	ds_nactives;	/* live sessions */
+	unsigned long	ds_nwriters;	/* sessions waiting to write */
+	unsigned long	ds_nopened;	/* sessions ever added */
+	unsigned long	ds_nwakeups;	/* waits that returned events */
+	unsigned long	ds_nevents;	/* descriptors reported ready */
+} slap_daemon_stats_t;
+
 /*
  * represents an operation pending from an ldap client
  */
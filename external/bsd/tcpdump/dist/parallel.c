@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2020 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#ifndef lint
+__RCSID("$NetBSD$");
+#endif
+
+/*
+ * Printing a savefile with several processes.
+ *
+ * Each worker process has a handle of its own on the file, opened before
+ * tcpdump gives up root, and reads every packet, but only dissects the
+ * ones that belong to it, into a buffer that it then sends down a pipe
+ * to the parent.  The parent reads the file too, and for each packet
+ * copies the text from the pipe of the worker the packet belongs to, so
+ * the output comes out in the order of the file.
+ * A worker can only get as far ahead of the parent as its pipe and its
+ * stdio buffer let it, which bounds the memory used.
+ *
+ * Which worker a packet belongs to is decided by a hash of its flow that
+ * is the same in both directions, so the state the TCP printer keeps
+ * for each connection (relative sequence numbers) is all in one worker.
+ * The printers that keep state across connections (NFS and RX reply
+ * matching, the ISAKMP cookie cache, the SMB info level) see all of their
+ * packets in the same worker too, as do the packets that aren't IP.
+ * pfsync packets are printed with stdio rather than through ndo_printf,
+ * so the parent prints those itself.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <netdissect-stdinc.h>
+
+#include <sys/wait.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "netdissect.h"
+#include "extract.h"
+#include "ethertype.h"
+#include "ipproto.h"
+#include "tcp.h"
+#include "udp.h"
+#include "print.h"
+#include "setsignal.h"
+#include "parallel.h"
+
+#ifndef DLT_LINUX_SLL
+#define DLT_LINUX_SLL	113
+#endif
+
+/* Printed by the parent rather than by a worker. */
+#define OWNER_PARENT	(-1)
+
+/* How many tunnels and ICMP errors to look into for the flow. */
+#define MAXDEPTH	2
+
+/* Length of the record a worker sends when it gets to the end. */
+#define RECORD_END	0xffffffffU
+
+#define WORKER_BUFSIZE	65536
+
+struct worker {
+	pcap_t	*pd;
+	pid_t	pid;
+	FILE	*in;		/* parent's end of the pipe */
+};
+
+static struct worker *workers;
+static u_int nworkers;
+static int dlt;
+
+static u_int self;		/* index of this worker */
+static FILE *out;		/* this worker's end of the pipe */
+static u_int npackets;		/* packets read by this worker */
+
+static char *buf;		/* text of one packet */
+static size_t buflen;
+static size_t bufsize;
+
+static void
+buf_grow(netdissect_options *ndo, size_t len)
+{
+	char *nbuf;
+	size_t nsize;
+
+	if (len <= bufsize)
+		return;
+	nsize = bufsize != 0 ? bufsize : 1024;
+	while (nsize < len)
+		nsize *= 2;
+	nbuf = realloc(buf, nsize);
+	if (nbuf == NULL)
+		(*ndo->ndo_error)(ndo, "parallel: out of memory");
+	buf = nbuf;
+	bufsize = nsize;
+}
+
+/*
+ * ndo_printf for the workers: append the output to the buffer.
+ */
+static int
+buf_printf(netdissect_options *ndo, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	for (;;) {
+		va_start(args, fmt);
+		ret = vsnprintf(buf + buflen, bufsize - buflen, fmt, args);
+		va_end(args);
+		if (ret < 0)
+			(*ndo->ndo_error)(ndo, "Unable to format output");
+		if ((size_t)ret < bufsize - buflen)
+			break;
+		buf_grow(ndo, buflen + ret + 1);
+	}
+	buflen += ret;
+	return (ret);
+}
+
+static int
+serial_port(u_int port)
+{
+	switch (port) {
+
+	case NFS_PORT:
+	case ISAKMP_PORT:
+	case ISAKMP_PORT_NATT:
+	case ISAKMP_PORT_USER1:
+	case ISAKMP_PORT_USER2:
+	case NETBIOS_NS_PORT:
+	case NETBIOS_DGRAM_PORT:
+	case NETBIOS_SSN_PORT:
+	case SMB_PORT:
+		return (1);
+	}
+	return (port >= RX_PORT_LOW && port <= RX_PORT_HIGH);
+}
+
+/*
+ * FNV-1a hash of one end of a flow.
+ */
+static uint32_t
+endpoint_hash(const u_char *addr, u_int alen, u_int port)
+{
+	uint32_t h;
+	u_int i;
+
+	h = 2166136261U;
+	for (i = 0; i < alen; i++)
+		h = (h ^ addr[i]) * 16777619U;
+	h = (h ^ (port >> 8)) * 16777619U;
+	h = (h ^ (port & 0xff)) * 16777619U;
+	return (h);
+}
+
+/*
+ * Work out which worker prints the IPv4 or IPv6 packet at 'bp'.
+ */
+static int
+ip_owner(netdissect_options *ndo, const u_char *bp, u_int len, int depth)
+{
+	const u_char *src, *dst;
+	u_int alen, hlen, proto, frag, sport, dport;
+	uint32_t h;
+
+	if (len < 1)
+		return (0);
+	switch (bp[0] >> 4) {
+
+	case 4:
+		if (len < 20)
+			return (0);
+		hlen = (bp[0] & 0x0f) * 4;
+		if (hlen < 20 || hlen > len)
+			return (0);
+		proto = bp[9];
+		frag = EXTRACT_16BITS(bp + 6) & 0x1fff;
+		src = bp + 12;
+		dst = bp + 16;
+		alen = 4;
+		break;
+
+	case 6:
+		if (len < 40)
+			return (0);
+		proto = bp[6];
+		frag = 0;
+		src = bp + 8;
+		dst = bp + 24;
+		alen = 16;
+		hlen = 40;
+		while (hlen + 8 <= len) {
+			if (proto == IPPROTO_HOPOPTS ||
+			    proto == IPPROTO_ROUTING ||
+			    proto == IPPROTO_DSTOPTS) {
+				proto = bp[hlen];
+				hlen += (bp[hlen + 1] + 1) * 8;
+			} else if (proto == IPPROTO_FRAGMENT) {
+				proto = bp[hlen];
+				frag = EXTRACT_16BITS(bp + hlen + 2) & 0xfff8;
+				hlen += 8;
+			} else
+				break;
+		}
+		if (hlen > len)
+			hlen = len;
+		break;
+
+	default:
+		return (0);
+	}
+	bp += hlen;
+	len -= hlen;
+
+	sport = dport = 0;
+	switch (proto) {
+
+#ifdef IPPROTO_PFSYNC
+	case IPPROTO_PFSYNC:
+		return (OWNER_PARENT);
+#endif
+
+	case IPPROTO_IPV4:
+	case IPPROTO_IPV6:
+		if (frag == 0 && depth > 0)
+			return (ip_owner(ndo, bp, len, depth - 1));
+		break;
+
+	case IPPROTO_GRE:
+		/*
+		 * Version 0 GRE carrying IP; the checksum, key and
+		 * sequence number fields are 4 bytes each.
+		 */
+		if (frag == 0 && depth > 0 && len >= 4 &&
+		    (bp[1] & 0x07) == 0) {
+			hlen = 4;
+			if (bp[0] & 0x80)
+				hlen += 4;
+			if (bp[0] & 0x20)
+				hlen += 4;
+			if (bp[0] & 0x10)
+				hlen += 4;
+			if (hlen <= len &&
+			    (EXTRACT_16BITS(bp + 2) == ETHERTYPE_IP ||
+			     EXTRACT_16BITS(bp + 2) == ETHERTYPE_IPV6))
+				return (ip_owner(ndo, bp + hlen, len - hlen,
+				    depth - 1));
+		}
+		break;
+
+	case IPPROTO_ICMP:
+		/*
+		 * The ICMP printer prints the header an error is about,
+		 * TCP state and all, so the error goes with the flow
+		 * that header belongs to.
+		 */
+		if (frag == 0 && depth > 0 && alen == 4 && len > 8) {
+			switch (bp[0]) {
+
+			case 3:		/* unreachable */
+			case 4:		/* source quench */
+			case 5:		/* redirect */
+			case 11:	/* time exceeded */
+			case 12:	/* parameter problem */
+				return (ip_owner(ndo, bp + 8, len - 8,
+				    depth - 1));
+			}
+		}
+		break;
+
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_SCTP:
+	case IPPROTO_DCCP:
+		if (frag == 0 && len >= 4) {
+			sport = EXTRACT_16BITS(bp);
+			dport = EXTRACT_16BITS(bp + 2);
+			if (serial_port(sport) || serial_port(dport))
+				return (0);
+			/*
+			 * With -T, RPC replies are matched to their calls
+			 * whatever the ports.
+			 */
+			if (proto == IPPROTO_UDP && ndo->ndo_packettype)
+				return (0);
+		}
+		break;
+	}
+
+	h = endpoint_hash(src, alen, sport) + endpoint_hash(dst, alen, dport);
+	h ^= proto * 0x9e3779b1U;
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	return (h % nworkers);
+}
+
+static int
+packet_owner(netdissect_options *ndo, const struct pcap_pkthdr *h,
+    const u_char *sp)
+{
+	u_int caplen, type;
+
+	caplen = h->caplen;
+	switch (dlt) {
+
+	case DLT_EN10MB:
+		if (caplen < 14)
+			return (0);
+		type = EXTRACT_16BITS(sp + 12);
+		sp += 14;
+		caplen -= 14;
+		while (type == ETHERTYPE_8021Q || type == ETHERTYPE_8021QinQ ||
+		    type == ETHERTYPE_8021Q9100 || type == ETHERTYPE_8021Q9200) {
+			if (caplen < 4)
+				return (0);
+			type = EXTRACT_16BITS(sp + 2);
+			sp += 4;
+			caplen -= 4;
+		}
+		if (type != ETHERTYPE_IP && type != ETHERTYPE_IPV6)
+			return (0);
+		break;
+
+	case DLT_LINUX_SLL:
+		if (caplen < 16)
+			return (0);
+		type = EXTRACT_16BITS(sp + 14);
+		if (type != ETHERTYPE_IP && type != ETHERTYPE_IPV6)
+			return (0);
+		sp += 16;
+		caplen -= 16;
+		break;
+
+	case DLT_NULL:
+#ifdef DLT_LOOP
+	case DLT_LOOP:
+#endif
+		if (caplen < 4)
+			return (0);
+		sp += 4;
+		caplen -= 4;
+		break;
+	}
+	return (ip_owner(ndo, sp, caplen, MAXDEPTH));
+}
+
+static int
+dlt_supported(int type)
+{
+	switch (type) {
+
+	case DLT_EN10MB:
+	case DLT_LINUX_SLL:
+	case DLT_NULL:
+#ifdef DLT_LOOP
+	case DLT_LOOP:
+#endif
+	case DLT_RAW:
+#ifdef DLT_IPV4
+	case DLT_IPV4:
+#endif
+#ifdef DLT_IPV6
+	case DLT_IPV6:
+#endif
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Open the savefile 'fname' once for each of 'n' workers.  This is done
+ * next to the parent's own open, before any chroot or change of user.
+ * Returns the number of workers, or 0 if the packets in the file can't
+ * be shared out.
+ */
+u_int
+parallel_open(netdissect_options *ndo, const char *fname, u_int n)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd;
+	u_int i;
+
+	workers = calloc(n, sizeof(*workers));
+	if (workers == NULL)
+		(*ndo->ndo_error)(ndo, "parallel: out of memory");
+	for (i = 0; i < n; i++) {
+#ifdef HAVE_PCAP_SET_TSTAMP_PRECISION
+		pd = pcap_open_offline_with_tstamp_precision(fname,
+		    ndo->ndo_tstamp_precision, ebuf);
+#else
+		pd = pcap_open_offline(fname, ebuf);
+#endif
+		if (pd == NULL)
+			(*ndo->ndo_error)(ndo, "%s", ebuf);
+		if (i == 0) {
+			dlt = pcap_datalink(pd);
+			if (!dlt_supported(dlt)) {
+				pcap_close(pd);
+				free(workers);
+				workers = NULL;
+				return (0);
+			}
+		}
+		workers[i].pd = pd;
+	}
+	nworkers = n;
+	return (n);
+}
+
+/*
+ * Give every worker the filter 'fcode'.
+ */
+void
+parallel_setfilter(netdissect_options *ndo, struct bpf_program *fcode)
+{
+	u_int i;
+
+	for (i = 0; i < nworkers; i++)
+		if (pcap_setfilter(workers[i].pd, fcode) < 0)
+			(*ndo->ndo_error)(ndo, "%s",
+			    pcap_geterr(workers[i].pd));
+}
+
+static void
+put_record(u_int len)
+{
+	uint32_t hdr;
+
+	hdr = len;
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+	    (len != RECORD_END && fwrite(buf, 1, len, out) != len))
+		_exit(1);
+}
+
+static void
+worker_packet(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	netdissect_options *ndo = (netdissect_options *)user;
+
+	++npackets;
+	if (packet_owner(ndo, h, sp) != (int)self) {
+		ts_skip(ndo, &h->ts);
+		return;
+	}
+	buflen = 0;
+	pretty_print_packet(ndo, h, sp, npackets);
+	put_record(buflen);
+}
+
+static void NORETURN
+worker_run(netdissect_options *ndo, int fd, int cnt)
+{
+	(void)setsignal(SIGPIPE, SIG_DFL);
+	(void)setsignal(SIGTERM, SIG_DFL);
+	(void)setsignal(SIGINT, SIG_DFL);
+	(void)setsignal(SIGHUP, SIG_DFL);
+
+	out = fdopen(fd, "w");
+	if (out == NULL)
+		_exit(1);
+	(void)setvbuf(out, NULL, _IOFBF, WORKER_BUFSIZE);
+	buf_grow(ndo, 1024);
+	ndo->ndo_printf = buf_printf;
+
+	/*
+	 * If reading the file fails, the parent will find out when it
+	 * gets to the same place and report it.
+	 */
+	(void)pcap_loop(workers[self].pd, cnt, worker_packet, (u_char *)ndo);
+	put_record(RECORD_END);
+	if (fclose(out) == EOF)
+		_exit(1);
+	_exit(0);
+}
+
+/*
+ * Start the workers; each prints up to 'cnt' packets, as pcap_loop()
+ * counts them.
+ */
+void
+parallel_start(netdissect_options *ndo, int cnt)
+{
+	int fds[2];
+	u_int i, j;
+	pid_t pid;
+
+	/*
+	 * We reap the workers ourselves, and don't want reads from
+	 * them interrupted when they exit.
+	 */
+	(void)setsignal(SIGCHLD, SIG_DFL);
+	(void)fflush(stdout);
+	(void)fflush(stderr);
+
+	for (i = 0; i < nworkers; i++) {
+		if (pipe(fds) < 0)
+			(*ndo->ndo_error)(ndo, "parallel: pipe: %s",
+			    pcap_strerror(errno));
+		pid = fork();
+		if (pid < 0)
+			(*ndo->ndo_error)(ndo, "parallel: fork: %s",
+			    pcap_strerror(errno));
+		if (pid == 0) {
+			close(fds[0]);
+			for (j = 0; j < i; j++)
+				(void)fclose(workers[j].in);
+			for (j = i + 1; j < nworkers; j++)
+				pcap_close(workers[j].pd);
+			self = i;
+			worker_run(ndo, fds[1], cnt);
+			/* NOTREACHED */
+		}
+		close(fds[1]);
+		pcap_close(workers[i].pd);
+		workers[i].pd = NULL;
+		workers[i].pid = pid;
+		workers[i].in = fdopen(fds[0], "r");
+		if (workers[i].in == NULL)
+			(*ndo->ndo_error)(ndo, "parallel: fdopen: %s",
+			    pcap_strerror(errno));
+	}
+}
+
+/*
+ * Read the next record from worker 'i' into the buffer.
+ */
+static u_int
+get_record(netdissect_options *ndo, u_int i)
+{
+	uint32_t hdr;
+
+	if (fread(&hdr, sizeof(hdr), 1, workers[i].in) != 1)
+		(*ndo->ndo_error)(ndo, "parallel: worker %u exited unexpectedly",
+		    i);
+	if (hdr == RECORD_END)
+		return (hdr);
+	buf_grow(ndo, hdr);
+	if (fread(buf, 1, hdr, workers[i].in) != hdr)
+		(*ndo->ndo_error)(ndo, "parallel: worker %u exited unexpectedly",
+		    i);
+	return (hdr);
+}
+
+/*
+ * Print a packet the parent has read: copy out what its worker printed
+ * for it, or print it here if no worker does.
+ */
+void
+parallel_print_packet(netdissect_options *ndo, const struct pcap_pkthdr *h,
+    const u_char *sp, u_int packets_captured)
+{
+	int owner;
+	u_int len;
+
+	owner = packet_owner(ndo, h, sp);
+	if (owner == OWNER_PARENT) {
+		pretty_print_packet(ndo, h, sp, packets_captured);
+		return;
+	}
+	ts_skip(ndo, &h->ts);
+	len = get_record(ndo, owner);
+	if (len == RECORD_END)
+		(*ndo->ndo_error)(ndo, "parallel: worker %d stopped early",
+		    owner);
+	if (fwrite(buf, 1, len, stdout) != len)
+		(*ndo->ndo_error)(ndo, "Unable to write output: %s",
+		    pcap_strerror(errno));
+}
+
+/*
+ * Wait for the workers.  If the parent got to the end of the file,
+ * 'complete' is set, and they should have too.
+ */
+void
+parallel_finish(netdissect_options *ndo, int complete)
+{
+	u_int i;
+
+	for (i = 0; i < nworkers; i++) {
+		if (complete && get_record(ndo, i) != RECORD_END)
+			(*ndo->ndo_error)(ndo,
+			    "parallel: worker %u printed too many packets", i);
+		(void)fclose(workers[i].in);
+	}
+	for (i = 0; i < nworkers; i++) {
+		while (waitpid(workers[i].pid, NULL, 0) < 0) {
+			if (errno != EINTR)
+				break;
+		}
+	}
+	free(workers);
+	workers = NULL;
+	nworkers = 0;
+}
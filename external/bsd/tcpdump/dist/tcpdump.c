@@ -121,6 +121,9 @@ __RCSID("$NetBSD: tcpdump.c,v 1.18 2019/10/01 16:06:16 christos Exp $");
 #include "ascii_strcasecmp.h"
 
 #include "print.h"
+#ifdef HAVE_FORK
+#include "parallel.h"
+#endif
 
 #ifndef PATH_MAX
 #define PATH_MAX 1024
@@ -167,6 +170,12 @@ static int Wflag;			/* recycle output files after this number of files */
 static int WflagChars;
 static char *zflag = NULL;		/* compress each savefile using a specified command (like gzip or bzip2) */
 static int immediate_mode;
+#ifdef HAVE_FORK
+static u_int nworkers;		/* processes to print a savefile with */
+#endif
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+static int compress_level = -1;	/* write compressed pcapng at this zlib level */
+#endif
 
 static int infodelay;
 static int infoprint;
@@ -188,6 +197,9 @@ static void show_devices_and_exit (void) NORETURN;
 #endif
 
 static void print_packet(u_char *, const struct pcap_pkthdr *, const u_char *);
+#ifdef HAVE_FORK
+static void print_packet_parallel(u_char *, const struct pcap_pkthdr *, const u_char *);
+#endif
 static void dump_packet_and_trunc(u_char *, const struct pcap_pkthdr *, const u_char *);
 static void dump_packet(u_char *, const struct pcap_pkthdr *, const u_char *);
 static void droproot(const char *, const char *);
@@ -233,11 +245,27 @@ struct dump_info {
 	char	*CurrentFileName;
 	pcap_t	*pd;
 	pcap_dumper_t *p;
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	pcap_ng_dumper_t *ngp;
+#endif
 #ifdef HAVE_CAPSICUM
 	int	dirfd;
 #endif
 };
 
+static int dump_open(struct dump_info *, const char *);
+#ifdef HAVE_CAPSICUM
+static int dump_fopen(struct dump_info *, FILE *);
+static FILE *dump_file(struct dump_info *);
+#endif
+static void dump_write(struct dump_info *, const struct pcap_pkthdr *,
+    const u_char *);
+#ifdef HAVE_PCAP_DUMP_FLUSH
+static void dump_flush(struct dump_info *);
+#endif
+static long dump_ftell(struct dump_info *);
+static void dump_close(struct dump_info *);
+
 #if defined(HAVE_PCAP_SET_PARSER_DEBUG)
 /*
  * We have pcap_set_parser_debug() in libpcap; declare it (it's not declared
@@ -543,6 +571,8 @@ show_devices_and_exit (void)
 #define OPTION_VERSION		128
 #define OPTION_TSTAMP_PRECISION	129
 #define OPTION_IMMEDIATE_MODE	130
+#define OPTION_WORKERS		131
+#define OPTION_COMPRESS		132
 
 static const struct option longopts[] = {
 #if defined(HAVE_PCAP_CREATE) || defined(_WIN32)
@@ -583,6 +613,12 @@ static const struct option longopts[] = {
 	{ "relinquish-privileges", required_argument, NULL, 'Z' },
 	{ "number", no_argument, NULL, '#' },
 	{ "version", no_argument, NULL, OPTION_VERSION },
+#ifdef HAVE_FORK
+	{ "workers", required_argument, NULL, OPTION_WORKERS },
+#endif
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	{ "compress", required_argument, NULL, OPTION_COMPRESS },
+#endif
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -810,9 +846,9 @@ tstamp_precision_to_string(int precision)
  *	   what the standard I/O library happens to require this week.
  */
 static void
-set_dumper_capsicum_rights(pcap_dumper_t *p)
+set_dumper_capsicum_rights(FILE *f)
 {
-	int fd = fileno(pcap_dump_file(p));
+	int fd = fileno(f);
 	cap_rights_t rights;
 
 	cap_rights_init(&rights, CAP_SEEK, CAP_WRITE, CAP_FCNTL);
@@ -1524,6 +1560,24 @@ main(int argc, char **argv)
 			break;
 #endif
 
+#ifdef HAVE_FORK
+		case OPTION_WORKERS:
+			i = atoi(optarg);
+			if (i <= 0 || i > PARALLEL_MAXWORKERS)
+				error("invalid number of workers %s", optarg);
+			nworkers = i;
+			break;
+#endif
+
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+		case OPTION_COMPRESS:
+			if (optarg[0] < '0' || optarg[0] > '9' ||
+			    optarg[1] != '\0')
+				error("invalid compression level %s", optarg);
+			compress_level = optarg[0] - '0';
+			break;
+#endif
+
 		default:
 			print_usage();
 			exit_tcpdump(1);
@@ -1559,6 +1613,17 @@ main(int argc, char **argv)
 	if (VFileName != NULL && RFileName != NULL)
 		error("-V and -r are mutually exclusive.");
 
+#ifdef HAVE_FORK
+	if (nworkers > 1 && (RFileName == NULL || strcmp(RFileName, "-") == 0 ||
+	    WFileName != NULL))
+		error("--workers can only be used to print a file read with -r");
+#endif
+
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	if (compress_level != -1 && WFileName == NULL)
+		error("--compress can only be used with -w");
+#endif
+
 #ifdef HAVE_PCAP_SET_IMMEDIATE_MODE
 	/*
 	 * If we're printing dissected packets to the standard output
@@ -1641,6 +1706,19 @@ main(int argc, char **argv)
 		    errno != ENOSYS) {
 			error("unable to limit pcap descriptor");
 		}
+#endif
+#ifdef HAVE_FORK
+		/*
+		 * The workers read the file through handles of their own,
+		 * which have to be opened now, before we chroot or give
+		 * up root.
+		 */
+		if (nworkers > 1 &&
+		    parallel_open(ndo, RFileName, nworkers) == 0) {
+			warning("--workers: can't share out packets of link-type %d, printing them with one process",
+			    pcap_datalink(pd));
+			nworkers = 0;
+		}
 #endif
 		dlt = pcap_datalink(pd);
 		dlt_name = pcap_datalink_val_to_name(dlt);
@@ -1884,7 +1962,6 @@ main(int argc, char **argv)
 	}
 #endif
 	if (WFileName) {
-		pcap_dumper_t *p;
 		/* Do not exceed the default PATH_MAX for files. */
 		dumpinfo.CurrentFileName = (char *)malloc(PATH_MAX + 1);
 
@@ -1897,7 +1974,9 @@ main(int argc, char **argv)
 		else
 		  MakeFilename(dumpinfo.CurrentFileName, WFileName, 0, 0);
 
-		p = pcap_dump_open(pd, dumpinfo.CurrentFileName);
+		dumpinfo.pd = pd;
+		if (dump_open(&dumpinfo, dumpinfo.CurrentFileName) == -1)
+			error("%s", pcap_geterr(pd));
 #ifdef HAVE_LIBCAP_NG
 		/* Give up CAP_DAC_OVERRIDE capability.
 		 * Only allow it to be restored if the -C or -G flag have been
@@ -1911,10 +1990,8 @@ main(int argc, char **argv)
 			);
 		capng_apply(CAPNG_SELECT_BOTH);
 #endif /* HAVE_LIBCAP_NG */
-		if (p == NULL)
-			error("%s", pcap_geterr(pd));
 #ifdef HAVE_CAPSICUM
-		set_dumper_capsicum_rights(p);
+		set_dumper_capsicum_rights(dump_file(&dumpinfo));
 #endif
 		if (Cflag != 0 || Gflag != 0) {
 #ifdef HAVE_CAPSICUM
@@ -1943,22 +2020,24 @@ main(int argc, char **argv)
 			dumpinfo.WFileName = WFileName;
 #endif
 			callback = dump_packet_and_trunc;
-			dumpinfo.pd = pd;
-			dumpinfo.p = p;
-			pcap_userdata = (u_char *)&dumpinfo;
-		} else {
+		} else
 			callback = dump_packet;
-			pcap_userdata = (u_char *)p;
-		}
+		pcap_userdata = (u_char *)&dumpinfo;
 #ifdef HAVE_PCAP_DUMP_FLUSH
 		if (Uflag)
-			pcap_dump_flush(p);
+			dump_flush(&dumpinfo);
 #endif
 	} else {
 		dlt = pcap_datalink(pd);
 		ndo->ndo_if_printer = get_if_printer(ndo, dlt);
 		callback = print_packet;
 		pcap_userdata = (u_char *)ndo;
+#ifdef HAVE_FORK
+		if (nworkers > 1) {
+			parallel_setfilter(ndo, &fcode);
+			callback = print_packet_parallel;
+		}
+#endif
 	}
 
 #ifdef SIGNAL_REQ_INFO
@@ -2039,8 +2118,17 @@ main(int argc, char **argv)
 		error("unable to enter the capability mode");
 #endif	/* HAVE_CAPSICUM */
 
+#ifdef HAVE_FORK
+	if (callback == print_packet_parallel)
+		parallel_start(ndo, cnt);
+#endif
+
 	do {
 		status = pcap_loop(pd, cnt, callback, pcap_userdata);
+#ifdef HAVE_FORK
+		if (callback == print_packet_parallel)
+			parallel_finish(ndo, status != -2);
+#endif
 		if (WFileName == NULL) {
 			/*
 			 * We're printing packets.  Flush the printed output,
@@ -2156,6 +2244,13 @@ main(int argc, char **argv)
 
 	free(cmdbuf);
 	pcap_freecode(&fcode);
+
+	/*
+	 * A compressed savefile isn't complete until its index has
+	 * been written out.
+	 */
+	if (WFileName != NULL)
+		dump_close(&dumpinfo);
 	exit_tcpdump(status == -1 ? 1 : 0);
 }
 
@@ -2310,6 +2405,105 @@ compress_savefile(const char *filename)
 }
 #endif /* HAVE_FORK && HAVE_VFORK */
 
+/*
+ * The savefile is written with pcap_dump(), or, with --compress, as a
+ * compressed pcapng file with pcap_ng_dump().
+ */
+static int
+dump_open(struct dump_info *dump_info, const char *fname)
+{
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	if (compress_level != -1) {
+		dump_info->ngp = pcap_ng_dump_open(dump_info->pd, fname,
+		    compress_level);
+		return (dump_info->ngp == NULL ? -1 : 0);
+	}
+#endif
+	dump_info->p = pcap_dump_open(dump_info->pd, fname);
+	return (dump_info->p == NULL ? -1 : 0);
+}
+
+#ifdef HAVE_CAPSICUM
+static int
+dump_fopen(struct dump_info *dump_info, FILE *fp)
+{
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	if (compress_level != -1) {
+		dump_info->ngp = pcap_ng_dump_fopen(dump_info->pd, fp,
+		    compress_level);
+		return (dump_info->ngp == NULL ? -1 : 0);
+	}
+#endif
+	dump_info->p = pcap_dump_fopen(dump_info->pd, fp);
+	return (dump_info->p == NULL ? -1 : 0);
+}
+
+static FILE *
+dump_file(struct dump_info *dump_info)
+{
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	if (compress_level != -1)
+		return (pcap_ng_dump_file(dump_info->ngp));
+#endif
+	return (pcap_dump_file(dump_info->p));
+}
+#endif
+
+static void
+dump_write(struct dump_info *dump_info, const struct pcap_pkthdr *h,
+    const u_char *sp)
+{
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	if (compress_level != -1) {
+		pcap_ng_dump((u_char *)dump_info->ngp, h, sp);
+		return;
+	}
+#endif
+	pcap_dump((u_char *)dump_info->p, h, sp);
+}
+
+#ifdef HAVE_PCAP_DUMP_FLUSH
+static void
+dump_flush(struct dump_info *dump_info)
+{
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	if (compress_level != -1) {
+		(void)pcap_ng_dump_flush(dump_info->ngp);
+		return;
+	}
+#endif
+	pcap_dump_flush(dump_info->p);
+}
+#endif
+
+/*
+ * For a compressed file this is an estimate of the size it will have,
+ * which is what -C wants to know.
+ */
+static long
+dump_ftell(struct dump_info *dump_info)
+{
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	if (compress_level != -1)
+		return ((long)pcap_ng_dump_ftell(dump_info->ngp));
+#endif
+	return (pcap_dump_ftell(dump_info->p));
+}
+
+static void
+dump_close(struct dump_info *dump_info)
+{
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	if (compress_level != -1) {
+		if (pcap_ng_dump_close(dump_info->ngp) == -1)
+			warning("%s: %s", dump_info->CurrentFileName,
+			    pcap_strerror(errno));
+		return;
+	}
+#endif
+	pcap_dump_close(dump_info->p);
+}
+
 static void
 dump_packet_and_trunc(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
 {
@@ -2354,7 +2548,7 @@ dump_packet_and_trunc(u_char *user, const struct pcap_pkthdr *h, const u_char *s
 			/*
 			 * Close the current file and open a new one.
 			 */
-			pcap_dump_close(dump_info->p);
+			dump_close(dump_info);
 
 			/*
 			 * Compress the file we just closed, if the user asked for it
@@ -2414,18 +2608,18 @@ dump_packet_and_trunc(u_char *user, const struct pcap_pkthdr *h, const u_char *s
 				error("unable to fdopen file %s",
 				    dump_info->CurrentFileName);
 			}
-			dump_info->p = pcap_dump_fopen(dump_info->pd, fp);
+			if (dump_fopen(dump_info, fp) == -1)
+				error("%s", pcap_geterr(pd));
 #else	/* !HAVE_CAPSICUM */
-			dump_info->p = pcap_dump_open(dump_info->pd, dump_info->CurrentFileName);
+			if (dump_open(dump_info, dump_info->CurrentFileName) == -1)
+				error("%s", pcap_geterr(pd));
 #endif
 #ifdef HAVE_LIBCAP_NG
 			capng_update(CAPNG_DROP, CAPNG_EFFECTIVE, CAP_DAC_OVERRIDE);
 			capng_apply(CAPNG_SELECT_BOTH);
 #endif /* HAVE_LIBCAP_NG */
-			if (dump_info->p == NULL)
-				error("%s", pcap_geterr(pd));
 #ifdef HAVE_CAPSICUM
-			set_dumper_capsicum_rights(dump_info->p);
+			set_dumper_capsicum_rights(dump_file(dump_info));
 #endif
 		}
 	}
@@ -2436,7 +2630,7 @@ dump_packet_and_trunc(u_char *user, const struct pcap_pkthdr *h, const u_char *s
 	 * file could put it over Cflag.
 	 */
 	if (Cflag != 0) {
-		long size = pcap_dump_ftell(dump_info->p);
+		long size = dump_ftell(dump_info);
 
 		if (size == -1)
 			error("ftell fails on output file");
@@ -2449,7 +2643,7 @@ dump_packet_and_trunc(u_char *user, const struct pcap_pkthdr *h, const u_char *s
 			/*
 			 * Close the current file and open a new one.
 			 */
-			pcap_dump_close(dump_info->p);
+			dump_close(dump_info);
 
 			/*
 			 * Compress the file we just closed, if the user
@@ -2485,26 +2679,26 @@ dump_packet_and_trunc(u_char *user, const struct pcap_pkthdr *h, const u_char *s
 				error("unable to fdopen file %s",
 				    dump_info->CurrentFileName);
 			}
-			dump_info->p = pcap_dump_fopen(dump_info->pd, fp);
+			if (dump_fopen(dump_info, fp) == -1)
+				error("%s", pcap_geterr(pd));
 #else	/* !HAVE_CAPSICUM */
-			dump_info->p = pcap_dump_open(dump_info->pd, dump_info->CurrentFileName);
+			if (dump_open(dump_info, dump_info->CurrentFileName) == -1)
+				error("%s", pcap_geterr(pd));
 #endif
 #ifdef HAVE_LIBCAP_NG
 			capng_update(CAPNG_DROP, CAPNG_EFFECTIVE, CAP_DAC_OVERRIDE);
 			capng_apply(CAPNG_SELECT_BOTH);
 #endif /* HAVE_LIBCAP_NG */
-			if (dump_info->p == NULL)
-				error("%s", pcap_geterr(pd));
 #ifdef HAVE_CAPSICUM
-			set_dumper_capsicum_rights(dump_info->p);
+			set_dumper_capsicum_rights(dump_file(dump_info));
 #endif
 		}
 	}
 
-	pcap_dump((u_char *)dump_info->p, h, sp);
+	dump_write(dump_info, h, sp);
 #ifdef HAVE_PCAP_DUMP_FLUSH
 	if (Uflag)
-		pcap_dump_flush(dump_info->p);
+		dump_flush(dump_info);
 #endif
 
 	--infodelay;
@@ -2519,10 +2713,10 @@ dump_packet(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
 
 	++infodelay;
 
-	pcap_dump(user, h, sp);
+	dump_write((struct dump_info *)user, h, sp);
 #ifdef HAVE_PCAP_DUMP_FLUSH
 	if (Uflag)
-		pcap_dump_flush((pcap_dumper_t *)user);
+		dump_flush((struct dump_info *)user);
 #endif
 
 	--infodelay;
@@ -2544,6 +2738,23 @@ print_packet(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
 		info(0);
 }
 
+#ifdef HAVE_FORK
+static void
+print_packet_parallel(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	++packets_captured;
+
+	++infodelay;
+
+	parallel_print_packet((netdissect_options *)user, h, sp,
+	    packets_captured);
+
+	--infodelay;
+	if (infoprint)
+		info(0);
+}
+#endif
+
 #ifdef _WIN32
 	/*
 	 * XXX - there should really be libpcap calls to get the version
@@ -2676,8 +2887,19 @@ print_usage(void)
 	(void)fprintf(stderr, "[ -T type ] [ --version ] [ -V file ]\n");
 	(void)fprintf(stderr,
 "\t\t[ -w file ] [ -W filecount ] [ -y datalinktype ] [ -z postrotate-command ]\n");
+#ifdef HAVE_PCAP_NG_DUMP_OPEN
+	(void)fprintf(stderr,
+"\t\t[ --compress level ]\n");
+#endif
+#ifdef HAVE_FORK
+	(void)fprintf(stderr,
+"\t\t[ --workers n ] ");
+#else
+	(void)fprintf(stderr,
+"\t\t");
+#endif
 	(void)fprintf(stderr,
-"\t\t[ -Z user ] [ expression ]\n");
+"[ -Z user ] [ expression ]\n");
 }
 /*
  * Local Variables:
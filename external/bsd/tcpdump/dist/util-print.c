@@ -323,6 +323,11 @@ _U_
 	return buf;
 }
 
+/*
+ * Time stamp of the first packet (-ttttt) or of the previous one (-ttt).
+ */
+static struct timeval tv_ref;
+
 /*
  * Print the timestamp
  */
@@ -334,7 +339,6 @@ ts_print(netdissect_options *ndo,
 	struct tm *tm;
 	time_t Time;
 	char buf[TS_BUF_SIZE];
-	static struct timeval tv_ref;
 	struct timeval tv_result;
 	int negative_offset;
 	int nano_prec;
@@ -403,6 +407,26 @@ ts_print(netdissect_options *ndo,
 	}
 }
 
+/*
+ * Note the timestamp of a packet that is not printed here, so that the
+ * relative timestamps of the packets that are come out as if it had been.
+ */
+void
+ts_skip(netdissect_options *ndo, const struct timeval *tvp)
+{
+	switch (ndo->ndo_tflag) {
+
+	case 3: /* Microseconds/nanoseconds since previous packet */
+		tv_ref = *tvp;
+		break;
+
+	case 5: /* Microseconds/nanoseconds since first packet */
+		if (!(netdissect_timevalisset(&tv_ref)))
+			tv_ref = *tvp;
+		break;
+	}
+}
+
 /*
  * Print an unsigned relative number of seconds (e.g. hold time, prune timer)
  * in the form 5m1s.  This does no truncation, so 32230861 seconds
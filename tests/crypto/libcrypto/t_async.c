@@ -0,0 +1,233 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check the ASYNC job pool statistics and fibre stack size of libcrypto,
+ * and time starting, pausing and resuming jobs.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atf-c.h>
+
+#include <openssl/async.h>
+
+#define NJOBS		100000
+#define NPAUSES		1000000
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int
+finish(void *arg)
+{
+
+	(*(int *)arg)++;
+	return 1;
+}
+
+static int
+pause_n(void *arg)
+{
+	int i, n;
+
+	n = *(int *)arg;
+	for (i = 0; i < n; i++)
+		if (!ASYNC_pause_job())
+			return 0;
+	return n;
+}
+
+/* Run |func| as a job to the end, resuming it every time it pauses. */
+static int
+run_job(int (*func)(void *), void *arg, size_t size)
+{
+	ASYNC_JOB *job = NULL;
+	ASYNC_WAIT_CTX *ctx;
+	int ret = 0, rv;
+
+	ATF_REQUIRE((ctx = ASYNC_WAIT_CTX_new()) != NULL);
+	while ((rv = ASYNC_start_job(&job, ctx, &ret, func, arg, size))
+	    == ASYNC_PAUSE)
+		continue;
+	ASYNC_WAIT_CTX_free(ctx);
+	ATF_REQUIRE_EQ(rv, ASYNC_FINISH);
+	return ret;
+}
+
+ATF_TC(pool_stats);
+ATF_TC_HEAD(pool_stats, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "ASYNC_get_pool_stats() counts jobs, misses, refusals and pauses");
+}
+
+ATF_TC_BODY(pool_stats, tc)
+{
+	ASYNC_JOB *job = NULL;
+	ASYNC_WAIT_CTX *ctx;
+	unsigned long misses, no_jobs, pauses;
+	size_t curr, idle;
+	int n, ret;
+
+	if (!ASYNC_is_capable())
+		atf_tc_skip("no fibres on this platform");
+
+	ATF_REQUIRE(ASYNC_init_thread(1, 1));
+	ATF_REQUIRE(ASYNC_get_pool_stats(&curr, &idle, &misses, &no_jobs,
+	    &pauses));
+	ATF_CHECK_EQ(curr, 1);
+	ATF_CHECK_EQ(idle, 1);
+	ATF_CHECK_EQ(misses, 0);
+	ATF_CHECK_EQ(pauses, 0);
+
+	/* One job in flight takes the only one; a second start is refused. */
+	n = 3;
+	ATF_REQUIRE((ctx = ASYNC_WAIT_CTX_new()) != NULL);
+	ATF_REQUIRE_EQ(ASYNC_start_job(&job, ctx, &ret, pause_n, &n,
+	    sizeof(n)), ASYNC_PAUSE);
+	ATF_REQUIRE(ASYNC_get_pool_stats(&curr, &idle, NULL, NULL, NULL));
+	ATF_CHECK_EQ(curr - idle, 1);
+	{
+		ASYNC_JOB *job2 = NULL;
+		int ret2;
+
+		ATF_CHECK_EQ(ASYNC_start_job(&job2, ctx, &ret2, finish, &ret2,
+		    0), ASYNC_NO_JOBS);
+	}
+	while (ASYNC_start_job(&job, ctx, &ret, pause_n, &n, sizeof(n))
+	    == ASYNC_PAUSE)
+		continue;
+	ASYNC_WAIT_CTX_free(ctx);
+	ATF_CHECK_EQ(ret, 3);
+
+	ATF_REQUIRE(ASYNC_get_pool_stats(&curr, &idle, &misses, &no_jobs,
+	    &pauses));
+	ATF_CHECK_EQ(curr, 1);
+	ATF_CHECK_EQ(idle, 1);
+	ATF_CHECK_EQ(misses, 0);
+	ATF_CHECK_EQ(no_jobs, 1);
+	ATF_CHECK_EQ(pauses, 3);
+	ASYNC_cleanup_thread();
+}
+
+ATF_TC(stack_size);
+ATF_TC_HEAD(stack_size, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "ASYNC_set_stack_size() refuses tiny stacks; jobs run on big ones");
+}
+
+ATF_TC_BODY(stack_size, tc)
+{
+	size_t old;
+	int n;
+
+	if (!ASYNC_is_capable())
+		atf_tc_skip("no fibres on this platform");
+
+	old = ASYNC_get_stack_size();
+	ATF_CHECK(!ASYNC_set_stack_size(1024));
+	ATF_CHECK_EQ(ASYNC_get_stack_size(), old);
+	ATF_REQUIRE(ASYNC_set_stack_size(256 * 1024));
+	ATF_CHECK_EQ(ASYNC_get_stack_size(), 256 * 1024);
+
+	n = 10;
+	ATF_CHECK_EQ(run_job(pause_n, &n, sizeof(n)), 10);
+	ASYNC_cleanup_thread();
+
+	ATF_REQUIRE(ASYNC_set_stack_size(0));
+	ATF_CHECK_EQ(ASYNC_get_stack_size(), 0);
+}
+
+ATF_TC(latency);
+ATF_TC_HEAD(latency, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Time job start to finish, and pause to resume");
+}
+
+ATF_TC_BODY(latency, tc)
+{
+	double tcold, twarm, tpause;
+	int i, n;
+
+	if (!ASYNC_is_capable())
+		atf_tc_skip("no fibres on this platform");
+
+	/* With no pool set up, jobs are made on demand. */
+	n = 0;
+	tcold = now();
+	for (i = 0; i < NJOBS; i++)
+		run_job(finish, &n, sizeof(n));
+	tcold = now() - tcold;
+	ASYNC_cleanup_thread();
+
+	ATF_REQUIRE(ASYNC_init_thread(4, 1));
+	twarm = now();
+	for (i = 0; i < NJOBS; i++)
+		run_job(finish, &n, sizeof(n));
+	twarm = now() - twarm;
+
+	n = NPAUSES;
+	tpause = now();
+	ATF_CHECK_EQ(run_job(pause_n, &n, sizeof(n)), NPAUSES);
+	tpause = now() - tpause;
+	ASYNC_cleanup_thread();
+
+	printf("start to finish: %.0f ns, %.0f ns with a pool set up\n",
+	    tcold * 1e9 / NJOBS, twarm * 1e9 / NJOBS);
+	printf("pause to resume: %.0f ns\n", tpause * 1e9 / NPAUSES);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, pool_stats);
+	ATF_TP_ADD_TC(tp, stack_size);
+	ATF_TP_ADD_TC(tp, latency);
+
+	return atf_no_error();
+}
@@ -0,0 +1,151 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Draw from RAND_bytes() in many threads at once, as "openssl speed
+ * -multi N rand" cannot: its processes each have their own DRBGs and
+ * never share the master one.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atf-c.h>
+
+#include <openssl/rand.h>
+
+#define NTHREADS	16
+#define SECONDS		1
+
+struct drawer {
+	pthread_t thread;
+	size_t size;
+	unsigned char first[16];
+	unsigned long calls;
+	int failed;
+};
+
+static volatile int started;
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *
+draw(void *arg)
+{
+	struct drawer *d = arg;
+	unsigned char *buf;
+	double end;
+
+	ATF_REQUIRE((buf = malloc(d->size)) != NULL);
+	while (!started)
+		continue;
+	end = now() + SECONDS;
+	while (now() < end) {
+		if (RAND_bytes(buf, (int)d->size) != 1) {
+			d->failed = 1;
+			break;
+		}
+		if (d->calls++ == 0)
+			memcpy(d->first, buf, sizeof(d->first));
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Run |nthreads| drawers of |size| bytes each and return the MB/s. */
+static double
+draw_all(int nthreads, size_t size)
+{
+	struct drawer d[NTHREADS];
+	double total;
+	int i, j;
+
+	memset(d, 0, sizeof(d));
+	started = 0;
+	for (i = 0; i < nthreads; i++) {
+		d[i].size = size;
+		ATF_REQUIRE(pthread_create(&d[i].thread, NULL, draw, &d[i]) == 0);
+	}
+	started = 1;
+	total = 0;
+	for (i = 0; i < nthreads; i++) {
+		ATF_REQUIRE(pthread_join(d[i].thread, NULL) == 0);
+		ATF_CHECK(!d[i].failed);
+		ATF_CHECK(d[i].calls > 0);
+		total += (double)d[i].calls * size;
+		for (j = 0; j < i; j++)
+			ATF_CHECK_MSG(memcmp(d[i].first, d[j].first,
+			    sizeof(d[i].first)) != 0,
+			    "threads %d and %d drew the same bytes", j, i);
+	}
+	return total / SECONDS / 1e6;
+}
+
+ATF_TC(threads);
+ATF_TC_HEAD(threads, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "RAND_bytes() from %d threads at once, timed", NTHREADS);
+	atf_tc_set_md_var(tc, "timeout", "60");
+}
+
+ATF_TC_BODY(threads, tc)
+{
+	static const size_t sizes[] = { 16, 256, 16384, 1024 * 1024 };
+	size_t i;
+
+	for (i = 0; i < __arraycount(sizes); i++)
+		printf("%zu bytes: %.1f MB/s in 1 thread, "
+		    "%.1f MB/s in %d threads\n", sizes[i],
+		    draw_all(1, sizes[i]), draw_all(NTHREADS, sizes[i]),
+		    NTHREADS);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, threads);
+
+	return atf_no_error();
+}
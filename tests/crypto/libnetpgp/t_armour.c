@@ -0,0 +1,466 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check the table-driven CRC24 and the batched base64 armour writer and
+ * reader of libnetpgp against straightforward reference versions.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atf-c.h>
+
+#include "types.h"
+#include "packet.h"
+#include "packet-parse.h"
+#include "create.h"
+#include "memory.h"
+#include "readerwriter.h"
+#include "signature.h"
+
+#define ARMOUR_HEADER	"-----BEGIN PGP MESSAGE-----\r\n\r\n"
+#define ARMOUR_TRAILER	"\r\n-----END PGP MESSAGE-----\r\n"
+#define LINE_LENGTH	76
+
+static const char b64[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* RFC 4880 section 6.1, one bit at a time */
+static unsigned
+crc24_ref(unsigned crc, const uint8_t *p, size_t len)
+{
+	int i;
+
+	while (len-- > 0) {
+		crc ^= (unsigned)*p++ << 16;
+		for (i = 0; i < 8; i++) {
+			crc <<= 1;
+			if (crc & 0x1000000)
+				crc ^= 0x1864cfb;
+		}
+	}
+	return crc & 0xffffff;
+}
+
+/* plain base64 of len bytes, with padding, into out */
+static size_t
+base64_ref(const uint8_t *p, size_t len, char *out)
+{
+	size_t	 i, o;
+	uint32_t w;
+
+	for (i = 0, o = 0; i < len; i += 3) {
+		w = (uint32_t)p[i] << 16;
+		if (i + 1 < len)
+			w |= (uint32_t)p[i + 1] << 8;
+		if (i + 2 < len)
+			w |= p[i + 2];
+		out[o++] = b64[(w >> 18) & 0x3f];
+		out[o++] = b64[(w >> 12) & 0x3f];
+		out[o++] = (i + 1 < len) ? b64[(w >> 6) & 0x3f] : '=';
+		out[o++] = (i + 2 < len) ? b64[w & 0x3f] : '=';
+	}
+	out[o] = '\0';
+	return o;
+}
+
+static void
+fill(uint8_t *p, size_t len, unsigned seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+/*
+ * Armour len bytes with pgp_writer_push_armor_msg(), handing them to
+ * pgp_write() in pieces of at most chunk bytes, and return the text.
+ */
+static char *
+armour(const uint8_t *p, size_t len, size_t chunk, size_t *outlen)
+{
+	pgp_output_t	*output;
+	pgp_memory_t	*mem;
+	size_t		 n, i;
+	char		*text;
+
+	pgp_setup_memory_write(&output, &mem, 128);
+	pgp_writer_push_armor_msg(output);
+	for (i = 0; i < len; i += n) {
+		n = (len - i < chunk) ? len - i : chunk;
+		ATF_REQUIRE(pgp_write(output, &p[i], (unsigned)n));
+	}
+	ATF_REQUIRE(pgp_writer_close(output));
+	*outlen = pgp_mem_len(mem);
+	ATF_REQUIRE((text = malloc(*outlen + 1)) != NULL);
+	memcpy(text, pgp_mem_data(mem), *outlen);
+	text[*outlen] = '\0';
+	pgp_output_delete(output);
+	pgp_memory_free(mem);
+	return text;
+}
+
+/*
+ * Build the armour the writer should produce for len bytes: the base64
+ * broken into lines of LINE_LENGTH, then "=" and the encoded checksum.
+ */
+static char *
+armour_ref(const uint8_t *p, size_t len)
+{
+	char	*enc, *text, *t;
+	uint8_t	 crc[3];
+	unsigned c;
+	size_t	 elen, i;
+
+	ATF_REQUIRE((enc = malloc(len / 3 * 4 + 8)) != NULL);
+	ATF_REQUIRE((text = malloc(len / 3 * 6 + 128)) != NULL);
+	elen = base64_ref(p, len, enc);
+	t = text + sprintf(text, "%s", ARMOUR_HEADER);
+	for (i = 0; i < elen; i++) {
+		if (i > 0 && i % LINE_LENGTH == 0) {
+			*t++ = '\r';
+			*t++ = '\n';
+		}
+		*t++ = enc[i];
+	}
+	c = crc24_ref(CRC24_INIT, p, len);
+	crc[0] = (uint8_t)(c >> 16);
+	crc[1] = (uint8_t)(c >> 8);
+	crc[2] = (uint8_t)c;
+	base64_ref(crc, sizeof(crc), enc);
+	sprintf(t, "\r\n=%s%s", enc, ARMOUR_TRAILER);
+	free(enc);
+	return text;
+}
+
+struct litdata {
+	uint8_t		*buf;
+	size_t		 len;
+	int		 errors;
+};
+
+static pgp_cb_ret_t
+litdata_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
+{
+	struct litdata *ld = pgp_callback_arg(cbinfo);
+
+	switch (pkt->tag) {
+	case PGP_PTAG_CT_LITDATA_BODY:
+		ld->buf = realloc(ld->buf, ld->len + pkt->u.litdata_body.length);
+		ATF_REQUIRE(ld->buf != NULL);
+		memcpy(ld->buf + ld->len, pkt->u.litdata_body.data,
+		    pkt->u.litdata_body.length);
+		ld->len += pkt->u.litdata_body.length;
+		break;
+	case PGP_PARSER_ERROR:
+	case PGP_PARSER_ERRCODE:
+		ld->errors++;
+		break;
+	default:
+		break;
+	}
+	return PGP_RELEASE_MEMORY;
+}
+
+/*
+ * Armour a literal data packet holding len bytes and read it back
+ * through the dearmouring reader.  Returns non-zero if the parse was
+ * clean and gave back the same bytes.
+ */
+static int
+roundtrip(const uint8_t *p, size_t len, int corrupt)
+{
+	pgp_output_t	*output;
+	pgp_memory_t	*mem;
+	pgp_stream_t	*stream;
+	pgp_io_t	 io;
+	struct litdata	 ld;
+	char		*text;
+	int		 ok;
+
+	pgp_setup_memory_write(&output, &mem, 128);
+	pgp_writer_push_armor_msg(output);
+	ATF_REQUIRE(pgp_write_litdata(output, p, (int)len, PGP_LDT_BINARY));
+	ATF_REQUIRE(pgp_writer_close(output));
+	pgp_output_delete(output);
+
+	if (corrupt) {
+		/* change one base64 character of the body */
+		text = pgp_mem_data(mem);
+		text += sizeof(ARMOUR_HEADER) - 1 + 8;
+		*text = (*text == 'A') ? 'B' : 'A';
+	}
+
+	memset(&ld, 0, sizeof(ld));
+	io.outs = io.errs = io.res = stderr;
+	pgp_setup_memory_read(&io, &stream, mem, &ld, litdata_cb, 0);
+	pgp_reader_push_dearmour(stream);
+	ok = pgp_parse(stream, 0) && ld.errors == 0 &&
+	    ld.len == len && (len == 0 || memcmp(ld.buf, p, len) == 0);
+	pgp_reader_pop_dearmour(stream);
+	pgp_teardown_memory_read(stream, mem);
+	free(ld.buf);
+	return ok;
+}
+
+ATF_TC(crc24_vectors);
+ATF_TC_HEAD(crc24_vectors, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "CRC24 of known buffers");
+}
+ATF_TC_BODY(crc24_vectors, tc)
+{
+	static const struct {
+		const char	*in;
+		unsigned	 crc;
+	} vec[] = {
+		{ "",				CRC24_INIT },
+		{ "123456789",			0x21cf02 },
+		{ "a",				0xf25713 },
+		{ "abc",			0xba1c7b },
+		{ "message digest",		0xdbf0b6 },
+		{ "abcdefghijklmnopqrstuvwxyz",	0xed3665 },
+	};
+	size_t i, len;
+
+	for (i = 0; i < __arraycount(vec); i++) {
+		len = strlen(vec[i].in);
+		ATF_CHECK_EQ_MSG(crc24_ref(CRC24_INIT,
+		    (const uint8_t *)vec[i].in, len), vec[i].crc,
+		    "reference, \"%s\"", vec[i].in);
+		ATF_CHECK_EQ_MSG(pgp_crc24_update(CRC24_INIT,
+		    (const uint8_t *)vec[i].in, len), vec[i].crc,
+		    "pgp_crc24_update, \"%s\"", vec[i].in);
+	}
+}
+
+ATF_TC(crc24_equivalence);
+ATF_TC_HEAD(crc24_equivalence, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "pgp_crc24_update() matches the bitwise CRC24 for all lengths, "
+	    "alignments and splits");
+}
+ATF_TC_BODY(crc24_equivalence, tc)
+{
+	uint8_t	 buf[300];
+	unsigned want, got;
+	size_t	 off, len, split;
+
+	fill(buf, sizeof(buf), 1);
+	for (off = 0; off < 8; off++) {
+		for (len = 0; off + len <= sizeof(buf) && len <= 80; len++) {
+			want = crc24_ref(CRC24_INIT, &buf[off], len);
+			got = pgp_crc24_update(CRC24_INIT, &buf[off], len);
+			ATF_REQUIRE_EQ_MSG(got, want, "off %zu len %zu",
+			    off, len);
+			for (split = 0; split <= len; split += 5) {
+				got = pgp_crc24_update(CRC24_INIT, &buf[off],
+				    split);
+				got = pgp_crc24_update(got, &buf[off + split],
+				    len - split);
+				ATF_REQUIRE_EQ_MSG(got, want,
+				    "off %zu len %zu split %zu",
+				    off, len, split);
+			}
+		}
+	}
+	got = CRC24_INIT;
+	for (len = 0; len < sizeof(buf); len++)
+		got = pgp_crc24(got, buf[len]);
+	ATF_CHECK_EQ(got, crc24_ref(CRC24_INIT, buf, sizeof(buf)));
+}
+
+ATF_TC(base64_vectors);
+ATF_TC_HEAD(base64_vectors, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "armour of the RFC 4648 base64 vectors, every length mod 3");
+}
+ATF_TC_BODY(base64_vectors, tc)
+{
+	static const struct {
+		const char	*in;
+		const char	*body;
+	} vec[] = {
+		{ "",		"" },
+		{ "f",		"Zg==" },
+		{ "fo",		"Zm8=" },
+		{ "foo",	"Zm9v" },
+		{ "foob",	"Zm9vYg==" },
+		{ "fooba",	"Zm9vYmE=" },
+		{ "foobar",	"Zm9vYmFy" },
+	};
+	char	*text, *want;
+	size_t	 i, len, blen, chunk;
+
+	for (i = 0; i < __arraycount(vec); i++) {
+		len = strlen(vec[i].in);
+		blen = strlen(vec[i].body);
+		want = armour_ref((const uint8_t *)vec[i].in, len);
+		ATF_REQUIRE(strncmp(want + sizeof(ARMOUR_HEADER) - 1,
+		    vec[i].body, blen) == 0);
+		for (chunk = 1; chunk <= 4; chunk++) {
+			text = armour((const uint8_t *)vec[i].in, len, chunk,
+			    &blen);
+			ATF_CHECK_STREQ_MSG(text, want, "\"%s\" in %zu byte "
+			    "writes", vec[i].in, chunk);
+			free(text);
+		}
+		free(want);
+	}
+}
+
+ATF_TC(base64_lines);
+ATF_TC_HEAD(base64_lines, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "armour output is wrapped at 76 columns, whatever the write sizes");
+}
+ATF_TC_BODY(base64_lines, tc)
+{
+	static const size_t chunks[] = { 1, 2, 3, 7, 57, 58, 1000, 5000 };
+	uint8_t	 buf[4000];
+	char	*text, *want;
+	size_t	 len, i, tlen;
+
+	fill(buf, sizeof(buf), 2);
+	for (len = 50; len <= 64; len++) {	/* around one full line */
+		want = armour_ref(buf, len);
+		for (i = 0; i < __arraycount(chunks); i++) {
+			text = armour(buf, len, chunks[i], &tlen);
+			ATF_CHECK_STREQ_MSG(text, want, "len %zu chunk %zu",
+			    len, chunks[i]);
+			free(text);
+		}
+		free(want);
+	}
+	for (len = sizeof(buf) - 3; len <= sizeof(buf); len++) {
+		want = armour_ref(buf, len);
+		for (i = 0; i < __arraycount(chunks); i++) {
+			text = armour(buf, len, chunks[i], &tlen);
+			ATF_CHECK_STREQ_MSG(text, want, "len %zu chunk %zu",
+			    len, chunks[i]);
+			free(text);
+		}
+		free(want);
+	}
+}
+
+ATF_TC(dearmour_roundtrip);
+ATF_TC_HEAD(dearmour_roundtrip, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "armoured literal data reads back intact, and a damaged body "
+	    "fails the checksum");
+}
+ATF_TC_BODY(dearmour_roundtrip, tc)
+{
+	static const size_t lens[] = {
+		1, 2, 3, 4, 5, 56, 57, 58, 59, 100, 1000, 4095, 4096, 10000
+	};
+	uint8_t	*buf;
+	size_t	 i;
+
+	ATF_REQUIRE((buf = malloc(10000)) != NULL);
+	fill(buf, 10000, 3);
+	for (i = 0; i < __arraycount(lens); i++)
+		ATF_CHECK_MSG(roundtrip(buf, lens[i], 0), "len %zu", lens[i]);
+	ATF_CHECK(!roundtrip(buf, 1000, 1));
+	free(buf);
+}
+
+ATF_TC(throughput);
+ATF_TC_HEAD(throughput, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "report CRC24 and armour throughput against the reference");
+}
+ATF_TC_BODY(throughput, tc)
+{
+	const size_t	 len = 1 << 20;
+	struct timeval	 t0, t1, t2;
+	uint8_t		*buf;
+	unsigned	 want, got;
+	double		 ref, fast;
+	size_t		 tlen;
+	char		*text;
+	int		 i;
+
+	ATF_REQUIRE((buf = malloc(len)) != NULL);
+	fill(buf, len, 4);
+
+	gettimeofday(&t0, NULL);
+	for (want = CRC24_INIT, i = 0; i < 4; i++)
+		want = crc24_ref(want, buf, len);
+	gettimeofday(&t1, NULL);
+	for (got = CRC24_INIT, i = 0; i < 4; i++)
+		got = pgp_crc24_update(got, buf, len);
+	gettimeofday(&t2, NULL);
+	ATF_REQUIRE_EQ(got, want);
+	ref = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	fast = (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) / 1e6;
+	printf("crc24: bitwise %.1f MB/s, pgp_crc24_update %.1f MB/s\n",
+	    ref > 0 ? 4 * len / ref / 1e6 : 0.,
+	    fast > 0 ? 4 * len / fast / 1e6 : 0.);
+
+	gettimeofday(&t0, NULL);
+	text = armour(buf, len, 4096, &tlen);
+	gettimeofday(&t1, NULL);
+	free(text);
+	fast = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	printf("armour: %.1f MB/s in 4096 byte writes\n",
+	    fast > 0 ? len / fast / 1e6 : 0.);
+	free(buf);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, crc24_vectors);
+	ATF_TP_ADD_TC(tp, crc24_equivalence);
+	ATF_TP_ADD_TC(tp, base64_vectors);
+	ATF_TP_ADD_TC(tp, base64_lines);
+	ATF_TP_ADD_TC(tp, dearmour_roundtrip);
+	ATF_TP_ADD_TC(tp, throughput);
+
+	return atf_no_error();
+}